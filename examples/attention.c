@@ -114,22 +114,18 @@ void train_attention(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     args.classes = classes;
     args.n = imgs;
     args.m = N;
+    args.cache = load_image_cache(options, paths, N);
     args.labels = labels;
     args.type = CLASSIFICATION_DATA;
 
     data train;
-    data buffer;
-    pthread_t load_thread;
-    args.d = &buffer;
-    load_thread = load_data(args);
+    data_loader *loader = make_data_loader(args, 2);
 
     int epoch = (*net->seen)/N;
     while(get_current_batch(net) < net->max_batches || net->max_batches == 0){
         time = what_time_is_it_now();
 
-        pthread_join(load_thread, 0);
-        train = buffer;
-        load_thread = load_data(args);
+        train = get_batch(loader);
         data resized = resize_data(train, net->w, net->h);
         extend_data_truth(&resized, divs*divs, 0);
         data *tiles = tile_data(train, divs, size);
@@ -199,7 +195,6 @@ void train_attention(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         printf("\n");
 
         free_data(resized);
-        free_data(train);
         if(avg_cls_loss == -1) avg_cls_loss = closs;
         if(avg_att_loss == -1) avg_att_loss = aloss;
         avg_cls_loss = avg_cls_loss*.9 + closs*.1;
@@ -221,7 +216,8 @@ void train_attention(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     char buff[256];
     snprintf(buff, sizeof(buff), "%s/%s.weights", backup_directory, base);
     save_weights(net, buff);
-    pthread_join(load_thread, 0);
+    free_data_loader(loader);
+    free_image_cache(args.cache);
 
     free_network(net);
     free_ptrs((void**)labels, classes);
@@ -0,0 +1,260 @@
+#include "darknet.h"
+#include "utils.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*
+ * Benchmarks the cfg zoo with random weights. Every network runs in a child
+ * process of its own, once for inference and once for training, so peak RSS
+ * is the child's and a network that fails doesn't stop the others. Results
+ * go to a JSON Lines file, one network per line, which a later run can be
+ * compared against.
+ */
+
+static char *bench_zoo[] = {
+    "cfg/yolov3-tiny.cfg", "cfg/yolov2-tiny.cfg", "cfg/yolov3.cfg", "cfg/yolov3-spp.cfg", "cfg/yolov2.cfg",
+    "cfg/darknet19.cfg", "cfg/darknet53.cfg", "cfg/extraction.cfg", "cfg/alexnet.cfg", "cfg/vgg-16.cfg",
+    "cfg/resnet18.cfg", "cfg/resnet50.cfg", "cfg/resnet152.cfg", "cfg/resnext50.cfg", "cfg/densenet201.cfg"
+};
+
+typedef struct {
+    double parse;
+    double batch1[3];
+    double batchn[3];
+    double peak_rss;
+    double train_step;
+    double train_peak_rss;
+    int ok, train_ok;
+} bench_result;
+
+/* The metrics compared between runs, all times where lower is better */
+typedef struct {
+    char *key;
+    size_t offset;
+} bench_metric;
+
+static bench_metric bench_metrics[] = {
+    {"parse_ms", offsetof(bench_result, parse)},
+    {"batch1_p50_ms", offsetof(bench_result, batch1)},
+    {"batchn_p50_ms", offsetof(bench_result, batchn)},
+    {"train_step_ms", offsetof(bench_result, train_step)}
+};
+
+static int double_comparator(const void *a, const void *b)
+{
+    double x = *(double *)a, y = *(double *)b;
+    return (x > y) - (x < y);
+}
+
+/* p50, p90 and p99 of runs timed forward passes, in ms */
+static void time_predictions(network *net, int runs, double *percentiles)
+{
+    int i;
+    double *times = calloc(runs, sizeof(double));
+    float *input = calloc((size_t)net->inputs*net->batch, sizeof(float));
+    for(i = 0; i < net->inputs*net->batch; ++i) input[i] = rand_uniform(0, 1);
+    network_predict(net, input);
+    for(i = 0; i < runs; ++i){
+        double start = what_time_is_it_now();
+        network_predict(net, input);
+        times[i] = 1000*(what_time_is_it_now() - start);
+    }
+    qsort(times, runs, sizeof(double), double_comparator);
+    percentiles[0] = times[(int)(.50*(runs - 1) + .5)];
+    percentiles[1] = times[(int)(.90*(runs - 1) + .5)];
+    percentiles[2] = times[(int)(.99*(runs - 1) + .5)];
+    free(input);
+    free(times);
+}
+
+static void bench_inference(char *cfg, int batch, int runs, bench_result *r)
+{
+    double start = what_time_is_it_now();
+    network *net = parse_network_cfg_batch(cfg, 1, 1);
+    r->parse = 1000*(what_time_is_it_now() - start);
+    time_predictions(net, runs, r->batch1);
+    free_network(net);
+    net = parse_network_cfg_batch(cfg, batch, 1);
+    time_predictions(net, runs, r->batchn);
+    free_network(net);
+    r->ok = 1;
+}
+
+/* Median of steps training steps on random inputs and empty truth, each
+   one a forward, backward and update pass */
+static void bench_training(char *cfg, int batch, int steps, bench_result *r)
+{
+    int i;
+    network *net = parse_network_cfg_batch(cfg, batch, 0);
+    for(i = 0; i < net->inputs*net->batch; ++i) net->input[i] = rand_uniform(0, 1);
+    if(net->truth) memset(net->truth, 0, (size_t)net->truths*net->batch*sizeof(float));
+    double *times = calloc(steps, sizeof(double));
+    train_network_datum(net);
+    for(i = 0; i < steps; ++i){
+        double start = what_time_is_it_now();
+        train_network_datum(net);
+        times[i] = 1000*(what_time_is_it_now() - start);
+    }
+    qsort(times, steps, sizeof(double), double_comparator);
+    r->train_step = times[steps/2];
+    free(times);
+    free_network(net);
+    r->train_ok = 1;
+}
+
+/* Runs one benchmark in a child and copies its results into r */
+static void bench_in_child(char *cfg, int batch, int runs, int train, bench_result *r)
+{
+    int fd[2];
+    if(pipe(fd)) error("Couldn't make a pipe for the benchmark");
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if(pid < 0) error("Couldn't fork the benchmark");
+    if(pid == 0){
+        bench_result mine = *r;
+        close(fd[0]);
+        /* the network's own logging would drown the results */
+        if(!freopen("/dev/null", "w", stderr)) _exit(1);
+        srand(2222222);
+        if(train) bench_training(cfg, batch, train, &mine);
+        else bench_inference(cfg, batch, runs, &mine);
+        ssize_t written = write(fd[1], &mine, sizeof(mine));
+        _exit(written != sizeof(mine));
+    }
+    close(fd[1]);
+    bench_result got;
+    ssize_t size = read(fd[0], &got, sizeof(got));
+    close(fd[0]);
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    if(size != sizeof(got) || !WIFEXITED(status) || WEXITSTATUS(status)) return;
+    double rss = usage.ru_maxrss/1024.;
+    if(train){
+        r->train_step = got.train_step;
+        r->train_peak_rss = rss;
+        r->train_ok = got.train_ok;
+    } else {
+        memcpy(r->batch1, got.batch1, sizeof(r->batch1));
+        memcpy(r->batchn, got.batchn, sizeof(r->batchn));
+        r->parse = got.parse;
+        r->peak_rss = rss;
+        r->ok = got.ok;
+    }
+}
+
+static void write_result(FILE *fp, char *cfg, int batch, int threads, bench_result r)
+{
+    fprintf(fp, "{\"cfg\": \"%s\", \"batch\": %d, \"threads\": %d, \"ok\": %s", cfg, batch, threads, r.ok ? "true" : "false");
+    if(r.ok){
+        fprintf(fp, ", \"parse_ms\": %.3f, \"batch1_p50_ms\": %.3f, \"batch1_p90_ms\": %.3f, \"batch1_p99_ms\": %.3f"
+                ", \"batchn_p50_ms\": %.3f, \"batchn_p90_ms\": %.3f, \"batchn_p99_ms\": %.3f, \"peak_rss_mb\": %.1f",
+                r.parse, r.batch1[0], r.batch1[1], r.batch1[2], r.batchn[0], r.batchn[1], r.batchn[2], r.peak_rss);
+    }
+    if(r.train_ok) fprintf(fp, ", \"train_step_ms\": %.3f, \"train_peak_rss_mb\": %.1f", r.train_step, r.train_peak_rss);
+    fprintf(fp, "}\n");
+}
+
+/* Value of "key": in one line of a results file */
+static int find_json_number(char *line, char *key, double *value)
+{
+    char quoted[64];
+    snprintf(quoted, sizeof(quoted), "\"%s\":", key);
+    char *p = strstr(line, quoted);
+    if(!p) return 0;
+    *value = strtod(p + strlen(quoted), 0);
+    return 1;
+}
+
+/**
+ * Compares a run with a previous results file.
+ * @return Number of metrics more than threshold slower than before
+ */
+static int compare_results(char *baseline, char **cfgs, bench_result *results, int n, float threshold)
+{
+    FILE *fp = fopen(baseline, "r");
+    if(!fp) file_error(baseline);
+    char line[4096];
+    int i, m, slower = 0;
+    printf("\nCompared with %s, %.0f%% slower is a regression\n", baseline, 100*threshold);
+    while(fgets(line, sizeof(line), fp)){
+        for(i = 0; i < n; ++i){
+            char name[1024];
+            snprintf(name, sizeof(name), "\"cfg\": \"%s\"", cfgs[i]);
+            if(strstr(line, name)) break;
+        }
+        if(i == n) continue;
+        for(m = 0; m < sizeof(bench_metrics)/sizeof(bench_metrics[0]); ++m){
+            double before, now = *(double *)((char *)(results + i) + bench_metrics[m].offset);
+            int measured = strcmp(bench_metrics[m].key, "train_step_ms") ? results[i].ok : results[i].train_ok;
+            if(!measured || !find_json_number(line, bench_metrics[m].key, &before) || before <= 0) continue;
+            double change = now/before - 1;
+            int regression = change > threshold;
+            if(regression) ++slower;
+            printf("%-28s %-14s %10.2f -> %10.2f %+7.1f%%%s\n", cfgs[i], bench_metrics[m].key, before, now,
+                    100*change, regression ? "  SLOWER" : "");
+        }
+    }
+    fclose(fp);
+    if(slower) printf("%d regression%s\n", slower, slower == 1 ? "" : "s");
+    return slower;
+}
+
+void run_bench(int argc, char **argv)
+{
+    int batch = find_int_arg(argc, argv, "-batch", 8);
+    int runs = find_int_arg(argc, argv, "-runs", 20);
+    int train = find_int_arg(argc, argv, "-train", 3);
+    int threads = find_int_arg(argc, argv, "-threads", 0);
+    float threshold = find_float_arg(argc, argv, "-threshold", .1);
+    char *outfile = find_char_arg(argc, argv, "-out", "results/bench.jsonl");
+    char *baseline = find_char_arg(argc, argv, "-compare", 0);
+    int i;
+    if(runs < 1) runs = 1;
+
+    /* the cfgs left on the command line, or the zoo */
+    char **cfgs = bench_zoo;
+    int n = sizeof(bench_zoo)/sizeof(bench_zoo[0]);
+    if(argc > 2 && argv[2]){
+        cfgs = argv + 2;
+        for(n = 0; 2 + n < argc && argv[2 + n]; ++n);
+    }
+
+    gpu_index = -1;
+    set_thread_pool_size(threads);
+    threads = thread_pool_size();
+    bench_result *results = calloc(n, sizeof(bench_result));
+    printf("%-28s %9s %9s %9s %9s %9s %9s %9s %8s\n", "cfg", "parse ms", "b1 p50", "b1 p90", "b1 p99",
+            "bN p50", "bN p99", "train ms", "RSS MB");
+    for(i = 0; i < n; ++i){
+        bench_in_child(cfgs[i], batch, runs, 0, results + i);
+        if(train > 0) bench_in_child(cfgs[i], batch, runs, train, results + i);
+        bench_result r = results[i];
+        if(!r.ok){
+            printf("%-28s failed\n", cfgs[i]);
+            continue;
+        }
+        printf("%-28s %9.1f %9.2f %9.2f %9.2f %9.2f %9.2f ", cfgs[i], r.parse, r.batch1[0], r.batch1[1], r.batch1[2],
+                r.batchn[0], r.batchn[2]);
+        if(r.train_ok) printf("%9.1f ", r.train_step);
+        else printf("%9s ", "-");
+        printf("%8.1f\n", r.peak_rss > r.train_peak_rss ? r.peak_rss : r.train_peak_rss);
+    }
+
+    FILE *fp = fopen(outfile, "w");
+    if(!fp) file_error(outfile);
+    for(i = 0; i < n; ++i) write_result(fp, cfgs[i], batch, threads, results[i]);
+    fclose(fp);
+    printf("Results in %s\n", outfile);
+
+    int slower = baseline ? compare_results(baseline, cfgs, results, n, threshold) : 0;
+    free(results);
+    if(slower) exit(1);
+}
@@ -81,6 +81,7 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     args.classes = classes;
     args.n = imgs;
     args.m = N;
+    args.cache = load_image_cache(options, paths, N);
     args.labels = labels;
     if (tag){
         args.type = TAG_DATA;
@@ -89,10 +90,7 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     }
 
     data train;
-    data buffer;
-    pthread_t load_thread;
-    args.d = &buffer;
-    load_thread = load_data(args);
+    data_loader *loader = make_data_loader(args, 2);
 
     int count = 0;
     int epoch = (*net->seen)/N;
@@ -110,10 +108,7 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
             args.max = net->max_ratio*dim;
             printf("%d %d\n", args.min, args.max);
 
-            pthread_join(load_thread, 0);
-            train = buffer;
-            free_data(train);
-            load_thread = load_data(args);
+            reset_data_loader(loader, args);
 
             for(i = 0; i < ngpus; ++i){
                 resize_network(nets[i], dim, dim);
@@ -122,9 +117,7 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         }
         time = what_time_is_it_now();
 
-        pthread_join(load_thread, 0);
-        train = buffer;
-        load_thread = load_data(args);
+        train = get_batch(loader);
 
         printf("Loaded: %lf seconds\n", what_time_is_it_now()-time);
         time = what_time_is_it_now();
@@ -142,7 +135,6 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         if(avg_loss == -1) avg_loss = loss;
         avg_loss = avg_loss*.9 + loss*.1;
         printf("%ld, %.3f: %f, %f avg, %f rate, %lf seconds, %ld images\n", get_current_batch(net), (float)(*net->seen)/N, loss, avg_loss, get_current_rate(net), what_time_is_it_now()-time, *net->seen);
-        free_data(train);
         if(*net->seen/N > epoch){
             epoch = *net->seen/N;
             char buff[256];
@@ -158,7 +150,8 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     char buff[256];
     snprintf(buff, sizeof(buff), "%s/%s.weights", backup_directory, base);
     save_weights(net, buff);
-    pthread_join(load_thread, 0);
+    free_data_loader(loader);
+    free_image_cache(args.cache);
 
     free_network(net);
     if(labels) free_ptrs((void**)labels, classes);
@@ -20,7 +20,9 @@ extern void run_cifar(int argc, char **argv);
 extern void run_go(int argc, char **argv);
 extern void run_art(int argc, char **argv);
 extern void run_super(int argc, char **argv);
+extern void run_bench(int argc, char **argv);
 extern void run_lsd(int argc, char **argv);
+extern void time_gemm_cpu(int m, int k, int n);
 
 void average(int argc, char *argv[])
 {
@@ -133,6 +135,26 @@ void speed(char *cfgfile, int tics)
     printf("Speed: %f Hz\n", tics/t);
 }
 
+void profile_net(char *cfgfile, char *weightfile, int tics, char *jsonfile, char *tracefile)
+{
+    gpu_index = -1;
+    network *net = load_network_inference(cfgfile, weightfile);
+    set_batch_network(net, 1);
+    image im = make_image(net->w, net->h, net->c);
+    int i;
+    /* the first pass faults in the buffers */
+    network_predict(net, im.data);
+    set_network_profiling(net, 1);
+    for(i = 0; i < tics; ++i){
+        network_predict(net, im.data);
+    }
+    print_network_profile(net, stdout);
+    if(jsonfile) save_network_profile(net, jsonfile);
+    if(tracefile) save_network_trace(net, tracefile);
+    free_image(im);
+    free_network(net);
+}
+
 void operations(char *cfgfile)
 {
     gpu_index = -1;
@@ -222,6 +244,35 @@ void rescale_net(char *cfgfile, char *weightfile, char *outfile)
     save_weights(net, outfile);
 }
 
+void quantize_net(char *cfgfile, char *weightfile, char *listfile, char *outfile)
+{
+    gpu_index = -1;
+    network *net = load_network(cfgfile, weightfile, 0);
+    set_batch_network(net, 1);
+    list *plist = get_paths(listfile);
+    char **paths = (char **)list_to_array(plist);
+    quantize_network(net, paths, plist->size);
+    save_weights_int8(net, outfile);
+    free_ptrs((void **)paths, plist->size);
+    free_list(plist);
+}
+
+void loadtime_net(char *cfgfile, char *weightfile)
+{
+    gpu_index = -1;
+    network *net = parse_network_cfg_inference(cfgfile);
+    load_weights_timed(net, weightfile);
+    free_network(net);
+}
+
+void mmap_net(char *cfgfile, char *weightfile, char *outfile)
+{
+    gpu_index = -1;
+    network *net = load_network_inference(cfgfile, weightfile);
+    save_weights_mmap(net, outfile);
+    free_network(net);
+}
+
 void rgbgr_net(char *cfgfile, char *weightfile, char *outfile)
 {
     gpu_index = -1;
@@ -410,6 +461,7 @@ int main(int argc, char **argv)
     if(find_arg(argc, argv, "-nogpu")) {
         gpu_index = -1;
     }
+    set_thread_pool_size(find_int_arg(argc, argv, "-threads", 0));
 
 #ifndef GPU
     gpu_index = -1;
@@ -425,6 +477,8 @@ int main(int argc, char **argv)
         run_yolo(argc, argv);
     } else if (0 == strcmp(argv[1], "super")){
         run_super(argc, argv);
+    } else if (0 == strcmp(argv[1], "bench")){
+        run_bench(argc, argv);
     } else if (0 == strcmp(argv[1], "lsd")){
         run_lsd(argc, argv);
     } else if (0 == strcmp(argv[1], "detector")){
@@ -473,12 +527,48 @@ int main(int argc, char **argv)
         statistics_net(argv[2], argv[3]);
     } else if (0 == strcmp(argv[1], "normalize")){
         normalize_net(argv[2], argv[3], argv[4]);
+    } else if (0 == strcmp(argv[1], "quantize")){
+        if(argc < 6){
+            fprintf(stderr, "usage: %s quantize <cfg> <weights> <calibration image list> <output weights>\n", argv[0]);
+            return 0;
+        }
+        quantize_net(argv[2], argv[3], argv[4], argv[5]);
+    } else if (0 == strcmp(argv[1], "pack")){
+        int shard_mb = find_int_arg(argc, argv, "-shard_mb", 256);
+        if(argc < 4){
+            fprintf(stderr, "usage: %s pack <image list> <output prefix> [-shard_mb size]\n", argv[0]);
+            return 0;
+        }
+        pack_records(argv[2], argv[3], (size_t)shard_mb << 20);
+    } else if (0 == strcmp(argv[1], "loadtime")){
+        if(argc < 4){
+            fprintf(stderr, "usage: %s loadtime <cfg> <weights>\n", argv[0]);
+            return 0;
+        }
+        loadtime_net(argv[2], argv[3]);
+    } else if (0 == strcmp(argv[1], "mmap")){
+        if(argc < 5){
+            fprintf(stderr, "usage: %s mmap <cfg> <weights> <output weights>\n", argv[0]);
+            return 0;
+        }
+        mmap_net(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "rescale")){
         rescale_net(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "ops")){
         operations(argv[2]);
     } else if (0 == strcmp(argv[1], "speed")){
         speed(argv[2], (argc > 3 && argv[3]) ? atoi(argv[3]) : 0);
+    } else if (0 == strcmp(argv[1], "profile")){
+        int tics = find_int_arg(argc, argv, "-n", 10);
+        char *jsonfile = find_char_arg(argc, argv, "-json", 0);
+        char *tracefile = find_char_arg(argc, argv, "-trace", 0);
+        if(argc < 3 || argv[2][0] == '-'){
+            fprintf(stderr, "usage: %s profile <cfg> [weights] [-n passes] [-json file] [-trace file]\n", argv[0]);
+            return 0;
+        }
+        profile_net(argv[2], (argc > 3 && argv[3]) ? argv[3] : 0, tics, jsonfile, tracefile);
+    } else if (0 == strcmp(argv[1], "gemm")){
+        time_gemm_cpu((argc > 4) ? atoi(argv[2]) : 0, (argc > 4) ? atoi(argv[3]) : 0, (argc > 4) ? atoi(argv[4]) : 0);
     } else if (0 == strcmp(argv[1], "oneoff")){
         oneoff(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "oneoff2")){
@@ -31,12 +31,21 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
 
     int imgs = net->batch * net->subdivisions * ngpus;
     printf("Learning Rate: %g, Momentum: %g, Decay: %g\n", net->learning_rate, net->momentum, net->decay);
-    data train, buffer;
+    data train;
 
     layer l = net->layers[net->n - 1];
 
     int classes = l.classes;
     float jitter = l.jitter;
+    /* multi-scale training goes up to 608, so sized for that once, keeping
+       any larger [net] max_w/max_h the cfg already reserved */
+    if(l.random){
+        for(i = 0; i < ngpus; ++i){
+            network *n = nets[i];
+            if(n->reserved_batch >= n->batch && n->max_w >= 608 && n->max_h >= 608) continue;
+            reserve_network(n, n->max_w > 608 ? n->max_w : 608, n->max_h > 608 ? n->max_h : 608);
+        }
+    }
 
     list *plist = get_paths(train_images);
     //int N = plist->size;
@@ -47,15 +56,16 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
     args.paths = paths;
     args.n = imgs;
     args.m = plist->size;
+    args.cache = load_image_cache(options, paths, plist->size);
+    args.records = load_record_reader(options);
     args.classes = classes;
     args.jitter = jitter;
     args.num_boxes = l.max_boxes;
-    args.d = &buffer;
     args.type = DETECTION_DATA;
     //args.type = INSTANCE_DATA;
     args.threads = 64;
 
-    pthread_t load_thread = load_data(args);
+    data_loader *loader = make_data_loader(args, 2);
     double time;
     int count = 0;
     //while(i*imgs < N*120){
@@ -69,10 +79,7 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
             args.w = dim;
             args.h = dim;
 
-            pthread_join(load_thread, 0);
-            train = buffer;
-            free_data(train);
-            load_thread = load_data(args);
+            reset_data_loader(loader, args);
 
             #pragma omp parallel for
             for(i = 0; i < ngpus; ++i){
@@ -81,9 +88,7 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
             net = nets[0];
         }
         time=what_time_is_it_now();
-        pthread_join(load_thread, 0);
-        train = buffer;
-        load_thread = load_data(args);
+        train = get_batch(loader);
 
         /*
            int k;
@@ -143,7 +148,6 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
             snprintf(buff, sizeof(buff), "%s/%s_%d.weights", backup_directory, base, i);
             save_weights(net, buff);
         }
-        free_data(train);
     }
 #ifdef GPU
     if(ngpus != 1) sync_nets(nets, ngpus, 0);
@@ -151,6 +155,9 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
     char buff[256];
     snprintf(buff, sizeof(buff), "%s/%s_final.weights", backup_directory, base);
     save_weights(net, buff);
+    free_data_loader(loader);
+    free_image_cache(args.cache);
+    free_record_reader(args.records);
 }
 
 
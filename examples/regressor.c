@@ -58,21 +58,17 @@ void train_regressor(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     args.paths = paths;
     args.n = imgs;
     args.m = N;
+    args.cache = load_image_cache(options, paths, N);
     args.type = REGRESSION_DATA;
 
     data train;
-    data buffer;
-    pthread_t load_thread;
-    args.d = &buffer;
-    load_thread = load_data(args);
+    data_loader *loader = make_data_loader(args, 2);
 
     int epoch = (*net->seen)/N;
     while(get_current_batch(net) < net->max_batches || net->max_batches == 0){
         time=clock();
 
-        pthread_join(load_thread, 0);
-        train = buffer;
-        load_thread = load_data(args);
+        train = get_batch(loader);
 
         printf("Loaded: %lf seconds\n", sec(clock()-time));
         time=clock();
@@ -90,7 +86,6 @@ void train_regressor(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         if(avg_loss == -1) avg_loss = loss;
         avg_loss = avg_loss*.9 + loss*.1;
         printf("%ld, %.3f: %f, %f avg, %f rate, %lf seconds, %ld images\n", get_current_batch(net), (float)(*net->seen)/N, loss, avg_loss, get_current_rate(net), sec(clock()-time), *net->seen);
-        free_data(train);
         if(*net->seen/N > epoch){
             epoch = *net->seen/N;
             char buff[256];
@@ -106,6 +101,8 @@ void train_regressor(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     char buff[256];
     snprintf(buff, sizeof(buff), "%s/%s.weights", backup_directory, base);
     save_weights(net, buff);
+    free_data_loader(loader);
+    free_image_cache(args.cache);
 
     free_network(net);
     free_ptrs((void**)paths, plist->size);
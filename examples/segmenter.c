@@ -62,21 +62,17 @@ void train_segmenter(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     args.paths = paths;
     args.n = imgs;
     args.m = N;
+    args.cache = load_image_cache(options, paths, N);
     args.type = SEGMENTATION_DATA;
 
     data train;
-    data buffer;
-    pthread_t load_thread;
-    args.d = &buffer;
-    load_thread = load_data(args);
+    data_loader *loader = make_data_loader(args, 2);
 
     int epoch = (*net->seen)/N;
     while(get_current_batch(net) < net->max_batches || net->max_batches == 0){
         double time = what_time_is_it_now();
 
-        pthread_join(load_thread, 0);
-        train = buffer;
-        load_thread = load_data(args);
+        train = get_batch(loader);
 
         printf("Loaded: %lf seconds\n", what_time_is_it_now()-time);
         time = what_time_is_it_now();
@@ -105,7 +101,6 @@ void train_segmenter(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         if(avg_loss == -1) avg_loss = loss;
         avg_loss = avg_loss*.9 + loss*.1;
         printf("%ld, %.3f: %f, %f avg, %f rate, %lf seconds, %ld images\n", get_current_batch(net), (float)(*net->seen)/N, loss, avg_loss, get_current_rate(net), what_time_is_it_now()-time, *net->seen);
-        free_data(train);
         if(*net->seen/N > epoch){
             epoch = *net->seen/N;
             char buff[256];
@@ -121,6 +116,8 @@ void train_segmenter(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     char buff[256];
     snprintf(buff, sizeof(buff), "%s/%s.weights", backup_directory, base);
     save_weights(net, buff);
+    free_data_loader(loader);
+    free_image_cache(args.cache);
 
     free_network(net);
     free_ptrs((void**)paths, plist->size);
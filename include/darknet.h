@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <pthread.h>
 
 #ifdef GPU
@@ -57,6 +58,10 @@ typedef enum{
     MULT, ADD, SUB, DIV
 } BINARY_ACTIVATION;
 
+typedef enum{
+    CONV_IM2COL, CONV_DIRECT, CONV_WINOGRAD2, CONV_WINOGRAD4, CONV_DEPTHWISE, CONV_GROUPED
+} CONV_ALGORITHM;
+
 typedef enum {
     CONVOLUTIONAL,
     DECONVOLUTIONAL,
@@ -150,6 +155,17 @@ struct layer{
     int index;
     int binary;
     int xnor;
+    CONV_ALGORITHM algorithm;
+    int nchwc;
+    int alias;
+    int alias_layer;
+    size_t alias_offset;
+    int fused;
+    int residual;
+    int residual_layer;
+    int upsampled;
+    int upsampled_layer;
+    int reserved;
     int steps;
     int hidden;
     int truth;
@@ -228,6 +244,7 @@ struct layer{
     float * concat_delta;
 
     float * binary_weights;
+    uint64_t * packed_weights;
 
     float * biases;
     float * bias_updates;
@@ -236,6 +253,12 @@ struct layer{
     float * scale_updates;
 
     float * weights;
+    float * winograd_weights;
+    float * direct_weights;
+    float * nchwc_weights;
+    signed char * weights_int8;
+    float * weight_scales;
+    float input_scale;
     float * weight_updates;
 
     float * delta;
@@ -481,6 +504,20 @@ typedef struct network{
     float *truth;
     float *delta;
     float *workspace;
+    int nchwc;
+    float *nchwc_buffer;
+    int threads;
+    int inference;
+    int plan_memory;
+    int optimize;
+    float *output_arena;
+    size_t output_arena_size;
+    struct network *parent;
+    void *weights_map;
+    size_t weights_map_size;
+    void *profile;
+    int max_w, max_h;
+    int reserved_batch;
     int train;
     int index;
     float *cost;
@@ -544,6 +581,9 @@ typedef enum {
     CLASSIFICATION_DATA, DETECTION_DATA, CAPTCHA_DATA, REGION_DATA, IMAGE_DATA, COMPARE_DATA, WRITING_DATA, SWAG_DATA, TAG_DATA, OLD_CLASSIFICATION_DATA, STUDY_DATA, DET_DATA, SUPER_DATA, LETTERBOX_DATA, REGRESSION_DATA, SEGMENTATION_DATA, INSTANCE_DATA, ISEG_DATA
 } data_type;
 
+typedef struct image_cache image_cache;
+typedef struct record_reader record_reader;
+
 typedef struct load_args{
     int threads;
     char **paths;
@@ -571,10 +611,14 @@ typedef struct load_args{
     float exposure;
     float hue;
     data *d;
+    float *X;
+    float *y;
     image *im;
     image *resized;
     data_type type;
     tree *hierarchy;
+    image_cache *cache;
+    record_reader *records;
 } load_args;
 
 typedef struct{
@@ -585,6 +629,8 @@ typedef struct{
 
 
 network *load_network(char *cfg, char *weights, int clear);
+network *load_network_inference(char *cfg, char *weights);
+network *clone_network_for_inference(network *net);
 load_args get_base_args(network *net);
 
 void free_data(data d);
@@ -602,6 +648,20 @@ typedef struct list{
 } list;
 
 pthread_t load_data(load_args args);
+typedef struct data_loader data_loader;
+data_loader *make_data_loader(load_args args, int prefetch);
+data get_batch(data_loader *loader);
+int try_get_batch(data_loader *loader, data *d);
+void reset_data_loader(data_loader *loader, load_args args);
+void free_data_loader(data_loader *loader);
+void build_image_cache(char *filename, char **paths, int n, int max_side, size_t max_bytes);
+image_cache *open_image_cache(char *filename);
+image_cache *load_image_cache(list *options, char **paths, int n);
+void free_image_cache(image_cache *cache);
+void pack_records(char *listfile, char *prefix, size_t shard_bytes);
+record_reader *open_record_reader(char *shardlist, int window);
+record_reader *load_record_reader(list *options);
+void free_record_reader(record_reader *reader);
 list *read_data_cfg(char *filename);
 list *read_cfg(char *filename);
 unsigned char *read_file(char *filename);
@@ -680,16 +740,34 @@ int option_find_int(list *l, char *key, int def);
 int option_find_int_quiet(list *l, char *key, int def);
 
 network *parse_network_cfg(char *filename);
+network *parse_network_cfg_inference(char *filename);
+network *parse_network_cfg_batch(char *filename, int batch, int inference);
 void save_weights(network *net, char *filename);
+void save_weights_int8(network *net, char *filename);
+void save_weights_binary(network *net, char *filename);
+void save_weights_mmap(network *net, char *filename);
+void quantize_network(network *net, char **paths, int n);
 void load_weights(network *net, char *filename);
 void save_weights_upto(network *net, char *filename, int cutoff);
 void load_weights_upto(network *net, char *filename, int start, int cutoff);
+void load_weights_timed(network *net, char *filename);
 
 void zero_objectness(layer l);
 void get_region_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, float tree_thresh, int relative, detection *dets);
 int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets);
 void free_network(network *net);
 void set_batch_network(network *net, int b);
+void set_network_layout(network *net, int block);
+size_t plan_network_memory(network *net);
+int optimize_network(network *net);
+void unoptimize_network(network *net);
+void set_network_profiling(network *net, int on);
+void reset_network_profile(network *net);
+void print_network_profile(network *net, FILE *fp);
+void save_network_profile(network *net, char *filename);
+void save_network_trace(network *net, char *filename);
+void set_thread_pool_size(int threads);
+int thread_pool_size(void);
 void set_temp_network(network *net, float t);
 image load_image(char *filename, int w, int h, int c);
 image load_image_color(char *filename, int w, int h);
@@ -704,6 +782,7 @@ image resize_max(image im, int max);
 image threshold_image(image im, float thresh);
 image mask_to_rgb(image mask);
 int resize_network(network *net, int w, int h);
+void reserve_network(network *net, int max_w, int max_h);
 void free_matrix(matrix m);
 void test_resize(char *filename);
 int show_image(image p, const char *name, int ms);
@@ -744,6 +823,8 @@ int network_height(network *net);
 float *network_predict_image(network *net, image im);
 void network_detect(network *net, image im, float thresh, float hier_thresh, float nms, detection *dets);
 detection *get_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num);
+detection **network_detect_batch(network *net, image *ims, int n, float thresh, float hier, int *map, int relative, int *num);
+void free_batch_detections(detection **dets, int *num, int n);
 void free_detections(detection *dets, int n);
 
 void reset_network_state(network *net, int b);
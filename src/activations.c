@@ -1,4 +1,5 @@
 #include "activations.h"
+#include "thread_pool.h"
 
 #include <math.h>
 #include <stdio.h>
@@ -97,11 +98,53 @@ float activate(float x, ACTIVATION a)
     return 0;
 }
 
+typedef struct {
+    float *x;
+    const float *y;
+    ACTIVATION a;
+} activation_args;
+
+static void activate_range(void *ptr, int begin, int end)
+{
+    activation_args *p = ptr;
+    int i;
+    for(i = begin; i < end; ++i){
+        p->x[i] = activate(p->x[i], p->a);
+    }
+}
+
 void activate_array(float *x, const int n, const ACTIVATION a)
+{
+    activation_args p = {x, 0, a};
+    parallel_for(n, PARALLEL_GRAIN, activate_range, &p);
+}
+
+/* x = activate(x*scale + bias) in one pass, with the common activations
+   hoisted out of the loop so it vectorizes */
+void scale_bias_activate_array(float *x, const int n, float scale, float bias, const ACTIVATION a)
 {
     int i;
-    for(i = 0; i < n; ++i){
-        x[i] = activate(x[i], a);
+    switch(a){
+        case LINEAR:
+            for(i = 0; i < n; ++i) x[i] = x[i]*scale + bias;
+            break;
+        case LEAKY:
+            for(i = 0; i < n; ++i){
+                float v = x[i]*scale + bias;
+                x[i] = (v > 0) ? v : .1f*v;
+            }
+            break;
+        case RELU:
+            for(i = 0; i < n; ++i){
+                float v = x[i]*scale + bias;
+                x[i] = (v > 0) ? v : 0;
+            }
+            break;
+        case LOGISTIC:
+            for(i = 0; i < n; ++i) x[i] = 1.f/(1.f + expf(-(x[i]*scale + bias)));
+            break;
+        default:
+            for(i = 0; i < n; ++i) x[i] = activate(x[i]*scale + bias, a);
     }
 }
 
@@ -140,11 +183,18 @@ float gradient(float x, ACTIVATION a)
     return 0;
 }
 
-void gradient_array(const float *x, const int n, const ACTIVATION a, float *delta)
+static void gradient_range(void *ptr, int begin, int end)
 {
+    activation_args *p = ptr;
     int i;
-    for(i = 0; i < n; ++i){
-        delta[i] *= gradient(x[i], a);
+    for(i = begin; i < end; ++i){
+        p->x[i] *= gradient(p->y[i], p->a);
     }
+}
+
+void gradient_array(const float *x, const int n, const ACTIVATION a, float *delta)
+{
+    activation_args p = {delta, x, a};
+    parallel_for(n, PARALLEL_GRAIN, gradient_range, &p);
 } 
 
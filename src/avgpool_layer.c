@@ -2,6 +2,7 @@
 #include "cuda.h"
 #include <stdio.h>
 #include "utils.h"
+#include "thread_pool.h"
 
 avgpool_layer make_avgpool_layer(int batch, int w, int h, int c)
 {
@@ -38,35 +39,49 @@ void resize_avgpool_layer(avgpool_layer *l, int w, int h)
     l->inputs = h*w*l->c;
 }
 
-void forward_avgpool_layer(const avgpool_layer l, network net)
-{
-    int b,i,k;
+typedef struct {
+    const avgpool_layer *l;
+    float *input, *delta;
+} avgpool_args;
 
-    for(b = 0; b < l.batch; ++b){
-        for(k = 0; k < l.c; ++k){
-            int out_index = k + b*l.c;
-            l.output[out_index] = 0;
-            for(i = 0; i < l.h*l.w; ++i){
-                int in_index = i + l.h*l.w*(k + b*l.c);
-                l.output[out_index] += net.input[in_index];
-            }
-            l.output[out_index] /= l.h*l.w;
+/* Channels b*c + k [begin, end), one output each */
+static void forward_avgpool_planes(void *ptr, int begin, int end)
+{
+    avgpool_args *a = ptr;
+    const avgpool_layer l = *a->l;
+    int p,i;
+    for(p = begin; p < end; ++p){
+        l.output[p] = 0;
+        for(i = 0; i < l.h*l.w; ++i){
+            int in_index = i + l.h*l.w*p;
+            l.output[p] += a->input[in_index];
         }
+        l.output[p] /= l.h*l.w;
     }
 }
 
-void backward_avgpool_layer(const avgpool_layer l, network net)
+void forward_avgpool_layer(const avgpool_layer l, network net)
 {
-    int b,i,k;
+    avgpool_args a = {&l, net.input, 0};
+    parallel_for(l.batch*l.c, parallel_grain((size_t)l.h*l.w), forward_avgpool_planes, &a);
+}
 
-    for(b = 0; b < l.batch; ++b){
-        for(k = 0; k < l.c; ++k){
-            int out_index = k + b*l.c;
-            for(i = 0; i < l.h*l.w; ++i){
-                int in_index = i + l.h*l.w*(k + b*l.c);
-                net.delta[in_index] += l.delta[out_index] / (l.h*l.w);
-            }
+static void backward_avgpool_planes(void *ptr, int begin, int end)
+{
+    avgpool_args *a = ptr;
+    const avgpool_layer l = *a->l;
+    int p,i;
+    for(p = begin; p < end; ++p){
+        for(i = 0; i < l.h*l.w; ++i){
+            int in_index = i + l.h*l.w*p;
+            a->delta[in_index] += l.delta[p] / (l.h*l.w);
         }
     }
 }
 
+void backward_avgpool_layer(const avgpool_layer l, network net)
+{
+    avgpool_args a = {&l, 0, net.delta};
+    parallel_for(l.batch*l.c, parallel_grain((size_t)l.h*l.w), backward_avgpool_planes, &a);
+}
+
@@ -3,6 +3,7 @@
 #include "blas.h"
 #include <stdio.h>
 #include "utils.h"
+#include "thread_pool.h"
 
 layer make_batchnorm_layer(int batch, int w, int h, int c)
 {
@@ -33,6 +34,9 @@ layer make_batchnorm_layer(int batch, int w, int h, int c)
     l.rolling_mean = safe_calloc(c, sizeof(float));
     l.rolling_variance = safe_calloc(c, sizeof(float));
 
+    l.x = safe_calloc(h * w * c * batch, sizeof(float));
+    l.x_norm = safe_calloc(h * w * c * batch, sizeof(float));
+
     l.forward = forward_batchnorm_layer;
     l.backward = backward_batchnorm_layer;
 #ifdef GPU
@@ -70,64 +74,101 @@ layer make_batchnorm_layer(int batch, int w, int h, int c)
     return l;
 }
 
-void backward_scale_cpu(float *x_norm, float *delta, int batch, int n, int size, float *scale_updates)
+/* Backward statistics are reduced per channel, one channel per thread, so
+   they come out the same for any thread count */
+typedef struct {
+    float *x, *delta, *mean, *variance;
+    float *mean_delta, *variance_delta, *out;
+    int batch, filters, spatial;
+} batchnorm_args;
+
+static void backward_scale_channels(void *ptr, int begin, int end)
 {
+    batchnorm_args *a = ptr;
     int i,b,f;
-    for(f = 0; f < n; ++f){
+    for(f = begin; f < end; ++f){
         float sum = 0;
-        for(b = 0; b < batch; ++b){
-            for(i = 0; i < size; ++i){
-                int index = i + size*(f + n*b);
-                sum += delta[index] * x_norm[index];
+        for(b = 0; b < a->batch; ++b){
+            for(i = 0; i < a->spatial; ++i){
+                int index = i + a->spatial*(f + a->filters*b);
+                sum += a->delta[index] * a->x[index];
             }
         }
-        scale_updates[f] += sum;
+        a->out[f] += sum;
     }
 }
 
-void mean_delta_cpu(float *delta, float *variance, int batch, int filters, int spatial, float *mean_delta)
+void backward_scale_cpu(float *x_norm, float *delta, int batch, int n, int size, float *scale_updates)
 {
+    batchnorm_args a = {x_norm, delta, 0, 0, 0, 0, scale_updates, batch, n, size};
+    parallel_for(n, parallel_grain((size_t)batch*size), backward_scale_channels, &a);
+}
 
+static void mean_delta_channels(void *ptr, int begin, int end)
+{
+    batchnorm_args *a = ptr;
     int i,j,k;
-    for(i = 0; i < filters; ++i){
-        mean_delta[i] = 0;
-        for (j = 0; j < batch; ++j) {
-            for (k = 0; k < spatial; ++k) {
-                int index = j*filters*spatial + i*spatial + k;
-                mean_delta[i] += delta[index];
+    for(i = begin; i < end; ++i){
+        a->mean_delta[i] = 0;
+        for (j = 0; j < a->batch; ++j) {
+            for (k = 0; k < a->spatial; ++k) {
+                int index = j*a->filters*a->spatial + i*a->spatial + k;
+                a->mean_delta[i] += a->delta[index];
             }
         }
-        mean_delta[i] *= (-1./sqrt(variance[i] + .00001f));
+        a->mean_delta[i] *= (-1./sqrt(a->variance[i] + .00001f));
     }
 }
-void  variance_delta_cpu(float *x, float *delta, float *mean, float *variance, int batch, int filters, int spatial, float *variance_delta)
+
+void mean_delta_cpu(float *delta, float *variance, int batch, int filters, int spatial, float *mean_delta)
 {
+    batchnorm_args a = {0, delta, 0, variance, mean_delta, 0, 0, batch, filters, spatial};
+    parallel_for(filters, parallel_grain((size_t)batch*spatial), mean_delta_channels, &a);
+}
 
+static void variance_delta_channels(void *ptr, int begin, int end)
+{
+    batchnorm_args *a = ptr;
     int i,j,k;
-    for(i = 0; i < filters; ++i){
-        variance_delta[i] = 0;
-        for(j = 0; j < batch; ++j){
-            for(k = 0; k < spatial; ++k){
-                int index = j*filters*spatial + i*spatial + k;
-                variance_delta[i] += delta[index]*(x[index] - mean[i]);
+    for(i = begin; i < end; ++i){
+        a->variance_delta[i] = 0;
+        for(j = 0; j < a->batch; ++j){
+            for(k = 0; k < a->spatial; ++k){
+                int index = j*a->filters*a->spatial + i*a->spatial + k;
+                a->variance_delta[i] += a->delta[index]*(a->x[index] - a->mean[i]);
             }
         }
-        variance_delta[i] *= -.5 * pow(variance[i] + .00001f, (float)(-3./2.));
+        a->variance_delta[i] *= -.5 * pow(a->variance[i] + .00001f, (float)(-3./2.));
     }
 }
-void normalize_delta_cpu(float *x, float *mean, float *variance, float *mean_delta, float *variance_delta, int batch, int filters, int spatial, float *delta)
+
+void  variance_delta_cpu(float *x, float *delta, float *mean, float *variance, int batch, int filters, int spatial, float *variance_delta)
+{
+    batchnorm_args a = {x, delta, mean, variance, 0, variance_delta, 0, batch, filters, spatial};
+    parallel_for(filters, parallel_grain((size_t)batch*spatial), variance_delta_channels, &a);
+}
+
+static void normalize_delta_channels(void *ptr, int begin, int end)
 {
+    batchnorm_args *a = ptr;
     int f, j, k;
+    int spatial = a->spatial, batch = a->batch;
     for(j = 0; j < batch; ++j){
-        for(f = 0; f < filters; ++f){
+        for(f = begin; f < end; ++f){
             for(k = 0; k < spatial; ++k){
-                int index = j*filters*spatial + f*spatial + k;
-                delta[index] = delta[index] * 1./(sqrt(variance[f] + .00001f)) + variance_delta[f] * 2. * (x[index] - mean[f]) / (spatial * batch) + mean_delta[f]/(spatial*batch);
+                int index = j*a->filters*spatial + f*spatial + k;
+                a->delta[index] = a->delta[index] * 1./(sqrt(a->variance[f] + .00001f)) + a->variance_delta[f] * 2. * (a->x[index] - a->mean[f]) / (spatial * batch) + a->mean_delta[f]/(spatial*batch);
             }
         }
     }
 }
 
+void normalize_delta_cpu(float *x, float *mean, float *variance, float *mean_delta, float *variance_delta, int batch, int filters, int spatial, float *delta)
+{
+    batchnorm_args a = {x, delta, mean, variance, mean_delta, variance_delta, 0, batch, filters, spatial};
+    parallel_for(filters, parallel_grain((size_t)batch*spatial), normalize_delta_channels, &a);
+}
+
 void resize_batchnorm_layer(layer *layer, int w, int h)
 {
     fprintf(stderr, "Not implemented\n");
@@ -136,7 +177,7 @@ void resize_batchnorm_layer(layer *layer, int w, int h)
 void forward_batchnorm_layer(layer l, network net)
 {
     if(l.type == BATCHNORM) copy_cpu(l.outputs*l.batch, net.input, 1, l.output, 1);
-    copy_cpu(l.outputs*l.batch, l.output, 1, l.x, 1);
+    if(l.x) copy_cpu(l.outputs*l.batch, l.output, 1, l.x, 1);
     if(net.train){
         mean_cpu(l.output, l.batch, l.out_c, l.out_h*l.out_w, l.mean);
         variance_cpu(l.output, l.mean, l.batch, l.out_c, l.out_h*l.out_w, l.variance);
@@ -155,6 +196,25 @@ void forward_batchnorm_layer(layer l, network net)
     add_bias(l.output, l.biases, l.batch, l.out_c, l.out_h*l.out_w);
 }
 
+/**
+ * Inference batchnorm (if any) and bias of a layer as one scale and shift
+ * per channel, the same arithmetic as normalize_cpu, scale_bias and add_bias.
+ * @param n Channels, l.n for convolutions and l.out_c for batchnorm layers
+ */
+void inference_scale_bias(layer l, int n, float *scales, float *biases)
+{
+    int i;
+    for(i = 0; i < n; ++i){
+        if(l.batch_normalize || l.type == BATCHNORM){
+            scales[i] = l.scales[i]/(sqrt(l.rolling_variance[i]) + .000001f);
+            biases[i] = l.biases[i] - l.rolling_mean[i]*scales[i];
+        } else {
+            scales[i] = 1;
+            biases[i] = l.biases[i];
+        }
+    }
+}
+
 void backward_batchnorm_layer(layer l, network net)
 {
     if(!net.train){
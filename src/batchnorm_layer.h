@@ -8,6 +8,7 @@
 layer make_batchnorm_layer(int batch, int w, int h, int c);
 void forward_batchnorm_layer(layer l, network net);
 void backward_batchnorm_layer(layer l, network net);
+void inference_scale_bias(layer l, int n, float *scales, float *biases);
 
 #ifdef GPU
 void forward_batchnorm_layer_gpu(layer l, network net);
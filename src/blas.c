@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "utils.h"
+#include "thread_pool.h"
 void reorg_cpu(float *x, int w, int h, int c, int batch, int stride, int forward, float *out)
 {
     int b,i,j,k;
@@ -48,21 +49,68 @@ void flatten(float *x, int size, int layers, int batch, int forward)
     free(swap);
 }
 
+/* Gates of the recurrent layers; c is the sum, or its delta going back */
+typedef struct {
+    float *a, *b, *s, *c;
+    float *da, *db, *ds;
+} weighted_args;
+
+static void weighted_sum_range(void *ptr, int begin, int end)
+{
+    weighted_args *w = ptr;
+    float *a = w->a, *b = w->b, *s = w->s;
+    int i;
+    for(i = begin; i < end; ++i){
+        w->c[i] = s[i]*a[i] + (1-s[i])*(b ? b[i] : 0);
+    }
+}
+
 void weighted_sum_cpu(float *a, float *b, float *s, int n, float *c)
 {
+    weighted_args w = {a, b, s, c};
+    parallel_for(n, PARALLEL_GRAIN, weighted_sum_range, &w);
+}
+
+static void weighted_delta_range(void *ptr, int begin, int end)
+{
+    weighted_args *w = ptr;
+    float *a = w->a, *b = w->b, *s = w->s, *dc = w->c;
     int i;
-    for(i = 0; i < n; ++i){
-        c[i] = s[i]*a[i] + (1-s[i])*(b ? b[i] : 0);
+    for(i = begin; i < end; ++i){
+        if(w->da) w->da[i] += dc[i] * s[i];
+        if(w->db) w->db[i] += dc[i] * (1-s[i]);
+        w->ds[i] += dc[i] * (a[i] - b[i]);
     }
 }
 
 void weighted_delta_cpu(float *a, float *b, float *s, float *da, float *db, float *ds, int n, float *dc)
 {
-    int i;
-    for(i = 0; i < n; ++i){
-        if(da) da[i] += dc[i] * s[i];
-        if(db) db[i] += dc[i] * (1-s[i]);
-        ds[i] += dc[i] * (a[i] - b[i]);
+    weighted_args w = {a, b, s, dc, da, db, ds};
+    parallel_for(n, PARALLEL_GRAIN, weighted_delta_range, &w);
+}
+
+typedef struct {
+    float *add, *out;
+    int w1, h1, c1, w2, h2, c2;
+    int stride, sample, minw, minh, minc;
+    float s1, s2;
+} shortcut_args;
+
+/* Planes b*minc + k [begin, end); each writes only its own output plane */
+static void shortcut_planes(void *ptr, int begin, int end)
+{
+    shortcut_args *a = ptr;
+    int i,j,p;
+    for(p = begin; p < end; ++p){
+        int b = p/a->minc;
+        int k = p%a->minc;
+        for(j = 0; j < a->minh; ++j){
+            for(i = 0; i < a->minw; ++i){
+                int out_index = i*a->sample + a->w2*(j*a->sample + a->h2*(k + a->c2*b));
+                int add_index = i*a->stride + a->w1*(j*a->stride + a->h1*(k + a->c1*b));
+                a->out[out_index] = a->s1*a->out[out_index] + a->s2*a->add[add_index];
+            }
+        }
     }
 }
 
@@ -78,50 +126,61 @@ void shortcut_cpu(int batch, int w1, int h1, int c1, float *add, int w2, int h2,
     int minh = (h1 < h2) ? h1 : h2;
     int minc = (c1 < c2) ? c1 : c2;
 
-    int i,j,k,b;
-    for(b = 0; b < batch; ++b){
-        for(k = 0; k < minc; ++k){
-            for(j = 0; j < minh; ++j){
-                for(i = 0; i < minw; ++i){
-                    int out_index = i*sample + w2*(j*sample + h2*(k + c2*b));
-                    int add_index = i*stride + w1*(j*stride + h1*(k + c1*b));
-                    out[out_index] = s1*out[out_index] + s2*add[add_index];
-                }
+    shortcut_args a = {add, out, w1, h1, c1, w2, h2, c2, stride, sample, minw, minh, minc, s1, s2};
+    parallel_for(batch*minc, parallel_grain((size_t)minw*minh), shortcut_planes, &a);
+}
+
+/* Per-channel statistics of batch x filters x spatial tensors; the thread
+   pool splits channels, so each sum keeps its serial order */
+typedef struct {
+    float *x, *mean, *variance;
+    int batch, filters, spatial;
+} channel_args;
+
+static void mean_channels(void *ptr, int begin, int end)
+{
+    channel_args *a = ptr;
+    float scale = 1./(a->batch * a->spatial);
+    int i,j,k;
+    for(i = begin; i < end; ++i){
+        a->mean[i] = 0;
+        for(j = 0; j < a->batch; ++j){
+            for(k = 0; k < a->spatial; ++k){
+                int index = j*a->filters*a->spatial + i*a->spatial + k;
+                a->mean[i] += a->x[index];
             }
         }
+        a->mean[i] *= scale;
     }
 }
 
 void mean_cpu(float *x, int batch, int filters, int spatial, float *mean)
 {
-    float scale = 1./(batch * spatial);
+    channel_args a = {x, mean, 0, batch, filters, spatial};
+    parallel_for(filters, parallel_grain((size_t)batch*spatial), mean_channels, &a);
+}
+
+static void variance_channels(void *ptr, int begin, int end)
+{
+    channel_args *a = ptr;
+    float scale = 1./(a->batch * a->spatial - 1);
     int i,j,k;
-    for(i = 0; i < filters; ++i){
-        mean[i] = 0;
-        for(j = 0; j < batch; ++j){
-            for(k = 0; k < spatial; ++k){
-                int index = j*filters*spatial + i*spatial + k;
-                mean[i] += x[index];
+    for(i = begin; i < end; ++i){
+        a->variance[i] = 0;
+        for(j = 0; j < a->batch; ++j){
+            for(k = 0; k < a->spatial; ++k){
+                int index = j*a->filters*a->spatial + i*a->spatial + k;
+                a->variance[i] += pow((a->x[index] - a->mean[i]), 2);
             }
         }
-        mean[i] *= scale;
+        a->variance[i] *= scale;
     }
 }
 
 void variance_cpu(float *x, float *mean, int batch, int filters, int spatial, float *variance)
 {
-    float scale = 1./(batch * spatial - 1);
-    int i,j,k;
-    for(i = 0; i < filters; ++i){
-        variance[i] = 0;
-        for(j = 0; j < batch; ++j){
-            for(k = 0; k < spatial; ++k){
-                int index = j*filters*spatial + i*spatial + k;
-                variance[i] += pow((x[index] - mean[i]), 2);
-            }
-        }
-        variance[i] *= scale;
-    }
+    channel_args a = {x, mean, variance, batch, filters, spatial};
+    parallel_for(filters, parallel_grain((size_t)batch*spatial), variance_channels, &a);
 }
 
 void l2normalize_cpu(float *x, float *dx, int batch, int filters, int spatial)
@@ -145,29 +204,51 @@ void l2normalize_cpu(float *x, float *dx, int batch, int filters, int spatial)
 }
 
 
-void normalize_cpu(float *x, float *mean, float *variance, int batch, int filters, int spatial)
+static void normalize_channels(void *ptr, int begin, int end)
 {
+    channel_args *a = ptr;
     int b, f, i;
-    for(b = 0; b < batch; ++b){
-        for(f = 0; f < filters; ++f){
-            for(i = 0; i < spatial; ++i){
-                int index = b*filters*spatial + f*spatial + i;
-                x[index] = (x[index] - mean[f])/(sqrt(variance[f]) + .000001f);
+    for(b = 0; b < a->batch; ++b){
+        for(f = begin; f < end; ++f){
+            for(i = 0; i < a->spatial; ++i){
+                int index = b*a->filters*a->spatial + f*a->spatial + i;
+                a->x[index] = (a->x[index] - a->mean[f])/(sqrt(a->variance[f]) + .000001f);
             }
         }
     }
 }
 
+void normalize_cpu(float *x, float *mean, float *variance, int batch, int filters, int spatial)
+{
+    channel_args a = {x, mean, variance, batch, filters, spatial};
+    parallel_for(filters, parallel_grain((size_t)batch*spatial), normalize_channels, &a);
+}
+
 void const_cpu(int N, float ALPHA, float *X, int INCX)
 {
     int i;
     for(i = 0; i < N; ++i) X[i*INCX] = ALPHA;
 }
 
-void mul_cpu(int N, float *X, int INCX, float *Y, int INCY)
+/* Element-wise loops over strided vectors; the thread pool splits the
+   index range and every element is computed as before */
+typedef struct {
+    float alpha;
+    float *x, *y, *z;
+    int incx, incy;
+} vector_args;
+
+static void mul_range(void *ptr, int begin, int end)
 {
+    vector_args *v = ptr;
     int i;
-    for(i = 0; i < N; ++i) Y[i*INCY] *= X[i*INCX];
+    for(i = begin; i < end; ++i) v->y[i*v->incy] *= v->x[i*v->incx];
+}
+
+void mul_cpu(int N, float *X, int INCX, float *Y, int INCY)
+{
+    vector_args v = {0, X, Y, 0, INCX, INCY};
+    parallel_for(N, PARALLEL_GRAIN, mul_range, &v);
 }
 
 void pow_cpu(int N, float ALPHA, float *X, int INCX, float *Y, int INCY)
@@ -176,22 +257,43 @@ void pow_cpu(int N, float ALPHA, float *X, int INCX, float *Y, int INCY)
     for(i = 0; i < N; ++i) Y[i*INCY] = pow(X[i*INCX], ALPHA);
 }
 
+static void axpy_range(void *ptr, int begin, int end)
+{
+    vector_args *v = ptr;
+    int i;
+    for(i = begin; i < end; ++i) v->y[i*v->incy] += v->alpha*v->x[i*v->incx];
+}
+
 void axpy_cpu(int N, float ALPHA, float *X, int INCX, float *Y, int INCY)
 {
+    vector_args v = {ALPHA, X, Y, 0, INCX, INCY};
+    parallel_for(N, PARALLEL_GRAIN, axpy_range, &v);
+}
+
+static void scal_range(void *ptr, int begin, int end)
+{
+    vector_args *v = ptr;
     int i;
-    for(i = 0; i < N; ++i) Y[i*INCY] += ALPHA*X[i*INCX];
+    for(i = begin; i < end; ++i) v->x[i*v->incx] *= v->alpha;
 }
 
 void scal_cpu(int N, float ALPHA, float *X, int INCX)
 {
+    vector_args v = {ALPHA, X, 0, 0, INCX};
+    parallel_for(N, PARALLEL_GRAIN, scal_range, &v);
+}
+
+static void fill_range(void *ptr, int begin, int end)
+{
+    vector_args *v = ptr;
     int i;
-    for(i = 0; i < N; ++i) X[i*INCX] *= ALPHA;
+    for(i = begin; i < end; ++i) v->x[i*v->incx] = v->alpha;
 }
 
 void fill_cpu(int N, float ALPHA, float *X, int INCX)
 {
-    int i;
-    for(i = 0; i < N; ++i) X[i*INCX] = ALPHA;
+    vector_args v = {ALPHA, X, 0, 0, INCX};
+    parallel_for(N, PARALLEL_GRAIN, fill_range, &v);
 }
 
 void deinter_cpu(int NX, float *X, int NY, float *Y, int B, float *OUT)
@@ -224,16 +326,30 @@ void inter_cpu(int NX, float *X, int NY, float *Y, int B, float *OUT)
     }
 }
 
+static void copy_range(void *ptr, int begin, int end)
+{
+    vector_args *v = ptr;
+    int i;
+    for(i = begin; i < end; ++i) v->y[i*v->incy] = v->x[i*v->incx];
+}
+
 void copy_cpu(int N, float *X, int INCX, float *Y, int INCY)
 {
+    vector_args v = {0, X, Y, 0, INCX, INCY};
+    parallel_for(N, PARALLEL_GRAIN, copy_range, &v);
+}
+
+static void mult_add_into_range(void *ptr, int begin, int end)
+{
+    vector_args *v = ptr;
     int i;
-    for(i = 0; i < N; ++i) Y[i*INCY] = X[i*INCX];
+    for(i = begin; i < end; ++i) v->z[i] += v->x[i]*v->y[i];
 }
 
 void mult_add_into_cpu(int N, float *X, float *Y, float *Z)
 {
-    int i;
-    for(i = 0; i < N; ++i) Z[i] += X[i]*Y[i];
+    vector_args v = {0, X, Y, Z};
+    parallel_for(N, PARALLEL_GRAIN, mult_add_into_range, &v);
 }
 
 void smooth_l1_cpu(int n, float *pred, float *truth, float *delta, float *error)
@@ -322,16 +438,29 @@ void softmax(float *input, int n, float temp, int stride, float *output)
 }
 
 
-void softmax_cpu(float *input, int n, int batch, int batch_offset, int groups, int group_offset, int stride, float temp, float *output)
+typedef struct {
+    float *input, *output;
+    int n, groups, batch_offset, group_offset, stride;
+    float temp;
+} softmax_args;
+
+/* Groups b*groups + g [begin, end), each normalized on its own */
+static void softmax_groups(void *ptr, int begin, int end)
 {
-    int g, b;
-    for(b = 0; b < batch; ++b){
-        for(g = 0; g < groups; ++g){
-            softmax(input + b*batch_offset + g*group_offset, n, temp, stride, output + b*batch_offset + g*group_offset);
-        }
+    softmax_args *a = ptr;
+    int t;
+    for(t = begin; t < end; ++t){
+        int offset = t/a->groups*a->batch_offset + t%a->groups*a->group_offset;
+        softmax(a->input + offset, a->n, a->temp, a->stride, a->output + offset);
     }
 }
 
+void softmax_cpu(float *input, int n, int batch, int batch_offset, int groups, int group_offset, int stride, float temp, float *output)
+{
+    softmax_args a = {input, output, n, groups, batch_offset, group_offset, stride, temp};
+    parallel_for(batch*groups, parallel_grain(n), softmax_groups, &a);
+}
+
 void upsample_cpu(float *in, int w, int h, int c, int batch, int stride, int forward, float scale, float *out)
 {
     int i, j, k, b;
@@ -1,3 +1,7 @@
+#include "col2im.h"
+#include "im2col.h"
+#include "thread_pool.h"
+#include "utils.h"
 #include <stdio.h>
 #include <math.h>
 void col2im_add_pixel(float *im, int height, int width, int channels,
@@ -15,25 +19,59 @@ void col2im_cpu(float* data_col,
          int channels,  int height,  int width,
          int ksize,  int stride, int pad, float* data_im) 
 {
-    int c,h,w;
     int height_col = (height + 2*pad - ksize) / stride + 1;
+    col2im_cpu_rows(data_col, channels, height, width, ksize, stride, pad, 0, height_col, data_im);
+}
+
+typedef struct {
+    float *col;
+    int channels, height, width;
+    int ksize, stride, pad;
+    int row0, rows;
+    float *im;
+} col2im_args;
+
+/* Image channels [begin, end): the ksize*ksize column rows of a channel
+   only add into its own plane, in the same order as a serial pass */
+SIMD_CLONES
+static void col2im_channels(void *ptr, int begin, int end)
+{
+    col2im_args *a = ptr;
+    int c,h,w;
+    int ksize = a->ksize, stride = a->stride, pad = a->pad, rows = a->rows;
+    int height = a->height, width = a->width;
     int width_col = (width + 2*pad - ksize) / stride + 1;
 
-    int channels_col = channels * ksize * ksize;
-    for (c = 0; c < channels_col; ++c) {
+    for (c = begin*ksize*ksize; c < end*ksize*ksize; ++c) {
         int w_offset = c % ksize;
         int h_offset = (c / ksize) % ksize;
         int c_im = c / ksize / ksize;
-        for (h = 0; h < height_col; ++h) {
-            for (w = 0; w < width_col; ++w) {
-                int im_row = h_offset + h * stride;
-                int im_col = w_offset + w * stride;
-                int col_index = (c * height_col + h) * width_col + w;
-                double val = data_col[col_index];
-                col2im_add_pixel(data_im, height, width, channels,
-                        im_row, im_col, c_im, pad, val);
+        float *plane = a->im + (size_t)c_im*height*width;
+        int w0, w1;
+        im2col_valid_columns(width, width_col, w_offset, stride, pad, &w0, &w1);
+        for (h = 0; h < rows; ++h) {
+            int im_row = h_offset + (a->row0 + h) * stride - pad;
+            if (im_row < 0 || im_row >= height) continue;
+            const float *src = a->col + ((size_t)c * rows + h) * width_col;
+            float *dst = plane + (size_t)im_row*width + w_offset - pad;
+            if (stride == 1) {
+                for (w = w0; w < w1; ++w) dst[w] += src[w];
+            } else if (stride == 2) {
+                for (w = w0; w < w1; ++w) dst[2*w] += src[w];
+            } else {
+                for (w = w0; w < w1; ++w) dst[w*stride] += src[w];
             }
         }
     }
 }
 
+// Accumulates a column buffer produced by im2col_cpu_rows with the same row0/rows
+void col2im_cpu_rows(float* data_col,
+         int channels,  int height,  int width,
+         int ksize,  int stride, int pad,
+         int row0, int rows, float* data_im)
+{
+    int width_col = (width + 2*pad - ksize) / stride + 1;
+    col2im_args a = {data_col, channels, height, width, ksize, stride, pad, row0, rows, data_im};
+    parallel_for(channels, parallel_grain((size_t)ksize*ksize*rows*width_col), col2im_channels, &a);
+}
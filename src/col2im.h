@@ -4,6 +4,10 @@
 void col2im_cpu(float* data_col,
         int channels, int height, int width,
         int ksize, int stride, int pad, float* data_im);
+void col2im_cpu_rows(float* data_col,
+        int channels, int height, int width,
+        int ksize, int stride, int pad,
+        int row0, int rows, float* data_im);
 
 #ifdef GPU
 void col2im_gpu(float *data_col,
@@ -5,6 +5,7 @@
 #include "cuda.h"
 #include "blas.h"
 #include "gemm.h"
+#include "quantize.h"
 
 #include <math.h>
 #include <stdio.h>
@@ -146,10 +147,15 @@ void update_connected_layer(layer l, update_args a)
     axpy_cpu(l.inputs*l.outputs, -decay*batch, l.weights, 1, l.weight_updates, 1);
     axpy_cpu(l.inputs*l.outputs, learning_rate/batch, l.weight_updates, 1, l.weights, 1);
     scal_cpu(l.inputs*l.outputs, momentum, l.weight_updates, 1);
+    update_int8_weights(l);
 }
 
 void forward_connected_layer(layer l, network net)
 {
+    if(l.weights_int8 && !net.train && !net.delta){
+        forward_connected_layer_int8(l, net);
+        return;
+    }
     fill_cpu(l.outputs*l.batch, 0, l.output, 1);
     int m = l.batch;
     int k = l.inputs;
@@ -209,6 +215,7 @@ void denormalize_connected_layer(layer l)
         l.rolling_mean[i] = 0;
         l.rolling_variance[i] = 1;
     }
+    update_int8_weights(l);
 }
 
 
@@ -1,11 +1,20 @@
 #include "convolutional_layer.h"
+#include "layer.h"
 #include "utils.h"
 #include "batchnorm_layer.h"
 #include "im2col.h"
 #include "col2im.h"
+#include "direct_conv.h"
+#include "depthwise_conv.h"
+#include "winograd.h"
+#include "nchwc.h"
+#include "quantize.h"
+#include "xnor.h"
 #include "blas.h"
 #include "gemm.h"
+#include "thread_pool.h"
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #ifdef AI2
@@ -83,6 +92,40 @@ image get_convolutional_delta(convolutional_layer l)
     return float_to_image(l.out_w,l.out_h,l.out_c,l.delta);
 }
 
+/* Direct conv only beats im2col+gemm while the im2col matrix is short */
+#define DIRECT_CONV_MAX_CHANNELS 32
+/* ...and works in blocks of 8 filters, so thinner groups go per pixel */
+#define DIRECT_CONV_MIN_GROUP_FILTERS 8
+/* Winograd needs enough channels and tiles to amortize its transforms */
+#define WINOGRAD_MIN_CHANNELS 8
+#define WINOGRAD_MIN_OUTPUTS (20*20)
+/* Largest error of a winograd layer relative to the largest output */
+#define WINOGRAD_TOLERANCE 1e-3
+/* Grouped layers run their groups in parallel, each as one serial
+   im2col+gemm, while a group's gemm is too small to split well */
+#define GROUPED_MAX_CHANNELS 64
+/* Budget for one band of the im2col matrix in the banded backward pass */
+#define CONV_BAND_BYTES (4*1024*1024)
+
+static int is_winograd(layer l)
+{
+    return l.algorithm == CONV_WINOGRAD2 || l.algorithm == CONV_WINOGRAD4;
+}
+
+static int winograd_tile(layer l)
+{
+    return l.algorithm == CONV_WINOGRAD4 ? 4 : 2;
+}
+
+static int band_rows(layer l)
+{
+    size_t row_bytes = (size_t)l.out_w*l.size*l.size*l.c/l.groups*sizeof(float);
+    int rows = CONV_BAND_BYTES/row_bytes;
+    if(rows < 1) rows = 1;
+    if(rows > l.out_h) rows = l.out_h;
+    return rows;
+}
+
 static size_t get_workspace_size(layer l){
 #ifdef CUDNN
     if(gpu_index >= 0){
@@ -115,9 +158,180 @@ static size_t get_workspace_size(layer l){
         return most;
     }
 #endif
+    /* depthwise needs no scratch; grouped uses one im2col matrix per thread */
+    if(l.algorithm == CONV_DEPTHWISE || l.algorithm == CONV_GROUPED) return 0;
+    if(l.algorithm == CONV_DIRECT || is_winograd(l)){
+        size_t s = (size_t)band_rows(l)*l.out_w*l.size*l.size*l.c/l.groups*sizeof(float);
+        /* room for both tile sizes so the tolerance check can step down */
+        if(is_winograd(l)){
+            size_t w2 = winograd_workspace_size(2, l.c/l.groups, l.n/l.groups, l.out_h, l.out_w);
+            size_t w4 = winograd_workspace_size(4, l.c/l.groups, l.n/l.groups, l.out_h, l.out_w);
+            if(w2 > s) s = w2;
+            if(w4 > s) s = w4;
+        }
+        return s;
+    }
     return (size_t)l.out_h*l.out_w*l.size*l.size*l.c/l.groups*sizeof(float);
 }
 
+CONV_ALGORITHM get_conv_algorithm(char *s)
+{
+    if (strcmp(s, "im2col")==0) return CONV_IM2COL;
+    if (strcmp(s, "direct")==0) return CONV_DIRECT;
+    if (strcmp(s, "winograd")==0) return CONV_WINOGRAD4;
+    if (strcmp(s, "winograd4")==0) return CONV_WINOGRAD4;
+    if (strcmp(s, "winograd2")==0) return CONV_WINOGRAD2;
+    if (strcmp(s, "depthwise")==0) return CONV_DEPTHWISE;
+    if (strcmp(s, "grouped")==0) return CONV_GROUPED;
+    fprintf(stderr, "Couldn't find convolution algorithm %s, going with im2col\n", s);
+    return CONV_IM2COL;
+}
+
+/**
+ * The algorithm a layer runs unless its cfg names one. Winograd is left to
+ * inference networks: training would transform the filters again after
+ * every update.
+ */
+CONV_ALGORITHM default_conv_algorithm(convolutional_layer l, int inference)
+{
+#ifdef GPU
+    if(gpu_index >= 0) return CONV_IM2COL;
+#endif
+    if(l.binary || l.xnor) return CONV_IM2COL;
+    if(l.groups > 1 && l.groups == l.c) return CONV_DEPTHWISE;
+    if(inference && winograd_supported(l.size, l.stride, l.pad) && l.c/l.groups >= WINOGRAD_MIN_CHANNELS
+            && l.out_h*l.out_w >= WINOGRAD_MIN_OUTPUTS) return CONV_WINOGRAD4;
+    if(direct_conv_supported(l.size, l.stride, l.pad) && l.c/l.groups <= DIRECT_CONV_MAX_CHANNELS
+            && (l.groups == 1 || l.n/l.groups >= DIRECT_CONV_MIN_GROUP_FILTERS)) return CONV_DIRECT;
+    if(l.groups > 1 && l.c/l.groups <= GROUPED_MAX_CHANNELS) return CONV_GROUPED;
+    return CONV_IM2COL;
+}
+
+/**
+ * Recomputes the cached winograd filters after l.weights changed.
+ * @param l Convolutional layer, does nothing unless it runs winograd
+ */
+void update_winograd_weights(convolutional_layer l)
+{
+    int j;
+    if(!is_winograd(l)) return;
+    size_t size = winograd_weights_size(winograd_tile(l), l.n/l.groups, l.c/l.groups);
+    for(j = 0; j < l.groups; ++j){
+        winograd_transform_weights(winograd_tile(l), l.weights + j*l.nweights/l.groups,
+                l.n/l.groups, l.c/l.groups, l.winograd_weights + j*size);
+    }
+}
+
+/**
+ * Repacks the direct convolution filters after l.weights changed.
+ * @param l Convolutional layer, does nothing unless it runs direct
+ */
+void update_direct_weights(convolutional_layer l)
+{
+    int j;
+    if(l.algorithm != CONV_DIRECT) return;
+    size_t size = direct_packed_size(l.c/l.groups, l.n/l.groups);
+    for(j = 0; j < l.groups; ++j){
+        direct_pack_filters(l.weights + j*l.nweights/l.groups, l.c/l.groups, l.n/l.groups, l.direct_weights + j*size);
+    }
+}
+
+void set_convolutional_algorithm(convolutional_layer *l, CONV_ALGORITHM a)
+{
+    if(a == CONV_DIRECT && (l->binary || l->xnor || !direct_conv_supported(l->size, l->stride, l->pad))){
+        fprintf(stderr, "Direct convolution needs a plain 3x3 layer with pad 1 and stride 1 or 2, using im2col\n");
+        a = CONV_IM2COL;
+    }
+    if((a == CONV_WINOGRAD2 || a == CONV_WINOGRAD4) && (l->binary || l->xnor || !winograd_supported(l->size, l->stride, l->pad))){
+        fprintf(stderr, "Winograd convolution needs a plain 3x3 layer with pad 1 and stride 1, using im2col\n");
+        a = CONV_IM2COL;
+    }
+    if(a == CONV_DEPTHWISE && (l->binary || l->xnor || l->groups != l->c)){
+        fprintf(stderr, "Depthwise convolution needs groups equal to the input channels, using im2col\n");
+        a = CONV_IM2COL;
+    }
+    if(a == CONV_GROUPED && (l->binary || l->xnor || l->groups < 2)){
+        fprintf(stderr, "Grouped convolution needs more than one group, using im2col\n");
+        a = CONV_IM2COL;
+    }
+    l->algorithm = a;
+    free(l->winograd_weights);
+    l->winograd_weights = 0;
+    if(is_winograd(*l)){
+        l->winograd_weights = safe_calloc(l->groups*winograd_weights_size(winograd_tile(*l), l->n/l->groups, l->c/l->groups), sizeof(float));
+        update_winograd_weights(*l);
+    }
+    free(l->direct_weights);
+    l->direct_weights = 0;
+    if(l->algorithm == CONV_DIRECT){
+        l->direct_weights = safe_calloc(l->groups*direct_packed_size(l->c/l->groups, l->n/l->groups) + 1, sizeof(float));
+        update_direct_weights(*l);
+    }
+    l->workspace_size = get_workspace_size(*l);
+}
+
+/* Largest deviation of the winograd path from im2col+gemm on a random patch,
+ * relative to the largest output. The patch comes from a fixed-seed LCG so
+ * loading a network leaves the rand() stream of training alone. */
+static float winograd_error(convolutional_layer l)
+{
+    int i, j;
+    int h = l.h < 12 ? l.h : 12;
+    int w = l.w < 12 ? l.w : 12;
+    int c = l.c/l.groups;
+    int m = l.n/l.groups;
+    float *im = safe_calloc(c*h*w, sizeof(float));
+    float *col = safe_calloc(c*9*h*w, sizeof(float));
+    float *ref = safe_calloc(m*h*w, sizeof(float));
+    float *out = safe_calloc(m*h*w, sizeof(float));
+    float *ws = safe_calloc(1, winograd_workspace_size(winograd_tile(l), c, m, h, w));
+    unsigned int seed = 1;
+    for(i = 0; i < c*h*w; ++i){
+        seed = seed*1664525u + 1013904223u;
+        im[i] = (seed >> 8)/16777216.f;
+    }
+
+    float err = 0;
+    float most = 0;
+    for(j = 0; j < l.groups; ++j){
+        im2col_cpu(im, c, h, w, 3, 1, 1, col);
+        gemm(0,0,m,h*w,c*9,1,l.weights + j*l.nweights/l.groups,c*9,col,h*w,0,ref,h*w);
+        winograd_conv3x3_cpu(winograd_tile(l), im, c, h, w,
+                l.winograd_weights + j*winograd_weights_size(winograd_tile(l), m, c), m, ws, out);
+        for(i = 0; i < m*h*w; ++i){
+            if(fabs(ref[i]) > most) most = fabs(ref[i]);
+            if(fabs(ref[i] - out[i]) > err) err = fabs(ref[i] - out[i]);
+        }
+    }
+    free(im);
+    free(col);
+    free(ref);
+    free(out);
+    free(ws);
+    return most > 0 ? err/most : err;
+}
+
+/**
+ * Checks a winograd layer against im2col+gemm with its current weights and
+ * steps down to F(2x2,3x3), then to direct convolution, until it is within
+ * tolerance. Both fit in the workspace the layer already asked for.
+ * @param l Convolutional layer
+ */
+void check_convolutional_algorithm(convolutional_layer *l)
+{
+    if(!is_winograd(*l)) return;
+    float err = winograd_error(*l);
+    if(err <= WINOGRAD_TOLERANCE) return;
+    if(l->algorithm == CONV_WINOGRAD4){
+        fprintf(stderr, "conv %dx%dx%d -> %d: winograd 4x4 error %g, trying 2x2\n", l->w, l->h, l->c, l->n, err);
+        set_convolutional_algorithm(l, CONV_WINOGRAD2);
+        err = winograd_error(*l);
+        if(err <= WINOGRAD_TOLERANCE) return;
+    }
+    fprintf(stderr, "conv %dx%dx%d -> %d: winograd 2x2 error %g, using direct convolution\n", l->w, l->h, l->c, l->n, err);
+    set_convolutional_algorithm(l, CONV_DIRECT);
+}
+
 #ifdef GPU
 #ifdef CUDNN
 void cudnn_convolutional_setup(layer *l)
@@ -228,7 +442,10 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     }
     if(xnor){
         l.binary_weights = safe_calloc(l.nweights, sizeof(float));
-        l.binary_input = safe_calloc(l.inputs*l.batch, sizeof(float));
+    }
+    if(binary || xnor){
+        l.packed_weights = safe_calloc(groups*binary_filter_words(n/groups, c/groups, size), sizeof(uint64_t));
+        update_binary_weights(l);
     }
 
     if(batch_normalize){
@@ -319,7 +536,7 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
 #endif
     }
 #endif
-    l.workspace_size = get_workspace_size(l);
+    set_convolutional_algorithm(&l, default_conv_algorithm(l, 0));
     l.activation = activation;
 
     // fprintf(stderr, "conv  %5d %2d x%2d /%2d  %4d x%4d x%4d   ->  %4d x%4d x%4d  %5.3f BFLOPs\n", n, size, size, stride, w, h, c, l.out_w, l.out_h, l.out_c, (2.0 * l.n * l.size*l.size*l.c/l.groups * l.out_h*l.out_w)/1000000000.);
@@ -340,6 +557,11 @@ void denormalize_convolutional_layer(convolutional_layer l)
         l.rolling_mean[i] = 0;
         l.rolling_variance[i] = 1;
     }
+    update_winograd_weights(l);
+    update_direct_weights(l);
+    update_nchwc_weights(l);
+    update_int8_weights(l);
+    update_binary_weights(l);
 }
 
 /*
@@ -380,11 +602,11 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h)
     l->outputs = l->out_h * l->out_w * l->out_c;
     l->inputs = l->w * l->h * l->c;
 
-    l->output = safe_realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta  = safe_realloc(l->delta,  l->batch*l->outputs*sizeof(float));
+    l->output = resize_layer_buffer(l, l->output, l->batch*l->outputs*sizeof(float));
+    l->delta  = resize_layer_buffer(l, l->delta,  l->batch*l->outputs*sizeof(float));
     if(l->batch_normalize){
-        l->x = safe_realloc(l->x, l->batch*l->outputs*sizeof(float));
-        l->x_norm  = safe_realloc(l->x_norm, l->batch*l->outputs*sizeof(float));
+        l->x = resize_layer_buffer(l, l->x, l->batch*l->outputs*sizeof(float));
+        l->x_norm  = resize_layer_buffer(l, l->x_norm, l->batch*l->outputs*sizeof(float));
     }
 
 #ifdef GPU
@@ -408,87 +630,322 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h)
     l->workspace_size = get_workspace_size(*l);
 }
 
-void add_bias(float *output, float *biases, int batch, int n, int size)
+typedef struct {
+    float *x, *v;
+    int batch, n, size;
+} bias_args;
+
+static void add_bias_channels(void *ptr, int begin, int end)
 {
+    bias_args *a = ptr;
     int i,j,b;
-    for(b = 0; b < batch; ++b){
-        for(i = 0; i < n; ++i){
-            for(j = 0; j < size; ++j){
-                output[(b*n + i)*size + j] += biases[i];
+    for(b = 0; b < a->batch; ++b){
+        for(i = begin; i < end; ++i){
+            for(j = 0; j < a->size; ++j){
+                a->x[(b*a->n + i)*a->size + j] += a->v[i];
             }
         }
     }
 }
 
-void scale_bias(float *output, float *scales, int batch, int n, int size)
+void add_bias(float *output, float *biases, int batch, int n, int size)
 {
+    bias_args a = {output, biases, batch, n, size};
+    parallel_for(n, parallel_grain((size_t)batch*size), add_bias_channels, &a);
+}
+
+static void scale_bias_channels(void *ptr, int begin, int end)
+{
+    bias_args *a = ptr;
     int i,j,b;
-    for(b = 0; b < batch; ++b){
-        for(i = 0; i < n; ++i){
-            for(j = 0; j < size; ++j){
-                output[(b*n + i)*size + j] *= scales[i];
+    for(b = 0; b < a->batch; ++b){
+        for(i = begin; i < end; ++i){
+            for(j = 0; j < a->size; ++j){
+                a->x[(b*a->n + i)*a->size + j] *= a->v[i];
             }
         }
     }
 }
 
-void backward_bias(float *bias_updates, float *delta, int batch, int n, int size)
+void scale_bias(float *output, float *scales, int batch, int n, int size)
 {
+    bias_args a = {output, scales, batch, n, size};
+    parallel_for(n, parallel_grain((size_t)batch*size), scale_bias_channels, &a);
+}
+
+static void backward_bias_channels(void *ptr, int begin, int end)
+{
+    bias_args *a = ptr;
     int i,b;
-    for(b = 0; b < batch; ++b){
-        for(i = 0; i < n; ++i){
-            bias_updates[i] += sum_array(delta+size*(i+b*n), size);
+    for(b = 0; b < a->batch; ++b){
+        for(i = begin; i < end; ++i){
+            a->v[i] += sum_array(a->x+a->size*(i+b*a->n), a->size);
         }
     }
 }
 
+void backward_bias(float *bias_updates, float *delta, int batch, int n, int size)
+{
+    bias_args a = {delta, bias_updates, batch, n, size};
+    parallel_for(n, parallel_grain((size_t)batch*size), backward_bias_channels, &a);
+}
+
+static __thread thread_buffer fused_scale_bias;
+
+/* Group j of batch item i, with workspace holding its im2col matrix */
+static void forward_convolutional_group(convolutional_layer l, network net, int i, int j,
+        float *workspace, float *scales, float *biases, float *residual)
+{
+    int f;
+    int m = l.n/l.groups;
+    int k = l.size*l.size*l.c/l.groups;
+    int n = l.out_w*l.out_h;
+    float *a = l.weights + j*l.nweights/l.groups;
+    float *b = workspace;
+    float *c = l.output + (i*l.groups + j)*n*m;
+    float *im =  net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
+    float *r = residual ? residual + (c - l.output) : 0;
+
+    if (l.xnor || l.algorithm == CONV_DIRECT || is_winograd(l)) {
+        if (l.xnor) {
+            xnor_conv_cpu(l, im, j, c);
+        } else if (l.algorithm == CONV_DIRECT) {
+            float *u = l.direct_weights + j*direct_packed_size(l.c/l.groups, m);
+            direct_conv3x3_cpu(im, l.c/l.groups, l.h, l.w, l.stride, a, u, m, c);
+        } else {
+            float *u = l.winograd_weights + j*winograd_weights_size(winograd_tile(l), m, l.c/l.groups);
+            winograd_conv3x3_cpu(winograd_tile(l), im, l.c/l.groups, l.h, l.w, u, m, workspace, c);
+        }
+        if (scales) {
+            for(f = 0; f < m; ++f){
+                scale_bias_activate_array(c + f*n, n, scales[j*m + f], biases[j*m + f], l.activation);
+                if (r) axpy_cpu(n, 1, r + f*n, 1, c + f*n, 1);
+            }
+        }
+        return;
+    }
+    if (l.size == 1) {
+        b = im;
+    } else {
+        im2col_cpu(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
+    }
+    if (scales) {
+        gemm_cpu_fused(0,0,m,n,k,a,k,b,n,c,n,scales + j*m,biases + j*m,l.activation,r);
+    } else {
+        gemm(0,0,m,n,k,1,a,k,b,n,1,c,n);
+    }
+}
+
+static __thread thread_buffer grouped_workspace;
+
+/* This thread's im2col matrix for one group of a CONV_GROUPED layer */
+static float *get_grouped_workspace(convolutional_layer l)
+{
+    size_t n = (size_t)l.out_h*l.out_w*l.size*l.size*l.c/l.groups;
+    return grow_thread_buffer(&grouped_workspace, n*sizeof(float));
+}
+
+typedef struct {
+    convolutional_layer *l;
+    network *net;
+    float *scales, *biases, *residual;
+} grouped_args;
+
+/* Items [begin, end) of batch x groups; the gemms inside run serially on
+   this thread, so the result matches the im2col path bit for bit */
+static void forward_grouped_range(void *ptr, int begin, int end)
+{
+    grouped_args *a = ptr;
+    float *workspace = get_grouped_workspace(*a->l);
+    int t;
+    for(t = begin; t < end; ++t){
+        forward_convolutional_group(*a->l, *a->net, t/a->l->groups, t%a->l->groups, workspace,
+                a->scales, a->biases, a->residual);
+    }
+}
+
+static __thread thread_buffer upsampled_output;
+
+/* A 1x1 convolution commutes with the nearest-neighbour upsample before it
+   (optimize_network folds the two): run it on the small input, the output
+   of l.upsampled_layer that the upsample layer left alone, then upsample
+   its output */
+static void forward_convolutional_upsampled(convolutional_layer l, network net)
+{
+    int s = l.upsampled;
+    convolutional_layer small = l;
+    small.upsampled = 0;
+    small.residual = 0;
+    small.w /= s;
+    small.h /= s;
+    small.out_w /= s;
+    small.out_h /= s;
+    small.inputs /= s*s;
+    small.outputs /= s*s;
+    small.output = grow_thread_buffer(&upsampled_output, (size_t)small.outputs*l.batch*sizeof(float));
+    net.input = net.layers[l.upsampled_layer].output;
+    forward_convolutional_layer(small, net);
+    upsample_cpu(small.output, small.out_w, small.out_h, l.n, l.batch, s, 1, 1, l.output);
+    if(l.residual) axpy_cpu(l.outputs*l.batch, 1, net.layers[l.residual_layer].output, 1, l.output, 1);
+}
+
 void forward_convolutional_layer(convolutional_layer l, network net)
 {
     int i, j;
 
+    if(l.upsampled){
+        forward_convolutional_upsampled(l, net);
+        return;
+    }
+
+    /* a shortcut folded in by optimize_network: its add happens here,
+       right after the activation */
+    float *residual = l.residual ? net.layers[l.residual_layer].output : 0;
+
+    if(l.weights_int8 && !net.train && !net.delta){
+        forward_convolutional_layer_int8(l, net);
+        if(residual) axpy_cpu(l.outputs*l.batch, 1, residual, 1, l.output, 1);
+        return;
+    }
+
     fill_cpu(l.outputs*l.batch, 0, l.output, 1);
 
-    if(l.xnor){
-        binarize_weights(l.weights, l.n, l.c/l.groups*l.size*l.size, l.binary_weights);
-        swap_binary(&l);
-        binarize_cpu(net.input, l.c*l.h*l.w*l.batch, l.binary_input);
-        net.input = l.binary_input;
+    /* At inference batchnorm is an affine map per filter: fold it and the
+       bias into one scale and shift, recomputed each pass (l.n values) so it
+       never goes stale, and apply them with the activation in the gemm
+       epilogue instead of three more passes over l.output. Callers that
+       backpropagate to the input (net.delta) still need l.x. */
+    float *scales = 0;
+    float *biases = 0;
+    if(!net.train && !net.delta){
+        scales = grow_thread_buffer(&fused_scale_bias, 2*l.n*sizeof(float));
+        biases = scales + l.n;
+        inference_scale_bias(l, l.n, scales, biases);
+    }
+
+    /* update_binary_weights keeps the binarized weights current; xnor
+       layers use their bit-packed copy */
+    if(l.binary && !l.xnor) swap_binary(&l);
+
+    if(l.algorithm == CONV_DEPTHWISE){
+        depthwise_conv_cpu(net.input, l.batch, l.c, l.h, l.w, l.size, l.stride, l.pad,
+                l.weights, l.n/l.groups, scales, biases, l.activation, l.output);
+        if(scales && residual) axpy_cpu(l.outputs*l.batch, 1, residual, 1, l.output, 1);
+    } else if(l.algorithm == CONV_GROUPED){
+        grouped_args a = {&l, &net, scales, biases, scales ? residual : 0};
+        int cost = l.n/l.groups*l.out_h*l.out_w*l.size*l.size*l.c/l.groups;
+        parallel_for(l.batch*l.groups, parallel_grain(cost), forward_grouped_range, &a);
+    } else {
+        for(i = 0; i < l.batch; ++i){
+            for(j = 0; j < l.groups; ++j){
+                forward_convolutional_group(l, net, i, j, net.workspace, scales, biases, scales ? residual : 0);
+            }
+        }
+    }
+
+    if(!scales){
+        if(l.batch_normalize){
+            forward_batchnorm_layer(l, net);
+        } else {
+            add_bias(l.output, l.biases, l.batch, l.n, l.out_h*l.out_w);
+        }
+        activate_array(l.output, l.outputs*l.batch, l.activation);
+        if(residual) axpy_cpu(l.outputs*l.batch, 1, residual, 1, l.output, 1);
     }
+    if(l.binary && !l.xnor) swap_binary(&l);
+}
 
+/* Same gradients as the im2col path, one band of output rows at a time so the
+ * workspace never holds the whole im2col matrix. */
+static void backward_convolutional_layer_banded(convolutional_layer l, network net)
+{
+    int i, j, y;
     int m = l.n/l.groups;
-    int k = l.size*l.size*l.c/l.groups;
-    int n = l.out_w*l.out_h;
+    int n = l.size*l.size*l.c/l.groups;
+    int k = l.out_w*l.out_h;
+    int band = band_rows(l);
+
     for(i = 0; i < l.batch; ++i){
         for(j = 0; j < l.groups; ++j){
-            float *a = l.weights + j*l.nweights/l.groups;
-            float *b = net.workspace;
-            float *c = l.output + (i*l.groups + j)*n*m;
-            float *im =  net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
-
-            if (l.size == 1) {
-                b = im;
-            } else {
-                im2col_cpu(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
+            float *delta = l.delta + (i*l.groups + j)*m*k;
+            float *w  = l.weights + j*l.nweights/l.groups;
+            float *dw = l.weight_updates + j*l.nweights/l.groups;
+            float *im  = net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
+            float *imd = net.delta ? net.delta + (i*l.groups + j)*l.c/l.groups*l.h*l.w : 0;
+
+            for(y = 0; y < l.out_h; y += band){
+                int rows = (y + band > l.out_h) ? l.out_h - y : band;
+                int kb = rows*l.out_w;
+                float *a = delta + y*l.out_w;
+
+                im2col_cpu_rows(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, y, rows, net.workspace);
+                gemm(0,1,m,n,kb,1,a,k,net.workspace,kb,1,dw,n);
+
+                if (imd) {
+                    gemm(1,0,n,kb,m,1,w,n,a,k,0,net.workspace,kb);
+                    col2im_cpu_rows(net.workspace, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, y, rows, imd);
+                }
             }
-            gemm(0,0,m,n,k,1,a,k,b,n,1,c,n);
         }
     }
+}
 
-    if(l.batch_normalize){
-        forward_batchnorm_layer(l, net);
+/* Gradients of group j of batch item i, with workspace holding its im2col matrix */
+static void backward_convolutional_group(convolutional_layer l, network net, int i, int j, float *workspace)
+{
+    int m = l.n/l.groups;
+    int n = l.size*l.size*l.c/l.groups;
+    int k = l.out_w*l.out_h;
+
+    float *a = l.delta + (i*l.groups + j)*m*k;
+    float *b = workspace;
+    float *c = l.weight_updates + j*l.nweights/l.groups;
+
+    float *im  = net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
+    float *imd = net.delta + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
+
+    if(l.size == 1){
+        b = im;
     } else {
-        add_bias(l.output, l.biases, l.batch, l.n, l.out_h*l.out_w);
+        im2col_cpu(im, l.c/l.groups, l.h, l.w, 
+                l.size, l.stride, l.pad, b);
     }
 
-    activate_array(l.output, l.outputs*l.batch, l.activation);
-    if(l.binary || l.xnor) swap_binary(&l);
+    gemm(0,1,m,n,k,1,a,k,b,k,1,c,n);
+
+    if (net.delta) {
+        a = l.weights + j*l.nweights/l.groups;
+        b = l.delta + (i*l.groups + j)*m*k;
+        c = workspace;
+        if (l.size == 1) {
+            c = imd;
+        }
+
+        gemm(1,0,n,k,m,1,a,n,b,k,0,c,k);
+
+        if (l.size != 1) {
+            col2im_cpu(workspace, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, imd);
+        }
+    }
+}
+
+/* Groups [begin, end); each owns its slice of l.weight_updates, so the batch
+   stays an inner loop in the same order as the im2col path */
+static void backward_grouped_range(void *ptr, int begin, int end)
+{
+    grouped_args *a = ptr;
+    float *workspace = get_grouped_workspace(*a->l);
+    int i, j;
+    for(j = begin; j < end; ++j){
+        for(i = 0; i < a->l->batch; ++i){
+            backward_convolutional_group(*a->l, *a->net, i, j, workspace);
+        }
+    }
 }
 
 void backward_convolutional_layer(convolutional_layer l, network net)
 {
     int i, j;
-    int m = l.n/l.groups;
-    int n = l.size*l.size*l.c/l.groups;
     int k = l.out_w*l.out_h;
 
     gradient_array(l.output, l.outputs*l.batch, l.activation, l.delta);
@@ -499,38 +956,29 @@ void backward_convolutional_layer(convolutional_layer l, network net)
         backward_bias(l.bias_updates, l.delta, l.batch, l.n, k);
     }
 
+    if(l.algorithm == CONV_DEPTHWISE){
+        depthwise_conv_backward_weights(net.input, l.delta, l.batch, l.c, l.h, l.w,
+                l.size, l.stride, l.pad, l.n/l.groups, l.weight_updates);
+        if(net.delta){
+            depthwise_conv_backward_data(l.delta, l.weights, l.batch, l.c, l.h, l.w,
+                    l.size, l.stride, l.pad, l.n/l.groups, net.delta);
+        }
+        return;
+    }
+    if(l.algorithm == CONV_GROUPED){
+        grouped_args a = {&l, &net, 0, 0};
+        int cost = l.batch*l.n/l.groups*k*l.size*l.size*l.c/l.groups;
+        parallel_for(l.groups, parallel_grain(cost), backward_grouped_range, &a);
+        return;
+    }
+    if(l.algorithm == CONV_DIRECT || is_winograd(l)){
+        backward_convolutional_layer_banded(l, net);
+        return;
+    }
+
     for(i = 0; i < l.batch; ++i){
         for(j = 0; j < l.groups; ++j){
-            float *a = l.delta + (i*l.groups + j)*m*k;
-            float *b = net.workspace;
-            float *c = l.weight_updates + j*l.nweights/l.groups;
-
-            float *im  = net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
-            float *imd = net.delta + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
-
-            if(l.size == 1){
-                b = im;
-            } else {
-                im2col_cpu(im, l.c/l.groups, l.h, l.w, 
-                        l.size, l.stride, l.pad, b);
-            }
-
-            gemm(0,1,m,n,k,1,a,k,b,k,1,c,n);
-
-            if (net.delta) {
-                a = l.weights + j*l.nweights/l.groups;
-                b = l.delta + (i*l.groups + j)*m*k;
-                c = net.workspace;
-                if (l.size == 1) {
-                    c = imd;
-                }
-
-                gemm(1,0,n,k,m,1,a,n,b,k,0,c,k);
-
-                if (l.size != 1) {
-                    col2im_cpu(net.workspace, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, imd);
-                }
-            }
+            backward_convolutional_group(l, net, i, j, net.workspace);
         }
     }
 }
@@ -553,6 +1001,11 @@ void update_convolutional_layer(convolutional_layer l, update_args a)
     axpy_cpu(l.nweights, -decay*batch, l.weights, 1, l.weight_updates, 1);
     axpy_cpu(l.nweights, learning_rate/batch, l.weight_updates, 1, l.weights, 1);
     scal_cpu(l.nweights, momentum, l.weight_updates, 1);
+    update_winograd_weights(l);
+    update_direct_weights(l);
+    update_nchwc_weights(l);
+    update_int8_weights(l);
+    update_binary_weights(l);
 }
 
 
@@ -573,6 +1026,11 @@ void rgbgr_weights(convolutional_layer l)
             rgbgr_image(im);
         }
     }
+    update_winograd_weights(l);
+    update_direct_weights(l);
+    update_nchwc_weights(l);
+    update_int8_weights(l);
+    update_binary_weights(l);
 }
 
 void rescale_weights(convolutional_layer l, float scale, float trans)
@@ -586,6 +1044,11 @@ void rescale_weights(convolutional_layer l, float scale, float trans)
             l.biases[i] += sum*trans;
         }
     }
+    update_winograd_weights(l);
+    update_direct_weights(l);
+    update_nchwc_weights(l);
+    update_int8_weights(l);
+    update_binary_weights(l);
 }
 
 image *get_weights(convolutional_layer l)
@@ -27,10 +27,17 @@ void cudnn_convolutional_setup(layer *l);
 
 convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam);
 void resize_convolutional_layer(convolutional_layer *layer, int w, int h);
+void set_convolutional_algorithm(convolutional_layer *layer, CONV_ALGORITHM a);
+CONV_ALGORITHM get_conv_algorithm(char *s);
+CONV_ALGORITHM default_conv_algorithm(convolutional_layer layer, int inference);
+void update_winograd_weights(convolutional_layer layer);
+void update_direct_weights(convolutional_layer layer);
+void check_convolutional_algorithm(convolutional_layer *layer);
 void forward_convolutional_layer(const convolutional_layer layer, network net);
 void update_convolutional_layer(convolutional_layer layer, update_args a);
 image *visualize_convolutional_layer(convolutional_layer layer, char *window, image *prev_weights);
 void binarize_weights(float *weights, int n, int size, float *binary);
+void binarize_cpu(float *input, int n, float *binary);
 void swap_binary(convolutional_layer *l);
 void binarize_weights2(float *weights, int n, int size, char *binary, float *scales);
 
@@ -1,4 +1,5 @@
 #include "cost_layer.h"
+#include "layer.h"
 #include "utils.h"
 #include "cuda.h"
 #include "blas.h"
@@ -69,8 +70,8 @@ void resize_cost_layer(cost_layer *l, int inputs)
 {
     l->inputs = inputs;
     l->outputs = inputs;
-    l->delta = safe_realloc(l->delta, inputs*l->batch*sizeof(float));
-    l->output = safe_realloc(l->output, inputs*l->batch*sizeof(float));
+    l->delta = resize_layer_buffer(l, l->delta, inputs*l->batch*sizeof(float));
+    l->output = resize_layer_buffer(l, l->output, inputs*l->batch*sizeof(float));
 #ifdef GPU
     cuda_free(l->delta_gpu);
     cuda_free(l->output_gpu);
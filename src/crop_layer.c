@@ -1,4 +1,5 @@
 #include "crop_layer.h"
+#include "layer.h"
 #include "cuda.h"
 #include <stdio.h>
 #include "utils.h"
@@ -57,7 +58,7 @@ void resize_crop_layer(layer *l, int w, int h)
     l->inputs = l->w * l->h * l->c;
     l->outputs = l->out_h * l->out_w * l->out_c;
 
-    l->output = safe_realloc(l->output, l->batch*l->outputs*sizeof(float));
+    l->output = resize_layer_buffer(l, l->output, l->batch*l->outputs*sizeof(float));
     #ifdef GPU
     cuda_free(l->output_gpu);
     l->output_gpu = cuda_make_array(l->output, l->outputs*l->batch);
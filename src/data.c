@@ -1,6 +1,8 @@
 #include "data.h"
 #include "utils.h"
 #include "image.h"
+#include "image_cache.h"
+#include "record_shard.h"
 #include "cuda.h"
 
 #include <stdio.h>
@@ -9,6 +11,87 @@
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Loaders give every row an allocation of its own, unless load_args X and
+ * y name a contiguous [n x cols] batch: then sample i goes to row i of it,
+ * and the data they return is shallow. The image loaders write to batch_X
+ * and the label loaders to batch_y, set for the length of one load.
+ */
+static __thread float *batch_X;
+static __thread float *batch_y;
+
+/* n zeroed rows, in buffer if there is one */
+static matrix make_batch_matrix(int n, int cols, float *buffer)
+{
+    int i;
+    if(!buffer) return make_matrix(n, cols);
+    matrix m;
+    m.rows = n;
+    m.cols = cols;
+    m.vals = safe_calloc(n, sizeof(float *));
+    memset(buffer, 0, (size_t)n*cols*sizeof(float));
+    for(i = 0; i < n; ++i) m.vals[i] = buffer + (size_t)i*cols;
+    return m;
+}
+
+/* Image for row i of X, to be drawn into in place */
+static image make_row_image(int i, int w, int h, int c)
+{
+    if(!batch_X) return make_image(w, h, c);
+    return float_to_image(w, h, c, batch_X + (size_t)i*w*h*c);
+}
+
+/* Row i of a batch from an image made for it, moved into buffer if there
+   is one */
+static float *keep_row(float *buffer, int i, image im)
+{
+    if(!buffer) return im.data;
+    size_t size = (size_t)im.w*im.h*im.c;
+    float *row = buffer + i*size;
+    memcpy(row, im.data, size*sizeof(float));
+    free_image(im);
+    return row;
+}
+
+/* The image cache of the load, set like batch_X */
+static __thread image_cache *load_cache;
+
+/* The image at path with 3 channels of 8 bits, from the cache if it holds
+   it. *cached tells whether it did: the cache's copy isn't to be freed. */
+static byte_image load_source_bytes(char *path, int *cached)
+{
+    byte_image im;
+    *cached = image_cache_find(load_cache, path, &im);
+    if(!*cached) im = load_byte_image(path, 3);
+    return im;
+}
+
+/* The records of the load, set like batch_X */
+static __thread record_reader *load_records;
+
+/* The image of a record, from the cache if it holds its path */
+static byte_image load_record_bytes(data_record record, int *cached)
+{
+    byte_image im;
+    *cached = image_cache_find(load_cache, record.path, &im);
+    if(!*cached) im = decode_byte_image(record.bytes, record.size, 3);
+    return im;
+}
+
+/* load_image_color, from the cache if it holds the image */
+static image load_source_image(char *path, int w, int h)
+{
+    byte_image b;
+    if(!image_cache_find(load_cache, path, &b)) return load_image_color(path, w, h);
+    image im = byte_image_to_image(b);
+    if(w && h && (w != im.w || h != im.h)){
+        image sized = resize_image(im, w, h);
+        free_image(im);
+        im = sized;
+    }
+    return im;
+}
+
 list *get_paths(char *filename)
 {
     char *path;
@@ -74,14 +157,14 @@ matrix load_image_paths_gray(char **paths, int n, int w, int h)
     X.cols = 0;
 
     for(i = 0; i < n; ++i){
-        image im = load_image(paths[i], w, h, 3);
+        image im = load_source_image(paths[i], w, h);
 
         image gray = grayscale_image(im);
         free_image(im);
         im = gray;
 
-        X.vals[i] = im.data;
         X.cols = im.h*im.w*im.c;
+        X.vals[i] = keep_row(batch_y, i, im);
     }
     return X;
 }
@@ -95,9 +178,9 @@ matrix load_image_paths(char **paths, int n, int w, int h)
     X.cols = 0;
 
     for(i = 0; i < n; ++i){
-        image im = load_image_color(paths[i], w, h);
-        X.vals[i] = im.data;
+        image im = load_source_image(paths[i], w, h);
         X.cols = im.h*im.w*im.c;
+        X.vals[i] = keep_row(batch_X, i, im);
     }
     return X;
 }
@@ -111,7 +194,7 @@ matrix load_image_augment_paths(char **paths, int n, int min, int max, int size,
     X.cols = 0;
 
     for(i = 0; i < n; ++i){
-        image im = load_image_color(paths[i], 0, 0);
+        image im = load_source_image(paths[i], 0, 0);
         image crop;
         if(center){
             crop = center_crop_image(im, size, size);
@@ -129,8 +212,8 @@ matrix load_image_augment_paths(char **paths, int n, int min, int max, int size,
         */
         //grayscale_image_3c(crop);
         free_image(im);
-        X.vals[i] = crop.data;
         X.cols = crop.h*crop.w*crop.c;
+        X.vals[i] = keep_row(batch_X, i, crop);
     }
     return X;
 }
@@ -444,9 +527,12 @@ void fill_truth_mask(char *path, int num_boxes, float *truth, int classes, int w
 }
 
 
-void fill_truth_detection(char *path, int num_boxes, float *truth, int classes, int flip, float dx, float dy, float sx, float sy)
+/**
+ * The label file of a detection image: images/ or JPEGImages/ become
+ * labels/ and the extension .txt.
+ */
+void detection_label_path(char *path, char *labelpath)
 {
-    char labelpath[4096];
     find_replace(path, "images", "labels", labelpath);
     find_replace(labelpath, "JPEGImages", "labels", labelpath);
 
@@ -455,8 +541,12 @@ void fill_truth_detection(char *path, int num_boxes, float *truth, int classes,
     find_replace(labelpath, ".png", ".txt", labelpath);
     find_replace(labelpath, ".JPG", ".txt", labelpath);
     find_replace(labelpath, ".JPEG", ".txt", labelpath);
-    int count = 0;
-    box_label *boxes = read_boxes(labelpath, &count);
+}
+
+/* Writes up to num_boxes of boxes, shuffled and moved like the image, as
+   truth. The boxes are modified. */
+static void fill_truth_boxes(box_label *boxes, int count, int num_boxes, float *truth, int flip, float dx, float dy, float sx, float sy)
+{
     randomize_boxes(boxes, count);
     correct_boxes(boxes, count, dx, dy, sx, sy, flip);
     if(count > num_boxes) count = num_boxes;
@@ -483,6 +573,15 @@ void fill_truth_detection(char *path, int num_boxes, float *truth, int classes,
         truth[(i-sub)*5+3] = h;
         truth[(i-sub)*5+4] = id;
     }
+}
+
+void fill_truth_detection(char *path, int num_boxes, float *truth, int classes, int flip, float dx, float dy, float sx, float sy)
+{
+    char labelpath[4096];
+    detection_label_path(path, labelpath);
+    int count = 0;
+    box_label *boxes = read_boxes(labelpath, &count);
+    fill_truth_boxes(boxes, count, num_boxes, truth, flip, dx, dy, sx, sy);
     free(boxes);
 }
 
@@ -610,7 +709,7 @@ static char* get_label_path(char *image_path, char *result)
 
 matrix load_regression_labels_paths(char **paths, int n, int k)
 {
-    matrix y = make_matrix(n, k);
+    matrix y = make_batch_matrix(n, k, batch_y);
     
     for(int i = 0; i < n; ++i){
         char labelpath[4096];
@@ -627,7 +726,7 @@ matrix load_regression_labels_paths(char **paths, int n, int k)
 
 matrix load_labels_paths(char **paths, int n, char **labels, int k, tree *hierarchy)
 {
-    matrix y = make_matrix(n, k);
+    matrix y = make_batch_matrix(n, k, batch_y);
     int i;
     for(i = 0; i < n && labels; ++i){
         fill_truth(paths[i], labels, k, y.vals[i]);
@@ -640,7 +739,7 @@ matrix load_labels_paths(char **paths, int n, char **labels, int k, tree *hierar
 
 matrix load_tags_paths(char **paths, int n, int k)
 {
-    matrix y = make_matrix(n, k);
+    matrix y = make_batch_matrix(n, k, batch_y);
     int i;
     //int count = 0;
     for(i = 0; i < n; ++i){
@@ -759,21 +858,21 @@ data load_data_seg(int n, char **paths, int m, int w, int h, int classes, int mi
     d.y.vals = safe_calloc(d.X.rows, sizeof(float*));
 
     for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
+        image orig = load_source_image(random_paths[i], 0, 0);
         augment_args a = random_augment_args(orig, angle, aspect, min, max, w, h);
         image sized = rotate_crop_image(orig, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
 
         int flip = rand()%2;
         if(flip) flip_image(sized);
         random_distort_image(sized, hue, saturation, exposure);
-        d.X.vals[i] = sized.data;
+        d.X.vals[i] = keep_row(batch_X, i, sized);
 
         image mask = get_segmentation_image(random_paths[i], orig.w, orig.h, classes);
         //image mask = make_image(orig.w, orig.h, classes+1);
         image sized_m = rotate_crop_image(mask, a.rad, a.scale/div, a.w/div, a.h/div, a.dx/div, a.dy/div, a.aspect);
 
         if(flip) flip_image(sized_m);
-        d.y.vals[i] = sized_m.data;
+        d.y.vals[i] = keep_row(batch_y, i, sized_m);
 
         free_image(orig);
         free_image(mask);
@@ -801,17 +900,17 @@ data load_data_iseg(int n, char **paths, int m, int w, int h, int classes, int b
     d.X.vals = safe_calloc(d.X.rows, sizeof(float*));
     d.X.cols = h*w*3;
 
-    d.y = make_matrix(n, (((w/div)*(h/div))+1)*boxes);
+    d.y = make_batch_matrix(n, (((w/div)*(h/div))+1)*boxes, batch_y);
 
     for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
+        image orig = load_source_image(random_paths[i], 0, 0);
         augment_args a = random_augment_args(orig, angle, aspect, min, max, w, h);
         image sized = rotate_crop_image(orig, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
 
         int flip = rand()%2;
         if(flip) flip_image(sized);
         random_distort_image(sized, hue, saturation, exposure);
-        d.X.vals[i] = sized.data;
+        d.X.vals[i] = keep_row(batch_X, i, sized);
         //show_image(sized, "image");
 
         fill_truth_iseg(random_paths[i], boxes, d.y.vals[i], classes, orig.w, orig.h, a, flip, w/div, h/div);
@@ -841,17 +940,17 @@ data load_data_mask(int n, char **paths, int m, int w, int h, int classes, int b
     d.X.vals = safe_calloc(d.X.rows, sizeof(float*));
     d.X.cols = h*w*3;
 
-    d.y = make_matrix(n, (coords+1)*boxes);
+    d.y = make_batch_matrix(n, (coords+1)*boxes, batch_y);
 
     for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
+        image orig = load_source_image(random_paths[i], 0, 0);
         augment_args a = random_augment_args(orig, angle, aspect, min, max, w, h);
         image sized = rotate_crop_image(orig, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
 
         int flip = rand()%2;
         if(flip) flip_image(sized);
         random_distort_image(sized, hue, saturation, exposure);
-        d.X.vals[i] = sized.data;
+        d.X.vals[i] = keep_row(batch_X, i, sized);
         //show_image(sized, "image");
 
         fill_truth_mask(random_paths[i], boxes, d.y.vals[i], classes, orig.w, orig.h, a, flip, 14, 14);
@@ -883,9 +982,9 @@ data load_data_region(int n, char **paths, int m, int w, int h, int size, int cl
 
 
     int k = size*size*(5+classes);
-    d.y = make_matrix(n, k);
+    d.y = make_batch_matrix(n, k, batch_y);
     for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
+        image orig = load_source_image(random_paths[i], 0, 0);
 
         int oh = orig.h;
         int ow = orig.w;
@@ -913,7 +1012,7 @@ data load_data_region(int n, char **paths, int m, int w, int h, int size, int cl
         image sized = resize_image(cropped, w, h);
         if(flip) flip_image(sized);
         random_distort_image(sized, hue, saturation, exposure);
-        d.X.vals[i] = sized.data;
+        d.X.vals[i] = keep_row(batch_X, i, sized);
 
         fill_truth_region(random_paths[i], d.y.vals[i], classes, size, flip, dx, dy, 1./sx, 1./sy);
 
@@ -926,8 +1025,8 @@ data load_data_region(int n, char **paths, int m, int w, int h, int size, int cl
 
 static void load_compare_images(char **paths, int i, float *data, int w, int h)
 {
-    image im1 = load_image_color(paths[i*2], w, h);
-    image im2 = load_image_color(paths[i*2+1], w, h);
+    image im1 = load_source_image(paths[i*2], w, h);
+    image im2 = load_source_image(paths[i*2+1], w, h);
     
     memcpy(data, im1.data, h*w*3*sizeof(float));
     memcpy(data + h*w*3, im2.data, h*w*3*sizeof(float));
@@ -1009,7 +1108,7 @@ data load_data_swag(char **paths, int n, int classes, float jitter)
     int index = rand()%n;
     char *random_path = paths[index];
 
-    image orig = load_image_color(random_path, 0, 0);
+    image orig = load_source_image(random_path, 0, 0);
     int h = orig.h;
     int w = orig.w;
 
@@ -1059,7 +1158,7 @@ data load_data_swag(char **paths, int n, int classes, float jitter)
 
 data load_data_detection(int n, char **paths, int m, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure)
 {
-    char **random_paths = get_random_paths(paths, n, m);
+    char **random_paths = load_records ? 0 : get_random_paths(paths, n, m);
     int i;
     data d = {0};
     d.shallow = 0;
@@ -1068,11 +1167,18 @@ data load_data_detection(int n, char **paths, int m, int w, int h, int boxes, in
     d.X.vals = safe_calloc(d.X.rows, sizeof(float*));
     d.X.cols = h*w*3;
 
-    d.y = make_matrix(n, 5*boxes);
+    d.y = make_batch_matrix(n, 5*boxes, batch_y);
     for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
-        image sized = make_image(w, h, orig.c);
-        fill_image(sized, .5);
+        int cached;
+        data_record record = {0};
+        byte_image orig;
+        if(load_records){
+            next_record(load_records, &record);
+            orig = load_record_bytes(record, &cached);
+        } else {
+            orig = load_source_bytes(random_paths[i], &cached);
+        }
+        image sized = make_row_image(i, w, h, orig.c);
 
         float dw = jitter * orig.w;
         float dh = jitter * orig.h;
@@ -1094,18 +1200,24 @@ data load_data_detection(int n, char **paths, int m, int w, int h, int boxes, in
         float dx = rand_uniform(0, w - nw);
         float dy = rand_uniform(0, h - nh);
 
-        place_image(orig, nw, nh, dx, dy, sized);
-
-        random_distort_image(sized, hue, saturation, exposure);
-
+        float dhue = rand_uniform(-hue, hue);
+        float dsat = rand_scale(saturation);
+        float dexp = rand_scale(exposure);
         int flip = rand()%2;
-        if(flip) flip_image(sized);
+
+        /* placed, distorted and flipped in one pass */
+        place_distort_image(orig, nw, nh, dx, dy, flip, dhue, dsat, dexp, sized);
         d.X.vals[i] = sized.data;
 
 
-        fill_truth_detection(random_paths[i], boxes, d.y.vals[i], classes, flip, -dx/w, -dy/h, nw/w, nh/h);
+        if(load_records){
+            fill_truth_boxes(record.boxes, record.n, boxes, d.y.vals[i], flip, -dx/w, -dy/h, nw/w, nh/h);
+            free_record(record);
+        } else {
+            fill_truth_detection(random_paths[i], boxes, d.y.vals[i], classes, flip, -dx/w, -dy/h, nw/w, nh/h);
+        }
 
-        free_image(orig);
+        if(!cached) free_byte_image(orig);
     }
     free(random_paths);
     return d;
@@ -1127,6 +1239,17 @@ static void normalize_load_args(load_args *a)
  */
 static void load_data_by_type(load_args *a)
 {
+    if(a->X){
+        if(!a->y) error("A batch buffer needs both X and y");
+        if(a->type == SWAG_DATA || a->type == COMPARE_DATA || a->type == IMAGE_DATA || a->type == LETTERBOX_DATA){
+            error("This data type can't be loaded into a batch buffer");
+        }
+    }
+    if(a->records && a->type != DETECTION_DATA) error("Only detection data can be loaded from records");
+    batch_X = a->X;
+    batch_y = a->y;
+    load_cache = a->cache;
+    load_records = a->records;
     switch(a->type) {
         case OLD_CLASSIFICATION_DATA:
             *a->d = load_data_old(a->paths, a->n, a->m, a->labels, a->classes, a->w, a->h);
@@ -1190,6 +1313,10 @@ static void load_data_by_type(load_args *a)
             fprintf(stderr, "Unknown data type: %d\n", a->type);
             break;
     }
+    batch_X = batch_y = 0;
+    load_cache = 0;
+    load_records = 0;
+    if(a->X) a->d->shallow = 1;
 }
 
 void *load_thread(void *ptr)
@@ -1313,13 +1440,13 @@ data load_data_super(char **paths, int n, int m, int w, int h, int scale)
     d.y.cols = w*scale * h*scale * 3;
 
     for(i = 0; i < n; ++i){
-        image im = load_image_color(paths[i], 0, 0);
+        image im = load_source_image(paths[i], 0, 0);
         image crop = random_crop_image(im, w*scale, h*scale);
         int flip = rand()%2;
         if (flip) flip_image(crop);
         image resize = resize_image(crop, w, h);
-        d.X.vals[i] = resize.data;
-        d.y.vals[i] = crop.data;
+        d.X.vals[i] = keep_row(batch_X, i, resize);
+        d.y.vals[i] = keep_row(batch_y, i, crop);
         free_image(im);
     }
 
@@ -1461,14 +1588,27 @@ data concat_data(data d1, data d2)
     return d;
 }
 
+/* Rows of all n, last one first like folding concat_data, in one pass */
 data concat_datas(data *d, int n)
 {
-    int i;
+    int i, j, rows = 0, count = 0;
     data out = {0};
-    for(i = 0; i < n; ++i){
-        data new = concat_data(d[i], out);
-        free_data(out);
-        out = new;
+    out.shallow = 1;
+    for(i = 0; i < n; ++i) rows += d[i].X.rows;
+    out.X.rows = out.y.rows = rows;
+    out.X.vals = safe_calloc(rows, sizeof(float *));
+    out.y.vals = safe_calloc(rows, sizeof(float *));
+    if(n){
+        out.X.cols = d[n-1].X.cols;
+        out.y.cols = d[n-1].y.cols;
+        out.w = d[n-1].w;
+        out.h = d[n-1].h;
+    }
+    for(i = n-1; i >= 0; --i){
+        for(j = 0; j < d[i].X.rows; ++j, ++count){
+            out.X.vals[count] = d[i].X.vals[j];
+            out.y.vals[count] = d[i].y.vals[j];
+        }
     }
     return out;
 }
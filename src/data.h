@@ -46,5 +46,6 @@ void randomize_data(data d);
 data *split_data(data d, int part, int total);
 data concat_datas(data *d, int n);
 void fill_truth(char *path, char **labels, int k, float *truth);
+void detection_label_path(char *path, char *labelpath);
 
 #endif
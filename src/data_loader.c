@@ -0,0 +1,299 @@
+#include "darknet.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * Long-lived loader behind get_batch.
+ *
+ * A fixed set of workers loads samples one at a time, each straight into
+ * its row of a preallocated contiguous batch, so there is no concat. Row
+ * sizes aren't known before the first sample of a shape is loaded: until
+ * then samples are loaded on their own and copied in.
+ *
+ * Batches live in a ring of prefetch + 1 slots: up to prefetch of them
+ * being filled or ready, and one lent to the consumer until its next
+ * get_batch. Slots keep their cache line aligned buffers, so once the
+ * batch shape settles nothing is allocated. Every batch is numbered; slot
+ * seq % size holds batch seq, and batches are started, handed out and
+ * released in that order.
+ *
+ * Samples of one batch are claimed in order by whichever worker is free,
+ * so several batches can be in flight at once. reset_data_loader changes
+ * the arguments for the batches started after it; the ones started before
+ * are finished short and dropped.
+ */
+
+typedef struct {
+    load_args args;
+    int n;
+    int claimed, done;
+    int sized;
+    unsigned generation;
+    float *X, *y;
+    float **xrows, **yrows;
+    size_t x_capacity, y_capacity;
+    int rows_capacity;
+    int xcols, ycols;
+    int w, h;
+} loader_slot;
+
+struct data_loader {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t ready;
+    load_args args;
+    unsigned generation;
+    int size;
+    loader_slot *slots;
+    long started, consumed, released;
+    int lent;
+    int stop;
+    int threads;
+    pthread_t *workers;
+};
+
+static loader_slot *slot_of(data_loader *q, long seq)
+{
+    return q->slots + seq % q->size;
+}
+
+/* Next sample to load, starting a batch if the one being filled is fully
+   claimed and a slot is free. Called with the lock held. */
+static loader_slot *claim_sample(data_loader *q, int *index)
+{
+    if(q->started > q->consumed){
+        loader_slot *s = slot_of(q, q->started - 1);
+        if(s->claimed < s->n){
+            *index = s->claimed++;
+            return s;
+        }
+    }
+    if(q->started - q->released >= q->size) return 0;
+    loader_slot *s = slot_of(q, q->started++);
+    /* same arguments, same shape */
+    if(s->generation != q->generation || s->n != q->args.n) s->sized = 0;
+    s->args = q->args;
+    s->n = q->args.n;
+    s->claimed = 1;
+    s->done = 0;
+    s->generation = q->generation;
+    *index = 0;
+    return s;
+}
+
+static float *aligned_floats(float *old, size_t n)
+{
+    void *p = 0;
+    free(old);
+    if(posix_memalign(&p, 64, n*sizeof(float))) error("Couldn't allocate a batch");
+    return p;
+}
+
+/* Sizes the slot for the first sample of its shape */
+static void size_slot(loader_slot *s, data d)
+{
+    int i;
+    size_t xsize = (size_t)s->n*d.X.cols;
+    size_t ysize = (size_t)s->n*d.y.cols;
+    if(xsize > s->x_capacity){
+        s->X = aligned_floats(s->X, xsize);
+        s->x_capacity = xsize;
+    }
+    if(ysize > s->y_capacity){
+        s->y = aligned_floats(s->y, ysize);
+        s->y_capacity = ysize;
+    }
+    if(s->n > s->rows_capacity){
+        s->xrows = safe_realloc(s->xrows, s->n*sizeof(float *));
+        s->yrows = safe_realloc(s->yrows, s->n*sizeof(float *));
+        s->rows_capacity = s->n;
+    }
+    s->xcols = d.X.cols;
+    s->ycols = d.y.cols;
+    for(i = 0; i < s->n; ++i){
+        s->xrows[i] = s->X + (size_t)i*s->xcols;
+        s->yrows[i] = s->y + (size_t)i*s->ycols;
+    }
+    s->w = d.w;
+    s->h = d.h;
+    s->sized = 1;
+}
+
+static void *loader_worker(void *ptr)
+{
+    data_loader *q = ptr;
+    pthread_mutex_lock(&q->lock);
+    while(1){
+        int i;
+        loader_slot *s;
+        while(!q->stop && !(s = claim_sample(q, &i))) pthread_cond_wait(&q->work, &q->lock);
+        if(q->stop) break;
+        load_args args = s->args;
+        int direct = s->sized && s->ycols;
+        if(direct){
+            args.X = s->xrows[i];
+            args.y = s->yrows[i];
+        }
+        pthread_mutex_unlock(&q->lock);
+
+        data d = {0};
+        args.n = 1;
+        args.d = &d;
+        if(!args.m) args.paths += i;
+        load_data_blocking(args);
+        if(d.X.rows != 1) error("The data loader loads one sample at a time, this type loads more");
+
+        if(!direct){
+            pthread_mutex_lock(&q->lock);
+            if(!s->sized) size_slot(s, d);
+            pthread_mutex_unlock(&q->lock);
+        }
+        if(d.X.cols != s->xcols || d.y.cols != s->ycols) error("Samples of one batch have different sizes");
+        if(!direct){
+            memcpy(s->xrows[i], d.X.vals[0], s->xcols*sizeof(float));
+            if(s->ycols) memcpy(s->yrows[i], d.y.vals[0], s->ycols*sizeof(float));
+        }
+        free_data(d);
+
+        pthread_mutex_lock(&q->lock);
+        if(++s->done == s->n) pthread_cond_broadcast(&q->ready);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+/**
+ * Starts a loader that keeps up to prefetch batches of args.n samples
+ * ready, loaded by args.threads workers.
+ */
+data_loader *make_data_loader(load_args args, int prefetch)
+{
+    int i;
+    data_loader *q = safe_calloc(1, sizeof(data_loader));
+    if(prefetch < 1) prefetch = 1;
+    if(args.n < 1) error("The data loader needs a batch size");
+    pthread_mutex_init(&q->lock, 0);
+    pthread_cond_init(&q->work, 0);
+    pthread_cond_init(&q->ready, 0);
+    q->args = args;
+    q->size = prefetch + 1;
+    q->slots = safe_calloc(q->size, sizeof(loader_slot));
+    q->threads = args.threads > 0 ? args.threads : 1;
+    q->workers = safe_calloc(q->threads, sizeof(pthread_t));
+    for(i = 0; i < q->threads; ++i){
+        if(pthread_create(q->workers + i, 0, loader_worker, q)) error("Thread creation failed");
+    }
+    return q;
+}
+
+/* Gives the lent batch's slot back. Called with the lock held. */
+static void release_lent(data_loader *q)
+{
+    if(!q->lent) return;
+    q->lent = 0;
+    ++q->released;
+    pthread_cond_broadcast(&q->work);
+}
+
+/* Hands out the next batch if it is done, dropping stale ones. Called with
+   the lock held. */
+static int take_batch(data_loader *q, data *d)
+{
+    while(q->consumed < q->started){
+        loader_slot *s = slot_of(q, q->consumed);
+        if(s->done < s->n) return 0;
+        if(s->generation != q->generation){
+            ++q->consumed;
+            ++q->released;
+            pthread_cond_broadcast(&q->work);
+            continue;
+        }
+        release_lent(q);
+        ++q->consumed;
+        q->lent = 1;
+        data b = {0};
+        b.shallow = 1;
+        b.w = s->w;
+        b.h = s->h;
+        b.X.rows = b.y.rows = s->n;
+        b.X.cols = s->xcols;
+        b.y.cols = s->ycols;
+        b.X.vals = s->xrows;
+        b.y.vals = s->yrows;
+        *d = b;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Next batch, waiting for it if it isn't loaded yet. The batch belongs to
+ * the loader and stays valid until the next get_batch, try_get_batch,
+ * reset_data_loader or free_data_loader; don't free it.
+ */
+data get_batch(data_loader *q)
+{
+    data d;
+    pthread_mutex_lock(&q->lock);
+    release_lent(q);
+    while(!take_batch(q, &d)) pthread_cond_wait(&q->ready, &q->lock);
+    pthread_mutex_unlock(&q->lock);
+    return d;
+}
+
+/**
+ * Like get_batch, but returns 0 at once if the next batch isn't ready.
+ * The batch from the previous call stays valid in that case.
+ */
+int try_get_batch(data_loader *q, data *d)
+{
+    pthread_mutex_lock(&q->lock);
+    int got = take_batch(q, d);
+    pthread_mutex_unlock(&q->lock);
+    return got;
+}
+
+/**
+ * Loads with new arguments from now on, for instance a new size. Batches
+ * already loaded or in flight are dropped and the lent one is released.
+ */
+void reset_data_loader(data_loader *q, load_args args)
+{
+    pthread_mutex_lock(&q->lock);
+    if(args.n < 1) error("The data loader needs a batch size");
+    release_lent(q);
+    if(q->started > q->consumed){
+        loader_slot *s = slot_of(q, q->started - 1);
+        s->n = s->claimed;
+    }
+    q->args = args;
+    ++q->generation;
+    pthread_cond_broadcast(&q->work);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void free_data_loader(data_loader *q)
+{
+    int i;
+    if(!q) return;
+    pthread_mutex_lock(&q->lock);
+    q->stop = 1;
+    pthread_cond_broadcast(&q->work);
+    pthread_mutex_unlock(&q->lock);
+    for(i = 0; i < q->threads; ++i) pthread_join(q->workers[i], 0);
+    for(i = 0; i < q->size; ++i){
+        loader_slot s = q->slots[i];
+        free(s.X);
+        free(s.y);
+        free(s.xrows);
+        free(s.yrows);
+    }
+    free(q->slots);
+    free(q->workers);
+    pthread_cond_destroy(&q->work);
+    pthread_cond_destroy(&q->ready);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+}
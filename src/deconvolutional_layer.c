@@ -1,4 +1,5 @@
 #include "deconvolutional_layer.h"
+#include "layer.h"
 #include "convolutional_layer.h"
 #include "batchnorm_layer.h"
 #include "utils.h"
@@ -42,6 +43,7 @@ layer make_deconvolutional_layer(int batch, int h, int w, int c, int n, int size
     l.w = w;
     l.c = c;
     l.n = n;
+    l.groups = 1;
     l.batch = batch;
     l.stride = stride;
     l.size = size;
@@ -190,11 +192,11 @@ void resize_deconvolutional_layer(layer *l, int h, int w)
     l->outputs = l->out_h * l->out_w * l->out_c;
     l->inputs = l->w * l->h * l->c;
 
-    l->output = safe_realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta  = safe_realloc(l->delta,  l->batch*l->outputs*sizeof(float));
+    l->output = resize_layer_buffer(l, l->output, l->batch*l->outputs*sizeof(float));
+    l->delta  = resize_layer_buffer(l, l->delta,  l->batch*l->outputs*sizeof(float));
     if(l->batch_normalize){
-        l->x = safe_realloc(l->x, l->batch*l->outputs*sizeof(float));
-        l->x_norm  = safe_realloc(l->x_norm, l->batch*l->outputs*sizeof(float));
+        l->x = resize_layer_buffer(l, l->x, l->batch*l->outputs*sizeof(float));
+        l->x_norm  = resize_layer_buffer(l, l->x_norm, l->batch*l->outputs*sizeof(float));
     }
 
 #ifdef GPU
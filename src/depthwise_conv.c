@@ -0,0 +1,252 @@
+#include "depthwise_conv.h"
+#include "activations.h"
+#include "im2col.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+/*
+ * Depthwise convolution, groups == channels.
+ *
+ * Every input channel is convolved with its own multiplier = filters/channels
+ * filters of size x size weights, which im2col+gemm runs as one gemm per
+ * channel with m = multiplier and k = size*size. Here each output plane is
+ * one pass over one input plane instead: rows are accumulated tap by tap over
+ * the columns that read inside the image (the same split im2col uses), and
+ * 3x3 pad 1 layers, the MobileNet case, sum all nine taps of an interior
+ * pixel at once. Planes are independent, so the pool runs them in parallel;
+ * the backward passes split by filter for the weight gradient and by input
+ * channel for the data gradient so no two threads write the same float.
+ */
+
+static inline __attribute__((always_inline))
+void depthwise_plane(const float *im, int height, int width, const int size, const int stride, int pad,
+        const float *weights, float *out)
+{
+    int out_h = (height + 2*pad - size)/stride + 1;
+    int out_w = (width + 2*pad - size)/stride + 1;
+    int oy, ky, kx, ox;
+    for(oy = 0; oy < out_h; ++oy){
+        float *o = out + oy*out_w;
+        for(ox = 0; ox < out_w; ++ox) o[ox] = 0;
+        for(ky = 0; ky < size; ++ky){
+            int iy = oy*stride + ky - pad;
+            if(iy < 0 || iy >= height) continue;
+            for(kx = 0; kx < size; ++kx){
+                int w0, w1;
+                im2col_valid_columns(width, out_w, kx, stride, pad, &w0, &w1);
+                const float *src = im + iy*width + kx - pad;
+                float w = weights[ky*size + kx];
+                for(ox = w0; ox < w1; ++ox) o[ox] += w*src[ox*stride];
+            }
+        }
+    }
+}
+
+static float depthwise_pixel3x3(const float *im, int height, int width, int iy0, int ix0, const float *w)
+{
+    float sum = 0;
+    int ky, kx;
+    for(ky = 0; ky < 3; ++ky){
+        int iy = iy0 + ky;
+        if(iy < 0 || iy >= height) continue;
+        for(kx = 0; kx < 3; ++kx){
+            int ix = ix0 + kx;
+            if(ix < 0 || ix >= width) continue;
+            sum += w[ky*3 + kx]*im[iy*width + ix];
+        }
+    }
+    return sum;
+}
+
+/* 3x3, pad 1. A row above or below the image is swapped for the middle row
+   with zero weights, so interior columns have no bounds checks at all. */
+static inline __attribute__((always_inline))
+void depthwise_plane3x3(const float *im, int height, int width, const int stride,
+        const float *weights, float *out)
+{
+    int out_h = (height - 1)/stride + 1;
+    int out_w = (width - 1)/stride + 1;
+    /* ox in [1, x_hi) never touches the horizontal padding */
+    int x_hi = (width >= 2) ? (width - 2)/stride + 1 : 0;
+    int oy, ox, k;
+    for(oy = 0; oy < out_h; ++oy){
+        int iy = oy*stride - 1;
+        const float *r1 = im + (iy + 1)*width;
+        const float *r0 = r1, *r2 = r1;
+        float w[9];
+        for(k = 0; k < 9; ++k) w[k] = weights[k];
+        if(iy >= 0) r0 = r1 - width;
+        else w[0] = w[1] = w[2] = 0;
+        if(iy + 2 < height) r2 = r1 + width;
+        else w[6] = w[7] = w[8] = 0;
+
+        float *o = out + oy*out_w;
+        o[0] = depthwise_pixel3x3(im, height, width, iy, -1, weights);
+        for(ox = 1; ox < x_hi; ++ox){
+            int x = ox*stride - 1;
+            o[ox] = w[0]*r0[x] + w[1]*r0[x + 1] + w[2]*r0[x + 2]
+                  + w[3]*r1[x] + w[4]*r1[x + 1] + w[5]*r1[x + 2]
+                  + w[6]*r2[x] + w[7]*r2[x + 1] + w[8]*r2[x + 2];
+        }
+        for(ox = (x_hi > 1 ? x_hi : 1); ox < out_w; ++ox){
+            o[ox] = depthwise_pixel3x3(im, height, width, iy, ox*stride - 1, weights);
+        }
+    }
+}
+
+typedef struct {
+    float *im;
+    int channels, height, width;
+    int size, stride, pad;
+    float *weights;
+    int multiplier;
+    float *scales, *biases;
+    ACTIVATION activation;
+    float *out;
+} depthwise_args;
+
+/* Output planes [begin, end) over the whole batch, plane p reads input
+   plane p/multiplier */
+SIMD_CLONES
+static void depthwise_forward_planes(void *ptr, int begin, int end)
+{
+    depthwise_args *a = ptr;
+    int filters = a->channels*a->multiplier;
+    int out_size = ((a->height + 2*a->pad - a->size)/a->stride + 1)*((a->width + 2*a->pad - a->size)/a->stride + 1);
+    int p;
+    for(p = begin; p < end; ++p){
+        int f = p%filters;
+        const float *im = a->im + (size_t)(p/a->multiplier)*a->height*a->width;
+        const float *w = a->weights + f*a->size*a->size;
+        float *out = a->out + (size_t)p*out_size;
+        if(a->size == 3 && a->pad == 1 && a->stride == 1){
+            depthwise_plane3x3(im, a->height, a->width, 1, w, out);
+        } else if(a->size == 3 && a->pad == 1 && a->stride == 2){
+            depthwise_plane3x3(im, a->height, a->width, 2, w, out);
+        } else if(a->stride == 1){
+            depthwise_plane(im, a->height, a->width, a->size, 1, a->pad, w, out);
+        } else {
+            depthwise_plane(im, a->height, a->width, a->size, a->stride, a->pad, w, out);
+        }
+        if(a->scales) scale_bias_activate_array(out, out_size, a->scales[f], a->biases[f], a->activation);
+    }
+}
+
+/**
+ * Depthwise convolution of a batch, filter f reading channel f/multiplier.
+ * @param scales If not 0, output plane f is then scaled by scales[f], shifted
+ *        by biases[f] and activated with a; otherwise it is the raw sum
+ */
+void depthwise_conv_cpu(float *im, int batch, int channels, int height, int width,
+        int size, int stride, int pad, float *weights, int multiplier,
+        float *scales, float *biases, ACTIVATION a, float *output)
+{
+    int out_size = ((height + 2*pad - size)/stride + 1)*((width + 2*pad - size)/stride + 1);
+    depthwise_args args = {im, channels, height, width, size, stride, pad, weights, multiplier, scales, biases, a, output};
+    parallel_for(batch*channels*multiplier, parallel_grain((size_t)out_size*size*size), depthwise_forward_planes, &args);
+}
+
+typedef struct {
+    float *im;
+    float *delta;
+    int batch, channels, height, width;
+    int size, stride, pad;
+    float *weights;
+    int multiplier;
+    float *out;
+} depthwise_backward_args;
+
+/* Weight gradients of filters [begin, end), summed over the batch */
+SIMD_CLONES
+static void depthwise_backward_weights_filters(void *ptr, int begin, int end)
+{
+    depthwise_backward_args *a = ptr;
+    int size = a->size, stride = a->stride, pad = a->pad;
+    int height = a->height, width = a->width;
+    int out_h = (height + 2*pad - size)/stride + 1;
+    int out_w = (width + 2*pad - size)/stride + 1;
+    int filters = a->channels*a->multiplier;
+    int f, i, ky, kx, oy, ox;
+    for(f = begin; f < end; ++f){
+        float *dw = a->out + f*size*size;
+        for(i = 0; i < a->batch; ++i){
+            const float *im = a->im + (size_t)(i*a->channels + f/a->multiplier)*height*width;
+            const float *delta = a->delta + (size_t)(i*filters + f)*out_h*out_w;
+            for(ky = 0; ky < size; ++ky){
+                for(kx = 0; kx < size; ++kx){
+                    int w0, w1;
+                    float sum = 0;
+                    im2col_valid_columns(width, out_w, kx, stride, pad, &w0, &w1);
+                    for(oy = 0; oy < out_h; ++oy){
+                        int iy = oy*stride + ky - pad;
+                        if(iy < 0 || iy >= height) continue;
+                        const float *src = im + iy*width + kx - pad;
+                        const float *d = delta + oy*out_w;
+                        if(stride == 1){
+                            for(ox = w0; ox < w1; ++ox) sum += d[ox]*src[ox];
+                        } else {
+                            for(ox = w0; ox < w1; ++ox) sum += d[ox]*src[ox*stride];
+                        }
+                    }
+                    dw[ky*size + kx] += sum;
+                }
+            }
+        }
+    }
+}
+
+void depthwise_conv_backward_weights(float *im, float *delta, int batch, int channels, int height, int width,
+        int size, int stride, int pad, int multiplier, float *weight_updates)
+{
+    int out_size = ((height + 2*pad - size)/stride + 1)*((width + 2*pad - size)/stride + 1);
+    depthwise_backward_args a = {im, delta, batch, channels, height, width, size, stride, pad, 0, multiplier, weight_updates};
+    parallel_for(channels*multiplier, parallel_grain((size_t)batch*out_size*size*size), depthwise_backward_weights_filters, &a);
+}
+
+/* Input gradients of planes [begin, end) over the batch, from the
+   multiplier filters reading each */
+SIMD_CLONES
+static void depthwise_backward_data_planes(void *ptr, int begin, int end)
+{
+    depthwise_backward_args *a = ptr;
+    int size = a->size, stride = a->stride, pad = a->pad;
+    int height = a->height, width = a->width;
+    int out_h = (height + 2*pad - size)/stride + 1;
+    int out_w = (width + 2*pad - size)/stride + 1;
+    int p, k, ky, kx, oy, ox;
+    for(p = begin; p < end; ++p){
+        float *imd = a->out + (size_t)p*height*width;
+        for(k = 0; k < a->multiplier; ++k){
+            int f = p%a->channels*a->multiplier + k;
+            const float *w = a->weights + f*size*size;
+            const float *delta = a->delta + (size_t)(p*a->multiplier + k)*out_h*out_w;
+            for(oy = 0; oy < out_h; ++oy){
+                const float *d = delta + oy*out_w;
+                for(ky = 0; ky < size; ++ky){
+                    int iy = oy*stride + ky - pad;
+                    if(iy < 0 || iy >= height) continue;
+                    for(kx = 0; kx < size; ++kx){
+                        int w0, w1;
+                        im2col_valid_columns(width, out_w, kx, stride, pad, &w0, &w1);
+                        float *dst = imd + iy*width + kx - pad;
+                        float wk = w[ky*size + kx];
+                        if(stride == 1){
+                            for(ox = w0; ox < w1; ++ox) dst[ox] += wk*d[ox];
+                        } else {
+                            for(ox = w0; ox < w1; ++ox) dst[ox*stride] += wk*d[ox];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Adds the input gradient to im_delta */
+void depthwise_conv_backward_data(float *delta, float *weights, int batch, int channels, int height, int width,
+        int size, int stride, int pad, int multiplier, float *im_delta)
+{
+    int out_size = ((height + 2*pad - size)/stride + 1)*((width + 2*pad - size)/stride + 1);
+    depthwise_backward_args a = {0, delta, batch, channels, height, width, size, stride, pad, weights, multiplier, im_delta};
+    parallel_for(batch*channels, parallel_grain((size_t)multiplier*out_size*size*size), depthwise_backward_data_planes, &a);
+}
@@ -0,0 +1,13 @@
+#ifndef DEPTHWISE_CONV_H
+#define DEPTHWISE_CONV_H
+#include "darknet.h"
+
+void depthwise_conv_cpu(float *im, int batch, int channels, int height, int width,
+        int size, int stride, int pad, float *weights, int multiplier,
+        float *scales, float *biases, ACTIVATION a, float *output);
+void depthwise_conv_backward_weights(float *im, float *delta, int batch, int channels, int height, int width,
+        int size, int stride, int pad, int multiplier, float *weight_updates);
+void depthwise_conv_backward_data(float *delta, float *weights, int batch, int channels, int height, int width,
+        int size, int stride, int pad, int multiplier, float *im_delta);
+
+#endif
@@ -0,0 +1,207 @@
+#include "direct_conv.h"
+#include "utils.h"
+#include "thread_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Direct 3x3 convolution, pad 1, stride 1 or 2.
+ *
+ * Reads the input image in place instead of expanding it with im2col. The
+ * filters are repacked in blocks of DIRECT_OCB as [channel][tap][filter], so
+ * every tap is one vector of filter weights; an output tile of DIRECT_OCB
+ * filters x DIRECT_XB pixels stays in registers while the kernel sweeps all
+ * input channels and taps. Columns that touch the padding use a one-pixel
+ * variant with bounds checks.
+ */
+
+#define DIRECT_OCB 8
+#define DIRECT_XB 12
+
+typedef float direct_vec __attribute__((vector_size(DIRECT_OCB*sizeof(float))));
+
+int direct_conv_supported(int size, int stride, int pad)
+{
+    return size == 3 && pad == 1 && (stride == 1 || stride == 2);
+}
+
+static inline __attribute__((always_inline))
+void direct_store(direct_vec *acc, int xb, float *out, int out_size, int ox)
+{
+    float res[DIRECT_XB][DIRECT_OCB];
+    int o, x;
+    memcpy(res, acc, xb*sizeof(direct_vec));
+    for(o = 0; o < DIRECT_OCB; ++o){
+        for(x = 0; x < xb; ++x) out[o*out_size + ox + x] = res[x][o];
+    }
+}
+
+/* xb output pixels starting at ox, none of which reads the horizontal padding */
+static inline __attribute__((always_inline))
+void direct_conv3x3_tile(float *im, int channels, int height, int width, const int stride,
+        int iy0, int ox, const int xb, float *packed, float *out, int out_size)
+{
+    direct_vec acc[DIRECT_XB];
+    int c, ky, kx, x;
+    for(x = 0; x < xb; ++x) acc[x] = (direct_vec){0};
+    for(c = 0; c < channels; ++c){
+        for(ky = 0; ky < 3; ++ky){
+            int iy = iy0 + ky;
+            if(iy < 0 || iy >= height) continue;
+            float *row = im + (c*height + iy)*width + ox*stride - 1;
+            float *wk = packed + (c*9 + ky*3)*DIRECT_OCB;
+            for(kx = 0; kx < 3; ++kx){
+                direct_vec w;
+                memcpy(&w, wk + kx*DIRECT_OCB, sizeof(w));
+                for(x = 0; x < xb; ++x){
+                    acc[x] += row[x*stride + kx]*w;
+                }
+            }
+        }
+    }
+    direct_store(acc, xb, out, out_size, ox);
+}
+
+/* one output pixel for the whole filter block, any column */
+static inline __attribute__((always_inline))
+void direct_conv3x3_edge(float *im, int channels, int height, int width, const int stride,
+        int iy0, int ox, float *packed, float *out, int out_size)
+{
+    direct_vec acc = {0};
+    int ix0 = ox*stride - 1;
+    int c, ky, kx;
+    for(c = 0; c < channels; ++c){
+        for(ky = 0; ky < 3; ++ky){
+            int iy = iy0 + ky;
+            if(iy < 0 || iy >= height) continue;
+            float *row = im + (c*height + iy)*width;
+            float *wk = packed + (c*9 + ky*3)*DIRECT_OCB;
+            for(kx = 0; kx < 3; ++kx){
+                int ix = ix0 + kx;
+                if(ix < 0 || ix >= width) continue;
+                direct_vec w;
+                memcpy(&w, wk + kx*DIRECT_OCB, sizeof(w));
+                acc += row[ix]*w;
+            }
+        }
+    }
+    direct_store(&acc, 1, out, out_size, ox);
+}
+
+static float direct_conv3x3_pixel(float *im, int channels, int height, int width,
+        int iy0, int ix0, float *weights)
+{
+    float sum = 0;
+    int c, ky, kx;
+    for(c = 0; c < channels; ++c){
+        for(ky = 0; ky < 3; ++ky){
+            int iy = iy0 + ky;
+            if(iy < 0 || iy >= height) continue;
+            for(kx = 0; kx < 3; ++kx){
+                int ix = ix0 + kx;
+                if(ix < 0 || ix >= width) continue;
+                sum += weights[(c*3 + ky)*3 + kx] * im[(c*height + iy)*width + ix];
+            }
+        }
+    }
+    return sum;
+}
+
+/* Floats direct_pack_filters writes */
+size_t direct_packed_size(int channels, int filters)
+{
+    return (size_t)filters/DIRECT_OCB*DIRECT_OCB*channels*9;
+}
+
+/**
+ * Repacks filters for direct_conv3x3_cpu. Filters past the last full block
+ * of DIRECT_OCB are read from weights as they are.
+ * @param packed direct_packed_size floats
+ */
+void direct_pack_filters(float *weights, int channels, int filters, float *packed)
+{
+    int full = filters/DIRECT_OCB*DIRECT_OCB;
+    int f;
+    for(f = 0; f < full; f += DIRECT_OCB){
+        float *w = weights + f*channels*9;
+        float *p = packed + f*channels*9;
+        int o, k;
+        for(o = 0; o < DIRECT_OCB; ++o){
+            for(k = 0; k < channels*9; ++k){
+                p[k*DIRECT_OCB + o] = w[o*channels*9 + k];
+            }
+        }
+    }
+}
+
+/* Output rows [oy0, oy1) for all filters */
+static inline __attribute__((always_inline))
+void direct_conv3x3_rows(float *im, int channels, int height, int width, const int stride,
+        float *weights, int filters, float *packed, float *output, int oy0, int oy1)
+{
+    int out_h = (height - 1)/stride + 1;
+    int out_w = (width - 1)/stride + 1;
+    int out_size = out_h*out_w;
+    /* ox in [1, x_hi) never touches the horizontal padding */
+    int x_hi = (width >= 2) ? (width - 2)/stride + 1 : 0;
+    int full = filters/DIRECT_OCB*DIRECT_OCB;
+    int oy;
+    for(oy = oy0; oy < oy1; ++oy){
+        int iy0 = oy*stride - 1;
+        int f, ox;
+        for(f = 0; f < full; f += DIRECT_OCB){
+            float *pf = packed + f*channels*9;
+            float *out = output + f*out_size + oy*out_w;
+            direct_conv3x3_edge(im, channels, height, width, stride, iy0, 0, pf, out, out_size);
+            for(ox = 1; ox + DIRECT_XB <= x_hi; ox += DIRECT_XB){
+                direct_conv3x3_tile(im, channels, height, width, stride, iy0, ox, DIRECT_XB, pf, out, out_size);
+            }
+            for(; ox + 4 <= x_hi; ox += 4){
+                direct_conv3x3_tile(im, channels, height, width, stride, iy0, ox, 4, pf, out, out_size);
+            }
+            for(; ox < out_w; ++ox){
+                direct_conv3x3_edge(im, channels, height, width, stride, iy0, ox, pf, out, out_size);
+            }
+        }
+        for(f = full; f < filters; ++f){
+            float *out = output + f*out_size + oy*out_w;
+            for(ox = 0; ox < out_w; ++ox){
+                out[ox] = direct_conv3x3_pixel(im, channels, height, width, iy0, ox*stride - 1, weights + f*channels*9);
+            }
+        }
+    }
+}
+
+typedef struct {
+    float *im;
+    int channels, height, width;
+    float *weights;
+    int filters;
+    float *packed;
+    float *output;
+} direct_conv_args;
+
+SIMD_CLONES
+static void direct_conv3x3_s1(void *ptr, int begin, int end)
+{
+    direct_conv_args *a = ptr;
+    direct_conv3x3_rows(a->im, a->channels, a->height, a->width, 1, a->weights, a->filters, a->packed, a->output, begin, end);
+}
+
+SIMD_CLONES
+static void direct_conv3x3_s2(void *ptr, int begin, int end)
+{
+    direct_conv_args *a = ptr;
+    direct_conv3x3_rows(a->im, a->channels, a->height, a->width, 2, a->weights, a->filters, a->packed, a->output, begin, end);
+}
+
+/**
+ * @param packed weights as direct_pack_filters packs them
+ */
+void direct_conv3x3_cpu(float *im, int channels, int height, int width,
+        int stride, float *weights, float *packed, int filters, float *output)
+{
+    direct_conv_args a = {im, channels, height, width, weights, filters, packed, output};
+    int out_h = (height - 1)/stride + 1;
+    parallel_for(out_h, 1, stride == 1 ? direct_conv3x3_s1 : direct_conv3x3_s2, &a);
+}
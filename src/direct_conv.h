@@ -0,0 +1,12 @@
+#ifndef DIRECT_CONV_H
+#define DIRECT_CONV_H
+#include <stddef.h>
+
+int direct_conv_supported(int size, int stride, int pad);
+
+size_t direct_packed_size(int channels, int filters);
+void direct_pack_filters(float *weights, int channels, int filters, float *packed);
+void direct_conv3x3_cpu(float *im, int channels, int height, int width,
+        int stride, float *weights, float *packed, int filters, float *output);
+
+#endif
@@ -1,4 +1,5 @@
 #include "dropout_layer.h"
+#include "layer.h"
 #include "utils.h"
 #include "cuda.h"
 #include <stdlib.h>
@@ -27,7 +28,7 @@ dropout_layer make_dropout_layer(int batch, int inputs, float probability)
 
 void resize_dropout_layer(dropout_layer *l, int inputs)
 {
-    l->rand = safe_realloc(l->rand, l->inputs*l->batch*sizeof(float));
+    l->rand = resize_layer_buffer(l, l->rand, l->inputs*l->batch*sizeof(float));
     #ifdef GPU
     cuda_free(l->rand_gpu);
 
@@ -1,9 +1,18 @@
 #include "gemm.h"
 #include "utils.h"
 #include "cuda.h"
+#include "activations.h"
+#include "thread_pool.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <pthread.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define GEMM_X86
+#include <immintrin.h>
+#endif
 
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
@@ -49,18 +58,67 @@ void time_random_matrix(int TA, int TB, int m, int k, int n)
     int ldb = (!TB)?n:k;
 
     float *c = random_matrix(m,n);
+    float *c_ref = safe_calloc(m*n, sizeof(float));
+    memcpy(c_ref, c, m*n*sizeof(float));
+
+    double flop = 2.*m*n*k;
+    int iter = 1 + (int)(2e9/flop);
+    if(iter > 50) iter = 50;
     int i;
-    clock_t start = clock(), end;
-    for(i = 0; i<10; ++i){
+
+    gemm_cpu_reference(TA,TB,m,n,k,1,a,lda,b,ldb,1,c_ref,n);
+    gemm_cpu(TA,TB,m,n,k,1,a,lda,b,ldb,1,c,n);
+    float err = 0;
+    for(i = 0; i < m*n; ++i){
+        float d = fabs(c[i] - c_ref[i]) / (1 + fabs(c_ref[i]));
+        if(d > err) err = d;
+    }
+
+    double start = what_time_is_it_now();
+    for(i = 0; i < iter; ++i){
+        gemm_cpu_reference(TA,TB,m,n,k,1,a,lda,b,ldb,1,c_ref,n);
+    }
+    double naive = (what_time_is_it_now() - start)/iter;
+
+    start = what_time_is_it_now();
+    for(i = 0; i < iter; ++i){
         gemm_cpu(TA,TB,m,n,k,1,a,lda,b,ldb,1,c,n);
     }
-    end = clock();
-    printf("Matrix Multiplication %dx%d * %dx%d, TA=%d, TB=%d: %lf ms\n",m,k,k,n, TA, TB, (float)(end-start)/CLOCKS_PER_SEC);
+    double blocked = (what_time_is_it_now() - start)/iter;
+
+    printf("Matrix Multiplication %dx%d * %dx%d, TA=%d, TB=%d: naive %8.3f ms %7.2f GFLOPS | %s %8.3f ms %7.2f GFLOPS | %5.1fx, rel err %g\n",
+            m,k,k,n, TA, TB,
+            naive*1000, flop/naive/1e9,
+            gemm_cpu_kernel_name(), blocked*1000, flop/blocked/1e9,
+            naive/blocked, err);
     free(a);
     free(b);
     free(c);
+    free(c_ref);
 }
 
+void time_gemm_cpu(int m, int k, int n)
+{
+    if(m > 0 && k > 0 && n > 0){
+        time_random_matrix(0,0,m,k,n);
+        time_random_matrix(1,0,m,k,n);
+        time_random_matrix(0,1,m,k,n);
+        time_random_matrix(1,1,m,k,n);
+        return;
+    }
+    /* forward (NN), weight gradient (NT) and input gradient (TN) shapes
+       from darknet53 / yolov3 at 416x416 */
+    time_random_matrix(0,0,32,27,43264);
+    time_random_matrix(0,0,64,288,10816);
+    time_random_matrix(0,0,128,576,2704);
+    time_random_matrix(0,0,256,1152,676);
+    time_random_matrix(0,0,512,2304,169);
+    time_random_matrix(0,0,1024,4608,169);
+    time_random_matrix(0,0,255,1024,169);
+    time_random_matrix(0,1,256,1152,676);
+    time_random_matrix(1,0,1152,676,256);
+    time_random_matrix(1,1,512,512,512);
+}
 
 void gemm(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A, int lda, 
@@ -71,84 +129,123 @@ void gemm(int TA, int TB, int M, int N, int K, float ALPHA,
     gemm_cpu( TA,  TB,  M, N, K, ALPHA,A,lda, B, ldb,BETA,C,ldc);
 }
 
-void gemm_nn(int M, int N, int K, float ALPHA, 
-        float *A, int lda, 
-        float *B, int ldb,
-        float *C, int ldc)
+typedef struct {
+    int TA, TB;
+    int M, N, K;
+    float ALPHA;
+    float *A; int lda;
+    float *B; int ldb;
+    float *C; int ldc;
+} gemm_args;
+
+/* Rows of C per chunk, about 64k multiply-adds each */
+static int gemm_row_grain(int N, int K)
+{
+    long work = (long)N*K;
+    return work >= 65536 ? 1 : (int)(65536/(work + 1)) + 1;
+}
+
+static void gemm_nn_rows(void *ptr, int begin, int end)
 {
+    gemm_args g = *(gemm_args *)ptr;
     int i,j,k;
-    #pragma omp parallel for
-    for(i = 0; i < M; ++i){
-        for(k = 0; k < K; ++k){
-            register float A_PART = ALPHA*A[i*lda+k];
-            for(j = 0; j < N; ++j){
-                C[i*ldc+j] += A_PART*B[k*ldb+j];
+    for(i = begin; i < end; ++i){
+        for(k = 0; k < g.K; ++k){
+            register float A_PART = g.ALPHA*g.A[i*g.lda+k];
+            for(j = 0; j < g.N; ++j){
+                g.C[i*g.ldc+j] += A_PART*g.B[k*g.ldb+j];
             }
         }
     }
 }
 
-void gemm_nt(int M, int N, int K, float ALPHA, 
-        float *A, int lda, 
-        float *B, int ldb,
-        float *C, int ldc)
+static void gemm_nt_rows(void *ptr, int begin, int end)
 {
+    gemm_args g = *(gemm_args *)ptr;
     int i,j,k;
-    #pragma omp parallel for
-    for(i = 0; i < M; ++i){
-        for(j = 0; j < N; ++j){
+    for(i = begin; i < end; ++i){
+        for(j = 0; j < g.N; ++j){
             register float sum = 0;
-            for(k = 0; k < K; ++k){
-                sum += ALPHA*A[i*lda+k]*B[j*ldb + k];
+            for(k = 0; k < g.K; ++k){
+                sum += g.ALPHA*g.A[i*g.lda+k]*g.B[j*g.ldb + k];
             }
-            C[i*ldc+j] += sum;
+            g.C[i*g.ldc+j] += sum;
         }
     }
 }
 
-void gemm_tn(int M, int N, int K, float ALPHA, 
-        float *A, int lda, 
-        float *B, int ldb,
-        float *C, int ldc)
+static void gemm_tn_rows(void *ptr, int begin, int end)
 {
+    gemm_args g = *(gemm_args *)ptr;
     int i,j,k;
-    #pragma omp parallel for
-    for(i = 0; i < M; ++i){
-        for(k = 0; k < K; ++k){
-            register float A_PART = ALPHA*A[k*lda+i];
-            for(j = 0; j < N; ++j){
-                C[i*ldc+j] += A_PART*B[k*ldb+j];
+    for(i = begin; i < end; ++i){
+        for(k = 0; k < g.K; ++k){
+            register float A_PART = g.ALPHA*g.A[k*g.lda+i];
+            for(j = 0; j < g.N; ++j){
+                g.C[i*g.ldc+j] += A_PART*g.B[k*g.ldb+j];
             }
         }
     }
 }
 
-void gemm_tt(int M, int N, int K, float ALPHA, 
-        float *A, int lda, 
-        float *B, int ldb,
-        float *C, int ldc)
+static void gemm_tt_rows(void *ptr, int begin, int end)
 {
+    gemm_args g = *(gemm_args *)ptr;
     int i,j,k;
-    #pragma omp parallel for
-    for(i = 0; i < M; ++i){
-        for(j = 0; j < N; ++j){
+    for(i = begin; i < end; ++i){
+        for(j = 0; j < g.N; ++j){
             register float sum = 0;
-            for(k = 0; k < K; ++k){
-                sum += ALPHA*A[i+k*lda]*B[k+j*ldb];
+            for(k = 0; k < g.K; ++k){
+                sum += g.ALPHA*g.A[i+k*g.lda]*g.B[k+j*g.ldb];
             }
-            C[i*ldc+j] += sum;
+            g.C[i*g.ldc+j] += sum;
         }
     }
 }
 
+void gemm_nn(int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float *C, int ldc)
+{
+    gemm_args g = {0, 0, M, N, K, ALPHA, A, lda, B, ldb, C, ldc};
+    parallel_for(M, gemm_row_grain(N, K), gemm_nn_rows, &g);
+}
 
-void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
+void gemm_nt(int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float *C, int ldc)
+{
+    gemm_args g = {0, 1, M, N, K, ALPHA, A, lda, B, ldb, C, ldc};
+    parallel_for(M, gemm_row_grain(N, K), gemm_nt_rows, &g);
+}
+
+void gemm_tn(int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float *C, int ldc)
+{
+    gemm_args g = {1, 0, M, N, K, ALPHA, A, lda, B, ldb, C, ldc};
+    parallel_for(M, gemm_row_grain(N, K), gemm_tn_rows, &g);
+}
+
+void gemm_tt(int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float *C, int ldc)
+{
+    gemm_args g = {1, 1, M, N, K, ALPHA, A, lda, B, ldb, C, ldc};
+    parallel_for(M, gemm_row_grain(N, K), gemm_tt_rows, &g);
+}
+
+
+void gemm_cpu_reference(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A, int lda, 
         float *B, int ldb,
         float BETA,
         float *C, int ldc)
 {
-    //printf("cpu: %d %d %d %d %d %f %d %d %f %d\n",TA, TB, M, N, K, ALPHA, lda, ldb, BETA, ldc);
     int i, j;
     for(i = 0; i < M; ++i){
         for(j = 0; j < N; ++j){
@@ -165,6 +262,425 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         gemm_tt(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
 }
 
+/*
+ * Blocked GEMM engine.
+ *
+ * C += ALPHA * op(A) * op(B) is computed Goto-style: B is packed into
+ * KC x NC panels of NR-wide column strips (sized for L2/L3), A into
+ * MC x KC blocks of MR-tall row strips (sized for L2), and an MR x NR
+ * register-tiled micro-kernel walks the packed strips (L1). Transposes are
+ * absorbed by the packing routines, so one driver serves all four variants.
+ * Each KC x NC panel of B and the matching KC-wide panel of A are packed
+ * once, in parallel, and the pool then splits the MC blocks and NR strips
+ * of C over the shared panels, as in BLIS. KC blocks are summed in the same
+ * order whatever the thread count.
+ * The micro-kernel is picked once at runtime from CPUID.
+ */
+
+#define GEMM_MAX_MR 8
+#define GEMM_MAX_NR 32
+
+typedef void (*gemm_kernel)(int kc, const float *a, const float *b, float *c, int ldc);
+
+/* Applied to each C tile after its last KC block, while it is still in
+   cache: C = act(scales[row]*C + biases[row]) + residual. The scale rides
+   along with ALPHA into the packed A. */
+typedef struct {
+    float *scales;
+    float *biases;
+    ACTIVATION a;
+    const float *residual;
+} gemm_epilogue;
+
+typedef struct {
+    const char *name;
+    int mr, nr;
+    int mc, kc, nc;
+    gemm_kernel kernel;
+} gemm_engine;
+
+#define GENERIC_MR 4
+#define GENERIC_NR 16
+
+static void gemm_kernel_generic(int kc, const float *a, const float *b, float *c, int ldc)
+{
+    float ab[GENERIC_MR*GENERIC_NR] = {0};
+    int p, i, j;
+    for(p = 0; p < kc; ++p){
+        for(i = 0; i < GENERIC_MR; ++i){
+            float a_part = a[i];
+            for(j = 0; j < GENERIC_NR; ++j){
+                ab[i*GENERIC_NR + j] += a_part*b[j];
+            }
+        }
+        a += GENERIC_MR;
+        b += GENERIC_NR;
+    }
+    for(i = 0; i < GENERIC_MR; ++i){
+        for(j = 0; j < GENERIC_NR; ++j){
+            c[i*ldc + j] += ab[i*GENERIC_NR + j];
+        }
+    }
+}
+
+#ifdef GEMM_X86
+
+__attribute__((target("avx2,fma")))
+static void gemm_kernel_avx2_6x16(int kc, const float *a, const float *b, float *c, int ldc)
+{
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    int p;
+    for(p = 0; p < kc; ++p){
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+        __m256 a0;
+        a0 = _mm256_broadcast_ss(a + 0);
+        c00 = _mm256_fmadd_ps(a0, b0, c00); c01 = _mm256_fmadd_ps(a0, b1, c01);
+        a0 = _mm256_broadcast_ss(a + 1);
+        c10 = _mm256_fmadd_ps(a0, b0, c10); c11 = _mm256_fmadd_ps(a0, b1, c11);
+        a0 = _mm256_broadcast_ss(a + 2);
+        c20 = _mm256_fmadd_ps(a0, b0, c20); c21 = _mm256_fmadd_ps(a0, b1, c21);
+        a0 = _mm256_broadcast_ss(a + 3);
+        c30 = _mm256_fmadd_ps(a0, b0, c30); c31 = _mm256_fmadd_ps(a0, b1, c31);
+        a0 = _mm256_broadcast_ss(a + 4);
+        c40 = _mm256_fmadd_ps(a0, b0, c40); c41 = _mm256_fmadd_ps(a0, b1, c41);
+        a0 = _mm256_broadcast_ss(a + 5);
+        c50 = _mm256_fmadd_ps(a0, b0, c50); c51 = _mm256_fmadd_ps(a0, b1, c51);
+        a += 6;
+        b += 16;
+    }
+#define GEMM_AVX2_STORE(row, lo, hi) \
+    _mm256_storeu_ps(c + row*ldc,     _mm256_add_ps(_mm256_loadu_ps(c + row*ldc),     lo)); \
+    _mm256_storeu_ps(c + row*ldc + 8, _mm256_add_ps(_mm256_loadu_ps(c + row*ldc + 8), hi));
+    GEMM_AVX2_STORE(0, c00, c01);
+    GEMM_AVX2_STORE(1, c10, c11);
+    GEMM_AVX2_STORE(2, c20, c21);
+    GEMM_AVX2_STORE(3, c30, c31);
+    GEMM_AVX2_STORE(4, c40, c41);
+    GEMM_AVX2_STORE(5, c50, c51);
+#undef GEMM_AVX2_STORE
+}
+
+__attribute__((target("avx512f")))
+static void gemm_kernel_avx512_8x32(int kc, const float *a, const float *b, float *c, int ldc)
+{
+    __m512 acc[8][2];
+    int i, p;
+    for(i = 0; i < 8; ++i){
+        acc[i][0] = _mm512_setzero_ps();
+        acc[i][1] = _mm512_setzero_ps();
+    }
+    for(p = 0; p < kc; ++p){
+        __m512 b0 = _mm512_load_ps(b);
+        __m512 b1 = _mm512_load_ps(b + 16);
+        for(i = 0; i < 8; ++i){
+            __m512 a0 = _mm512_set1_ps(a[i]);
+            acc[i][0] = _mm512_fmadd_ps(a0, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(a0, b1, acc[i][1]);
+        }
+        a += 8;
+        b += 32;
+    }
+    for(i = 0; i < 8; ++i){
+        _mm512_storeu_ps(c + i*ldc,      _mm512_add_ps(_mm512_loadu_ps(c + i*ldc),      acc[i][0]));
+        _mm512_storeu_ps(c + i*ldc + 16, _mm512_add_ps(_mm512_loadu_ps(c + i*ldc + 16), acc[i][1]));
+    }
+}
+
+#endif
+
+static const gemm_engine gemm_engine_generic = {"generic", GENERIC_MR, GENERIC_NR, 128, 256, 4096, gemm_kernel_generic};
+#ifdef GEMM_X86
+static const gemm_engine gemm_engine_avx2    = {"avx2",    6, 16, 144, 256, 4096, gemm_kernel_avx2_6x16};
+static const gemm_engine gemm_engine_avx512  = {"avx512",  8, 32, 128, 384, 4096, gemm_kernel_avx512_8x32};
+#endif
+
+static const gemm_engine *gemm_active_engine = &gemm_engine_generic;
+static pthread_once_t gemm_engine_once = PTHREAD_ONCE_INIT;
+
+static void select_gemm_engine(void)
+{
+#ifdef GEMM_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")){
+        gemm_active_engine = &gemm_engine_avx512;
+    } else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+        gemm_active_engine = &gemm_engine_avx2;
+    }
+#endif
+}
+
+static const gemm_engine *get_gemm_engine(void)
+{
+    pthread_once(&gemm_engine_once, select_gemm_engine);
+    return gemm_active_engine;
+}
+
+const char *gemm_cpu_kernel_name(void)
+{
+    return get_gemm_engine()->name;
+}
+
+/* Overrides the CPUID choice, e.g. to compare kernels. Returns 0 if the
+   named kernel is unknown or not supported by this CPU. */
+int gemm_cpu_select_kernel(const char *name)
+{
+    get_gemm_engine();
+    if(0 == strcmp(name, "generic")){
+        gemm_active_engine = &gemm_engine_generic;
+        return 1;
+    }
+#ifdef GEMM_X86
+    if(0 == strcmp(name, "avx2") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+        gemm_active_engine = &gemm_engine_avx2;
+        return 1;
+    }
+    if(0 == strcmp(name, "avx512") && __builtin_cpu_supports("avx512f")){
+        gemm_active_engine = &gemm_engine_avx512;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+/* Packing buffers are per calling thread so independent networks can run
+   gemm concurrently */
+static __thread thread_buffer gemm_pack_a;
+static __thread thread_buffer gemm_pack_b;
+
+/* Packs alpha*op(A)[ic:ic+mc, pc:pc+kc] into MR-row strips, k-major within
+   a strip, zero padding the last strip. Rows are further multiplied by
+   scales[row] if given. */
+static void pack_a(int TA, int mc, int kc, float ALPHA, float *scales, float *A, int lda, int mr, float *pack)
+{
+    int ir, i, p;
+    for(ir = 0; ir < mc; ir += mr){
+        int rows = (mc - ir < mr) ? mc - ir : mr;
+        for(p = 0; p < kc; ++p){
+            for(i = 0; i < rows; ++i){
+                int row = ir + i;
+                float s = scales ? ALPHA*scales[row] : ALPHA;
+                pack[i] = s*(TA ? A[p*lda + row] : A[row*lda + p]);
+            }
+            for(; i < mr; ++i) pack[i] = 0;
+            pack += mr;
+        }
+    }
+}
+
+/* Packs op(B)[pc:pc+kc, jc:jc+nc] into NR-column strips, k-major within a
+   strip, zero padding the last strip. */
+static void pack_b(int TB, int kc, int nc, float *B, int ldb, int nr, float *pack)
+{
+    int jr, j, p;
+    for(jr = 0; jr < nc; jr += nr){
+        int cols = (nc - jr < nr) ? nc - jr : nr;
+        for(p = 0; p < kc; ++p){
+            if(!TB){
+                memcpy(pack, B + p*ldb + jr, cols*sizeof(float));
+                j = cols;
+            } else {
+                for(j = 0; j < cols; ++j){
+                    pack[j] = B[(jr + j)*ldb + p];
+                }
+            }
+            for(; j < nr; ++j) pack[j] = 0;
+            pack += nr;
+        }
+    }
+}
+
+static void gemm_macro_kernel(const gemm_engine *e, int mc, int nc, int kc,
+        const float *pa, const float *pb, float *C, int ldc, float *biases, ACTIVATION act,
+        const float *residual)
+{
+    int mr = e->mr;
+    int nr = e->nr;
+    int n_strips = (nc + nr - 1)/nr;
+    int s;
+    for(s = 0; s < n_strips; ++s){
+        int jr = s*nr;
+        int cols = (nc - jr < nr) ? nc - jr : nr;
+        const float *b = pb + (size_t)jr*kc;
+        int ir;
+        for(ir = 0; ir < mc; ir += mr){
+            int rows = (mc - ir < mr) ? mc - ir : mr;
+            const float *a = pa + (size_t)ir*kc;
+            float *c = C + ir*ldc + jr;
+            if(rows == mr && cols == nr){
+                e->kernel(kc, a, b, c, ldc);
+            } else {
+                float tmp[GEMM_MAX_MR*GEMM_MAX_NR] = {0};
+                int i, j;
+                e->kernel(kc, a, b, tmp, nr);
+                for(i = 0; i < rows; ++i){
+                    for(j = 0; j < cols; ++j){
+                        c[i*ldc + j] += tmp[i*nr + j];
+                    }
+                }
+            }
+            if(biases){
+                int i, j;
+                for(i = 0; i < rows; ++i){
+                    scale_bias_activate_array(c + i*ldc, cols, 1, biases[ir + i], act);
+                }
+                if(residual){
+                    const float *r = residual + ir*ldc + jr;
+                    for(i = 0; i < rows; ++i){
+                        for(j = 0; j < cols; ++j) c[i*ldc + j] += r[i*ldc + j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* One KC x NC slice of the product: B[pc:pc+kc, jc:jc+nc] and all of
+   A[:, pc:pc+kc], packed once into the calling thread's buffers and shared
+   by the chunks that multiply them */
+typedef struct {
+    const gemm_engine *e;
+    gemm_args g;
+    const gemm_epilogue *ep;
+    int jc, nc, pc, kc;
+    int strips;
+    float *pa, *pb;
+} gemm_panel_args;
+
+/* Chunks are NR-column strips of the B panel */
+static void gemm_pack_b_strips(void *ptr, int begin, int end)
+{
+    gemm_panel_args *t = ptr;
+    gemm_args g = t->g;
+    int nr = t->e->nr;
+    int jr = begin*nr;
+    int cols = (end*nr < t->nc ? end*nr : t->nc) - jr;
+    int col = t->jc + jr;
+    float *b = g.TB ? g.B + col*g.ldb + t->pc : g.B + t->pc*g.ldb + col;
+    pack_b(g.TB, t->kc, cols, b, g.ldb, nr, t->pb + (size_t)jr*t->kc);
+}
+
+/* Chunks are MR-row strips of the A panel */
+static void gemm_pack_a_strips(void *ptr, int begin, int end)
+{
+    gemm_panel_args *t = ptr;
+    gemm_args g = t->g;
+    int mr = t->e->mr;
+    int ir = begin*mr;
+    int rows = (end*mr < g.M ? end*mr : g.M) - ir;
+    float *a = g.TA ? g.A + t->pc*g.lda + ir : g.A + ir*g.lda + t->pc;
+    float *scales = t->ep && t->ep->scales ? t->ep->scales + ir : 0;
+    pack_a(g.TA, rows, t->kc, g.ALPHA, scales, a, g.lda, mr, t->pa + (size_t)ir*t->kc);
+}
+
+/* Chunks are the NR-column strips of each MC row block, block major */
+static void gemm_panel_tiles(void *ptr, int begin, int end)
+{
+    gemm_panel_args *t = ptr;
+    const gemm_engine *e = t->e;
+    gemm_args g = t->g;
+    const gemm_epilogue *ep = t->ep;
+    int tile;
+    for(tile = begin; tile < end; ++tile){
+        int ic = tile / t->strips * e->mc;
+        int jr = tile % t->strips * e->nr;
+        int mc = (g.M - ic < e->mc) ? g.M - ic : e->mc;
+        int cols = (t->nc - jr < e->nr) ? t->nc - jr : e->nr;
+        int jc = t->jc + jr;
+        float *biases = ep && t->pc + t->kc >= g.K ? ep->biases + ic : 0;
+        const float *residual = biases && ep->residual ? ep->residual + ic*g.ldc + jc : 0;
+        gemm_macro_kernel(e, mc, cols, t->kc, t->pa + (size_t)ic*t->kc, t->pb + (size_t)jr*t->kc,
+                g.C + ic*g.ldc + jc, g.ldc, biases, ep ? ep->a : LINEAR, residual);
+    }
+}
+
+static void gemm_blocked(const gemm_engine *e, int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *B, int ldb,
+        float *C, int ldc, const gemm_epilogue *ep)
+{
+    int a_strips = (M + e->mr - 1)/e->mr;
+    gemm_panel_args t = {e, {TA, TB, M, N, K, ALPHA, A, lda, B, ldb, C, ldc}, ep};
+    int kc_max = K < e->kc ? K : e->kc;
+    t.pa = grow_thread_buffer(&gemm_pack_a, (size_t)a_strips*e->mr*kc_max*sizeof(float));
+    t.pb = grow_thread_buffer(&gemm_pack_b, (size_t)kc_max*e->nc*sizeof(float));
+    int row_blocks = (M + e->mc - 1)/e->mc;
+    for(t.jc = 0; t.jc < N; t.jc += e->nc){
+        t.nc = (N - t.jc < e->nc) ? N - t.jc : e->nc;
+        t.strips = (t.nc + e->nr - 1)/e->nr;
+        for(t.pc = 0; t.pc < K; t.pc += e->kc){
+            t.kc = (K - t.pc < e->kc) ? K - t.pc : e->kc;
+            parallel_for(t.strips, parallel_grain((size_t)t.kc*e->nr), gemm_pack_b_strips, &t);
+            parallel_for(a_strips, parallel_grain((size_t)t.kc*e->mr), gemm_pack_a_strips, &t);
+            parallel_for(row_blocks*t.strips, parallel_grain((size_t)e->mc*e->nr*t.kc), gemm_panel_tiles, &t);
+        }
+    }
+}
+
+void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc)
+{
+    //printf("cpu: %d %d %d %d %d %f %d %d %f %d\n",TA, TB, M, N, K, ALPHA, lda, ldb, BETA, ldc);
+    const gemm_engine *e = get_gemm_engine();
+    /* Packing costs a full pass over B; for vector-like products the plain
+       loops are already bandwidth bound and cheaper. */
+    if(M < e->mr/2 || N < 4 || K < 4){
+        gemm_cpu_reference(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, BETA, C, ldc);
+        return;
+    }
+    int i, j;
+    if(BETA != 1){
+        for(i = 0; i < M; ++i){
+            for(j = 0; j < N; ++j){
+                C[i*ldc + j] *= BETA;
+            }
+        }
+    }
+    gemm_blocked(e, TA, TB, M, N, K, ALPHA, A, lda, B, ldb, C, ldc, 0);
+}
+
+/**
+ * C = act(diag(scales)*op(A)*op(B) + biases) + residual, with the scale
+ * folded into the packed A and the bias, activation and residual applied
+ * tile by tile, so a convolution's output is written once instead of once
+ * per pass.
+ * @param scales Per-row scale of A, or 0 for none
+ * @param biases Per-row bias
+ * @param residual Added after the activation, laid out like C, or 0
+ */
+void gemm_cpu_fused(int TA, int TB, int M, int N, int K,
+        float *A, int lda,
+        float *B, int ldb,
+        float *C, int ldc,
+        float *scales, float *biases, ACTIVATION a, const float *residual)
+{
+    const gemm_engine *e = get_gemm_engine();
+    int i, j;
+    if(M < e->mr/2 || N < 4 || K < 4){
+        gemm_cpu_reference(TA, TB, M, N, K, 1, A, lda, B, ldb, 0, C, ldc);
+        for(i = 0; i < M; ++i){
+            scale_bias_activate_array(C + i*ldc, N, scales ? scales[i] : 1, biases[i], a);
+            if(residual){
+                for(j = 0; j < N; ++j) C[i*ldc + j] += residual[i*ldc + j];
+            }
+        }
+        return;
+    }
+    gemm_epilogue ep = {scales, biases, a, residual};
+    for(i = 0; i < M; ++i){
+        memset(C + i*ldc, 0, N*sizeof(float));
+    }
+    gemm_blocked(e, TA, TB, M, N, K, 1, A, lda, B, ldb, C, ldc, &ep);
+}
+
 #ifdef GPU
 
 #include <math.h>
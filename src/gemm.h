@@ -1,5 +1,6 @@
 #ifndef GEMM_H
 #define GEMM_H
+#include "darknet.h"
 
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
@@ -18,6 +19,24 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float BETA,
         float *C, int ldc);
 
+void gemm_cpu_reference(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc);
+
+void gemm_cpu_fused(int TA, int TB, int M, int N, int K,
+        float *A, int lda,
+        float *B, int ldb,
+        float *C, int ldc,
+        float *scales, float *biases, ACTIVATION a, const float *residual);
+
+const char *gemm_cpu_kernel_name(void);
+int gemm_cpu_select_kernel(const char *name);
+float *random_matrix(int rows, int cols);
+void time_random_matrix(int TA, int TB, int m, int k, int n);
+void time_gemm_cpu(int m, int k, int n);
+
 #ifdef GPU
 void gemm_gpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A_gpu, int lda, 
@@ -0,0 +1,227 @@
+#include "graph_optimizer.h"
+#include "memory_plan.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Rewrites of an inference network's layer graph, done once after it is
+ * built so the forward pass moves less data:
+ *
+ *  - a shortcut right after a convolution that nothing else reads is added
+ *    in the convolution's epilogue, and the shortcut does nothing;
+ *  - an upsample read only by a 1x1 convolution is skipped: the convolution
+ *    runs on the small input and upsamples its own, usually thinner, output;
+ *  - a route with one input is that input, with no copy;
+ *  - the inputs of a concatenating route write straight into their slices
+ *    of its output (batch 1, where each slice is contiguous), so the route
+ *    copies nothing, an upsample feeding it included.
+ *
+ * A layer whose output lives inside another layer's buffer is an alias:
+ * its output is layers[alias_layer].output + alias_offset. Layers whose work
+ * moved to a neighbour are fused. plan_network_memory, clones and
+ * free_network follow the aliases; unoptimize_network undoes it all.
+ */
+
+/**
+ * Layer whose buffer holds layer i's output, through dropouts and aliases.
+ */
+int output_owner(network *net, int i)
+{
+    layer l = net->layers[i];
+    if(l.type == DROPOUT && i > 0) return output_owner(net, i-1);
+    if(l.alias) return output_owner(net, l.alias_layer);
+    return i;
+}
+
+static float *output_address(network *net, int i)
+{
+    layer l = net->layers[i];
+    if(l.type == DROPOUT && i > 0) return output_address(net, i-1);
+    if(l.alias) return output_address(net, l.alias_layer) + l.alias_offset;
+    return l.output;
+}
+
+/* The inputs a route concatenates in place start where the sizes of the
+   ones before them add up to, which a reserved network's resize changes */
+static void update_concat_offsets(network *net)
+{
+    int i, j;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        size_t offset = 0;
+        if(l->type != ROUTE || l->n < 2) continue;
+        for(j = 0; j < l->n; offset += l->input_sizes[j++]){
+            int k = l->input_layers[j];
+            while(1){
+                layer in = net->layers[k];
+                if(in.type == DROPOUT && k > 0) --k;
+                else if(in.alias && in.alias_layer != i) k = in.alias_layer;
+                else break;
+            }
+            if(net->layers[k].alias && net->layers[k].alias_layer == i) net->layers[k].alias_offset = offset;
+        }
+    }
+}
+
+/**
+ * Points every alias and dropout at its place in the owner's buffer, after
+ * the owners' buffers moved or their sizes changed.
+ */
+void link_layer_outputs(network *net)
+{
+    int i;
+    update_concat_offsets(net);
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if((l->type == DROPOUT && i > 0) || l->alias) l->output = output_address(net, i);
+    }
+    net->output = get_network_output_layer(net).output;
+}
+
+/* How many layers read each buffer during the pass, plus one if it is read
+   after the pass */
+static int *count_readers(network *net)
+{
+    int i, j;
+    int *readers = safe_calloc(net->n, sizeof(int));
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == ROUTE){
+            for(j = 0; j < l.n; ++j) ++readers[output_owner(net, l.input_layers[j])];
+        } else if(i > 0){
+            ++readers[output_owner(net, i-1)];
+        }
+        if(l.type == SHORTCUT) ++readers[output_owner(net, l.index)];
+        if(output_read_after_forward(net, i)) ++readers[output_owner(net, i)];
+    }
+    return readers;
+}
+
+static void make_alias(network *net, int i, int owner, size_t offset)
+{
+    layer *l = net->layers + i;
+    free(l->output);
+    l->output = 0;
+    l->alias = 1;
+    l->alias_layer = owner;
+    l->alias_offset = offset;
+}
+
+static int fold_shortcut(network *net, int i, int *readers)
+{
+    layer *s = net->layers + i;
+    if(s->type != SHORTCUT || i == 0) return 0;
+    layer *conv = net->layers + i - 1;
+    if(conv->type != CONVOLUTIONAL || conv->alias || readers[i-1] != 1) return 0;
+    if(s->activation != LINEAR || s->alpha != 1 || s->beta != 1) return 0;
+    if(s->w != s->out_w || s->h != s->out_h || s->c != s->out_c) return 0;
+    conv->residual = 1;
+    conv->residual_layer = s->index;
+    s->fused = 1;
+    make_alias(net, i, i - 1, 0);
+    fprintf(stderr, "%5d shortcut      added in the epilogue of %d\n", i, i - 1);
+    return 1;
+}
+
+static int fold_upsample(network *net, int i, int *readers)
+{
+    layer *u = net->layers + i;
+    if(u->type != UPSAMPLE || i == 0 || i + 1 >= net->n) return 0;
+    layer *conv = net->layers + i + 1;
+    if(u->reverse || u->scale != 1 || u->alias || readers[i] != 1) return 0;
+    if(conv->type != CONVOLUTIONAL || conv->size != 1 || conv->stride != 1 || conv->pad) return 0;
+    if(conv->groups != 1 || conv->binary || conv->xnor) return 0;
+    conv->upsampled = u->stride;
+    conv->upsampled_layer = i - 1;
+    u->fused = 1;
+    make_alias(net, i, i + 1, 0);
+    fprintf(stderr, "%5d upsample      after the 1x1 convolution %d\n", i, i + 1);
+    return 1;
+}
+
+static int alias_route(network *net, int i)
+{
+    layer *l = net->layers + i;
+    if(l->type != ROUTE || l->n != 1) return 0;
+    int src = l->input_layers[0];
+    if(output_kept_between_passes(net->layers[output_owner(net, src)])) return 0;
+    make_alias(net, i, src, 0);
+    fprintf(stderr, "%5d route         alias of %d\n", i, src);
+    return 1;
+}
+
+static int concat_in_place(network *net, int i)
+{
+    layer *l = net->layers + i;
+    int j, placed = 0;
+    size_t offset = 0;
+    if(l->type != ROUTE || l->n < 2 || l->batch != 1) return 0;
+    for(j = 0; j < l->n; offset += l->input_sizes[j++]){
+        int src = output_owner(net, l->input_layers[j]);
+        layer in = net->layers[src];
+        /* each buffer can only be in one place */
+        if(in.alias || in.outputs != l->input_sizes[j] || output_kept_between_passes(in)) continue;
+        make_alias(net, src, i, offset);
+        if(!placed) fprintf(stderr, "%5d route         written in place by", i);
+        fprintf(stderr, " %d", l->input_layers[j]);
+        ++placed;
+    }
+    if(placed) fprintf(stderr, "\n");
+    return placed > 0;
+}
+
+/**
+ * Rewrites an inference network's graph so that routes, shortcuts and
+ * upsamples copy as little as possible, and logs each rewrite. The results
+ * don't change. Training networks, GPU networks and packed channel layouts
+ * are left alone. Runs again by itself after resize_network.
+ * @return Number of rewrites
+ */
+int optimize_network(network *net)
+{
+    int i;
+    int planned = net->output_arena != 0;
+    unplan_network_memory(net);
+    unoptimize_network(net);
+
+    int folded = 0, upsamples = 0, aliases = 0, concats = 0;
+    int gpu = 0;
+#ifdef GPU
+    gpu = net->gpu_index >= 0;
+#endif
+    if(net->inference && !net->nchwc && !gpu){
+        int *readers = count_readers(net);
+        for(i = 0; i < net->n; ++i) folded += fold_shortcut(net, i, readers);
+        for(i = 0; i < net->n; ++i) upsamples += fold_upsample(net, i, readers);
+        for(i = 0; i < net->n; ++i) aliases += alias_route(net, i);
+        for(i = 0; i < net->n; ++i) concats += concat_in_place(net, i);
+        free(readers);
+        link_layer_outputs(net);
+        fprintf(stderr, "Graph optimizer: %d shortcuts folded, %d upsamples moved, %d routes aliased, %d concatenated in place\n",
+                folded, upsamples, aliases, concats);
+    }
+    if(planned) plan_network_memory(net);
+    return folded + upsamples + aliases + concats;
+}
+
+/**
+ * Gives every layer its own output and its own forward pass again.
+ */
+void unoptimize_network(network *net)
+{
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->alias) l->output = safe_calloc((size_t)l->outputs*l->batch, sizeof(float));
+        l->alias = 0;
+        l->alias_layer = 0;
+        l->alias_offset = 0;
+        l->fused = 0;
+        l->residual = 0;
+        l->residual_layer = 0;
+        l->upsampled = 0;
+        l->upsampled_layer = 0;
+    }
+    link_layer_outputs(net);
+}
@@ -0,0 +1,8 @@
+#ifndef GRAPH_OPTIMIZER_H
+#define GRAPH_OPTIMIZER_H
+#include "darknet.h"
+
+int output_owner(network *net, int i);
+void link_layer_outputs(network *net);
+
+#endif
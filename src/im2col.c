@@ -1,5 +1,8 @@
 #include "im2col.h"
+#include "thread_pool.h"
+#include "utils.h"
 #include <stdio.h>
+#include <string.h>
 float im2col_get_pixel(float *im, int height, int width, int channels,
                         int row, int col, int channel, int pad)
 {
@@ -17,24 +20,78 @@ void im2col_cpu(float* data_im,
      int channels,  int height,  int width,
      int ksize,  int stride, int pad, float* data_col) 
 {
-    int c,h,w;
     int height_col = (height + 2*pad - ksize) / stride + 1;
+    im2col_cpu_rows(data_im, channels, height, width, ksize, stride, pad, 0, height_col, data_col);
+}
+
+/* Output columns [*w0, *w1) of a kernel tap at column offset w_offset
+   that read inside the image; the rest read padding */
+void im2col_valid_columns(int width, int width_col, int w_offset, int stride, int pad, int *w0, int *w1)
+{
+    int first = pad > w_offset ? (pad - w_offset + stride - 1)/stride : 0;
+    int last = width - 1 + pad - w_offset;
+    int end = last < 0 ? 0 : last/stride + 1;
+    if(end > width_col) end = width_col;
+    if(first > end) first = end;
+    *w0 = first;
+    *w1 = end;
+}
+
+typedef struct {
+    float *im;
+    int channels, height, width;
+    int ksize, stride, pad;
+    int row0, rows;
+    float *col;
+} im2col_args;
+
+/* Column rows [begin, end). Padding is handled once per row: the valid
+   span is a straight copy for stride 1 and a strided one otherwise, left
+   as loops so short rows do not pay for a libc call. */
+SIMD_CLONES
+static void im2col_channels(void *ptr, int begin, int end)
+{
+    im2col_args *a = ptr;
+    int c,h,w;
+    int ksize = a->ksize, stride = a->stride, pad = a->pad, rows = a->rows;
+    int height = a->height, width = a->width;
     int width_col = (width + 2*pad - ksize) / stride + 1;
 
-    int channels_col = channels * ksize * ksize;
-    for (c = 0; c < channels_col; ++c) {
+    for (c = begin; c < end; ++c) {
         int w_offset = c % ksize;
         int h_offset = (c / ksize) % ksize;
         int c_im = c / ksize / ksize;
-        for (h = 0; h < height_col; ++h) {
-            for (w = 0; w < width_col; ++w) {
-                int im_row = h_offset + h * stride;
-                int im_col = w_offset + w * stride;
-                int col_index = (c * height_col + h) * width_col + w;
-                data_col[col_index] = im2col_get_pixel(data_im, height, width, channels,
-                        im_row, im_col, c_im, pad);
+        float *plane = a->im + (size_t)c_im*height*width;
+        int w0, w1;
+        im2col_valid_columns(width, width_col, w_offset, stride, pad, &w0, &w1);
+        for (h = 0; h < rows; ++h) {
+            int im_row = h_offset + (a->row0 + h) * stride - pad;
+            float *dst = a->col + ((size_t)c * rows + h) * width_col;
+            if (im_row < 0 || im_row >= height) {
+                memset(dst, 0, width_col*sizeof(float));
+                continue;
             }
+            const float *src = plane + (size_t)im_row*width + w_offset - pad;
+            for (w = 0; w < w0; ++w) dst[w] = 0;
+            if (stride == 1) {
+                for (w = w0; w < w1; ++w) dst[w] = src[w];
+            } else if (stride == 2) {
+                for (w = w0; w < w1; ++w) dst[w] = src[2*w];
+            } else {
+                for (w = w0; w < w1; ++w) dst[w] = src[w*stride];
+            }
+            for (w = w1; w < width_col; ++w) dst[w] = 0;
         }
     }
 }
 
+// Only output rows [row0, row0 + rows), laid out as if the image had that many rows
+void im2col_cpu_rows(float* data_im,
+     int channels,  int height,  int width,
+     int ksize,  int stride, int pad,
+     int row0, int rows, float* data_col)
+{
+    int width_col = (width + 2*pad - ksize) / stride + 1;
+    im2col_args a = {data_im, channels, height, width, ksize, stride, pad, row0, rows, data_col};
+    parallel_for(channels*ksize*ksize, parallel_grain((size_t)rows*width_col), im2col_channels, &a);
+}
@@ -4,6 +4,11 @@
 void im2col_cpu(float* data_im,
         int channels, int height, int width,
         int ksize, int stride, int pad, float* data_col);
+void im2col_cpu_rows(float* data_im,
+        int channels, int height, int width,
+        int ksize, int stride, int pad,
+        int row0, int rows, float* data_col);
+void im2col_valid_columns(int width, int width_col, int w_offset, int stride, int pad, int *w0, int *w1);
 
 #ifdef GPU
 
@@ -2,6 +2,7 @@
 #include "utils.h"
 #include "blas.h"
 #include "cuda.h"
+#include "thread_pool.h"
 #include <stdio.h>
 #include <math.h>
 
@@ -1210,46 +1211,224 @@ void saturate_exposure_image(image im, float sat, float exposure)
     constrain_image(im);
 }
 
-image resize_image(image im, int w, int h)
+/* The float of every byte value, the same load_image_stb has always given */
+static void fill_byte_table(float *table)
 {
-    image resized = make_image(w, h, im.c);   
-    image part = make_image(w, im.h, im.c);
-    int r, c, k;
-    float w_scale = (float)(im.w - 1) / (w - 1);
-    float h_scale = (float)(im.h - 1) / (h - 1);
-    for(k = 0; k < im.c; ++k){
-        for(r = 0; r < im.h; ++r){
-            for(c = 0; c < w; ++c){
-                float val = 0;
-                if(c == w-1 || im.w == 1){
-                    val = get_pixel(im, im.w-1, r, k);
-                } else {
-                    float sx = c*w_scale;
-                    int ix = (int) sx;
-                    float dx = sx - ix;
-                    val = (1 - dx) * get_pixel(im, ix, r, k) + dx * get_pixel(im, ix+1, r, k);
+    int i;
+    for(i = 0; i < 256; ++i) table[i] = (float)i/255.;
+}
+
+typedef struct {
+    byte_image im;
+    image canvas;
+    int w, h, dy;
+    float hue, sat, val;
+    int *x0, *x1;
+    float *wx0, *wx1, *fill;
+    float lut[256];
+} place_distort_args;
+
+/* Distorts rows r, g and b of n pixels in place, as distort_image followed
+   by constrain_image does. Plain selects, so it vectorizes. */
+static void distort_pixels(float *r, float *g, float *b, int n, float hue, float sat, float val)
+{
+    int i;
+    for(i = 0; i < n; ++i){
+        float rv = r[i], gv = g[i], bv = b[i];
+        float max = fmaxf(rv, fmaxf(gv, bv));
+        float min = fminf(rv, fminf(gv, bv));
+        float delta = max - min;
+        float inv = 1/(delta > 0 ? delta : 1);
+        float h = 4 + (rv - gv)*inv;
+        h = gv == max ? 2 + (bv - rv)*inv : h;
+        h = rv == max ? (gv - bv)*inv : h;
+        h = h < 0 ? h + 6 : h;
+        h = h*(1/6.f) + hue;
+        h = h > 1 ? h - 1 : h;
+        h = h < 0 ? h + 1 : h;
+        float s = delta/(max > 0 ? max : 1)*sat;
+        float v = max*val;
+
+        /* hsv_to_rgb's sextants */
+        float h6 = 6*h;
+        float index = (int)h6;
+        float f = h6 - index;
+        float p = v*(1 - s);
+        float q = v*(1 - s*f);
+        float t = v*(1 - s*(1 - f));
+        float rr = index == 1 ? q : v;
+        rr = index == 2 || index == 3 ? p : rr;
+        rr = index == 4 ? t : rr;
+        float gg = index == 0 ? t : v;
+        gg = index == 3 ? q : gg;
+        gg = index >= 4 ? p : gg;
+        float bb = index <= 1 ? p : v;
+        bb = index == 2 ? t : bb;
+        bb = index >= 5 ? q : bb;
+        rr = s == 0 ? v : rr;
+        gg = s == 0 ? v : gg;
+        bb = s == 0 ? v : bb;
+        r[i] = fminf(fmaxf(rr, 0), 1);
+        g[i] = fminf(fmaxf(gg, 0), 1);
+        b[i] = fminf(fmaxf(bb, 0), 1);
+    }
+}
+
+/* Canvas rows [begin, end): sampled straight into the channel planes, then
+   distorted there */
+static void place_distort_rows(void *ptr, int begin, int end)
+{
+    place_distort_args *a = ptr;
+    byte_image im = a->im;
+    image canvas = a->canvas;
+    size_t plane = (size_t)canvas.w*canvas.h;
+    int y, x, k;
+    for(y = begin; y < end; ++y){
+        float *out = canvas.data + (size_t)y*canvas.w;
+        int sy = y - a->dy;
+        if(sy < 0 || sy >= a->h){
+            for(k = 0; k < 3; ++k){
+                for(x = 0; x < canvas.w; ++x) out[k*plane + x] = .5;
+            }
+        } else {
+            float ry = ((float)sy / a->h) * im.h;
+            int iy = (int) floorf(ry);
+            float fy = ry - iy;
+            float wy0 = iy < im.h ? 1 - fy : 0;
+            float wy1 = iy + 1 < im.h ? fy : 0;
+            const unsigned char *row0 = im.data + (size_t)(iy < im.h ? iy : im.h - 1)*im.w*3;
+            const unsigned char *row1 = im.data + (size_t)(iy + 1 < im.h ? iy + 1 : im.h - 1)*im.w*3;
+            for(x = 0; x < canvas.w; ++x){
+                int x0 = a->x0[x], x1 = a->x1[x];
+                float wx0 = a->wx0[x], wx1 = a->wx1[x];
+                for(k = 0; k < 3; ++k){
+                    float top = wx0*a->lut[row0[x0 + k]] + wx1*a->lut[row0[x1 + k]];
+                    float bottom = wx0*a->lut[row1[x0 + k]] + wx1*a->lut[row1[x1 + k]];
+                    out[k*plane + x] = a->fill[x] + wy0*top + wy1*bottom;
                 }
-                set_pixel(part, c, r, k, val);
             }
         }
+        distort_pixels(out, out + plane, out + 2*plane, canvas.w, a->hue, a->sat, a->val);
     }
-    for(k = 0; k < im.c; ++k){
-        for(r = 0; r < h; ++r){
-            float sy = r*h_scale;
-            int iy = (int) sy;
-            float dy = sy - iy;
-            for(c = 0; c < w; ++c){
-                float val = (1-dy) * get_pixel(part, c, iy, k);
-                set_pixel(resized, c, r, k, val);
-            }
-            if(r == h-1 || im.h == 1) continue;
-            for(c = 0; c < w; ++c){
-                float val = dy * get_pixel(part, c, iy+1, k);
-                add_pixel(resized, c, r, k, val);
+}
+
+/**
+ * The detection augmentation in one pass over the canvas: what
+ * place_image of im, scaled to w x h at (dx, dy) on a canvas filled with
+ * .5, then distort_image and, if flip, flip_image would give. Samples the
+ * 8-bit source directly, so it never needs a float copy of it.
+ */
+void place_distort_image(byte_image im, int w, int h, int dx, int dy, int flip, float hue, float sat, float val, image canvas)
+{
+    int i;
+    assert(im.c == 3 && canvas.c == 3);
+    place_distort_args a = {0};
+    a.im = im;
+    a.canvas = canvas;
+    a.w = w;
+    a.h = h;
+    a.dy = dy;
+    a.hue = hue;
+    a.sat = sat;
+    a.val = val;
+    fill_byte_table(a.lut);
+
+    /* The source columns and weights of every canvas column, flip included;
+       columns off the source read as 0 like bilinear_interpolate's */
+    a.x0 = safe_calloc(canvas.w, sizeof(int));
+    a.x1 = safe_calloc(canvas.w, sizeof(int));
+    a.wx0 = safe_calloc(canvas.w, sizeof(float));
+    a.wx1 = safe_calloc(canvas.w, sizeof(float));
+    a.fill = safe_calloc(canvas.w, sizeof(float));
+    for(i = 0; i < canvas.w; ++i){
+        int sx = (flip ? canvas.w - 1 - i : i) - dx;
+        if(sx < 0 || sx >= w){
+            a.fill[i] = .5;
+            continue;
+        }
+        float rx = ((float)sx / w) * im.w;
+        int ix = (int) floorf(rx);
+        float fx = rx - ix;
+        a.x0[i] = 3*(ix < im.w ? ix : im.w - 1);
+        a.x1[i] = 3*(ix + 1 < im.w ? ix + 1 : im.w - 1);
+        a.wx0[i] = ix < im.w ? 1 - fx : 0;
+        a.wx1[i] = ix + 1 < im.w ? fx : 0;
+    }
+    parallel_for(canvas.h, parallel_grain((size_t)32*canvas.w), place_distort_rows, &a);
+    free(a.x0);
+    free(a.x1);
+    free(a.wx0);
+    free(a.wx1);
+    free(a.fill);
+}
+
+typedef struct {
+    image im, part, resized;
+} resize_args;
+
+/* Horizontal pass, rows k*im.h + r of the source */
+static void resize_columns(void *ptr, int begin, int end)
+{
+    resize_args *a = ptr;
+    image im = a->im;
+    image part = a->part;
+    int w = part.w;
+    float w_scale = (float)(im.w - 1) / (w - 1);
+    int t, c;
+    for(t = begin; t < end; ++t){
+        int k = t / im.h;
+        int r = t % im.h;
+        for(c = 0; c < w; ++c){
+            float val = 0;
+            if(c == w-1 || im.w == 1){
+                val = get_pixel(im, im.w-1, r, k);
+            } else {
+                float sx = c*w_scale;
+                int ix = (int) sx;
+                float dx = sx - ix;
+                val = (1 - dx) * get_pixel(im, ix, r, k) + dx * get_pixel(im, ix+1, r, k);
             }
+            set_pixel(part, c, r, k, val);
+        }
+    }
+}
+
+/* Vertical pass, rows k*h + r of the result */
+static void resize_rows(void *ptr, int begin, int end)
+{
+    resize_args *a = ptr;
+    image im = a->im;
+    image part = a->part;
+    image resized = a->resized;
+    int w = resized.w;
+    int h = resized.h;
+    float h_scale = (float)(im.h - 1) / (h - 1);
+    int t, c;
+    for(t = begin; t < end; ++t){
+        int k = t / h;
+        int r = t % h;
+        float sy = r*h_scale;
+        int iy = (int) sy;
+        float dy = sy - iy;
+        for(c = 0; c < w; ++c){
+            float val = (1-dy) * get_pixel(part, c, iy, k);
+            set_pixel(resized, c, r, k, val);
+        }
+        if(r == h-1 || im.h == 1) continue;
+        for(c = 0; c < w; ++c){
+            float val = dy * get_pixel(part, c, iy+1, k);
+            add_pixel(resized, c, r, k, val);
         }
     }
+}
 
+image resize_image(image im, int w, int h)
+{
+    image resized = make_image(w, h, im.c);   
+    image part = make_image(w, im.h, im.c);
+    resize_args a = {im, part, resized};
+    parallel_for(im.c*im.h, parallel_grain(w), resize_columns, &a);
+    parallel_for(im.c*h, parallel_grain(2*w), resize_rows, &a);
     free_image(part);
     return resized;
 }
@@ -1306,25 +1485,65 @@ void test_resize(char *filename)
 
 image load_image_stb(char *filename, int channels)
 {
-    int w, h, c;
-    unsigned char *data = stbi_load(filename, &w, &h, &c, channels);
-    if (!data) {
+    byte_image b = load_byte_image(filename, channels);
+    image im = byte_image_to_image(b);
+    free_byte_image(b);
+    return im;
+}
+
+/**
+ * Decodes an image to 8 bits per channel, channels interleaved, without
+ * converting it to floats.
+ * @param channels Channels to convert to, 0 for the file's own
+ */
+byte_image load_byte_image(char *filename, int channels)
+{
+    byte_image im;
+    im.data = stbi_load(filename, &im.w, &im.h, &im.c, channels);
+    if (!im.data) {
         fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n", filename, stbi_failure_reason());
         exit(0);
     }
-    if(channels) c = channels;
-    int i,j,k;
-    image im = make_image(w, h, c);
-    for(k = 0; k < c; ++k){
-        for(j = 0; j < h; ++j){
-            for(i = 0; i < w; ++i){
-                int dst_index = i + w*j + w*h*k;
-                int src_index = k + c*i + c*w*j;
-                im.data[dst_index] = (float)data[src_index]/255.;
-            }
-        }
+    if(channels) im.c = channels;
+    return im;
+}
+
+/**
+ * load_byte_image for an encoded image already in memory.
+ */
+byte_image decode_byte_image(unsigned char *bytes, size_t size, int channels)
+{
+    byte_image im;
+    im.data = stbi_load_from_memory(bytes, size, &im.w, &im.h, &im.c, channels);
+    if (!im.data) {
+        fprintf(stderr, "Cannot decode image\nSTB Reason: %s\n", stbi_failure_reason());
+        exit(0);
+    }
+    if(channels) im.c = channels;
+    return im;
+}
+
+void free_byte_image(byte_image im)
+{
+    stbi_image_free(im.data);
+}
+
+/**
+ * Planar float copy of an 8-bit image, with values in [0, 1].
+ */
+image byte_image_to_image(byte_image b)
+{
+    float table[256];
+    size_t i;
+    int k;
+    size_t plane = (size_t)b.w*b.h;
+    image im = make_image(b.w, b.h, b.c);
+    fill_byte_table(table);
+    for(k = 0; k < b.c; ++k){
+        float *out = im.data + k*plane;
+        const unsigned char *in = b.data + k;
+        for(i = 0; i < plane; ++i) out[i] = table[in[i*b.c]];
     }
-    free(data);
     return im;
 }
 
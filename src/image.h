@@ -13,6 +13,12 @@
 extern "C" {
 #endif
 
+/* 8 bits per channel, channels interleaved, as decoded */
+typedef struct {
+    int w, h, c;
+    unsigned char *data;
+} byte_image;
+
 #ifdef OPENCV
 void *open_video_stream(const char *f, int c, int w, int h, int fps);
 image get_image_from_stream(void *p);
@@ -35,6 +41,11 @@ image resize_max(image im, int max);
 void translate_image(image m, float s);
 void embed_image(image source, image dest, int dx, int dy);
 void place_image(image im, int w, int h, int dx, int dy, image canvas);
+void place_distort_image(byte_image im, int w, int h, int dx, int dy, int flip, float hue, float sat, float val, image canvas);
+byte_image load_byte_image(char *filename, int channels);
+byte_image decode_byte_image(unsigned char *bytes, size_t size, int channels);
+void free_byte_image(byte_image im);
+image byte_image_to_image(byte_image b);
 void saturate_image(image im, float sat);
 void exposure_image(image im, float sat);
 void distort_image(image im, float hue, float sat, float val);
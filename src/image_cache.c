@@ -0,0 +1,318 @@
+#include "image_cache.h"
+#include "option_list.h"
+#include "thread_pool.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Decoded-image cache for training lists.
+ *
+ * The file is a header, the images of a list already decoded (8 bits per
+ * channel, three channels interleaved, each on an IMAGE_CACHE_ALIGN
+ * boundary), then an index with each image's offset and size followed by
+ * the paths the index names. Images with a side over the cache's
+ * max_side are downscaled first, keeping their aspect ratio. Once the
+ * pixels reach max_bytes the rest of the list is left out, and the loaders
+ * decode those images as before.
+ *
+ * The file is mapped read only and shared, so loader threads and processes
+ * read the same pages: a cache that fits in memory stays in the page cache,
+ * a larger one is read from disk instead of being decoded again.
+ */
+
+#define IMAGE_CACHE_MAGIC "dkimage"
+#define IMAGE_CACHE_VERSION 1
+#define IMAGE_CACHE_ALIGN 64
+#define IMAGE_CACHE_CHUNK 64
+
+/* FNV-1a */
+#define HASH_OFFSET 14695981039346656037ULL
+#define HASH_PRIME 1099511628211ULL
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t alignment;
+    uint64_t list_hash;
+    uint64_t list_size;
+    uint64_t max_bytes;
+    uint32_t max_side;
+    uint32_t reserved;
+    uint64_t images;
+    uint64_t index_offset;
+} image_cache_header;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t name;
+    int32_t w, h, c;
+    int32_t reserved;
+} image_cache_entry;
+
+struct image_cache {
+    char *map;
+    size_t size;
+    image_cache_header *header;
+    image_cache_entry *entries;
+    char *names;
+    /* open addressing over the entries by path, -1 where empty */
+    int *table;
+    size_t table_size;
+};
+
+static uint64_t hash_string(uint64_t h, const char *s)
+{
+    for(; *s; ++s){
+        h ^= (unsigned char)*s;
+        h *= HASH_PRIME;
+    }
+    return h;
+}
+
+/* The list a cache was built from, so a changed list rebuilds it */
+static uint64_t hash_list(char **paths, int n)
+{
+    int i;
+    uint64_t h = HASH_OFFSET;
+    for(i = 0; i < n; ++i){
+        h = hash_string(h, paths[i]);
+        h = (h ^ '\n')*HASH_PRIME;
+    }
+    return h;
+}
+
+static size_t align_offset(size_t offset)
+{
+    return (offset + IMAGE_CACHE_ALIGN - 1)/IMAGE_CACHE_ALIGN*IMAGE_CACHE_ALIGN;
+}
+
+/* im with its longer side brought down to max_side, im itself if it fits */
+static byte_image downscale_byte_image(byte_image im, int max_side)
+{
+    int side = im.w > im.h ? im.w : im.h;
+    if(!max_side || side <= max_side) return im;
+    int w = (int)((float)im.w*max_side/side + .5);
+    int h = (int)((float)im.h*max_side/side + .5);
+    if(w < 1) w = 1;
+    if(h < 1) h = 1;
+    image f = byte_image_to_image(im);
+    image sized = resize_image(f, w, h);
+    byte_image out = {w, h, im.c, safe_malloc((size_t)w*h*im.c)};
+    size_t i, plane = (size_t)w*h;
+    int k;
+    for(k = 0; k < im.c; ++k){
+        for(i = 0; i < plane; ++i){
+            float v = sized.data[k*plane + i]*255 + .5;
+            out.data[i*im.c + k] = v < 0 ? 0 : v > 255 ? 255 : (unsigned char)v;
+        }
+    }
+    free_image(f);
+    free_image(sized);
+    free_byte_image(im);
+    return out;
+}
+
+typedef struct {
+    char **paths;
+    byte_image *images;
+    int max_side;
+} decode_args;
+
+static void decode_images(void *ptr, int begin, int end)
+{
+    decode_args *a = ptr;
+    int i;
+    for(i = begin; i < end; ++i){
+        a->images[i] = downscale_byte_image(load_byte_image(a->paths[i], 3), a->max_side);
+    }
+}
+
+/**
+ * Decodes paths into a cache file, a chunk of images at a time on the
+ * thread pool. The file is written next to filename and renamed over it
+ * when complete.
+ * @param max_side Longest side images are downscaled to, 0 to keep them
+ * @param max_bytes Pixel bytes after which images are left out, 0 for all
+ */
+void build_image_cache(char *filename, char **paths, int n, int max_side, size_t max_bytes)
+{
+    int i, j;
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    FILE *fp = fopen(tmp, "wb");
+    if(!fp) file_error(tmp);
+
+    image_cache_header h = {IMAGE_CACHE_MAGIC, IMAGE_CACHE_VERSION, IMAGE_CACHE_ALIGN};
+    h.list_hash = hash_list(paths, n);
+    h.list_size = n;
+    h.max_bytes = max_bytes;
+    h.max_side = max_side;
+    fwrite(&h, sizeof(h), 1, fp);
+
+    image_cache_entry *entries = safe_calloc(n ? n : 1, sizeof(image_cache_entry));
+    byte_image *images = safe_calloc(IMAGE_CACHE_CHUNK, sizeof(byte_image));
+    size_t offset = align_offset(sizeof(h));
+    size_t pixels = 0, names = 0;
+    int count = 0, full = 0;
+    double start = what_time_is_it_now();
+    for(i = 0; i < n && !full; i += IMAGE_CACHE_CHUNK){
+        int m = n - i < IMAGE_CACHE_CHUNK ? n - i : IMAGE_CACHE_CHUNK;
+        decode_args a = {paths + i, images, max_side};
+        parallel_for(m, 1, decode_images, &a);
+        for(j = 0; j < m; ++j){
+            byte_image im = images[j];
+            size_t bytes = (size_t)im.w*im.h*im.c;
+            if(max_bytes && pixels + bytes > max_bytes) full = 1;
+            if(!full){
+                if(fseek(fp, offset, SEEK_SET)) file_error(tmp);
+                if(fwrite(im.data, 1, bytes, fp) != bytes) file_error(tmp);
+                image_cache_entry *e = entries + count++;
+                e->offset = offset;
+                e->name = names;
+                e->w = im.w;
+                e->h = im.h;
+                e->c = im.c;
+                names += strlen(paths[i + j]) + 1;
+                pixels += bytes;
+                offset = align_offset(offset + bytes);
+            }
+            free_byte_image(im);
+        }
+        fprintf(stderr, "\rCaching images: %d / %d", count, n);
+    }
+    fprintf(stderr, "\n");
+
+    h.images = count;
+    h.index_offset = offset;
+    if(fseek(fp, offset, SEEK_SET)) file_error(tmp);
+    fwrite(entries, sizeof(image_cache_entry), count, fp);
+    for(i = 0; i < count; ++i) fwrite(paths[i], 1, strlen(paths[i]) + 1, fp);
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&h, sizeof(h), 1, fp);
+    if(fclose(fp)) file_error(tmp);
+    if(rename(tmp, filename)) file_error(filename);
+    fprintf(stderr, "Cached %d of %d images, %.1f MB, in %.1f seconds\n",
+            count, n, pixels/(1024.*1024.), what_time_is_it_now() - start);
+    free(images);
+    free(entries);
+}
+
+/**
+ * Maps a cache file built by build_image_cache.
+ */
+image_cache *open_image_cache(char *filename)
+{
+    size_t i;
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    struct stat st;
+    if(fstat(fd, &st) || (size_t)st.st_size < sizeof(image_cache_header)) file_error(filename);
+    size_t size = st.st_size;
+    char *map = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) file_error(filename);
+
+    image_cache *cache = safe_calloc(1, sizeof(image_cache));
+    cache->map = map;
+    cache->size = size;
+    cache->header = (image_cache_header *)map;
+    image_cache_header h = *cache->header;
+    if(memcmp(h.magic, IMAGE_CACHE_MAGIC, sizeof(h.magic))) error("Not an image cache");
+    if(h.version != IMAGE_CACHE_VERSION) error("Unsupported image cache version");
+    if(h.index_offset + h.images*sizeof(image_cache_entry) > size) error("Truncated image cache");
+    cache->entries = (image_cache_entry *)(map + h.index_offset);
+    cache->names = (char *)(cache->entries + h.images);
+    size_t names_size = size - (cache->names - map);
+
+    cache->table_size = 16;
+    while(cache->table_size < 2*h.images) cache->table_size *= 2;
+    cache->table = safe_malloc(cache->table_size*sizeof(int));
+    memset(cache->table, -1, cache->table_size*sizeof(int));
+    for(i = 0; i < h.images; ++i){
+        image_cache_entry e = cache->entries[i];
+        if(e.offset + (size_t)e.w*e.h*e.c > h.index_offset || e.name >= names_size) error("Truncated image cache");
+        size_t slot = hash_string(HASH_OFFSET, cache->names + e.name) & (cache->table_size - 1);
+        while(cache->table[slot] >= 0) slot = (slot + 1) & (cache->table_size - 1);
+        cache->table[slot] = i;
+    }
+    return cache;
+}
+
+/**
+ * Looks path up in the cache. The image points into the mapping: it stays
+ * valid until free_image_cache and must not be freed.
+ * @return 1 if the cache holds path, 0 otherwise or without a cache
+ */
+int image_cache_find(image_cache *cache, char *path, byte_image *im)
+{
+    if(!cache) return 0;
+    size_t slot = hash_string(HASH_OFFSET, path) & (cache->table_size - 1);
+    for(; cache->table[slot] >= 0; slot = (slot + 1) & (cache->table_size - 1)){
+        image_cache_entry e = cache->entries[cache->table[slot]];
+        if(strcmp(cache->names + e.name, path)) continue;
+        im->w = e.w;
+        im->h = e.h;
+        im->c = e.c;
+        im->data = (unsigned char *)cache->map + e.offset;
+        return 1;
+    }
+    return 0;
+}
+
+int image_cache_size(image_cache *cache)
+{
+    return cache ? cache->header->images : 0;
+}
+
+/* Whether filename is a cache of this list with these limits */
+static int image_cache_matches(char *filename, char **paths, int n, int max_side, size_t max_bytes)
+{
+    image_cache_header h;
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) return 0;
+    int got = fread(&h, sizeof(h), 1, fp);
+    fclose(fp);
+    return got == 1 && !memcmp(h.magic, IMAGE_CACHE_MAGIC, sizeof(h.magic)) &&
+        h.version == IMAGE_CACHE_VERSION && h.list_hash == hash_list(paths, n) &&
+        h.list_size == (uint64_t)n && h.max_side == (uint32_t)max_side && h.max_bytes == max_bytes;
+}
+
+/**
+ * The cache a .data file asks for, built from paths first if it is missing
+ * or was built from another list or with other limits:
+ *
+ *     cache = data/train.cache
+ *     cache_max_side = 640    # downscale images with a longer side
+ *     cache_max_mb = 20000    # leave out the images past this many MB
+ *
+ * @return 0 without a cache option
+ */
+image_cache *load_image_cache(list *options, char **paths, int n)
+{
+    char *filename = option_find(options, "cache");
+    if(!filename) return 0;
+    int max_side = option_find_int_quiet(options, "cache_max_side", 0);
+    size_t max_bytes = (size_t)option_find_int_quiet(options, "cache_max_mb", 0) << 20;
+    if(!image_cache_matches(filename, paths, n, max_side, max_bytes)){
+        fprintf(stderr, "Building image cache %s\n", filename);
+        build_image_cache(filename, paths, n, max_side, max_bytes);
+    }
+    image_cache *cache = open_image_cache(filename);
+    fprintf(stderr, "Image cache %s: %d of %d images\n", filename, image_cache_size(cache), n);
+    return cache;
+}
+
+void free_image_cache(image_cache *cache)
+{
+    if(!cache) return;
+    munmap(cache->map, cache->size);
+    free(cache->table);
+    free(cache);
+}
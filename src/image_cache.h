@@ -0,0 +1,9 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+#include "darknet.h"
+#include "image.h"
+
+int image_cache_find(image_cache *cache, char *path, byte_image *im);
+int image_cache_size(image_cache *cache);
+
+#endif
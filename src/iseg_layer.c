@@ -1,4 +1,5 @@
 #include "iseg_layer.h"
+#include "layer.h"
 #include "activations.h"
 #include "blas.h"
 #include "box.h"
@@ -63,8 +64,8 @@ void resize_iseg_layer(layer *l, int w, int h)
     l->outputs = h*w*l->c;
     l->inputs = l->outputs;
 
-    l->output = safe_realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta = safe_realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    l->output = resize_layer_buffer(l, l->output, l->batch*l->outputs*sizeof(float));
+    l->delta = resize_layer_buffer(l, l->delta, l->batch*l->outputs*sizeof(float));
 
 #ifdef GPU
     cuda_free(l->delta_gpu);
@@ -82,7 +83,7 @@ void forward_iseg_layer(const layer l, network net)
     int i,b,j,k;
     int ids = l.extra;
     memcpy(l.output, net.input, l.outputs*l.batch*sizeof(float));
-    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
+    if(l.delta) memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
 
 #ifndef GPU
     for (b = 0; b < l.batch; ++b){
@@ -90,6 +91,7 @@ void forward_iseg_layer(const layer l, network net)
         activate_array(l.output + index, l.classes*l.w*l.h, LOGISTIC);
     }
 #endif
+    if(!l.delta) return;
 
     for (b = 0; b < l.batch; ++b){
         // a priori, each pixel has no class
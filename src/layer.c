@@ -1,8 +1,81 @@
 #include "layer.h"
 #include "cuda.h"
 
+#include "utils.h"
+
 #include <stdlib.h>
 
+/**
+ * Clears the pointers to the buffers free_layer_training releases without
+ * freeing them, for a copy of a layer that doesn't own them.
+ */
+void forget_layer_training(layer *l)
+{
+    l->delta = 0;
+    l->weight_updates = 0;
+    l->bias_updates = 0;
+    l->scale_updates = 0;
+    l->x = 0;
+    l->x_norm = 0;
+    l->mean = 0;
+    l->variance = 0;
+    l->mean_delta = 0;
+    l->variance_delta = 0;
+    l->indexes = 0;
+    l->rand = 0;
+    l->m = 0;
+    l->v = 0;
+    l->bias_m = 0;
+    l->bias_v = 0;
+    l->scale_m = 0;
+    l->scale_v = 0;
+}
+
+/**
+ * Frees the buffers only backward and update use: gradients, batch
+ * statistics, maxpool argmax indexes and optimizer state. Recurrent layers
+ * keep theirs, their forward passes clear the deltas of the layers they wrap.
+ * @param l Layer of an inference-only network, see [net] inference=1
+ */
+void free_layer_training(layer *l)
+{
+    if(l->type == RNN || l->type == GRU || l->type == LSTM || l->type == CRNN) return;
+    /* a dropout layer's output and delta belong to the layer before it */
+    if(l->type == DROPOUT){
+        free(l->rand);
+    } else {
+        free(l->delta);
+        free(l->weight_updates);
+        free(l->bias_updates);
+        free(l->scale_updates);
+        free(l->x);
+        free(l->x_norm);
+        free(l->mean);
+        free(l->variance);
+        free(l->mean_delta);
+        free(l->variance_delta);
+        free(l->indexes);
+        free(l->rand);
+        free(l->m);
+        free(l->v);
+        free(l->bias_m);
+        free(l->bias_v);
+        free(l->scale_m);
+        free(l->scale_v);
+    }
+    forget_layer_training(l);
+}
+
+/**
+ * Reallocates one of a layer's buffers for its new shape in resize, or
+ * leaves it where it is when reserve_network sized it for the largest one.
+ */
+void *resize_layer_buffer(layer *l, void *buffer, size_t size)
+{
+    if(l->reserved) return buffer;
+    return safe_realloc(buffer, size);
+}
+
 void free_layer(layer l)
 {
     if(l.type == DROPOUT){
@@ -27,11 +100,17 @@ void free_layer(layer l)
     if(l.concat)             free(l.concat);
     if(l.concat_delta)       free(l.concat_delta);
     if(l.binary_weights)     free(l.binary_weights);
+    if(l.packed_weights)     free(l.packed_weights);
     if(l.biases)             free(l.biases);
     if(l.bias_updates)       free(l.bias_updates);
     if(l.scales)             free(l.scales);
     if(l.scale_updates)      free(l.scale_updates);
     if(l.weights)            free(l.weights);
+    if(l.winograd_weights)   free(l.winograd_weights);
+    if(l.direct_weights)     free(l.direct_weights);
+    if(l.nchwc_weights)      free(l.nchwc_weights);
+    if(l.weights_int8)       free(l.weights_int8);
+    if(l.weight_scales)      free(l.weight_scales);
     if(l.weight_updates)     free(l.weight_updates);
     if(l.delta)              free(l.delta);
     if(l.output)             free(l.output);
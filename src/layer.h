@@ -1 +1,5 @@
 #include "darknet.h"
+
+void free_layer_training(layer *l);
+void forget_layer_training(layer *l);
+void *resize_layer_buffer(layer *l, void *buffer, size_t size);
@@ -4,6 +4,7 @@
 #include "col2im.h"
 #include "blas.h"
 #include "gemm.h"
+#include "thread_pool.h"
 #include <stdio.h>
 #include <time.h>
 
@@ -88,11 +89,37 @@ local_layer make_local_layer(int batch, int h, int w, int c, int n, int size, in
     return l;
 }
 
+/* Every location has its own filters, so the pool splits locations: each
+   gemm below writes only its location's column or filters */
+typedef struct {
+    const local_layer *l;
+    float *columns, *output, *delta;
+} local_args;
+
+static void forward_local_locations(void *ptr, int begin, int end)
+{
+    local_args *p = ptr;
+    const local_layer l = *p->l;
+    int locations = l.out_w*l.out_h;
+    int j;
+    for(j = begin; j < end; ++j){
+        float *a = l.weights + j*l.size*l.size*l.c*l.n;
+        float *b = p->columns + j;
+        float *c = p->output + j;
+
+        int m = l.n;
+        int n = 1;
+        int k = l.size*l.size*l.c;
+
+        gemm(0,0,m,n,k,1,a,k,b,locations,1,c,locations);
+    }
+}
+
 void forward_local_layer(const local_layer l, network net)
 {
     int out_h = local_out_height(l);
     int out_w = local_out_width(l);
-    int i, j;
+    int i;
     int locations = out_h * out_w;
 
     for(i = 0; i < l.batch; ++i){
@@ -103,26 +130,54 @@ void forward_local_layer(const local_layer l, network net)
         float *input = net.input + i*l.w*l.h*l.c;
         im2col_cpu(input, l.c, l.h, l.w, 
                 l.size, l.stride, l.pad, net.workspace);
-        float *output = l.output + i*l.outputs;
-        for(j = 0; j < locations; ++j){
-            float *a = l.weights + j*l.size*l.size*l.c*l.n;
-            float *b = net.workspace + j;
-            float *c = output + j;
+        local_args a = {&l, net.workspace, l.output + i*l.outputs};
+        parallel_for(locations, parallel_grain((size_t)l.size*l.size*l.c*l.n), forward_local_locations, &a);
+    }
+    activate_array(l.output, l.outputs*l.batch, l.activation);
+}
 
-            int m = l.n;
-            int n = 1;
-            int k = l.size*l.size*l.c;
+static void local_weight_updates(void *ptr, int begin, int end)
+{
+    local_args *p = ptr;
+    const local_layer l = *p->l;
+    int locations = l.out_w*l.out_h;
+    int j;
+    for(j = begin; j < end; ++j){
+        float *a = p->delta + j;
+        float *b = p->columns + j;
+        float *c = l.weight_updates + j*l.size*l.size*l.c*l.n;
+        int m = l.n;
+        int n = l.size*l.size*l.c;
+        int k = 1;
+
+        gemm(0,1,m,n,k,1,a,locations,b,locations,1,c,n);
+    }
+}
 
-            gemm(0,0,m,n,k,1,a,k,b,locations,1,c,locations);
-        }
+static void local_input_deltas(void *ptr, int begin, int end)
+{
+    local_args *p = ptr;
+    const local_layer l = *p->l;
+    int locations = l.out_w*l.out_h;
+    int j;
+    for(j = begin; j < end; ++j){
+        float *a = l.weights + j*l.size*l.size*l.c*l.n;
+        float *b = p->delta + j;
+        float *c = p->columns + j;
+
+        int m = l.size*l.size*l.c;
+        int n = 1;
+        int k = l.n;
+
+        gemm(1,0,m,n,k,1,a,m,b,locations,0,c,locations);
     }
-    activate_array(l.output, l.outputs*l.batch, l.activation);
 }
 
 void backward_local_layer(local_layer l, network net)
 {
-    int i, j;
+    int i;
     int locations = l.out_w*l.out_h;
+    int grain = parallel_grain((size_t)l.size*l.size*l.c*l.n);
 
     gradient_array(l.output, l.outputs*l.batch, l.activation, l.delta);
 
@@ -135,30 +190,11 @@ void backward_local_layer(local_layer l, network net)
         im2col_cpu(input, l.c, l.h, l.w, 
                 l.size, l.stride, l.pad, net.workspace);
 
-        for(j = 0; j < locations; ++j){ 
-            float *a = l.delta + i*l.outputs + j;
-            float *b = net.workspace + j;
-            float *c = l.weight_updates + j*l.size*l.size*l.c*l.n;
-            int m = l.n;
-            int n = l.size*l.size*l.c;
-            int k = 1;
-
-            gemm(0,1,m,n,k,1,a,locations,b,locations,1,c,n);
-        }
+        local_args a = {&l, net.workspace, 0, l.delta + i*l.outputs};
+        parallel_for(locations, grain, local_weight_updates, &a);
 
         if(net.delta){
-            for(j = 0; j < locations; ++j){ 
-                float *a = l.weights + j*l.size*l.size*l.c*l.n;
-                float *b = l.delta + i*l.outputs + j;
-                float *c = net.workspace + j;
-
-                int m = l.size*l.size*l.c;
-                int n = 1;
-                int k = l.n;
-
-                gemm(1,0,m,n,k,1,a,m,b,locations,0,c,locations);
-            }
-
+            parallel_for(locations, grain, local_input_deltas, &a);
             col2im_cpu(net.workspace, l.c,  l.h,  l.w,  l.size,  l.stride, l.pad, net.delta+i*l.c*l.h*l.w);
         }
     }
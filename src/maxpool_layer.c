@@ -1,7 +1,9 @@
 #include "maxpool_layer.h"
+#include "layer.h"
 #include "cuda.h"
 #include <stdio.h>
 #include "utils.h"
+#include "thread_pool.h"
 
 image get_maxpool_image(maxpool_layer l)
 {
@@ -63,9 +65,9 @@ void resize_maxpool_layer(maxpool_layer *l, int w, int h)
     l->outputs = l->out_w * l->out_h * l->c;
     int output_size = l->outputs * l->batch;
 
-    l->indexes = safe_realloc(l->indexes, output_size * sizeof(int));
-    l->output = safe_realloc(l->output, output_size * sizeof(float));
-    l->delta = safe_realloc(l->delta, output_size * sizeof(float));
+    l->indexes = resize_layer_buffer(l, l->indexes, output_size * sizeof(int));
+    l->output = resize_layer_buffer(l, l->output, output_size * sizeof(float));
+    l->delta = resize_layer_buffer(l, l->delta, output_size * sizeof(float));
 
     #ifdef GPU
     cuda_free((float *)l->indexes_gpu);
@@ -77,52 +79,69 @@ void resize_maxpool_layer(maxpool_layer *l, int w, int h)
     #endif
 }
 
-void forward_maxpool_layer(const maxpool_layer l, network net)
+typedef struct {
+    const maxpool_layer *l;
+    float *input, *delta;
+} maxpool_args;
+
+/* Output planes [begin, end); plane b*c + k only reads input plane b*c + k */
+static void forward_maxpool_planes(void *ptr, int begin, int end)
 {
-    int b,i,j,k,m,n;
+    maxpool_args *a = ptr;
+    const maxpool_layer l = *a->l;
+    int p,i,j,m,n;
     int w_offset = -l.pad/2;
     int h_offset = -l.pad/2;
 
     int h = l.out_h;
     int w = l.out_w;
-    int c = l.c;
 
-    for(b = 0; b < l.batch; ++b){
-        for(k = 0; k < c; ++k){
-            for(i = 0; i < h; ++i){
-                for(j = 0; j < w; ++j){
-                    int out_index = j + w*(i + h*(k + c*b));
-                    float max = -FLT_MAX;
-                    int max_i = -1;
-                    for(n = 0; n < l.size; ++n){
-                        for(m = 0; m < l.size; ++m){
-                            int cur_h = h_offset + i*l.stride + n;
-                            int cur_w = w_offset + j*l.stride + m;
-                            int index = cur_w + l.w*(cur_h + l.h*(k + b*l.c));
-                            int valid = (cur_h >= 0 && cur_h < l.h &&
-                                         cur_w >= 0 && cur_w < l.w);
-                            float val = (valid != 0) ? net.input[index] : -FLT_MAX;
-                            max_i = (val > max) ? index : max_i;
-                            max   = (val > max) ? val   : max;
-                        }
+    for(p = begin; p < end; ++p){
+        for(i = 0; i < h; ++i){
+            for(j = 0; j < w; ++j){
+                int out_index = j + w*(i + h*p);
+                float max = -FLT_MAX;
+                int max_i = -1;
+                for(n = 0; n < l.size; ++n){
+                    for(m = 0; m < l.size; ++m){
+                        int cur_h = h_offset + i*l.stride + n;
+                        int cur_w = w_offset + j*l.stride + m;
+                        int index = cur_w + l.w*(cur_h + l.h*p);
+                        int valid = (cur_h >= 0 && cur_h < l.h &&
+                                     cur_w >= 0 && cur_w < l.w);
+                        float val = (valid != 0) ? a->input[index] : -FLT_MAX;
+                        max_i = (val > max) ? index : max_i;
+                        max   = (val > max) ? val   : max;
                     }
-                    l.output[out_index] = max;
-                    l.indexes[out_index] = max_i;
                 }
+                l.output[out_index] = max;
+                if(l.indexes) l.indexes[out_index] = max_i;
             }
         }
     }
 }
 
-void backward_maxpool_layer(const maxpool_layer l, network net)
+void forward_maxpool_layer(const maxpool_layer l, network net)
+{
+    maxpool_args a = {&l, net.input, 0};
+    parallel_for(l.batch*l.c, parallel_grain((size_t)l.out_h*l.out_w*l.size*l.size), forward_maxpool_planes, &a);
+}
+
+static void backward_maxpool_planes(void *ptr, int begin, int end)
 {
+    maxpool_args *a = ptr;
+    const maxpool_layer l = *a->l;
+    int size = l.out_h*l.out_w;
     int i;
-    int h = l.out_h;
-    int w = l.out_w;
-    int c = l.c;
-    for(i = 0; i < h*w*c*l.batch; ++i){
+    for(i = begin*size; i < end*size; ++i){
         int index = l.indexes[i];
-        net.delta[index] += l.delta[i];
+        a->delta[index] += l.delta[i];
     }
 }
 
+void backward_maxpool_layer(const maxpool_layer l, network net)
+{
+    maxpool_args a = {&l, 0, net.delta};
+    parallel_for(l.batch*l.c, parallel_grain((size_t)l.out_h*l.out_w), backward_maxpool_planes, &a);
+}
+
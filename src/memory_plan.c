@@ -0,0 +1,172 @@
+#include "memory_plan.h"
+#include "graph_optimizer.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Liveness-based placement of layer outputs for inference.
+ *
+ * Layer i writes its output during forward pass step i, and the output is
+ * last read by the next layer, a later route or shortcut that names it, or
+ * the caller once the pass is over (the network output and detection layers).
+ * Outputs whose [first, last] steps do not overlap can share memory, so every
+ * output gets an offset in one arena: largest first, each at the lowest
+ * offset that does not collide with an already placed output alive at the
+ * same time. Dropout layers alias the layer before them, optimize_network
+ * aliases lay whole outputs inside others (the owner's slot then lives from
+ * its first writer to its last reader), and recurrent layers keep state in
+ * their outputs across passes, so none of them gets its own slot.
+ */
+
+/* offsets stay on 64-byte boundaries for the vector kernels */
+#define PLAN_ALIGN 16
+
+typedef struct {
+    int layer;
+    int first, last;
+    size_t size;
+    size_t offset;
+} output_slot;
+
+int output_kept_between_passes(layer l)
+{
+    return l.type == RNN || l.type == GRU || l.type == LSTM || l.type == CRNN;
+}
+
+/**
+ * Whether layer i's output is read after forward_network returns: the
+ * network output and what it is computed from, and the detection layers.
+ */
+int output_read_after_forward(network *net, int i)
+{
+    int out = net->n - 1;
+    while(out > 0 && net->layers[out].type == COST) --out;
+    layer l = net->layers[i];
+    return i >= out || l.type == YOLO || l.type == REGION || l.type == DETECTION || l.type == ISEG || l.truth;
+}
+
+static int slot_size_comparator(const void *a, const void *b)
+{
+    const output_slot *x = a, *y = b;
+    if(x->size != y->size) return x->size < y->size ? 1 : -1;
+    return x->layer - y->layer;
+}
+
+int in_output_arena(network *net, float *p)
+{
+    return net->output_arena && p >= net->output_arena && p < net->output_arena + net->output_arena_size;
+}
+
+/**
+ * Gives every layer whose output lives in the arena a private buffer again
+ * and frees the arena, which resize_network needs to realloc outputs.
+ */
+void unplan_network_memory(network *net)
+{
+    int i;
+    if(!net->output_arena) return;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->type == DROPOUT || l->alias) continue;
+        if(in_output_arena(net, l->output)){
+            l->output = safe_calloc((size_t)l->outputs*l->batch, sizeof(float));
+        }
+    }
+    free(net->output_arena);
+    net->output_arena = 0;
+    net->output_arena_size = 0;
+    link_layer_outputs(net);
+}
+
+/**
+ * Moves the layer outputs of an inference network into one shared arena,
+ * reusing memory between outputs that are never alive at the same time.
+ * Intermediate outputs are overwritten during the pass, only the network
+ * output and the detection layers can be read afterwards.
+ * @return Arena size in bytes
+ */
+size_t plan_network_memory(network *net)
+{
+    int i, j, k;
+#ifdef GPU
+    if(net->gpu_index >= 0) return 0;
+#endif
+    unplan_network_memory(net);
+
+    int n = net->n;
+    int *owner = safe_calloc(n, sizeof(int));
+    int *first = safe_calloc(n, sizeof(int));
+    int *last = safe_calloc(n, sizeof(int));
+    for(i = 0; i < n; ++i){
+        owner[i] = output_owner(net, i);
+        first[i] = last[i] = i;
+    }
+    for(i = 0; i < n; ++i){
+        if(first[owner[i]] > i) first[owner[i]] = i;
+    }
+#define READ_AT(src, step) if(last[owner[src]] < (step)) last[owner[src]] = (step)
+    for(i = 0; i < n; ++i){
+        layer l = net->layers[i];
+        if(i > 0) READ_AT(i-1, i);
+        if(l.type == ROUTE){
+            for(j = 0; j < l.n; ++j) READ_AT(l.input_layers[j], i);
+        } else if(l.type == SHORTCUT){
+            READ_AT(l.index, i);
+        }
+        if(l.residual) READ_AT(l.residual_layer, i);
+        if(l.upsampled) READ_AT(l.upsampled_layer, i);
+        if(output_read_after_forward(net, i)) READ_AT(i, n);
+    }
+#undef READ_AT
+
+    output_slot *slots = safe_calloc(n, sizeof(output_slot));
+    int nslots = 0;
+    size_t naive = 0;
+    for(i = 0; i < n; ++i){
+        layer l = net->layers[i];
+        if(owner[i] != i || output_kept_between_passes(l) || !l.output) continue;
+        size_t size = (size_t)l.outputs*l.batch;
+        naive += size;
+        output_slot s = {i, first[i], last[i], (size + PLAN_ALIGN - 1)/PLAN_ALIGN*PLAN_ALIGN, 0};
+        slots[nslots++] = s;
+    }
+    qsort(slots, nslots, sizeof(output_slot), slot_size_comparator);
+
+    /* placed slots sorted by offset, so each new slot takes the first gap
+       between the ones alive at the same time */
+    output_slot **placed = safe_calloc(nslots, sizeof(output_slot *));
+    size_t arena = 0;
+    for(i = 0; i < nslots; ++i){
+        output_slot *s = slots + i;
+        size_t offset = 0;
+        for(j = 0; j < i; ++j){
+            output_slot *p = placed[j];
+            if(p->last < s->first || s->last < p->first) continue;
+            if(p->offset >= offset + s->size) break;
+            if(p->offset + p->size > offset) offset = p->offset + p->size;
+        }
+        s->offset = offset;
+        for(k = i; k > 0 && placed[k-1]->offset > offset; --k) placed[k] = placed[k-1];
+        placed[k] = s;
+        if(offset + s->size > arena) arena = offset + s->size;
+    }
+
+    net->output_arena = arena ? safe_calloc(arena, sizeof(float)) : 0;
+    net->output_arena_size = arena;
+    for(i = 0; i < nslots; ++i){
+        layer *l = net->layers + slots[i].layer;
+        free(l->output);
+        l->output = net->output_arena + slots[i].offset;
+    }
+    link_layer_outputs(net);
+
+    fprintf(stderr, "Memory plan: %d outputs in %.1f MB instead of %.1f MB\n",
+            nslots, arena*sizeof(float)/1e6, naive*sizeof(float)/1e6);
+    free(placed);
+    free(slots);
+    free(last);
+    free(first);
+    free(owner);
+    return arena*sizeof(float);
+}
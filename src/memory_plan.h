@@ -0,0 +1,10 @@
+#ifndef MEMORY_PLAN_H
+#define MEMORY_PLAN_H
+#include "darknet.h"
+
+int in_output_arena(network *net, float *p);
+void unplan_network_memory(network *net);
+int output_kept_between_passes(layer l);
+int output_read_after_forward(network *net, int i);
+
+#endif
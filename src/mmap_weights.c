@@ -0,0 +1,374 @@
+#include "mmap_weights.h"
+#include "batchnorm_layer.h"
+#include "connected_layer.h"
+#include "convolutional_layer.h"
+#include "local_layer.h"
+#include "nchwc.h"
+#include "xnor.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Memory-mapped weights container.
+ *
+ * The file is a header, an index with one entry per parameter tensor (layer,
+ * sublayer of a recurrent layer, which array, dtype, shape, byte offset) and
+ * the tensors themselves, each on a MMAP_WEIGHTS_ALIGN boundary. Tensors hold
+ * the arrays exactly as they are in memory after a classic load, so connected
+ * layers are already transposed, flipped convolutions already flipped and
+ * int8 layers carry both their int8 and dequantized float weights; loading
+ * only points the layer arrays into the mapping. Caches derived from the
+ * weights (winograd transforms, binary and bit-packed copies) are rebuilt.
+ *
+ * The mapping is private and writable, so pages stay shared in the page
+ * cache between processes until someone updates the weights, which then
+ * copies only the pages written.
+ */
+
+#define MMAP_WEIGHTS_MAGIC "dkmmapw"
+#define MMAP_WEIGHTS_VERSION 1
+#define MMAP_WEIGHTS_ALIGN 64
+
+typedef enum {
+    TENSOR_BIASES, TENSOR_SCALES, TENSOR_ROLLING_MEAN, TENSOR_ROLLING_VARIANCE,
+    TENSOR_WEIGHTS, TENSOR_WEIGHTS_INT8, TENSOR_WEIGHT_SCALES, TENSOR_INPUT_SCALE
+} tensor_kind;
+
+typedef enum {
+    TENSOR_F32, TENSOR_I8
+} tensor_dtype;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t alignment;
+    uint64_t seen;
+    uint64_t tensors;
+} mmap_weights_header;
+
+typedef struct {
+    int32_t layer;
+    int32_t sublayer;
+    int32_t kind;
+    int32_t dtype;
+    int32_t ndims;
+    int32_t shape[4];
+    int32_t reserved;
+    uint64_t offset;
+    uint64_t bytes;
+} mmap_tensor_entry;
+
+/* One array of a layer: where its pointer lives and what it holds. The input
+   scale is a single float stored in the layer itself, so it has no pointer. */
+typedef struct {
+    tensor_kind kind;
+    tensor_dtype dtype;
+    void **data;
+    float *value;
+    int ndims;
+    int shape[4];
+} layer_tensor;
+
+/* The layers holding weights: a recurrent layer's wrapped layers, or l */
+static int weight_sublayers(layer *l, layer **subs)
+{
+    switch(l->type){
+        case RNN:
+        case CRNN:
+            subs[0] = l->input_layer;
+            subs[1] = l->self_layer;
+            subs[2] = l->output_layer;
+            return 3;
+        case LSTM:
+            subs[0] = l->wi; subs[1] = l->wf; subs[2] = l->wo; subs[3] = l->wg;
+            subs[4] = l->ui; subs[5] = l->uf; subs[6] = l->uo; subs[7] = l->ug;
+            return 8;
+        case GRU:
+            subs[0] = l->wz; subs[1] = l->wr; subs[2] = l->wh;
+            subs[3] = l->uz; subs[4] = l->ur; subs[5] = l->uh;
+            return 6;
+        default:
+            subs[0] = l;
+            return 1;
+    }
+}
+
+static int add_tensor(layer_tensor *t, int n, tensor_kind kind, tensor_dtype dtype, void *data,
+        int d0, int d1, int d2, int d3)
+{
+    layer_tensor x = {kind, dtype, (void **)data, 0, 1, {d0, 1, 1, 1}};
+    if(d1 > 1 || d2 > 1 || d3 > 1){
+        x.ndims = 4;
+        x.shape[1] = d1;
+        x.shape[2] = d2;
+        x.shape[3] = d3;
+    }
+    t[n] = x;
+    return n + 1;
+}
+
+/* The parameter arrays of a layer that holds weights itself */
+static int layer_tensors(layer *l, layer_tensor *t)
+{
+    int n = 0, outputs;
+    switch(l->type){
+        case CONVOLUTIONAL:
+        case DECONVOLUTIONAL:
+        case CONNECTED:
+            outputs = l->type == CONNECTED ? l->outputs : l->n;
+            n = add_tensor(t, n, TENSOR_BIASES, TENSOR_F32, &l->biases, outputs, 1, 1, 1);
+            if(l->batch_normalize){
+                n = add_tensor(t, n, TENSOR_SCALES, TENSOR_F32, &l->scales, outputs, 1, 1, 1);
+                n = add_tensor(t, n, TENSOR_ROLLING_MEAN, TENSOR_F32, &l->rolling_mean, outputs, 1, 1, 1);
+                n = add_tensor(t, n, TENSOR_ROLLING_VARIANCE, TENSOR_F32, &l->rolling_variance, outputs, 1, 1, 1);
+            }
+            if(l->type == CONNECTED){
+                n = add_tensor(t, n, TENSOR_WEIGHTS, TENSOR_F32, &l->weights, l->outputs, l->inputs, 1, 1);
+            } else if(l->type == CONVOLUTIONAL){
+                n = add_tensor(t, n, TENSOR_WEIGHTS, TENSOR_F32, &l->weights, l->n, l->c/l->groups, l->size, l->size);
+            } else {
+                n = add_tensor(t, n, TENSOR_WEIGHTS, TENSOR_F32, &l->weights, l->c, l->n, l->size, l->size);
+            }
+            if(l->weights_int8){
+                n = add_tensor(t, n, TENSOR_WEIGHTS_INT8, TENSOR_I8, &l->weights_int8,
+                        t[n-1].shape[0], t[n-1].shape[1], t[n-1].shape[2], t[n-1].shape[3]);
+                n = add_tensor(t, n, TENSOR_WEIGHT_SCALES, TENSOR_F32, &l->weight_scales, outputs, 1, 1, 1);
+                n = add_tensor(t, n, TENSOR_INPUT_SCALE, TENSOR_F32, 0, 1, 1, 1, 1);
+                t[n-1].value = &l->input_scale;
+            }
+            break;
+        case BATCHNORM:
+            n = add_tensor(t, n, TENSOR_SCALES, TENSOR_F32, &l->scales, l->c, 1, 1, 1);
+            n = add_tensor(t, n, TENSOR_ROLLING_MEAN, TENSOR_F32, &l->rolling_mean, l->c, 1, 1, 1);
+            n = add_tensor(t, n, TENSOR_ROLLING_VARIANCE, TENSOR_F32, &l->rolling_variance, l->c, 1, 1, 1);
+            break;
+        case LOCAL:
+            n = add_tensor(t, n, TENSOR_BIASES, TENSOR_F32, &l->biases, l->outputs, 1, 1, 1);
+            n = add_tensor(t, n, TENSOR_WEIGHTS, TENSOR_F32, &l->weights,
+                    l->out_w*l->out_h, l->n, l->c, l->size*l->size);
+            break;
+        default:
+            break;
+    }
+    return n;
+}
+
+static size_t tensor_bytes(layer_tensor t)
+{
+    size_t count = (size_t)t.shape[0]*t.shape[1]*t.shape[2]*t.shape[3];
+    return count*(t.dtype == TENSOR_I8 ? sizeof(signed char) : sizeof(float));
+}
+
+static void *tensor_source(layer_tensor t)
+{
+    return t.value ? (void *)t.value : *t.data;
+}
+
+static size_t align_offset(size_t offset)
+{
+    return (offset + MMAP_WEIGHTS_ALIGN - 1)/MMAP_WEIGHTS_ALIGN*MMAP_WEIGHTS_ALIGN;
+}
+
+/**
+ * Saves the network in the memory-mapped format load_weights also reads.
+ * Use it to convert a classic weights file: load it, then save it here.
+ */
+void save_weights_mmap(network *net, char *filename)
+{
+    int i, j, k;
+    layer_tensor t[16];
+    layer *subs[8];
+    size_t count = 0;
+#ifdef GPU
+    if(net->gpu_index >= 0){
+        cuda_set_device(net->gpu_index);
+        for(i = 0; i < net->n; ++i){
+            layer l = net->layers[i];
+            if(l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL) pull_convolutional_layer(l);
+            if(l.type == CONNECTED) pull_connected_layer(l);
+            if(l.type == BATCHNORM) pull_batchnorm_layer(l);
+            if(l.type == LOCAL) pull_local_layer(l);
+        }
+    }
+#endif
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].dontsave) continue;
+        int nsubs = weight_sublayers(net->layers + i, subs);
+        for(j = 0; j < nsubs; ++j) count += layer_tensors(subs[j], t);
+    }
+
+    mmap_tensor_entry *entries = safe_calloc(count, sizeof(mmap_tensor_entry));
+    size_t offset = align_offset(sizeof(mmap_weights_header) + count*sizeof(mmap_tensor_entry));
+    size_t e = 0;
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].dontsave) continue;
+        int nsubs = weight_sublayers(net->layers + i, subs);
+        for(j = 0; j < nsubs; ++j){
+            int n = layer_tensors(subs[j], t);
+            for(k = 0; k < n; ++k){
+                mmap_tensor_entry *x = entries + e++;
+                x->layer = i;
+                x->sublayer = j;
+                x->kind = t[k].kind;
+                x->dtype = t[k].dtype;
+                x->ndims = t[k].ndims;
+                memcpy(x->shape, t[k].shape, sizeof(x->shape));
+                x->offset = offset;
+                x->bytes = tensor_bytes(t[k]);
+                offset = align_offset(offset + x->bytes);
+            }
+        }
+    }
+
+    fprintf(stderr, "Saving memory-mapped weights to %s\n", filename);
+    FILE *fp = fopen(filename, "wb");
+    if(!fp) file_error(filename);
+    mmap_weights_header h = {MMAP_WEIGHTS_MAGIC, MMAP_WEIGHTS_VERSION, MMAP_WEIGHTS_ALIGN, *net->seen, count};
+    fwrite(&h, sizeof(h), 1, fp);
+    fwrite(entries, sizeof(mmap_tensor_entry), count, fp);
+    e = 0;
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].dontsave) continue;
+        int nsubs = weight_sublayers(net->layers + i, subs);
+        for(j = 0; j < nsubs; ++j){
+            int n = layer_tensors(subs[j], t);
+            for(k = 0; k < n; ++k, ++e){
+                if(fseek(fp, entries[e].offset, SEEK_SET)) file_error(filename);
+                fwrite(tensor_source(t[k]), 1, entries[e].bytes, fp);
+            }
+        }
+    }
+    /* pad the last tensor so the file ends on the alignment */
+    if(offset > (size_t)ftell(fp)){
+        fseek(fp, offset - 1, SEEK_SET);
+        fputc(0, fp);
+    }
+    fclose(fp);
+    free(entries);
+}
+
+int is_mmap_weights_file(char *filename)
+{
+    char magic[8] = {0};
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) return 0;
+    int n = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    return n == sizeof(magic) && memcmp(magic, MMAP_WEIGHTS_MAGIC, sizeof(magic)) == 0;
+}
+
+/* Rebuilds what the classic loader derives from the weights */
+static void finish_mapped_layer(layer *l)
+{
+    if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL){
+        update_winograd_weights(*l);
+        update_direct_weights(*l);
+        update_binary_weights(*l);
+        if(l->type == CONVOLUTIONAL) check_convolutional_algorithm(l);
+    }
+    update_nchwc_weights(*l);
+#ifdef GPU
+    if(gpu_index >= 0){
+        if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL) push_convolutional_layer(*l);
+        if(l->type == CONNECTED) push_connected_layer(*l);
+        if(l->type == BATCHNORM) push_batchnorm_layer(*l);
+        if(l->type == LOCAL) push_local_layer(*l);
+    }
+#endif
+}
+
+/**
+ * Points the parameter arrays of layers [start, cutoff) into a mapping of a
+ * file written by save_weights_mmap. The arrays parse_network_cfg allocated
+ * are freed; free_network unmaps the file.
+ */
+void load_weights_mmap(network *net, char *filename, int start, int cutoff)
+{
+    size_t i;
+    int j, k;
+    layer_tensor t[16];
+    layer *subs[8];
+    if(net->weights_map) error("Network already has memory-mapped weights");
+
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    struct stat st;
+    if(fstat(fd, &st) || (size_t)st.st_size < sizeof(mmap_weights_header)) file_error(filename);
+    size_t size = st.st_size;
+    char *map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) file_error(filename);
+
+    mmap_weights_header *h = (mmap_weights_header *)map;
+    mmap_tensor_entry *entries = (mmap_tensor_entry *)(map + sizeof(mmap_weights_header));
+    if(h->version != MMAP_WEIGHTS_VERSION) error("Unsupported memory-mapped weights version");
+    if(sizeof(mmap_weights_header) + h->tensors*sizeof(mmap_tensor_entry) > size) error("Truncated memory-mapped weights file");
+    *net->seen = h->seen;
+    net->weights_map = map;
+    net->weights_map_size = size;
+
+    for(i = 0; i < h->tensors; ++i){
+        mmap_tensor_entry x = entries[i];
+        if(x.layer < start || x.layer >= cutoff || x.layer >= net->n) continue;
+        layer *l = net->layers + x.layer;
+        if(l->dontload) continue;
+        if(x.sublayer >= weight_sublayers(l, subs)) error("Memory-mapped weights don't match the cfg");
+        layer *sub = subs[x.sublayer];
+        /* int8 tensors name arrays make_int8_weights would allocate */
+        if(x.kind == TENSOR_WEIGHTS_INT8 && !sub->weights_int8) sub->weights_int8 = (signed char *)(map + x.offset);
+        if(x.kind == TENSOR_WEIGHT_SCALES && !sub->weight_scales) sub->weight_scales = (float *)(map + x.offset);
+        int n = layer_tensors(sub, t);
+        for(k = 0; k < n; ++k) if((int)t[k].kind == x.kind) break;
+        if(k == n || (int)t[k].dtype != x.dtype || tensor_bytes(t[k]) != x.bytes || x.offset + x.bytes > size){
+            fprintf(stderr, "Layer %d: tensor %d has shape %d x %d x %d x %d in the file\n",
+                    x.layer, x.kind, x.shape[0], x.shape[1], x.shape[2], x.shape[3]);
+            error("Memory-mapped weights don't match the cfg");
+        }
+        if(t[k].value){
+            memcpy(t[k].value, map + x.offset, sizeof(float));
+        } else {
+            if(*t[k].data != map + x.offset) free(*t[k].data);
+            *t[k].data = map + x.offset;
+        }
+    }
+
+    for(j = start; j < net->n && j < cutoff; ++j){
+        layer *l = net->layers + j;
+        if(l->dontload) continue;
+        int nsubs = weight_sublayers(l, subs);
+        for(k = 0; k < nsubs; ++k) finish_mapped_layer(subs[k]);
+    }
+}
+
+/* Clears every layer pointer into the mapping, so free_layer skips them,
+   and unmaps the file */
+void release_mapped_weights(network *net)
+{
+    int i, j, k;
+    layer_tensor t[16];
+    layer *subs[8];
+    char *begin = net->weights_map;
+    char *end = begin + net->weights_map_size;
+    if(!begin) return;
+    for(i = 0; i < net->n; ++i){
+        int nsubs = weight_sublayers(net->layers + i, subs);
+        for(j = 0; j < nsubs; ++j){
+            int n = layer_tensors(subs[j], t);
+            for(k = 0; k < n; ++k){
+                if(!t[k].data) continue;
+                char *p = *t[k].data;
+                if(p >= begin && p < end) *t[k].data = 0;
+            }
+        }
+    }
+    munmap(net->weights_map, net->weights_map_size);
+    net->weights_map = 0;
+    net->weights_map_size = 0;
+}
@@ -0,0 +1,9 @@
+#ifndef MMAP_WEIGHTS_H
+#define MMAP_WEIGHTS_H
+#include "darknet.h"
+
+int is_mmap_weights_file(char *filename);
+void load_weights_mmap(network *net, char *filename, int start, int cutoff);
+void release_mapped_weights(network *net);
+
+#endif
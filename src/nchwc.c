@@ -0,0 +1,583 @@
+#include "nchwc.h"
+#include "network.h"
+#include "activations.h"
+#include "batchnorm_layer.h"
+#include "blas.h"
+#include "utils.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define NCHWC_X86
+#endif
+
+/*
+ * Channel-blocked NCHW[block]c layout for CPU inference.
+ *
+ * A packed tensor stores channels in groups of block (8 or 16): element
+ * (c, y, x) lives at ((c/block*h + y)*w + x)*block + c%block, so the block
+ * channels of one pixel are a single vector. Convolutions broadcast an input
+ * pixel against a vector of block filters, pooling and upsampling move whole
+ * vectors, and element-wise layers (shortcut, route, activations) do not care
+ * about the layout at all.
+ *
+ * set_network_layout decides which layers produce packed outputs; layers
+ * that are not packed see plain NCHW, and forward_network_nchwc reorders
+ * between the two only where the layout changes along the layer chain.
+ * Packed convolutions and batchnorm layers keep their filters, reordered,
+ * and their folded scales and biases in l.nchwc_weights.
+ */
+
+/* filters per vector: one 16c block or two 8c blocks */
+#define NCHWC_LANES 16
+#define NCHWC_MAX_XB 8
+
+typedef float nchwc_vec __attribute__((vector_size(NCHWC_LANES*sizeof(float))));
+
+int get_layout(char *s)
+{
+    if (strcmp(s, "nchw")==0) return 0;
+    if (strcmp(s, "nchw8c")==0) return 8;
+    if (strcmp(s, "nchw16c")==0) return 16;
+    fprintf(stderr, "Couldn't find layout %s, going with nchw\n", s);
+    return 0;
+}
+
+/* Arguments of the plain per-plane loops below */
+typedef struct {
+    int block;
+    float *in, *out;
+    int batch, channels, height, width, spatial;
+    int size, stride, pad, out_h, out_w;
+    float scale;
+    float *scales, *biases;
+} nchwc_args;
+
+static void nchw_to_nchwc_planes(void *ptr, int begin, int end)
+{
+    nchwc_args *a = ptr;
+    int block = a->block, spatial = a->spatial;
+    int t;
+    for(t = begin; t < end; ++t){
+        float *src = a->in + (size_t)t*block*spatial;
+        float *dst = a->out + (size_t)t*block*spatial;
+        int i, j;
+        for(i = 0; i < spatial; ++i){
+            for(j = 0; j < block; ++j) dst[i*block + j] = src[j*spatial + i];
+        }
+    }
+}
+
+void nchw_to_nchwc(float *in, int batch, int channels, int spatial, int block, float *out)
+{
+    nchwc_args a = {block, in, out, batch, channels, 0, 0, spatial};
+    parallel_for(batch*channels/block, 1, nchw_to_nchwc_planes, &a);
+}
+
+static void nchwc_to_nchw_planes(void *ptr, int begin, int end)
+{
+    nchwc_args *a = ptr;
+    int block = a->block, spatial = a->spatial;
+    int t;
+    for(t = begin; t < end; ++t){
+        float *src = a->in + (size_t)t*block*spatial;
+        float *dst = a->out + (size_t)t*block*spatial;
+        int i, j;
+        for(j = 0; j < block; ++j){
+            for(i = 0; i < spatial; ++i) dst[j*spatial + i] = src[i*block + j];
+        }
+    }
+}
+
+void nchwc_to_nchw(float *in, int batch, int channels, int spatial, int block, float *out)
+{
+    nchwc_args a = {block, in, out, batch, channels, 0, 0, spatial};
+    parallel_for(batch*channels/block, 1, nchwc_to_nchw_planes, &a);
+}
+
+/* xb consecutive output pixels (in row-major order, so a tile may wrap
+ * onto the next row) of nsb filter super-blocks. The input is already
+ * zero-padded, so every window is in bounds and each pixel reads at a fixed
+ * offset from its window's corner. ps is the input's pixel stride: 1 for
+ * plain NCHW, the block for packed. Only the first n pixels are stored. */
+static inline __attribute__((always_inline))
+void nchwc_conv_tile(const int nsb, const int xb, const int ps, const int size,
+        float *im, int channels, int height, int width, int *off, int n,
+        float *packed, size_t sb_size, nchwc_vec *scale, nchwc_vec *bias,
+        int block, int blocks, int sb, size_t plane, float *out)
+{
+    nchwc_vec acc[2][NCHWC_MAX_XB];
+    int c, ky, kx, x, s, h;
+    for(x = 0; x < xb; ++x){
+        for(s = 0; s < nsb; ++s) acc[s][x] = (nchwc_vec){0};
+    }
+    for(c = 0; c < channels; ++c){
+        float *chan = (ps == 1) ? im + (size_t)c*height*width
+                                : im + (size_t)(c/ps)*height*width*ps + c%ps;
+        for(ky = 0; ky < size; ++ky){
+            float *wk = packed + (c*size + ky)*size*NCHWC_LANES;
+            float *row = chan + ky*width*ps;
+            for(kx = 0; kx < size; ++kx){
+                nchwc_vec w[2];
+                for(s = 0; s < nsb; ++s) memcpy(&w[s], wk + s*sb_size + kx*NCHWC_LANES, sizeof(nchwc_vec));
+                for(x = 0; x < xb; ++x){
+                    float a = row[off[x] + kx*ps];
+                    for(s = 0; s < nsb; ++s) acc[s][x] += a*w[s];
+                }
+            }
+        }
+    }
+    /* a super-block is one 16-filter block or two 8-filter blocks */
+    for(s = 0; s < nsb; ++s){
+        for(x = 0; x < n; ++x){
+            float r[NCHWC_LANES];
+            nchwc_vec v = acc[s][x]*scale[s] + bias[s];
+            memcpy(r, &v, sizeof(v));
+            for(h = 0; h < NCHWC_LANES/block; ++h){
+                int f = (sb + s)*NCHWC_LANES/block + h;
+                if(f < blocks) memcpy(out + f*plane + x*block, r + h*block, block*sizeof(float));
+            }
+        }
+    }
+}
+
+static inline __attribute__((always_inline))
+void nchwc_conv(const int nsb, const int xb, const int ps, const int size, int block, int batch,
+        float *im, int channels, int height, int width, int stride, float *packed,
+        int filters, float *scales, float *biases, int out_h, int out_w, float *output, int t0, int t1)
+{
+    int blocks = filters/block;
+    int sbs = (filters + NCHWC_LANES - 1)/NCHWC_LANES;
+    int groups = (sbs + nsb - 1)/nsb;
+    int pixels = out_h*out_w;
+    int tiles = (pixels + xb - 1)/xb;
+    size_t sb_size = (size_t)channels*size*size*NCHWC_LANES;
+    size_t plane = (size_t)pixels*block;
+    int t;
+    for(t = t0; t < t1; ++t){
+        int b = t/(groups*tiles);
+        int sb = t/tiles%groups*nsb;
+        int p0 = t%tiles*xb;
+        int n = (pixels - p0 < xb) ? pixels - p0 : xb;
+        float *in = im + (size_t)b*channels*height*width;
+        float *pf = packed + sb*sb_size;
+        float *out = output + (size_t)b*blocks*plane + (size_t)p0*block;
+        int off[NCHWC_MAX_XB];
+        int x;
+        for(x = 0; x < xb; ++x){
+            /* the tail tile repeats its last pixel rather than branching */
+            int p = (x < n) ? p0 + x : p0 + n - 1;
+            off[x] = (p/out_w*stride*width + p%out_w*stride)*ps;
+        }
+        /* odd super-block out */
+        int odd = nsb > 1 && sb + 1 == sbs;
+        nchwc_vec scale[2], bias[2];
+        memcpy(scale, scales + sb*NCHWC_LANES, (odd ? 1 : nsb)*sizeof(nchwc_vec));
+        memcpy(bias, biases + sb*NCHWC_LANES, (odd ? 1 : nsb)*sizeof(nchwc_vec));
+        if(odd){
+            nchwc_conv_tile(1, xb, ps, size, in, channels, height, width, off, n, pf, sb_size, scale, bias, block, blocks, sb, plane, out);
+        } else {
+            nchwc_conv_tile(nsb, xb, ps, size, in, channels, height, width, off, n, pf, sb_size, scale, bias, block, blocks, sb, plane, out);
+        }
+    }
+}
+
+static inline __attribute__((always_inline))
+void nchwc_conv_size(const int nsb, const int xb, const int ps, int size, int block, int batch,
+        float *im, int channels, int height, int width, int stride, float *packed,
+        int filters, float *scales, float *biases, int out_h, int out_w, float *output, int t0, int t1)
+{
+    if(size == 1){
+        nchwc_conv(nsb, xb, ps, 1, block, batch, im, channels, height, width, stride, packed, filters, scales, biases, out_h, out_w, output, t0, t1);
+    } else if(size == 3){
+        nchwc_conv(nsb, xb, ps, 3, block, batch, im, channels, height, width, stride, packed, filters, scales, biases, out_h, out_w, output, t0, t1);
+    } else {
+        nchwc_conv(nsb, xb, ps, size, block, batch, im, channels, height, width, stride, packed, filters, scales, biases, out_h, out_w, output, t0, t1);
+    }
+}
+
+static inline __attribute__((always_inline))
+void nchwc_conv_input(const int nsb, const int xb, int in_block, int size, int block, int batch,
+        float *im, int channels, int height, int width, int stride, float *packed,
+        int filters, float *scales, float *biases, int out_h, int out_w, float *output, int t0, int t1)
+{
+    if(in_block == 16){
+        nchwc_conv_size(nsb, xb, 16, size, block, batch, im, channels, height, width, stride, packed, filters, scales, biases, out_h, out_w, output, t0, t1);
+    } else if(in_block == 8){
+        nchwc_conv_size(nsb, xb, 8, size, block, batch, im, channels, height, width, stride, packed, filters, scales, biases, out_h, out_w, output, t0, t1);
+    } else {
+        nchwc_conv_size(nsb, xb, 1, size, block, batch, im, channels, height, width, stride, packed, filters, scales, biases, out_h, out_w, output, t0, t1);
+    }
+}
+
+typedef struct {
+    int wide;
+    int in_block, size, block, batch;
+    float *im;
+    int channels, height, width, stride;
+    float *packed;
+    int filters;
+    float *scales, *biases;
+    int out_h, out_w;
+    float *output;
+} nchwc_conv_args;
+
+SIMD_CLONES
+static void nchwc_conv_tiles(void *ptr, int begin, int end)
+{
+    nchwc_conv_args *a = ptr;
+    if(a->wide){
+        nchwc_conv_input(2, 8, a->in_block, a->size, a->block, a->batch, a->im, a->channels, a->height, a->width, a->stride,
+                a->packed, a->filters, a->scales, a->biases, a->out_h, a->out_w, a->output, begin, end);
+    } else {
+        nchwc_conv_input(1, 6, a->in_block, a->size, a->block, a->batch, a->im, a->channels, a->height, a->width, a->stride,
+                a->packed, a->filters, a->scales, a->biases, a->out_h, a->out_w, a->output, begin, end);
+    }
+}
+
+static __thread thread_buffer nchwc_padded;
+
+/* copies planes of h*w pixels, ps floats each, into the middle of
+ * zeroed (h+2*pad)*(w+2*pad) planes */
+static void nchwc_pad(float *in, int planes, int h, int w, int ps, int pad, float *out)
+{
+    int ph = h + 2*pad;
+    int pw = w + 2*pad;
+    int t;
+    memset(out, 0, (size_t)planes*ph*pw*ps*sizeof(float));
+    for(t = 0; t < planes*h; ++t){
+        int c = t/h;
+        int y = t%h;
+        memcpy(out + (((size_t)c*ph + y + pad)*pw + pad)*ps,
+               in + ((size_t)c*h + y)*w*ps, (size_t)w*ps*sizeof(float));
+    }
+}
+
+/* 2x16 filters by 8 pixels with AVX-512, 16 by 6 otherwise */
+static int nchwc_wide = 0;
+static pthread_once_t nchwc_wide_once = PTHREAD_ONCE_INIT;
+
+static void select_nchwc_tiles(void)
+{
+#ifdef NCHWC_X86
+    __builtin_cpu_init();
+    nchwc_wide = __builtin_cpu_supports("avx512f");
+#endif
+}
+
+/**
+ * Convolution with a packed output and either a plain (in_block 0) or a
+ * packed input, followed by a per-filter scale and bias.
+ * @param block Output channel block, 8 or 16; filters must be a multiple
+ * @param packed Filters, scales and biases as update_nchwc_weights lays
+ * them out
+ */
+void nchwc_conv_cpu(int block, float *im, int in_block, int channels, int height, int width,
+        int size, int stride, int pad, float *packed, int filters,
+        int batch, int out_h, int out_w, float *output)
+{
+    int ks = channels*size*size;
+    int sbs = (filters + NCHWC_LANES - 1)/NCHWC_LANES;
+    float *sc = packed + (size_t)sbs*NCHWC_LANES*ks;
+    float *bi = sc + sbs*NCHWC_LANES;
+    if(pad){
+        int planes = batch*channels/(in_block ? in_block : 1);
+        size_t np = (size_t)batch*channels*(height + 2*pad)*(width + 2*pad);
+        float *padded = grow_thread_buffer(&nchwc_padded, np*sizeof(float));
+        nchwc_pad(im, planes, height, width, in_block ? in_block : 1, pad, padded);
+        im = padded;
+        height += 2*pad;
+        width += 2*pad;
+    }
+    /* the same tile shapes as the gemm micro-kernels: 2x16 filters by 8
+     * pixels fills AVX-512's 32 registers, 16 by 6 AVX2's 16 */
+    pthread_once(&nchwc_wide_once, select_nchwc_tiles);
+    int wide = nchwc_wide;
+    int nsb = wide ? 2 : 1;
+    int xb = wide ? 8 : 6;
+    nchwc_conv_args a = {wide, in_block, size, block, batch, im, channels, height, width, stride,
+        packed, filters, sc, bi, out_h, out_w, output};
+    int tiles = batch*((sbs + nsb - 1)/nsb)*((out_h*out_w + xb - 1)/xb);
+    parallel_for(tiles, 1, nchwc_conv_tiles, &a);
+}
+
+static void nchwc_maxpool_rows(void *ptr, int begin, int end)
+{
+    nchwc_args *a = ptr;
+    int block = a->block, height = a->height, width = a->width;
+    int size = a->size, stride = a->stride, out_h = a->out_h, out_w = a->out_w;
+    int offset = -a->pad/2;
+    int t;
+    for(t = begin; t < end; ++t){
+        int c = t/out_h;
+        int oy = t%out_h;
+        float *plane = a->in + (size_t)c*height*width*block;
+        float *dst = a->out + ((size_t)c*out_h + oy)*out_w*block;
+        int ox, n, m, j;
+        for(ox = 0; ox < out_w; ++ox){
+            float max[16];
+            for(j = 0; j < block; ++j) max[j] = -FLT_MAX;
+            for(n = 0; n < size; ++n){
+                int iy = offset + oy*stride + n;
+                if(iy < 0 || iy >= height) continue;
+                for(m = 0; m < size; ++m){
+                    int ix = offset + ox*stride + m;
+                    if(ix < 0 || ix >= width) continue;
+                    float *p = plane + ((size_t)iy*width + ix)*block;
+                    for(j = 0; j < block; ++j) max[j] = (p[j] > max[j]) ? p[j] : max[j];
+                }
+            }
+            memcpy(dst + ox*block, max, block*sizeof(float));
+        }
+    }
+}
+
+void nchwc_maxpool_cpu(int block, float *in, int channels, int height, int width,
+        int size, int stride, int pad, int out_h, int out_w, float *out)
+{
+    nchwc_args a = {block, in, out, 1, channels, height, width, 0, size, stride, pad, out_h, out_w};
+    parallel_for(channels/block*out_h, 4, nchwc_maxpool_rows, &a);
+}
+
+static void nchwc_upsample_rows(void *ptr, int begin, int end)
+{
+    nchwc_args *a = ptr;
+    int block = a->block, width = a->width, stride = a->stride;
+    int out_h = a->height*stride;
+    int out_w = width*stride;
+    int t;
+    for(t = begin; t < end; ++t){
+        int c = t/out_h;
+        int oy = t%out_h;
+        float *src = a->in + ((size_t)c*a->height + oy/stride)*width*block;
+        float *dst = a->out + ((size_t)c*out_h + oy)*out_w*block;
+        int ox, j;
+        for(ox = 0; ox < out_w; ++ox){
+            for(j = 0; j < block; ++j) dst[ox*block + j] = a->scale*src[ox/stride*block + j];
+        }
+    }
+}
+
+void nchwc_upsample_cpu(int block, float *in, int channels, int height, int width,
+        int stride, float scale, float *out)
+{
+    nchwc_args a = {block, in, out, 1, channels, height, width, 0, 0, stride};
+    a.scale = scale;
+    parallel_for(channels/block*height*stride, 4, nchwc_upsample_rows, &a);
+}
+
+static void nchwc_scale_bias_planes(void *ptr, int begin, int end)
+{
+    nchwc_args *a = ptr;
+    int block = a->block, spatial = a->spatial;
+    int t;
+    for(t = begin; t < end; ++t){
+        int c = t%(a->channels/block)*block;
+        float *p = a->out + (size_t)t*spatial*block;
+        float *scales = a->scales + c;
+        float *biases = a->biases + c;
+        int i, j;
+        for(i = 0; i < spatial; ++i){
+            for(j = 0; j < block; ++j) p[i*block + j] = p[i*block + j]*scales[j] + biases[j];
+        }
+    }
+}
+
+void nchwc_scale_bias_cpu(int block, float *x, int batch, int channels, int spatial, float *scales, float *biases)
+{
+    nchwc_args a = {block, x, x, batch, channels, 0, 0, spatial};
+    a.scales = scales;
+    a.biases = biases;
+    parallel_for(batch*channels/block, 1, nchwc_scale_bias_planes, &a);
+}
+
+static int nchwc_supported(layer l, int block)
+{
+    switch(l.type){
+        case CONVOLUTIONAL:
+            return l.groups == 1 && !l.binary && !l.xnor && l.n%block == 0;
+        case MAXPOOL:
+        case BATCHNORM:
+            return l.c%block == 0;
+        case UPSAMPLE:
+            return !l.reverse && l.c%block == 0;
+        case SHORTCUT:
+            return l.w == l.out_w && l.h == l.out_h && l.c == l.out_c && l.c%block == 0;
+        case ROUTE:
+            return l.out_c && l.out_c%block == 0;
+        default:
+            return 0;
+    }
+}
+
+/* Route, shortcut and dropout layers read another layer's output buffer as
+ * is, so they and their sources must agree on the layout */
+static int unify_layout(layer *a, layer *b)
+{
+    if(a->nchwc == b->nchwc) return 0;
+    a->nchwc = b->nchwc = 0;
+    return 1;
+}
+
+/* Convolutions: filters as [super-block][channel][ky][kx][16 filters], zero
+ * past the last filter, then the scales and the biases of every super-block
+ * filter. Batchnorm layers: their scales and biases. */
+static size_t nchwc_weights_size(layer l)
+{
+    if(l.type == BATCHNORM) return 2*(size_t)l.out_c;
+    int sbs = (l.n + NCHWC_LANES - 1)/NCHWC_LANES;
+    return (size_t)sbs*NCHWC_LANES*(l.c*l.size*l.size + 2);
+}
+
+/**
+ * Repacks a packed layer's filters and folds its batchnorm and bias again
+ * after its weights change. Does nothing for layers that aren't packed.
+ */
+void update_nchwc_weights(layer l)
+{
+    if(!l.nchwc_weights) return;
+    if(l.type == BATCHNORM){
+        inference_scale_bias(l, l.out_c, l.nchwc_weights, l.nchwc_weights + l.out_c);
+        return;
+    }
+    int ks = l.c*l.size*l.size;
+    int sbs = (l.n + NCHWC_LANES - 1)/NCHWC_LANES;
+    float *sc = l.nchwc_weights + (size_t)sbs*NCHWC_LANES*ks;
+    int f, k;
+    for(f = 0; f < l.n; ++f){
+        float *w = l.weights + (size_t)f*ks;
+        float *p = l.nchwc_weights + (size_t)f/NCHWC_LANES*NCHWC_LANES*ks + f%NCHWC_LANES;
+        for(k = 0; k < ks; ++k) p[k*NCHWC_LANES] = w[k];
+    }
+    inference_scale_bias(l, l.n, sc, sc + sbs*NCHWC_LANES);
+}
+
+/**
+ * Picks the layout of every layer's output for CPU inference. Layers that
+ * can run on channel blocks (convolutional, maxpool, batchnorm, upsample,
+ * shortcut, route) produce packed outputs; the rest, and the last layer,
+ * stay plain so heads and callers still see NCHW.
+ * @param net Network
+ * @param block Channels per block, 8 or 16, or 0 for plain NCHW everywhere
+ */
+void set_network_layout(network *net, int block)
+{
+    int i, j, changed, packed = 0;
+    size_t most = 0;
+    if(block != 0 && block != 8 && block != 16){
+        fprintf(stderr, "Channel block must be 8 or 16, using nchw\n");
+        block = 0;
+    }
+    /* the graph rewrites assume plain NCHW outputs */
+    if(block) unoptimize_network(net);
+    net->nchwc = block;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        l->nchwc = (block && nchwc_supported(*l, block)) ? block : 0;
+    }
+    if(net->n) net->layers[net->n-1].nchwc = 0;
+    do{
+        changed = 0;
+        for(i = 0; i < net->n; ++i){
+            layer *l = net->layers + i;
+            if(l->type == ROUTE){
+                for(j = 0; j < l->n; ++j) changed |= unify_layout(l, net->layers + l->input_layers[j]);
+            } else if(l->type == SHORTCUT){
+                changed |= unify_layout(l, net->layers + l->index);
+            } else if(l->type == DROPOUT && i > 0){
+                changed |= unify_layout(l, net->layers + i - 1);
+            }
+        }
+    } while(changed);
+
+    /* clones share the original's packed weights, their layouts are the same */
+    for(i = 0; i < net->n && !net->parent; ++i){
+        layer *l = net->layers + i;
+        free(l->nchwc_weights);
+        l->nchwc_weights = 0;
+        if(l->nchwc && (l->type == CONVOLUTIONAL || l->type == BATCHNORM)){
+            l->nchwc_weights = safe_calloc(nchwc_weights_size(*l), sizeof(float));
+            update_nchwc_weights(*l);
+        }
+    }
+
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.nchwc) ++packed;
+        if((size_t)l.inputs*l.batch > most) most = (size_t)l.inputs*l.batch;
+        if((size_t)l.outputs*l.batch > most) most = (size_t)l.outputs*l.batch;
+    }
+    free(net->nchwc_buffer);
+    net->nchwc_buffer = 0;
+    if(block){
+        net->nchwc_buffer = safe_calloc(most, sizeof(float));
+        fprintf(stderr, "NCHW%dc layout: %d of %d layers packed\n", block, packed, net->n);
+    }
+    /* the buffer and any outputs given back above are for the current size */
+    if(net->reserved_batch) reserve_network(net, net->max_w, net->max_h);
+}
+
+static void forward_layer_nchwc(layer l, network net, int in_block)
+{
+    switch(l.type){
+        case CONVOLUTIONAL:
+            nchwc_conv_cpu(l.nchwc, net.input, in_block, l.c, l.h, l.w, l.size, l.stride, l.pad,
+                    l.nchwc_weights, l.n, l.batch, l.out_h, l.out_w, l.output);
+            activate_array(l.output, l.outputs*l.batch, l.activation);
+            break;
+        case MAXPOOL:
+            nchwc_maxpool_cpu(l.nchwc, net.input, l.c*l.batch, l.h, l.w, l.size, l.stride, l.pad, l.out_h, l.out_w, l.output);
+            break;
+        case UPSAMPLE:
+            nchwc_upsample_cpu(l.nchwc, net.input, l.c*l.batch, l.h, l.w, l.stride, l.scale, l.output);
+            break;
+        case BATCHNORM:
+            copy_cpu(l.outputs*l.batch, net.input, 1, l.output, 1);
+            nchwc_scale_bias_cpu(l.nchwc, l.output, l.batch, l.out_c, l.out_h*l.out_w,
+                    l.nchwc_weights, l.nchwc_weights + l.out_c);
+            break;
+        default:
+            l.forward(l, net);
+    }
+}
+
+/**
+ * Inference forward pass over packed layers, reordering net.input wherever
+ * a layer expects a different layout than its predecessor produced.
+ * @param netp Network after set_network_layout
+ */
+void forward_network_nchwc(network *netp)
+{
+    network net = *netp;
+    int in_block = 0;
+    int in_c = net.c;
+    int in_spatial = net.h*net.w;
+    int i;
+    for(i = 0; i < net.n; ++i){
+        net.index = i;
+        layer l = net.layers[i];
+        /* convolutions read either layout, routes ignore net.input */
+        int want = (l.type == ROUTE || (l.type == CONVOLUTIONAL && l.nchwc)) ? in_block : l.nchwc;
+        if(want != in_block){
+            if(want) nchw_to_nchwc(net.input, l.batch, in_c, in_spatial, want, net.nchwc_buffer);
+            else nchwc_to_nchw(net.input, l.batch, in_c, in_spatial, in_block, net.nchwc_buffer);
+            net.input = net.nchwc_buffer;
+        }
+        double start = net.profile ? profile_clock() : 0;
+        if(l.nchwc) forward_layer_nchwc(l, net, want);
+        else l.forward(l, net);
+        if(net.profile) profile_layer(netp, i, PROFILE_FORWARD, start);
+        net.input = l.output;
+        in_block = l.nchwc;
+        in_c = l.out_c;
+        in_spatial = l.out_h*l.out_w;
+        if(l.truth) {
+            net.truth = l.output;
+        }
+    }
+    calc_network_cost(netp);
+}
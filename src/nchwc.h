@@ -0,0 +1,22 @@
+#ifndef NCHWC_H
+#define NCHWC_H
+#include "darknet.h"
+
+int get_layout(char *s);
+
+void nchw_to_nchwc(float *in, int batch, int channels, int spatial, int block, float *out);
+void nchwc_to_nchw(float *in, int batch, int channels, int spatial, int block, float *out);
+
+void nchwc_conv_cpu(int block, float *im, int in_block, int channels, int height, int width,
+        int size, int stride, int pad, float *packed, int filters,
+        int batch, int out_h, int out_w, float *output);
+void nchwc_maxpool_cpu(int block, float *in, int channels, int height, int width,
+        int size, int stride, int pad, int out_h, int out_w, float *out);
+void nchwc_upsample_cpu(int block, float *in, int channels, int height, int width,
+        int stride, float scale, float *out);
+void nchwc_scale_bias_cpu(int block, float *x, int batch, int channels, int spatial, float *scales, float *biases);
+
+void update_nchwc_weights(layer l);
+void forward_network_nchwc(network *net);
+
+#endif
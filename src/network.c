@@ -33,6 +33,13 @@
 #include "shortcut_layer.h"
 #include "parser.h"
 #include "data.h"
+#include "nchwc.h"
+#include "memory_plan.h"
+#include "graph_optimizer.h"
+#include "mmap_weights.h"
+#include "quantize.h"
+#include "profiler.h"
+#include "thread_pool.h"
 
 // Global synchronization context
 static sync_mutexes g_sync = {0};
@@ -71,6 +78,101 @@ network *load_network(char *cfg, char *weights, int clear)
     return net;
 }
 
+/**
+ * Loads a network for prediction only: no deltas, weight updates or
+ * optimizer state are kept, which train_network refuses.
+ */
+network *load_network_inference(char *cfg, char *weights)
+{
+    network *net = parse_network_cfg_inference(cfg);
+    if(weights && weights[0] != 0){
+        load_weights(net, weights);
+    }
+    return net;
+}
+
+/**
+ * Makes a network that can predict at the same time as net, from another
+ * thread. The clone shares all of net's parameters (weights, biases,
+ * batchnorm scales and rolling statistics, int8 and binary copies) and owns
+ * only what a forward pass writes: layer outputs, normalization scratch, the
+ * input and the workspace. Clones run on the CPU, can't be trained or
+ * resized, and have to be freed with free_network before net is.
+ */
+network *clone_network_for_inference(network *net)
+{
+    int i;
+    size_t workspace_size = 0;
+    network *clone = safe_calloc(1, sizeof(network));
+    *clone = *net;
+    clone->parent = net->parent ? net->parent : net;
+    clone->gpu_index = -1;
+    clone->inference = 1;
+    clone->train = 0;
+    clone->layers = safe_calloc(net->n, sizeof(layer));
+    clone->input = safe_calloc(net->inputs*net->batch, sizeof(float));
+    clone->truth = 0;
+    clone->delta = 0;
+    clone->cost = safe_calloc(1, sizeof(float));
+    clone->workspace = 0;
+    clone->nchwc_buffer = 0;
+    clone->output_arena = 0;
+    clone->output_arena_size = 0;
+    clone->profile = 0;
+    clone->reserved_batch = 0;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == RNN || l.type == GRU || l.type == LSTM || l.type == CRNN){
+            error("Recurrent layers keep state between passes and can't be cloned");
+        }
+        forget_layer_training(&l);
+        l.reserved = 0;
+        /* dropouts and aliases point into the clone's buffers below */
+        if(l.type != DROPOUT && !l.alias && l.output){
+            l.output = safe_calloc((size_t)l.outputs*l.batch, sizeof(float));
+        }
+        if(l.type == NORMALIZATION){
+            l.squared = safe_calloc((size_t)l.w*l.h*l.c*l.batch, sizeof(float));
+            l.norms = safe_calloc((size_t)l.w*l.h*l.c*l.batch, sizeof(float));
+        } else if(l.type == L2NORM){
+            l.scales = safe_calloc((size_t)l.inputs*l.batch, sizeof(float));
+        }
+        if(l.workspace_size > workspace_size) workspace_size = l.workspace_size;
+        clone->layers[i] = l;
+    }
+    if(workspace_size) clone->workspace = safe_calloc(1, workspace_size);
+    link_layer_outputs(clone);
+    if(net->nchwc) set_network_layout(clone, net->nchwc);
+    if(net->plan_memory) plan_network_memory(clone);
+    if(net->profile) set_network_profiling(clone, 1);
+    return clone;
+}
+
+/* Frees what clone_network_for_inference allocated, not the shared weights */
+static void free_network_clone(network *net)
+{
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == DROPOUT) continue;
+        if(!l.alias && !in_output_arena(net, l.output)) free(l.output);
+        if(l.type == NORMALIZATION){
+            free(l.squared);
+            free(l.norms);
+        } else if(l.type == L2NORM){
+            free(l.scales);
+        }
+    }
+    free_network_profile(net);
+    free(net->layers);
+    free(net->input);
+    free(net->cost);
+    free(net->workspace);
+    free(net->nchwc_buffer);
+    free(net->output_arena);
+    free(net);
+}
+
 size_t get_current_batch(network *net)
 {
     size_t batch_num = (*net->seen)/(net->batch*net->subdivisions);
@@ -179,6 +281,14 @@ char *get_layer_string(LAYER_TYPE a)
             return "normalization";
         case BATCHNORM:
             return "batchnorm";
+        case UPSAMPLE:
+            return "upsample";
+        case L2NORM:
+            return "l2norm";
+        case LOGXENT:
+            return "logistic";
+        case ISEG:
+            return "iseg";
         default:
             break;
     }
@@ -204,6 +314,12 @@ void forward_network(network *netp)
         return;
     }
 #endif
+    int limit = set_thread_pool_limit(netp->threads);
+    if(netp->nchwc && !netp->train){
+        forward_network_nchwc(netp);
+        set_thread_pool_limit(limit);
+        return;
+    }
     network net = *netp;
     int i;
     for(i = 0; i < net.n; ++i){
@@ -212,13 +328,16 @@ void forward_network(network *netp)
         if(l.delta){
             fill_cpu(l.outputs * l.batch, 0, l.delta, 1);
         }
+        double start = net.profile ? profile_clock() : 0;
         l.forward(l, net);
+        if(net.profile) profile_layer(netp, i, PROFILE_FORWARD, start);
         net.input = l.output;
         if(l.truth) {
             net.truth = l.output;
         }
     }
     calc_network_cost(netp);
+    set_thread_pool_limit(limit);
 }
 
 void update_network(network *netp)
@@ -229,6 +348,7 @@ void update_network(network *netp)
         return;
     }
 #endif
+    int limit = set_thread_pool_limit(netp->threads);
     network net = *netp;
     int i;
     update_args a = {0};
@@ -246,9 +366,14 @@ void update_network(network *netp)
     for(i = 0; i < net.n; ++i){
         layer l = net.layers[i];
         if(l.update){
+            double start = net.profile ? profile_clock() : 0;
             l.update(l, a);
+            if(net.profile) profile_layer(netp, i, PROFILE_UPDATE, start);
         }
+        /* batchnorm layers move their rolling statistics in forward */
+        if(l.type == BATCHNORM) update_nchwc_weights(l);
     }
+    set_thread_pool_limit(limit);
 }
 
 void calc_network_cost(network *netp)
@@ -279,6 +404,7 @@ void backward_network(network *netp)
         return;
     }
 #endif
+    int limit = set_thread_pool_limit(netp->threads);
     network net = *netp;
     int i;
     network orig = net;
@@ -293,12 +419,16 @@ void backward_network(network *netp)
             net.delta = prev.delta;
         }
         net.index = i;
+        double start = net.profile ? profile_clock() : 0;
         l.backward(l, net);
+        if(net.profile) profile_layer(netp, i, PROFILE_BACKWARD, start);
     }
+    set_thread_pool_limit(limit);
 }
 
 float train_network_datum(network *net)
 {
+    if(net->inference) error("Network was built with inference=1 and can't be trained");
     *net->seen += net->batch;
     net->train = 1;
     forward_network(net);
@@ -322,19 +452,42 @@ float train_network_sgd(network *net, data d, int n)
     return (float)sum/(n*batch);
 }
 
+/* Rows [offset, offset + n) of m one after another in memory */
+static int rows_contiguous(matrix m, int offset, int n)
+{
+    int i;
+    for(i = 1; i < n; ++i){
+        if(m.vals[offset + i] != m.vals[offset] + (size_t)i*m.cols) return 0;
+    }
+    return 1;
+}
+
 float train_network(network *net, data d)
 {
     assert(d.X.rows % net->batch == 0);
     int batch = net->batch;
     int n = d.X.rows / batch;
+    float *input = net->input;
+    float *truth = net->truth;
 
     int i;
     float sum = 0;
     for(i = 0; i < n; ++i){
-        get_next_batch(d, batch, i*batch, net->input, net->truth);
+        /* a contiguous batch is trained on where it is, not copied in */
+        if(d.X.cols == net->inputs && d.y.cols == net->truths &&
+                rows_contiguous(d.X, i*batch, batch) && rows_contiguous(d.y, i*batch, batch)){
+            net->input = d.X.vals[i*batch];
+            net->truth = d.y.vals[i*batch];
+        } else {
+            net->input = input;
+            net->truth = truth;
+            get_next_batch(d, batch, i*batch, net->input, net->truth);
+        }
         float err = train_network_datum(net);
         sum += err;
     }
+    net->input = input;
+    net->truth = truth;
     return (float)sum/(n*batch);
 }
 
@@ -364,6 +517,9 @@ void set_batch_network(network *net, int b)
         }
 #endif
     }
+    /* concatenating in place depends on the batch */
+    if(net->optimize) optimize_network(net);
+    if(net->reserved_batch) reserve_network(net, net->max_w, net->max_h);
 }
 
 /**
@@ -396,7 +552,7 @@ static void resize_layer_by_type(layer *l, int w, int h, network *net, int input
             resize_route_layer(l, net);
             break;
         case SHORTCUT:
-            resize_shortcut_layer(l, w, h);
+            resize_shortcut_layer(l, w, h, net->layers[l->index].out_w, net->layers[l->index].out_h);
             break;
         case UPSAMPLE:
             resize_upsample_layer(l, w, h);
@@ -460,13 +616,76 @@ static void update_network_buffers(network *net, size_t workspace_size)
 #endif
 }
 
+/* Shapes only: every buffer was reserved for the largest shape, the
+   memory plan and the graph rewrites hold for all smaller ones */
+static void resize_reserved_network(network *net, int w, int h)
+{
+    int i, inputs = 0;
+    net->w = w;
+    net->h = h;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        resize_layer_by_type(l, w, h, net, inputs);
+        inputs = l->outputs;
+        w = l->out_w;
+        h = l->out_h;
+        if(l->type == AVGPOOL) break;
+    }
+    layer out = get_network_output_layer(net);
+    net->inputs = net->layers[0].inputs;
+    net->outputs = out.outputs;
+    net->truths = out.outputs;
+    if(net->layers[net->n-1].truths) net->truths = net->layers[net->n-1].truths;
+    link_layer_outputs(net);
+}
+
+/**
+ * Sizes every buffer of net for inputs up to max_w x max_h at the current
+ * batch, so that resize_network up to that size only updates shapes and
+ * allocates nothing. Resizing past it reserves again for the larger size,
+ * and so does set_batch_network. GPU networks are left as they are.
+ */
+void reserve_network(network *net, int max_w, int max_h)
+{
+    int i, w = net->w, h = net->h;
+#ifdef GPU
+    if(net->gpu_index >= 0) return;
+#endif
+    if(net->parent) error("Network clones can't be resized, resize the original and clone it again");
+    if(max_w < w) max_w = w;
+    if(max_h < h) max_h = h;
+    net->reserved_batch = 0;
+    for(i = 0; i < net->n; ++i) net->layers[i].reserved = 0;
+    resize_network(net, max_w, max_h);
+    net->max_w = max_w;
+    net->max_h = max_h;
+    net->reserved_batch = net->batch;
+    for(i = 0; i < net->n; ++i) net->layers[i].reserved = 1;
+    resize_reserved_network(net, w, h);
+    fprintf(stderr, "Reserved for %d x %d at batch %d\n", max_w, max_h, net->batch);
+}
+
 int resize_network(network *net, int w, int h)
 {
+    if(net->parent) error("Network clones can't be resized, resize the original and clone it again");
+    if(net->reserved_batch){
+        if(w > net->max_w || h > net->max_h || net->batch > net->reserved_batch){
+            int max_w = w > net->max_w ? w : net->max_w;
+            int max_h = h > net->max_h ? h : net->max_h;
+            reserve_network(net, max_w, max_h);
+        }
+        resize_reserved_network(net, w, h);
+        return 0;
+    }
 #ifdef GPU
     cuda_set_device(net->gpu_index);
     cuda_free(net->workspace);
 #endif
     
+    /* outputs in the arena or inside other outputs can't be realloc'ed,
+       planned and optimized again below */
+    unplan_network_memory(net);
+    unoptimize_network(net);
     net->w = w;
     net->h = h;
     int inputs = 0;
@@ -477,6 +696,7 @@ int resize_network(network *net, int w, int h)
         layer l = net->layers[i];
         
         resize_layer_by_type(&l, w, h, net, inputs);
+        if(net->inference) free_layer_training(&l);
         
         // Update workspace size
         if(l.workspace_size > workspace_size) {
@@ -498,6 +718,9 @@ int resize_network(network *net, int w, int h)
     
     // Update network buffers with new dimensions
     update_network_buffers(net, workspace_size);
+    if(net->nchwc) set_network_layout(net, net->nchwc);
+    if(net->optimize) optimize_network(net);
+    if(net->plan_memory) plan_network_memory(net);
     
     return 0;
 }
@@ -588,12 +811,10 @@ int num_detections(network *net, float thresh)
     return s;
 }
 
-detection *make_network_boxes(network *net, float thresh, int *num)
+static detection *alloc_network_boxes(network *net, int nboxes)
 {
     layer l = net->layers[net->n - 1];
     int i;
-    int nboxes = num_detections(net, thresh);
-    if(num) *num = nboxes;
     detection *dets = safe_calloc(nboxes, sizeof(detection));
     if(!dets) {
         error("Failed to allocate memory for detections");
@@ -613,6 +834,13 @@ detection *make_network_boxes(network *net, float thresh, int *num)
     return dets;
 }
 
+detection *make_network_boxes(network *net, float thresh, int *num)
+{
+    int nboxes = num_detections(net, thresh);
+    if(num) *num = nboxes;
+    return alloc_network_boxes(net, nboxes);
+}
+
 void fill_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, detection *dets)
 {
     int j;
@@ -650,6 +878,92 @@ void free_detections(detection *dets, int n)
     free(dets);
 }
 
+/* Layer l as batch item b alone sees it, so the batch 1 decoders read that
+   item's output (and skip their flipped-pair averaging for batch 2) */
+static layer batch_item_layer(layer l, int b)
+{
+    l.output += (size_t)b*l.outputs;
+    l.batch = 1;
+    return l;
+}
+
+static int num_item_detections(network *net, float thresh, int b)
+{
+    int i;
+    int s = 0;
+    for(i = 0; i < net->n; ++i){
+        layer l = batch_item_layer(net->layers[i], b);
+        if(l.type == YOLO){
+            s += yolo_num_detections(l, thresh);
+        }
+        if(l.type == DETECTION || l.type == REGION){
+            s += l.w*l.h*l.n;
+        }
+    }
+    return s;
+}
+
+static void fill_item_boxes(network *net, int b, int w, int h, float thresh, float hier, int *map, int relative, detection *dets)
+{
+    int j;
+    for(j = 0; j < net->n; ++j){
+        layer l = batch_item_layer(net->layers[j], b);
+        if(l.type == YOLO){
+            int count = get_yolo_detections(l, w, h, net->w, net->h, thresh, map, relative, dets);
+            dets += count;
+        }
+        if(l.type == REGION){
+            get_region_detections(l, w, h, net->w, net->h, thresh, map, hier, relative, dets);
+            dets += l.w*l.h*l.n;
+        }
+        if(l.type == DETECTION){
+            get_detection_detections(l, w, h, thresh, dets);
+            dets += l.w*l.h*l.n;
+        }
+    }
+}
+
+/**
+ * Detects objects in n images with one forward pass. Each image is
+ * letterboxed into its own slot of the input batch, and every batch item's
+ * yolo, region and detection outputs are decoded on their own, with boxes
+ * corrected for that image's size. The network's batch becomes n; if its
+ * buffers were built for fewer images they grow through resize_network,
+ * which clones can't do.
+ * @param num Gets the number of detections of each image
+ * @return n detection arrays, freed with free_batch_detections
+ */
+detection **network_detect_batch(network *net, image *ims, int n, float thresh, float hier, int *map, int relative, int *num)
+{
+    int b;
+    if(n != net->batch){
+        int grow = n > net->batch;
+        set_batch_network(net, n);
+        if(grow) resize_network(net, net->w, net->h);
+    }
+    for(b = 0; b < n; ++b){
+        image boxed = {net->w, net->h, net->c, net->input + (size_t)b*net->inputs};
+        fill_image(boxed, .5);
+        letterbox_image_into(ims[b], net->w, net->h, boxed);
+    }
+    network_predict(net, net->input);
+
+    detection **dets = safe_calloc(n, sizeof(detection *));
+    for(b = 0; b < n; ++b){
+        num[b] = num_item_detections(net, thresh, b);
+        dets[b] = alloc_network_boxes(net, num[b]);
+        fill_item_boxes(net, b, ims[b].w, ims[b].h, thresh, hier, map, relative, dets[b]);
+    }
+    return dets;
+}
+
+void free_batch_detections(detection **dets, int *num, int n)
+{
+    int b;
+    for(b = 0; b < n; ++b) free_detections(dets[b], num[b]);
+    free(dets);
+}
+
 float *network_predict_image(network *net, image im)
 {
     image imr = letterbox_image(im, net->w, net->h);
@@ -659,6 +973,64 @@ float *network_predict_image(network *net, image im)
     return p;
 }
 
+/**
+ * Calibrates the network for int8 inference. Runs the float network over
+ * the images to find each convolutional and connected layer's input range,
+ * then quantizes its weights per output channel.
+ * @param net Network with float weights and batch 1
+ * @param paths Calibration images, letterboxed to the network size
+ * @param n Number of images
+ */
+void quantize_network(network *net, char **paths, int n)
+{
+    int i, j;
+    if(net->weights_map) error("Can't quantize memory-mapped weights, load the classic weights file");
+    float *range = safe_calloc(net->n, sizeof(float));
+    int nchwc = net->nchwc;
+    /* calibrate on the float path, layer by layer in NCHW, with every
+       layer's input kept until the pass is over */
+    net->nchwc = 0;
+    unplan_network_memory(net);
+    unoptimize_network(net);
+    for(j = 0; j < net->n; ++j){
+        layer *l = &net->layers[j];
+        free(l->weights_int8);
+        free(l->weight_scales);
+        l->weights_int8 = 0;
+        l->weight_scales = 0;
+    }
+    for(i = 0; i < n; ++i){
+        image im = load_image_color(paths[i], 0, 0);
+        image sized = letterbox_image(im, net->w, net->h);
+        network_predict(net, sized.data);
+        for(j = 0; j < net->n; ++j){
+            layer l = net->layers[j];
+            if(!int8_supported(l)) continue;
+            float *in = j ? net->layers[j-1].output : sized.data;
+            int x;
+            for(x = 0; x < l.inputs; ++x){
+                if(fabs(in[x]) > range[j]) range[j] = fabs(in[x]);
+            }
+        }
+        free_image(im);
+        free_image(sized);
+        fprintf(stderr, "\rCalibrated %d/%d", i + 1, n);
+    }
+    fprintf(stderr, "\n");
+    for(j = 0; j < net->n; ++j){
+        layer *l = &net->layers[j];
+        if(!int8_supported(*l)) continue;
+        make_int8_weights(l);
+        l->input_scale = range[j] > 0 ? range[j]/127 : 1;
+        update_int8_weights(*l);
+    }
+    net->nchwc = nchwc;
+    if(net->optimize) optimize_network(net);
+    if(net->plan_memory) plan_network_memory(net);
+    if(net->reserved_batch) reserve_network(net, net->max_w, net->max_h);
+    free(range);
+}
+
 int network_width(network *net){return net->w;}
 int network_height(network *net){return net->h;}
 
@@ -805,12 +1177,22 @@ float network_accuracy_multi(network *net, data d, int n)
 void free_network(network *net)
 {
     int i;
+    if(net->parent){
+        free_network_clone(net);
+        return;
+    }
+    free_network_profile(net);
+    release_mapped_weights(net);
     for(i = 0; i < net->n; ++i){
-        free_layer(net->layers[i]);
+        layer l = net->layers[i];
+        if(l.alias || in_output_arena(net, l.output)) l.output = 0;
+        free_layer(l);
     }
     free(net->layers);
+    free(net->output_arena);
     if(net->input) free(net->input);
     if(net->truth) free(net->truth);
+    if(net->nchwc_buffer) free(net->nchwc_buffer);
 #ifdef GPU
     if(net->input_gpu) cuda_free(net->input_gpu);
     if(net->truth_gpu) cuda_free(net->truth_gpu);
@@ -1,4 +1,5 @@
 #include "normalization_layer.h"
+#include "layer.h"
 #include "blas.h"
 
 #include <stdio.h>
@@ -48,10 +49,10 @@ void resize_normalization_layer(layer *layer, int w, int h)
     layer->out_w = w;
     layer->inputs = w*h*c;
     layer->outputs = layer->inputs;
-    layer->output = safe_realloc(layer->output, h * w * c * batch * sizeof(float));
-    layer->delta = safe_realloc(layer->delta, h * w * c * batch * sizeof(float));
-    layer->squared = safe_realloc(layer->squared, h * w * c * batch * sizeof(float));
-    layer->norms = safe_realloc(layer->norms, h * w * c * batch * sizeof(float));
+    layer->output = resize_layer_buffer(layer, layer->output, h * w * c * batch * sizeof(float));
+    layer->delta = resize_layer_buffer(layer, layer->delta, h * w * c * batch * sizeof(float));
+    layer->squared = resize_layer_buffer(layer, layer->squared, h * w * c * batch * sizeof(float));
+    layer->norms = resize_layer_buffer(layer, layer->norms, h * w * c * batch * sizeof(float));
 #ifdef GPU
     cuda_free(layer->output_gpu);
     cuda_free(layer->delta_gpu); 
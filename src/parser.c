@@ -2,6 +2,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "activation_layer.h"
 #include "logistic_layer.h"
@@ -36,6 +38,13 @@
 #include "softmax_layer.h"
 #include "lstm_layer.h"
 #include "utils.h"
+#include "nchwc.h"
+#include "quantize.h"
+#include "xnor.h"
+#include "mmap_weights.h"
+#include "profiler.h"
+#include "thread_pool.h"
+#include "network.h"
 
 typedef struct{
     char *type;
@@ -215,6 +224,9 @@ convolutional_layer parse_convolutional(list *options, size_params params)
     convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,groups,size,stride,padding,activation, batch_normalize, binary, xnor, params.net->adam);
     layer.flipped = option_find_int_quiet(options, "flipped", 0);
     layer.dot = option_find_float_quiet(options, "dot", 0);
+    char *algorithm_s = option_find(options, "algorithm");
+    if(algorithm_s) set_convolutional_algorithm(&layer, get_conv_algorithm(algorithm_s));
+    else if(params.net->inference) set_convolutional_algorithm(&layer, default_conv_algorithm(layer, 1));
 
     return layer;
 }
@@ -789,6 +801,12 @@ void parse_net_options(list *options, network *net)
     parse_augmentation_params(options, net);
     parse_learning_policy(options, net);
     net->max_batches = option_find_int(options, "max_batches", 0);
+    char *layout_s = option_find(options, "layout");
+    if(layout_s) net->nchwc = get_layout(layout_s);
+    net->threads = option_find_int_quiet(options, "threads", 0);
+    net->inference = option_find_int_quiet(options, "inference", 0);
+    net->max_w = option_find_int_quiet(options, "max_w", 0);
+    net->max_h = option_find_int_quiet(options, "max_h", 0);
 }
 
 int is_network(section *s)
@@ -908,7 +926,7 @@ static void finalize_network(network *net, size_t workspace_size)
     }
 }
 
-network *parse_network_cfg(char *filename)
+static network *parse_network_cfg_mode(char *filename, int inference, int batch)
 {
     list *sections = read_cfg(filename);
     node *n = sections->front;
@@ -921,6 +939,13 @@ network *parse_network_cfg(char *filename)
     list *options = s->options;
     if(!is_network(s)) error("First section must be [net] or [network]");
     parse_net_options(options, net);
+    if(inference) net->inference = 1;
+    if(batch > 0){
+        net->batch = batch;
+        net->subdivisions = 1;
+    }
+    net->plan_memory = option_find_int_quiet(options, "plan_memory", net->inference);
+    net->optimize = option_find_int_quiet(options, "optimize", net->inference);
     
     size_params params;
     initialize_network_params(&params, net);
@@ -948,6 +973,9 @@ network *parse_network_cfg(char *filename)
         
         apply_layer_options(&l, options, net);
         option_unused(options);
+        /* each layer drops its training buffers as soon as it is built, so
+           they never all exist at once */
+        if(net->inference) free_layer_training(&l);
         
         net->layers[count] = l;
         if (l.workspace_size > workspace_size) workspace_size = l.workspace_size;
@@ -961,10 +989,34 @@ network *parse_network_cfg(char *filename)
     
     free_list(sections);
     finalize_network(net, workspace_size);
+    if(net->nchwc) set_network_layout(net, net->nchwc);
+    if(net->optimize) optimize_network(net);
+    if(net->plan_memory) plan_network_memory(net);
+    if(net->max_w > net->w || net->max_h > net->h) reserve_network(net, net->max_w, net->max_h);
+    profile_network_from_environment(net);
     
     return net;
 }
 
+network *parse_network_cfg(char *filename)
+{
+    return parse_network_cfg_mode(filename, 0, 0);
+}
+
+/* Builds the network without the gradient, batch statistics and optimizer
+   buffers training needs, as if its [net] section said inference=1 */
+network *parse_network_cfg_inference(char *filename)
+{
+    return parse_network_cfg_mode(filename, 1, 0);
+}
+
+/* Builds the network with batch in place of the cfg's batch and
+   subdivisions, for training or, with inference set, for prediction only */
+network *parse_network_cfg_batch(char *filename, int batch, int inference)
+{
+    return parse_network_cfg_mode(filename, inference, batch);
+}
+
 list *read_cfg(char *filename)
 {
     FILE *file = fopen(filename, "r");
@@ -1007,9 +1059,9 @@ void save_convolutional_weights_binary(layer l, FILE *fp)
         pull_convolutional_layer(l);
     }
 #endif
-    binarize_weights(l.weights, l.n, l.c*l.size*l.size, l.binary_weights);
-    int size = l.c*l.size*l.size;
+    int size = l.c/l.groups*l.size*l.size;
     int i, j, k;
+    binarize_weights(l.weights, l.n, size, l.binary_weights);
     fwrite(l.biases, sizeof(float), l.n, fp);
     if (l.batch_normalize){
         fwrite(l.scales, sizeof(float), l.n, fp);
@@ -1020,7 +1072,7 @@ void save_convolutional_weights_binary(layer l, FILE *fp)
         float mean = l.binary_weights[i*size];
         if(mean < 0) mean = -mean;
         fwrite(&mean, sizeof(float), 1, fp);
-        for(j = 0; j < size/8; ++j){
+        for(j = 0; j < (size + 7)/8; ++j){
             int index = i*size + j*8;
             unsigned char c = 0;
             for(k = 0; k < 8; ++k){
@@ -1081,7 +1133,24 @@ void save_connected_weights(layer l, FILE *fp)
     }
 }
 
-void save_weights_upto(network *net, char *filename, int cutoff)
+/* An int8 layer is stored as its biases, batchnorm parameters, input
+   scale, per-channel weight scales, then the int8 weights */
+static void save_int8_weights(layer l, FILE *fp)
+{
+    int n = l.type == CONNECTED ? l.outputs : l.n;
+    size_t num = l.type == CONNECTED ? (size_t)l.outputs*l.inputs : (size_t)l.nweights;
+    fwrite(l.biases, sizeof(float), n, fp);
+    if (l.batch_normalize){
+        fwrite(l.scales, sizeof(float), n, fp);
+        fwrite(l.rolling_mean, sizeof(float), n, fp);
+        fwrite(l.rolling_variance, sizeof(float), n, fp);
+    }
+    fwrite(&l.input_scale, sizeof(float), 1, fp);
+    fwrite(l.weight_scales, sizeof(float), n, fp);
+    fwrite(l.weights_int8, sizeof(signed char), num, fp);
+}
+
+static void save_weights_file(network *net, char *filename, int cutoff, int minor)
 {
 #ifdef GPU
     if(net->gpu_index >= 0){
@@ -1093,7 +1162,6 @@ void save_weights_upto(network *net, char *filename, int cutoff)
     if(!fp) file_error(filename);
 
     int major = 0;
-    int minor = 2;
     int revision = 0;
     fwrite(&major, sizeof(int), 1, fp);
     fwrite(&minor, sizeof(int), 1, fp);
@@ -1104,6 +1172,15 @@ void save_weights_upto(network *net, char *filename, int cutoff)
     for(i = 0; i < net->n && i < cutoff; ++i){
         layer l = net->layers[i];
         if (l.dontsave) continue;
+        if(minor == INT8_WEIGHTS_MINOR && int8_supported(l)){
+            if(!l.weights_int8) error("Layer was not quantized");
+            save_int8_weights(l, fp);
+            continue;
+        }
+        if(minor == BINARY_WEIGHTS_MINOR && l.type == CONVOLUTIONAL && (l.binary || l.xnor)){
+            save_convolutional_weights_binary(l, fp);
+            continue;
+        }
         if(l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL){
             save_convolutional_weights(l, fp);
         } if(l.type == CONNECTED){
@@ -1154,11 +1231,36 @@ void save_weights_upto(network *net, char *filename, int cutoff)
     }
     fclose(fp);
 }
+
+void save_weights_upto(network *net, char *filename, int cutoff)
+{
+    save_weights_file(net, filename, cutoff, 2);
+}
+
 void save_weights(network *net, char *filename)
 {
     save_weights_upto(net, filename, net->n);
 }
 
+/**
+ * Saves a network quantized by quantize_network. Layers that run int8 are
+ * stored as int8; load_weights recognizes the file by its minor version.
+ */
+void save_weights_int8(network *net, char *filename)
+{
+    save_weights_file(net, filename, net->n, INT8_WEIGHTS_MINOR);
+}
+
+/**
+ * Saves binary and xnor convolutional layers at 1 bit per weight plus a
+ * scale per filter, which is all their forward pass uses. The latent float
+ * weights are lost, so this is for deployment rather than training.
+ */
+void save_weights_binary(network *net, char *filename)
+{
+    save_weights_file(net, filename, net->n, BINARY_WEIGHTS_MINOR);
+}
+
 void transpose_matrix(float *a, int rows, int cols)
 {
     float *transpose = calloc(rows*cols, sizeof(float));
@@ -1201,6 +1303,7 @@ void load_batchnorm_weights(layer l, FILE *fp)
     fread(l.scales, sizeof(float), l.c, fp);
     fread(l.rolling_mean, sizeof(float), l.c, fp);
     fread(l.rolling_variance, sizeof(float), l.c, fp);
+    update_nchwc_weights(l);
 #ifdef GPU
     if(gpu_index >= 0){
         push_batchnorm_layer(l);
@@ -1216,12 +1319,12 @@ void load_convolutional_weights_binary(layer l, FILE *fp)
         fread(l.rolling_mean, sizeof(float), l.n, fp);
         fread(l.rolling_variance, sizeof(float), l.n, fp);
     }
-    int size = l.c*l.size*l.size;
+    int size = l.c/l.groups*l.size*l.size;
     int i, j, k;
     for(i = 0; i < l.n; ++i){
         float mean = 0;
         fread(&mean, sizeof(float), 1, fp);
-        for(j = 0; j < size/8; ++j){
+        for(j = 0; j < (size + 7)/8; ++j){
             int index = i*size + j*8;
             unsigned char c = 0;
             fread(&c, sizeof(char), 1, fp);
@@ -1231,6 +1334,7 @@ void load_convolutional_weights_binary(layer l, FILE *fp)
             }
         }
     }
+    update_binary_weights(l);
 #ifdef GPU
     if(gpu_index >= 0){
         push_convolutional_layer(l);
@@ -1259,6 +1363,10 @@ void load_convolutional_weights(layer l, FILE *fp)
     if (l.flipped) {
         transpose_matrix(l.weights, l.c*l.size*l.size, l.n);
     }
+    update_winograd_weights(l);
+    update_direct_weights(l);
+    update_nchwc_weights(l);
+    update_binary_weights(l);
     
 #ifdef GPU
     if(gpu_index >= 0){
@@ -1268,7 +1376,8 @@ void load_convolutional_weights(layer l, FILE *fp)
 }
 
 
-static void read_weights_header(FILE *fp, network *net, int *transpose)
+/* Returns the minor version */
+static int read_weights_header(FILE *fp, network *net, int *transpose)
 {
     int major, minor, revision;
     fread(&major, sizeof(int), 1, fp);
@@ -1283,6 +1392,35 @@ static void read_weights_header(FILE *fp, network *net, int *transpose)
         *net->seen = iseen;
     }
     *transpose = (major > 1000) || (minor > 1000);
+    return minor;
+}
+
+static void load_int8_weights(layer *l, FILE *fp)
+{
+    int n = l->type == CONNECTED ? l->outputs : l->n;
+    size_t num = l->type == CONNECTED ? (size_t)l->outputs*l->inputs : (size_t)l->nweights;
+    make_int8_weights(l);
+    fread(l->biases, sizeof(float), n, fp);
+    if (l->batch_normalize){
+        fread(l->scales, sizeof(float), n, fp);
+        fread(l->rolling_mean, sizeof(float), n, fp);
+        fread(l->rolling_variance, sizeof(float), n, fp);
+    }
+    fread(&l->input_scale, sizeof(float), 1, fp);
+    fread(l->weight_scales, sizeof(float), n, fp);
+    fread(l->weights_int8, sizeof(signed char), num, fp);
+    dequantize_int8_weights(*l);
+    if(l->type == CONVOLUTIONAL){
+        update_winograd_weights(*l);
+        update_direct_weights(*l);
+        update_nchwc_weights(*l);
+    }
+#ifdef GPU
+    if(gpu_index >= 0){
+        if(l->type == CONVOLUTIONAL) push_convolutional_layer(*l);
+        else push_connected_layer(*l);
+    }
+#endif
 }
 
 static void load_lstm_weights(layer l, FILE *fp, int transpose)
@@ -1359,7 +1497,118 @@ static void load_layer_weights(layer l, FILE *fp, int transpose)
     }
 }
 
-void load_weights_upto(network *net, char *filename, int start, int cutoff)
+/* Bytes the loaders above read for l from a file with this minor version */
+static size_t layer_weights_bytes(layer l, int minor)
+{
+    size_t floats = 0;
+    int i, n;
+    if(l.dontload) return 0;
+    if(minor == INT8_WEIGHTS_MINOR && int8_supported(l)){
+        n = l.type == CONNECTED ? l.outputs : l.n;
+        size_t num = l.type == CONNECTED ? (size_t)l.outputs*l.inputs : (size_t)l.nweights;
+        return (n + (l.batch_normalize ? 3*n : 0) + 1 + n)*sizeof(float) + num;
+    }
+    if(minor == BINARY_WEIGHTS_MINOR && l.type == CONVOLUTIONAL && (l.binary || l.xnor)){
+        int size = l.c/l.groups*l.size*l.size;
+        floats = l.n + ((l.batch_normalize && !l.dontloadscales) ? 3*l.n : 0);
+        return floats*sizeof(float) + (size_t)l.n*(sizeof(float) + (size + 7)/8);
+    }
+    switch(l.type){
+        case CONVOLUTIONAL:
+        case DECONVOLUTIONAL:
+            n = l.numload ? l.numload : l.n;
+            floats = n + ((l.batch_normalize && !l.dontloadscales) ? 3*n : 0) + (size_t)l.c/l.groups*n*l.size*l.size;
+            break;
+        case CONNECTED:
+            floats = l.outputs + (size_t)l.outputs*l.inputs + ((l.batch_normalize && !l.dontloadscales) ? 3*l.outputs : 0);
+            break;
+        case BATCHNORM:
+            floats = 3*l.c;
+            break;
+        case LOCAL:
+            floats = l.outputs + (size_t)l.size*l.size*l.c*l.n*l.out_w*l.out_h;
+            break;
+        case CRNN:
+            return layer_weights_bytes(*l.input_layer, minor) + layer_weights_bytes(*l.self_layer, minor)
+                + layer_weights_bytes(*l.output_layer, minor);
+        case RNN:
+        case LSTM:
+        case GRU:
+            {
+                layer *subs[8] = {l.input_layer, l.self_layer, l.output_layer};
+                if(l.type == LSTM){
+                    layer *w[8] = {l.wi, l.wf, l.wo, l.wg, l.ui, l.uf, l.uo, l.ug};
+                    memcpy(subs, w, sizeof(w));
+                } else if(l.type == GRU){
+                    layer *w[8] = {l.wz, l.wr, l.wh, l.uz, l.ur, l.uh};
+                    memcpy(subs, w, sizeof(w));
+                }
+                size_t bytes = 0;
+                for(i = 0; i < 8 && subs[i]; ++i) bytes += layer_weights_bytes(*subs[i], minor);
+                return bytes;
+            }
+        default:
+            break;
+    }
+    return floats*sizeof(float);
+}
+
+static void load_layer(layer *l, FILE *fp, int minor, int transpose)
+{
+    if(minor == INT8_WEIGHTS_MINOR && int8_supported(*l) && !l->dontload){
+        load_int8_weights(l, fp);
+    } else if(minor == BINARY_WEIGHTS_MINOR && l->type == CONVOLUTIONAL && (l->binary || l->xnor) && !l->dontload){
+        load_convolutional_weights_binary(*l, fp);
+    } else {
+        load_layer_weights(*l, fp, transpose);
+    }
+    if(l->type == CONVOLUTIONAL && !l->dontload){
+        check_convolutional_algorithm(l);
+    }
+}
+
+typedef struct {
+    network *net;
+    int fd;
+    int minor, transpose;
+    int start;
+    size_t *offsets;
+    size_t *bytes;
+    double *read_time;
+    double *process_time;
+} weights_load_args;
+
+/* Layers start + [begin, end): each is read whole with pread, then parsed
+   from memory by the same loaders as a sequential read */
+static void load_layers_range(void *ptr, int begin, int end)
+{
+    weights_load_args *a = ptr;
+    int i;
+    for(i = begin; i < end; ++i){
+        layer *l = a->net->layers + a->start + i;
+        if(!a->bytes[i]) continue;
+        double t0 = what_time_is_it_now();
+        char *buf = safe_malloc(a->bytes[i]);
+        size_t got = 0;
+        while(got < a->bytes[i]){
+            ssize_t r = pread(a->fd, buf + got, a->bytes[i] - got, a->offsets[i] + got);
+            if(r <= 0) break;
+            got += r;
+        }
+        double t1 = what_time_is_it_now();
+        /* past the end of a truncated file the layer keeps its weights,
+           as fread would leave them */
+        FILE *fp = fmemopen(buf, got, "rb");
+        if(!fp) error("Couldn't read weights from memory");
+        load_layer(l, fp, a->minor, a->transpose);
+        fclose(fp);
+        free(buf);
+        a->read_time[i] = t1 - t0;
+        a->process_time[i] = what_time_is_it_now() - t1;
+    }
+}
+
+static void load_weights_file(network *net, char *filename, int start, int cutoff, int verbose)
 {
 #ifdef GPU
     if(net->gpu_index >= 0){
@@ -1368,17 +1617,75 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff)
 #endif
     
     fflush(stdout);
+    if(is_mmap_weights_file(filename)){
+        load_weights_mmap(net, filename, start, cutoff);
+        return;
+    }
+    double time = what_time_is_it_now();
     FILE *fp = fopen(filename, "rb");
     if(!fp) file_error(filename);
     
     int transpose;
-    read_weights_header(fp, net, &transpose);
+    int minor = read_weights_header(fp, net, &transpose);
+    size_t first = ftell(fp), offset = first;
+    if(cutoff > net->n) cutoff = net->n;
+    int i, n = cutoff > start ? cutoff - start : 0;
     
-    for(int i = start; i < net->n && i < cutoff; ++i){
-        load_layer_weights(net->layers[i], fp, transpose);
+    /* every layer's place in the file follows from the cfg, so the kernel
+       can start reading all of them before the first is parsed */
+    weights_load_args a = {net, fileno(fp), minor, transpose, start};
+    a.offsets = safe_calloc(n + 1, sizeof(size_t));
+    a.bytes = safe_calloc(n + 1, sizeof(size_t));
+    a.read_time = safe_calloc(n + 1, sizeof(double));
+    a.process_time = safe_calloc(n + 1, sizeof(double));
+    for(i = 0; i < n; ++i){
+        a.offsets[i] = offset;
+        a.bytes[i] = layer_weights_bytes(net->layers[start + i], minor);
+        offset += a.bytes[i];
     }
+    posix_fadvise(a.fd, first, offset - first, POSIX_FADV_WILLNEED);
     
+    /* pushing to the GPU stays on the thread that set the device */
+    int grain = 1;
+#ifdef GPU
+    if(gpu_index >= 0 && n > 0) grain = n;
+#endif
+    parallel_for(n, grain, load_layers_range, &a);
     fclose(fp);
+    
+    time = what_time_is_it_now() - time;
+    if(verbose){
+        double read = 0, process = 0;
+        fprintf(stderr, "layer   type              MB    read ms  process ms\n");
+        for(i = 0; i < n; ++i){
+            if(!a.bytes[i]) continue;
+            layer l = net->layers[start + i];
+            fprintf(stderr, "%5d   %-12s %8.2f %10.2f %11.2f\n", start + i, get_layer_string(l.type),
+                    a.bytes[i]/1e6, a.read_time[i]*1e3, a.process_time[i]*1e3);
+            read += a.read_time[i];
+            process += a.process_time[i];
+        }
+        fprintf(stderr, "Loaded %.1f MB in %.3f s on %d thread%s (read %.3f s, process %.3f s, summed over layers)\n",
+                (offset - first)/1e6, time, thread_pool_size(), thread_pool_size() == 1 ? "" : "s", read, process);
+    }
+    free(a.offsets);
+    free(a.bytes);
+    free(a.read_time);
+    free(a.process_time);
+}
+
+void load_weights_upto(network *net, char *filename, int start, int cutoff)
+{
+    load_weights_file(net, filename, start, cutoff, 0);
+}
+
+/**
+ * Loads weights like load_weights and prints how long each layer took to
+ * read and to convert.
+ */
+void load_weights_timed(network *net, char *filename)
+{
+    load_weights_file(net, filename, 0, net->n, 1);
 }
 
 void load_weights(network *net, char *filename)
@@ -0,0 +1,455 @@
+#include "profiler.h"
+#include "network.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * Per-layer profiling of the CPU forward, backward and update passes.
+ *
+ * Every layer call is timed and charged an estimate of the floating point
+ * operations it does and the bytes it moves, from the layer's shape alone:
+ * multiply-adds of the convolutions and matrix products, a few operations
+ * per element for the rest, and every input, output and parameter array
+ * read or written once. Those are lower bounds on the traffic, but close
+ * enough to tell a layer limited by arithmetic (many FLOPs per byte) from
+ * one limited by memory bandwidth. Calls are also kept as events for a
+ * Chrome trace, up to PROFILE_MAX_EVENTS.
+ *
+ * DARKNET_PROFILE=1 profiles every parsed network and prints the table when
+ * it is freed or the program exits, DARKNET_PROFILE_JSON and
+ * DARKNET_PROFILE_TRACE name files to save the summary and the trace to.
+ */
+
+#define PROFILE_PHASES 3
+#define PROFILE_MAX_EVENTS (1 << 20)
+
+typedef struct {
+    int calls;
+    double seconds;
+    double flops;
+    double bytes;
+} layer_timing;
+
+typedef struct {
+    int layer;
+    profile_phase phase;
+    double start;
+    double seconds;
+} profile_event;
+
+typedef struct network_profile {
+    int n;
+    layer_timing *timings;
+    profile_event *events;
+    size_t nevents;
+    size_t capacity;
+    size_t dropped;
+    double start;
+    /* profiles turned on by the environment report themselves */
+    network *net;
+    struct network_profile *next;
+} network_profile;
+
+static const char *phase_names[PROFILE_PHASES] = {"forward", "backward", "update"};
+
+static pthread_mutex_t reported_lock = PTHREAD_MUTEX_INITIALIZER;
+static network_profile *reported = 0;
+
+double profile_clock(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec*1e-9;
+}
+
+static int weighted_layer(layer *l)
+{
+    return l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL || l->type == CONNECTED || l->type == LOCAL;
+}
+
+static double layer_params(layer *l)
+{
+    switch(l->type){
+        case CONVOLUTIONAL:
+        case DECONVOLUTIONAL:
+            return (double)l->nweights + l->n*(l->batch_normalize ? 3 : 1);
+        case CONNECTED:
+            return (double)l->inputs*l->outputs + l->outputs*(l->batch_normalize ? 3 : 1);
+        case LOCAL:
+            return (double)l->c*l->n*l->size*l->size*l->out_h*l->out_w + l->outputs;
+        case BATCHNORM:
+            return 2.*l->c;
+        default:
+            return 0;
+    }
+}
+
+/* Recurrent layers do their work in sublayers */
+static int sublayers(layer *l, layer **subs)
+{
+    layer *all[] = {l->input_layer, l->self_layer, l->output_layer,
+        l->uz, l->wz, l->ur, l->wr, l->uh, l->wh,
+        l->uf, l->wf, l->ui, l->wi, l->ug, l->wg, l->uo, l->wo};
+    int i, n = 0;
+    if(l->type != RNN && l->type != GRU && l->type != LSTM && l->type != CRNN) return 0;
+    for(i = 0; i < sizeof(all)/sizeof(all[0]); ++i){
+        if(all[i]) subs[n++] = all[i];
+    }
+    return n;
+}
+
+/* Routes copy only the inputs that were not written in place */
+static double route_bytes(network *net, layer *l)
+{
+    int j;
+    double bytes = 0;
+    float *dst = l->output;
+    for(j = 0; j < l->n; ++j){
+        if(net->layers[l->input_layers[j]].output != dst) bytes += 2.*l->input_sizes[j]*l->batch*sizeof(float);
+        dst += l->input_sizes[j];
+    }
+    return bytes;
+}
+
+static void forward_cost(network *net, layer *l, double *flops, double *bytes)
+{
+    double in = (double)l->inputs*l->batch;
+    double out = (double)l->outputs*l->batch;
+    double params = layer_params(l);
+    double weight_size = l->weights_int8 ? 1 : sizeof(float);
+    *flops = out;
+    *bytes = (in + out)*sizeof(float) + params*weight_size;
+    switch(l->type){
+        case CONVOLUTIONAL:
+            *flops = 2.*l->n*l->c/l->groups*l->size*l->size*l->out_h*l->out_w*l->batch + 2*out;
+            /* the convolution runs on the small input and upsamples its output */
+            if(l->upsampled) *flops /= l->upsampled*l->upsampled;
+            if(l->residual){
+                *flops += out;
+                *bytes += out*sizeof(float);
+            }
+            break;
+        case DECONVOLUTIONAL:
+            *flops = 2.*l->n*l->c*l->size*l->size*l->h*l->w*l->batch + 2*out;
+            break;
+        case CONNECTED:
+            *flops = 2.*l->inputs*l->outputs*l->batch + 2*out;
+            break;
+        case LOCAL:
+            *flops = 2.*l->c*l->n*l->size*l->size*l->out_h*l->out_w*l->batch + out;
+            break;
+        case MAXPOOL:
+            *flops = out*l->size*l->size;
+            break;
+        case AVGPOOL:
+            *flops = in;
+            break;
+        case SOFTMAX:
+        case L2NORM:
+        case COST:
+            *flops = 3*in;
+            break;
+        case NORMALIZATION:
+            *flops = 2*in*l->size;
+            break;
+        case BATCHNORM:
+            *flops = 4*out;
+            break;
+        case SHORTCUT:
+            *flops = 2*out;
+            *bytes += out*sizeof(float);
+            break;
+        case ROUTE:
+            *flops = 0;
+            *bytes = route_bytes(net, l);
+            break;
+        case UPSAMPLE:
+        case REORG:
+        case CROP:
+        case DROPOUT:
+            *flops = 0;
+            *bytes = 2*out*sizeof(float);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * FLOPs and bytes of one call of a layer in a phase. Backward passes of
+ * weighted layers do two products, one for the weight gradient and one for
+ * the input delta; updates touch every parameter and its update a few times.
+ */
+static void layer_cost(network *net, layer *l, profile_phase phase, double *flops, double *bytes)
+{
+    layer *subs[17];
+    int i, n = sublayers(l, subs);
+    *flops = *bytes = 0;
+    if(n){
+        for(i = 0; i < n; ++i){
+            double f, b;
+            layer_cost(net, subs[i], phase, &f, &b);
+            *flops += f;
+            *bytes += b;
+        }
+        return;
+    }
+    if(phase == PROFILE_UPDATE){
+        /* adam keeps two moments next to every parameter */
+        int adam = l->m != 0;
+        double params = layer_params(l);
+        *flops = params*(adam ? 10 : 4);
+        *bytes = params*sizeof(float)*(adam ? 8 : 4);
+        return;
+    }
+    /* layers folded into a neighbour do nothing */
+    if(l->fused) return;
+    forward_cost(net, l, flops, bytes);
+    if(phase == PROFILE_BACKWARD){
+        if(weighted_layer(l)) *flops *= 2;
+        *bytes *= 2;
+    }
+}
+
+static network_profile *make_network_profile(int n)
+{
+    network_profile *p = safe_calloc(1, sizeof(network_profile));
+    p->n = n;
+    p->timings = safe_calloc((size_t)n*PROFILE_PHASES, sizeof(layer_timing));
+    p->start = profile_clock();
+    return p;
+}
+
+/**
+ * Charges layer i of net one call in a phase that started at start.
+ * Called by the passes only while profiling is on.
+ */
+void profile_layer(network *net, int i, profile_phase phase, double start)
+{
+    network_profile *p = net->profile;
+    double now = profile_clock();
+    double flops, bytes;
+    layer_cost(net, net->layers + i, phase, &flops, &bytes);
+    layer_timing *t = p->timings + (size_t)i*PROFILE_PHASES + phase;
+    ++t->calls;
+    t->seconds += now - start;
+    t->flops += flops;
+    t->bytes += bytes;
+
+    if(p->nevents == p->capacity){
+        if(p->capacity == PROFILE_MAX_EVENTS){
+            ++p->dropped;
+            return;
+        }
+        p->capacity = p->capacity ? 2*p->capacity : 1024;
+        p->events = realloc(p->events, p->capacity*sizeof(profile_event));
+        if(!p->events) error("Couldn't grow the profile trace");
+    }
+    profile_event e = {i, phase, start - p->start, now - start};
+    p->events[p->nevents++] = e;
+}
+
+/**
+ * What was recorded for layer i in a phase.
+ * @return Number of calls, 0 when net is not profiled
+ */
+int get_layer_profile(network *net, int i, profile_phase phase, double *seconds, double *flops, double *bytes)
+{
+    network_profile *p = net->profile;
+    if(!p || i < 0 || i >= p->n) return 0;
+    layer_timing t = p->timings[(size_t)i*PROFILE_PHASES + phase];
+    if(seconds) *seconds = t.seconds;
+    if(flops) *flops = t.flops;
+    if(bytes) *bytes = t.bytes;
+    return t.calls;
+}
+
+/**
+ * Turns per-layer profiling of net's CPU passes on or off. Turning it off
+ * drops what was recorded.
+ */
+void set_network_profiling(network *net, int on)
+{
+    if(on && !net->profile){
+        net->profile = make_network_profile(net->n);
+    } else if(!on && net->profile){
+        free_network_profile(net);
+    }
+}
+
+/**
+ * Forgets the calls recorded so far, for instance those of warm-up passes.
+ */
+void reset_network_profile(network *net)
+{
+    network_profile *p = net->profile;
+    if(!p) return;
+    memset(p->timings, 0, (size_t)p->n*PROFILE_PHASES*sizeof(layer_timing));
+    p->nevents = 0;
+    p->dropped = 0;
+    p->start = profile_clock();
+}
+
+static double ratio(double a, double b)
+{
+    return b > 0 ? a/b : 0;
+}
+
+/**
+ * Prints one line per layer and phase with the time per call, its share of
+ * the phase, the estimated GFLOPs and MB per call, the rates they were done
+ * at and the arithmetic intensity, then the totals of each phase.
+ */
+void print_network_profile(network *net, FILE *fp)
+{
+    network_profile *p = net->profile;
+    int i, phase;
+    if(!p) return;
+    for(phase = 0; phase < PROFILE_PHASES; ++phase){
+        double seconds = 0, flops = 0, bytes = 0;
+        int passes = 0;
+        for(i = 0; i < p->n; ++i){
+            layer_timing t = p->timings[i*PROFILE_PHASES + phase];
+            seconds += t.seconds;
+            flops += t.flops;
+            bytes += t.bytes;
+            if(t.calls > passes) passes = t.calls;
+        }
+        if(!passes) continue;
+        fprintf(fp, "%s, %d passes\n", phase_names[phase], passes);
+        fprintf(fp, "layer type               ms/call  %%time  GFLOP/call  MB/call  GFLOP/s    GB/s  FLOP/B\n");
+        for(i = 0; i < p->n; ++i){
+            layer_timing t = p->timings[i*PROFILE_PHASES + phase];
+            if(!t.calls) continue;
+            fprintf(fp, "%5d %-15s %10.3f %6.1f %11.3f %8.2f %8.2f %7.2f %7.2f\n",
+                    i, get_layer_string(net->layers[i].type), 1000*t.seconds/t.calls, 100*ratio(t.seconds, seconds),
+                    t.flops/t.calls/1e9, t.bytes/t.calls/1e6, ratio(t.flops, t.seconds)/1e9,
+                    ratio(t.bytes, t.seconds)/1e9, ratio(t.flops, t.bytes));
+        }
+        fprintf(fp, "total                 %10.3f %6.1f %11.3f %8.2f %8.2f %7.2f %7.2f\n\n",
+                1000*seconds/passes, 100., flops/passes/1e9, bytes/passes/1e6,
+                ratio(flops, seconds)/1e9, ratio(bytes, seconds)/1e9, ratio(flops, bytes));
+    }
+    if(p->dropped) fprintf(fp, "%zu calls left out of the trace\n", p->dropped);
+}
+
+/**
+ * Saves the per-layer totals as JSON: one object per layer and phase that
+ * ran, with its calls, seconds, FLOPs and bytes and the rates.
+ */
+void save_network_profile(network *net, char *filename)
+{
+    network_profile *p = net->profile;
+    int i, phase, first = 1;
+    if(!p) return;
+    FILE *fp = fopen(filename, "w");
+    if(!fp) file_error(filename);
+    fprintf(fp, "{\"layers\": [");
+    for(i = 0; i < p->n; ++i){
+        for(phase = 0; phase < PROFILE_PHASES; ++phase){
+            layer_timing t = p->timings[i*PROFILE_PHASES + phase];
+            if(!t.calls) continue;
+            fprintf(fp, "%s\n  {\"index\": %d, \"type\": \"%s\", \"phase\": \"%s\", \"calls\": %d, "
+                    "\"seconds\": %.9f, \"flops\": %.0f, \"bytes\": %.0f, \"gflops_per_second\": %.3f, \"gb_per_second\": %.3f}",
+                    first ? "" : ",", i, get_layer_string(net->layers[i].type), phase_names[phase], t.calls,
+                    t.seconds, t.flops, t.bytes, ratio(t.flops, t.seconds)/1e9, ratio(t.bytes, t.seconds)/1e9);
+            first = 0;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+}
+
+/**
+ * Saves every recorded call as a complete event of the Chrome trace event
+ * format, for chrome://tracing or Perfetto. Phases are drawn as threads.
+ */
+void save_network_trace(network *net, char *filename)
+{
+    network_profile *p = net->profile;
+    size_t i;
+    if(!p) return;
+    FILE *fp = fopen(filename, "w");
+    if(!fp) file_error(filename);
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    for(i = 0; i < p->nevents; ++i){
+        profile_event e = p->events[i];
+        double flops, bytes;
+        layer_cost(net, net->layers + e.layer, e.phase, &flops, &bytes);
+        fprintf(fp, "%s\n  {\"name\": \"%d %s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, "
+                "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"flops\": %.0f, \"bytes\": %.0f}}",
+                i ? "," : "", e.layer, get_layer_string(net->layers[e.layer].type), phase_names[e.phase], e.phase,
+                e.start*1e6, e.seconds*1e6, flops, bytes);
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+}
+
+static void report_network_profile(network *net)
+{
+    char *json = getenv("DARKNET_PROFILE_JSON");
+    char *trace = getenv("DARKNET_PROFILE_TRACE");
+    print_network_profile(net, stderr);
+    if(json && *json) save_network_profile(net, json);
+    if(trace && *trace) save_network_trace(net, trace);
+}
+
+static void report_at_exit(void)
+{
+    pthread_mutex_lock(&reported_lock);
+    network_profile *p;
+    for(p = reported; p; p = p->next) report_network_profile(p->net);
+    reported = 0;
+    pthread_mutex_unlock(&reported_lock);
+}
+
+static void register_report_at_exit(void)
+{
+    atexit(report_at_exit);
+}
+
+/**
+ * Turns profiling on if DARKNET_PROFILE is set to anything but 0, with a
+ * report when net is freed or the program exits.
+ */
+void profile_network_from_environment(network *net)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    char *env = getenv("DARKNET_PROFILE");
+    if(!env || !*env || strcmp(env, "0") == 0 || net->profile) return;
+    set_network_profiling(net, 1);
+    network_profile *p = net->profile;
+    p->net = net;
+    pthread_mutex_lock(&reported_lock);
+    p->next = reported;
+    reported = p;
+    pthread_mutex_unlock(&reported_lock);
+    pthread_once(&once, register_report_at_exit);
+}
+
+/**
+ * Frees net's profile, after reporting it if the environment asked for it.
+ */
+void free_network_profile(network *net)
+{
+    network_profile *p = net->profile;
+    if(!p) return;
+    pthread_mutex_lock(&reported_lock);
+    network_profile **link;
+    for(link = &reported; *link; link = &(*link)->next){
+        if(*link == p){
+            *link = p->next;
+            report_network_profile(net);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&reported_lock);
+    free(p->timings);
+    free(p->events);
+    free(p);
+    net->profile = 0;
+}
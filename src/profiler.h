@@ -0,0 +1,15 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include "darknet.h"
+
+typedef enum {
+    PROFILE_FORWARD, PROFILE_BACKWARD, PROFILE_UPDATE
+} profile_phase;
+
+double profile_clock(void);
+void profile_layer(network *net, int i, profile_phase phase, double start);
+int get_layer_profile(network *net, int i, profile_phase phase, double *seconds, double *flops, double *bytes);
+void profile_network_from_environment(network *net);
+void free_network_profile(network *net);
+
+#endif
@@ -0,0 +1,535 @@
+#include "quantize.h"
+#include "batchnorm_layer.h"
+#include "activations.h"
+#include "utils.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define INT8_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Int8 inference for convolutional and connected layers.
+ *
+ * Weights are quantized symmetrically per output channel and each layer's
+ * input per tensor, with a scale calibrated on sample images, so that
+ * y = input_scale*weight_scales[f]*sum(qw*qx). The sums come from an int8
+ * GEMM with exact int32 accumulation. B is packed as unsigned bytes qx+128
+ * in groups of four along K, the operand layout of VNNI's vpdpbusd. The
+ * 128*rowsum(A) this adds is subtracted when the tile is stored. A is
+ * packed the same way as signed bytes. Both are zero padded to the tile
+ * size.
+ */
+
+#define INT8_MAX_MR 8
+#define INT8_MAX_NR 32
+#define INT8_KC 512
+
+/* c = (accumulate ? c : 0) + a*b over k4 groups of four */
+typedef void (*int8_kernel)(int k4, const signed char *a, const unsigned char *b, int *c, int ldc, int accumulate);
+
+typedef struct {
+    const char *name;
+    int mr, nr;
+    int8_kernel kernel;
+} int8_engine;
+
+#define INT8_GENERIC_MR 4
+#define INT8_GENERIC_NR 8
+
+static void int8_kernel_generic(int k4, const signed char *a, const unsigned char *b, int *c, int ldc, int accumulate)
+{
+    int ab[INT8_GENERIC_MR*INT8_GENERIC_NR];
+    int p, i, j, t;
+    for(i = 0; i < INT8_GENERIC_MR; ++i){
+        for(j = 0; j < INT8_GENERIC_NR; ++j){
+            ab[i*INT8_GENERIC_NR + j] = accumulate ? c[i*ldc + j] : 0;
+        }
+    }
+    for(p = 0; p < k4; ++p){
+        for(i = 0; i < INT8_GENERIC_MR; ++i){
+            for(j = 0; j < INT8_GENERIC_NR; ++j){
+                for(t = 0; t < 4; ++t){
+                    ab[i*INT8_GENERIC_NR + j] += a[i*4 + t]*b[j*4 + t];
+                }
+            }
+        }
+        a += INT8_GENERIC_MR*4;
+        b += INT8_GENERIC_NR*4;
+    }
+    for(i = 0; i < INT8_GENERIC_MR; ++i){
+        for(j = 0; j < INT8_GENERIC_NR; ++j){
+            c[i*ldc + j] = ab[i*INT8_GENERIC_NR + j];
+        }
+    }
+}
+
+#ifdef INT8_X86
+
+/* No byte dot product before VNNI (vpmaddubsw saturates at 16 bits), so
+   widen to 16 bits and use vpmaddwd: each 32-bit lane then holds half of a
+   column's four products, and the halves are added pairwise at the end. */
+__attribute__((target("avx2")))
+static void int8_kernel_avx2_6x8(int k4, const signed char *a, const unsigned char *b, int *c, int ldc, int accumulate)
+{
+    __m256i acc[6][2];
+    int i, p;
+    for(i = 0; i < 6; ++i){
+        acc[i][0] = _mm256_setzero_si256();
+        acc[i][1] = _mm256_setzero_si256();
+    }
+    for(p = 0; p < k4; ++p){
+        __m256i b0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)b));
+        __m256i b1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(b + 16)));
+        for(i = 0; i < 6; ++i){
+            int w;
+            memcpy(&w, a + i*4, sizeof(w));
+            __m256i a0 = _mm256_cvtepi8_epi16(_mm_set1_epi32(w));
+            acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_madd_epi16(b0, a0));
+            acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_madd_epi16(b1, a0));
+        }
+        a += 24;
+        b += 32;
+    }
+    for(i = 0; i < 6; ++i){
+        __m256i s = _mm256_permute4x64_epi64(_mm256_hadd_epi32(acc[i][0], acc[i][1]), 0xD8);
+        if(accumulate) s = _mm256_add_epi32(s, _mm256_loadu_si256((const __m256i *)(c + i*ldc)));
+        _mm256_storeu_si256((__m256i *)(c + i*ldc), s);
+    }
+}
+
+__attribute__((target("avx512f,avx512vnni")))
+static void int8_kernel_avx512vnni_8x32(int k4, const signed char *a, const unsigned char *b, int *c, int ldc, int accumulate)
+{
+    __m512i acc[8][2];
+    int i, p;
+    for(i = 0; i < 8; ++i){
+        acc[i][0] = accumulate ? _mm512_loadu_si512(c + i*ldc) : _mm512_setzero_si512();
+        acc[i][1] = accumulate ? _mm512_loadu_si512(c + i*ldc + 16) : _mm512_setzero_si512();
+    }
+    for(p = 0; p < k4; ++p){
+        __m512i b0 = _mm512_loadu_si512(b);
+        __m512i b1 = _mm512_loadu_si512(b + 64);
+        for(i = 0; i < 8; ++i){
+            int w;
+            memcpy(&w, a + i*4, sizeof(w));
+            __m512i a0 = _mm512_set1_epi32(w);
+            acc[i][0] = _mm512_dpbusd_epi32(acc[i][0], b0, a0);
+            acc[i][1] = _mm512_dpbusd_epi32(acc[i][1], b1, a0);
+        }
+        a += 32;
+        b += 128;
+    }
+    for(i = 0; i < 8; ++i){
+        _mm512_storeu_si512(c + i*ldc, acc[i][0]);
+        _mm512_storeu_si512(c + i*ldc + 16, acc[i][1]);
+    }
+}
+
+#endif
+
+static const int8_engine int8_engine_generic = {"generic", INT8_GENERIC_MR, INT8_GENERIC_NR, int8_kernel_generic};
+#ifdef INT8_X86
+static const int8_engine int8_engine_avx2       = {"avx2",       6,  8, int8_kernel_avx2_6x8};
+static const int8_engine int8_engine_avx512vnni = {"avx512vnni", 8, 32, int8_kernel_avx512vnni_8x32};
+#endif
+
+static const int8_engine *int8_active_engine = &int8_engine_generic;
+static pthread_once_t int8_engine_once = PTHREAD_ONCE_INIT;
+
+static void select_int8_engine(void)
+{
+#ifdef INT8_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512vnni")){
+        int8_active_engine = &int8_engine_avx512vnni;
+    } else if(__builtin_cpu_supports("avx2")){
+        int8_active_engine = &int8_engine_avx2;
+    }
+#endif
+}
+
+static const int8_engine *get_int8_engine(void)
+{
+    pthread_once(&int8_engine_once, select_int8_engine);
+    return int8_active_engine;
+}
+
+const char *gemm_int8_kernel_name(void)
+{
+    return get_int8_engine()->name;
+}
+
+/* Overrides the CPUID choice. Returns 0 if the named kernel is unknown or
+   not supported by this CPU. */
+int gemm_int8_select_kernel(const char *name)
+{
+    get_int8_engine();
+    if(0 == strcmp(name, "generic")){
+        int8_active_engine = &int8_engine_generic;
+        return 1;
+    }
+#ifdef INT8_X86
+    if(0 == strcmp(name, "avx2") && __builtin_cpu_supports("avx2")){
+        int8_active_engine = &int8_engine_avx2;
+        return 1;
+    }
+    if(0 == strcmp(name, "avx512vnni") && __builtin_cpu_supports("avx512vnni")){
+        int8_active_engine = &int8_engine_avx512vnni;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+/* Scratch is per calling thread, like gemm's packing buffers */
+static __thread thread_buffer int8_pack_a;
+static __thread thread_buffer int8_pack_b;
+static __thread thread_buffer int8_rowsum;
+static __thread thread_buffer int8_input;
+static __thread thread_buffer int8_col;
+static __thread thread_buffer int8_acc;
+static __thread thread_buffer int8_scale_bias;
+
+/* A[0:M, 0:K] into MR-row strips of [K/4][MR][4], with the row sums */
+static void pack_a_int8(int M, int K, signed char *A, int lda, int mr, signed char *pack, int *rowsum)
+{
+    int k4 = (K + 3)/4;
+    int ir, i, p, t;
+    for(ir = 0; ir < M; ir += mr){
+        for(i = 0; i < mr; ++i){
+            int row = ir + i;
+            int sum = 0;
+            for(p = 0; p < k4; ++p){
+                for(t = 0; t < 4; ++t){
+                    int k = p*4 + t;
+                    signed char v = (row < M && k < K) ? A[row*lda + k] : 0;
+                    pack[(p*mr + i)*4 + t] = v;
+                    sum += v;
+                }
+            }
+            rowsum[row] = sum;
+        }
+        pack += (size_t)k4*mr*4;
+    }
+}
+
+typedef struct {
+    const int8_engine *e;
+    int M, N, K;
+    signed char *pa;
+    int *rowsum;
+    signed char *B;
+    int ldb;
+    unsigned char *pb;
+    int *C;
+    int ldc;
+} gemm_int8_args;
+
+/* B[0:K, 0:N] + 128 into NR-column strips of [K/4][NR][4] */
+static void pack_b_int8(void *ptr, int begin, int end)
+{
+    static const signed char zero[INT8_MAX_NR] = {0};
+    gemm_int8_args *g = ptr;
+    int N = g->N, K = g->K, ldb = g->ldb, nr = g->e->nr;
+    signed char *B = g->B;
+    unsigned char *pack = g->pb;
+    int k4 = (K + 3)/4;
+    int s;
+    for(s = begin; s < end; ++s){
+        int jr = s*nr;
+        int cols = (N - jr < nr) ? N - jr : nr;
+        unsigned char *dst = pack + (size_t)s*k4*nr*4;
+        int p, j, t;
+        if(cols < nr) memset(dst, 128, (size_t)k4*nr*4);
+        for(p = 0; p < k4; ++p){
+            const signed char *src[4];
+            for(t = 0; t < 4; ++t) src[t] = p*4 + t < K ? B + (size_t)(p*4 + t)*ldb + jr : zero;
+            /* xor 0x80 is +128 from int8 to uint8 */
+            for(j = 0; j < cols; ++j){
+                dst[j*4 + 0] = src[0][j] ^ 0x80;
+                dst[j*4 + 1] = src[1][j] ^ 0x80;
+                dst[j*4 + 2] = src[2][j] ^ 0x80;
+                dst[j*4 + 3] = src[3][j] ^ 0x80;
+            }
+            dst += nr*4;
+        }
+    }
+}
+
+/* Column strips [begin, end) of C over the whole K range */
+static void gemm_int8_strips(void *ptr, int begin, int end)
+{
+    gemm_int8_args *g = ptr;
+    const int8_engine *e = g->e;
+    int M = g->M, N = g->N, ldc = g->ldc;
+    int mr = e->mr;
+    int nr = e->nr;
+    int k4 = (g->K + 3)/4;
+    int s, pc, ir, i, j;
+    for(s = begin; s < end; ++s){
+        int jr = s*nr;
+        int cols = (N - jr < nr) ? N - jr : nr;
+        for(pc = 0; pc < k4; pc += INT8_KC/4){
+            int kb = (k4 - pc < INT8_KC/4) ? k4 - pc : INT8_KC/4;
+            const unsigned char *b = g->pb + ((size_t)jr*k4 + (size_t)pc*nr)*4;
+            for(ir = 0; ir < M; ir += mr){
+                int rows = (M - ir < mr) ? M - ir : mr;
+                const signed char *a = g->pa + ((size_t)ir*k4 + (size_t)pc*mr)*4;
+                int *c = g->C + (size_t)ir*ldc + jr;
+                if(rows == mr && cols == nr){
+                    e->kernel(kb, a, b, c, ldc, pc > 0);
+                    continue;
+                }
+                int tmp[INT8_MAX_MR*INT8_MAX_NR];
+                if(pc > 0){
+                    for(i = 0; i < rows; ++i) memcpy(tmp + i*nr, c + i*ldc, cols*sizeof(int));
+                }
+                e->kernel(kb, a, b, tmp, nr, pc > 0);
+                for(i = 0; i < rows; ++i) memcpy(c + i*ldc, tmp + i*nr, cols*sizeof(int));
+            }
+        }
+        for(i = 0; i < M; ++i){
+            int bias = 128*g->rowsum[i];
+            int *c = g->C + (size_t)i*ldc + jr;
+            for(j = 0; j < cols; ++j) c[j] -= bias;
+        }
+    }
+}
+
+/**
+ * Exact int32 C = A*B for int8 A (M x K) and B (K x N), all row-major.
+ * Both operands are packed once; the K loop is blocked so a KC x NR panel
+ * of B stays in L1 while it meets every row strip of A. Column strips of C
+ * are split over the thread pool.
+ */
+void gemm_int8_cpu(int M, int N, int K,
+        signed char *A, int lda,
+        signed char *B, int ldb,
+        int *C, int ldc)
+{
+    const int8_engine *e = get_int8_engine();
+    int mr = e->mr;
+    int nr = e->nr;
+    int k4 = (K + 3)/4;
+    int strips_m = (M + mr - 1)/mr;
+    int strips_n = (N + nr - 1)/nr;
+    gemm_int8_args g = {e, M, N, K};
+    g.pa = grow_thread_buffer(&int8_pack_a, (size_t)strips_m*mr*k4*4);
+    g.rowsum = grow_thread_buffer(&int8_rowsum, (size_t)strips_m*mr*sizeof(int));
+    g.pb = grow_thread_buffer(&int8_pack_b, (size_t)strips_n*nr*k4*4);
+    g.B = B;
+    g.ldb = ldb;
+    g.C = C;
+    g.ldc = ldc;
+    pack_a_int8(M, K, A, lda, mr, g.pa, g.rowsum);
+    parallel_for(strips_n, 4, pack_b_int8, &g);
+    parallel_for(strips_n, 1, gemm_int8_strips, &g);
+}
+
+/* rounds half away from zero; unlike lrintf this vectorizes */
+static inline signed char quantize_value(float x, float inv)
+{
+    float v = x*inv;
+    if(v > 127) v = 127;
+    if(v < -127) v = -127;
+    return (signed char)(int)(v + (v < 0 ? -.5f : .5f));
+}
+
+void quantize_array(float *x, int n, float scale, signed char *q)
+{
+    float inv = 1.f/scale;
+    int i;
+    for(i = 0; i < n; ++i) q[i] = quantize_value(x[i], inv);
+}
+
+/**
+ * Symmetric per-filter quantization.
+ * @param n Filters (output channels)
+ * @param size Weights per filter
+ * @param scales Out: per-filter scale, weight ~= q*scale
+ */
+void quantize_weights_int8(float *weights, int n, int size, signed char *q, float *scales)
+{
+    int f, i;
+    for(f = 0; f < n; ++f){
+        float *w = weights + (size_t)f*size;
+        float max = 0;
+        for(i = 0; i < size; ++i){
+            if(fabs(w[i]) > max) max = fabs(w[i]);
+        }
+        scales[f] = max > 0 ? max/127 : 1;
+        quantize_array(w, size, scales[f], q + (size_t)f*size);
+    }
+}
+
+static int int8_outputs(layer l)
+{
+    return l.type == CONNECTED ? l.outputs : l.n;
+}
+
+static size_t int8_weights_size(layer l)
+{
+    return l.type == CONNECTED ? (size_t)l.outputs*l.inputs : (size_t)l.nweights;
+}
+
+int int8_supported(layer l)
+{
+    return (l.type == CONVOLUTIONAL && !l.binary && !l.xnor) || l.type == CONNECTED;
+}
+
+/**
+ * Allocates a layer's int8 weights and per-channel scales. They stay empty
+ * until update_int8_weights or a weights file fills them.
+ */
+void make_int8_weights(layer *l)
+{
+    if(l->weights_int8) return;
+    l->weights_int8 = safe_calloc(int8_weights_size(*l), sizeof(signed char));
+    l->weight_scales = safe_calloc(int8_outputs(*l), sizeof(float));
+}
+
+/**
+ * Requantizes l.weights after they changed.
+ * @param l Convolutional or connected layer, does nothing unless it runs int8
+ */
+void update_int8_weights(layer l)
+{
+    if(!l.weights_int8) return;
+    int n = int8_outputs(l);
+    quantize_weights_int8(l.weights, n, int8_weights_size(l)/n, l.weights_int8, l.weight_scales);
+}
+
+/* Float copy of the int8 weights, for the paths that don't run int8 */
+void dequantize_int8_weights(layer l)
+{
+    int n = int8_outputs(l);
+    size_t size = int8_weights_size(l)/n;
+    size_t i;
+    int f;
+    for(f = 0; f < n; ++f){
+        for(i = 0; i < size; ++i){
+            l.weights[f*size + i] = l.weights_int8[f*size + i]*l.weight_scales[f];
+        }
+    }
+}
+
+static float *int8_scale_bias_buffer(layer l, int n)
+{
+    float *sb = grow_thread_buffer(&int8_scale_bias, 2*n*sizeof(float));
+    int f;
+    inference_scale_bias(l, n, sb, sb + n);
+    for(f = 0; f < n; ++f) sb[f] *= l.input_scale*l.weight_scales[f];
+    return sb;
+}
+
+typedef struct {
+    signed char *im;
+    int height, width, ksize, stride, pad;
+    signed char *col;
+} im2col_int8_args;
+
+static void im2col_int8_rows(void *ptr, int begin, int end)
+{
+    im2col_int8_args *a = ptr;
+    signed char *im = a->im, *col = a->col;
+    int height = a->height, width = a->width;
+    int ksize = a->ksize, stride = a->stride, pad = a->pad;
+    int height_col = (height + 2*pad - ksize)/stride + 1;
+    int width_col = (width + 2*pad - ksize)/stride + 1;
+    int c;
+    for(c = begin; c < end; ++c){
+        int w_offset = c % ksize;
+        int h_offset = (c / ksize) % ksize;
+        int c_im = c / ksize / ksize;
+        /* output columns whose input x = w_offset + w*stride - pad is inside */
+        int w0 = pad > w_offset ? (pad - w_offset + stride - 1)/stride : 0;
+        int last = width - 1 + pad - w_offset;
+        int w1 = last < 0 ? 0 : last/stride + 1;
+        int h, w;
+        if(w1 > width_col) w1 = width_col;
+        if(w0 > w1) w0 = w1;
+        for(h = 0; h < height_col; ++h){
+            int row = h_offset + h*stride - pad;
+            signed char *dst = col + ((size_t)c*height_col + h)*width_col;
+            if(row < 0 || row >= height){
+                memset(dst, 0, width_col);
+                continue;
+            }
+            signed char *src = im + ((size_t)c_im*height + row)*width + w_offset - pad;
+            memset(dst, 0, w0);
+            if(stride == 1){
+                memcpy(dst + w0, src + w0, w1 - w0);
+            } else {
+                for(w = w0; w < w1; ++w) dst[w] = src[w*stride];
+            }
+            memset(dst + w1, 0, width_col - w1);
+        }
+    }
+}
+
+static void im2col_int8(signed char *im, int channels, int height, int width,
+        int ksize, int stride, int pad, signed char *col)
+{
+    im2col_int8_args a = {im, height, width, ksize, stride, pad, col};
+    parallel_for(channels*ksize*ksize, 4, im2col_int8_rows, &a);
+}
+
+void forward_convolutional_layer_int8(layer l, network net)
+{
+    int i, j, f, x;
+    int m = l.n/l.groups;
+    int k = l.size*l.size*l.c/l.groups;
+    int n = l.out_w*l.out_h;
+    int spatial = l.c/l.groups*l.h*l.w;
+    int direct = l.size == 1 && l.stride == 1 && l.pad == 0;
+
+    float *sb = int8_scale_bias_buffer(l, l.n);
+    signed char *qim = grow_thread_buffer(&int8_input, spatial);
+    signed char *qcol = direct ? 0 : grow_thread_buffer(&int8_col, (size_t)k*n);
+    int *acc = grow_thread_buffer(&int8_acc, (size_t)m*n*sizeof(int));
+
+    for(i = 0; i < l.batch; ++i){
+        for(j = 0; j < l.groups; ++j){
+            float *im = net.input + (size_t)(i*l.groups + j)*spatial;
+            float *c = l.output + (size_t)(i*l.groups + j)*n*m;
+            quantize_array(im, spatial, l.input_scale, qim);
+            if(!direct) im2col_int8(qim, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, qcol);
+            gemm_int8_cpu(m, n, k, l.weights_int8 + (size_t)j*l.nweights/l.groups, k, direct ? qim : qcol, n, acc, n);
+            for(f = 0; f < m; ++f){
+                int g = j*m + f;
+                for(x = 0; x < n; ++x) c[f*n + x] = acc[f*n + x];
+                scale_bias_activate_array(c + f*n, n, sb[g], sb[l.n + g], l.activation);
+            }
+        }
+    }
+}
+
+void forward_connected_layer_int8(layer l, network net)
+{
+    int m = l.outputs;
+    int k = l.inputs;
+    int n = l.batch;
+    int b, p, f;
+
+    float *sb = int8_scale_bias_buffer(l, m);
+    signed char *qin = grow_thread_buffer(&int8_input, (size_t)k*n);
+    int *acc = grow_thread_buffer(&int8_acc, (size_t)m*n*sizeof(int));
+    float inv = 1.f/l.input_scale;
+
+    /* B is the transposed input, one column per image */
+    for(b = 0; b < n; ++b){
+        for(p = 0; p < k; ++p) qin[p*n + b] = quantize_value(net.input[b*k + p], inv);
+    }
+    gemm_int8_cpu(m, n, k, l.weights_int8, k, qin, n, acc, n);
+    for(f = 0; f < m; ++f){
+        for(b = 0; b < n; ++b) l.output[b*m + f] = acc[f*n + b]*sb[f] + sb[m + f];
+    }
+    activate_array(l.output, m*n, l.activation);
+}
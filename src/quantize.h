@@ -0,0 +1,26 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+#include "darknet.h"
+
+/* Weights files with this minor version hold int8 convolutional and
+   connected layers, see save_weights_int8 */
+#define INT8_WEIGHTS_MINOR 3
+
+void gemm_int8_cpu(int M, int N, int K,
+        signed char *A, int lda,
+        signed char *B, int ldb,
+        int *C, int ldc);
+const char *gemm_int8_kernel_name(void);
+int gemm_int8_select_kernel(const char *name);
+
+void quantize_array(float *x, int n, float scale, signed char *q);
+void quantize_weights_int8(float *weights, int n, int size, signed char *q, float *scales);
+void make_int8_weights(layer *l);
+void update_int8_weights(layer l);
+void dequantize_int8_weights(layer l);
+
+int int8_supported(layer l);
+void forward_convolutional_layer_int8(layer l, network net);
+void forward_connected_layer_int8(layer l, network net);
+
+#endif
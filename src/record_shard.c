@@ -0,0 +1,295 @@
+#include "record_shard.h"
+#include "data.h"
+#include "option_list.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+ * Packed training records.
+ *
+ * darknet pack turns a list of images into shards: files of records, each
+ * holding an image's path, its encoded bytes as they are on disk and the
+ * boxes of its label file, already parsed. A text file lists the shards.
+ * Training then reads a few large files front to back instead of opening
+ * an image and a label file for every sample, which is what costs on
+ * network filesystems.
+ *
+ * A reader goes through the shards one after the other in a shuffled
+ * order and shuffles records across a window: each draw takes a random
+ * record of the window and reads the next one in its place. After the
+ * last shard the order is shuffled again.
+ */
+
+#define RECORD_MAGIC "dkshard"
+#define RECORD_VERSION 1
+#define RECORD_READ_BUFFER (1 << 20)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t records;
+} shard_header;
+
+typedef struct {
+    uint32_t path;
+    uint32_t image;
+    uint32_t boxes;
+    uint32_t reserved;
+} record_header;
+
+typedef struct {
+    int32_t id;
+    float x, y, w, h;
+} record_box;
+
+struct record_reader {
+    pthread_mutex_t lock;
+    char **shards;
+    int n;
+    int *order;
+    int next;
+    FILE *fp;
+    char *buffer;
+    uint32_t left;
+    data_record *window;
+    int size;
+    int filled;
+};
+
+static unsigned char *read_bytes(char *filename, size_t *size)
+{
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) file_error(filename);
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char *bytes = safe_malloc(*size ? *size : 1);
+    if(fread(bytes, 1, *size, fp) != *size) file_error(filename);
+    fclose(fp);
+    return bytes;
+}
+
+/* The boxes of path's label file, 0 if it has none (a classification
+   list, for instance) */
+static box_label *read_label_boxes(char *path, int *n)
+{
+    char labelpath[4096];
+    detection_label_path(path, labelpath);
+    *n = 0;
+    if(access(labelpath, R_OK)) return 0;
+    return read_boxes(labelpath, n);
+}
+
+static FILE *open_shard(char *prefix, int index, FILE *shardlist)
+{
+    char name[4096];
+    snprintf(name, sizeof(name), "%s-%05d.rec", prefix, index);
+    FILE *fp = fopen(name, "wb");
+    if(!fp) file_error(name);
+    shard_header h = {RECORD_MAGIC, RECORD_VERSION, 0};
+    fwrite(&h, sizeof(h), 1, fp);
+    fprintf(shardlist, "%s\n", name);
+    return fp;
+}
+
+static void close_shard(FILE *fp, int records)
+{
+    shard_header h = {RECORD_MAGIC, RECORD_VERSION, records};
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&h, sizeof(h), 1, fp);
+    if(ferror(fp) | fclose(fp)) error("Couldn't write a record shard");
+}
+
+/**
+ * Packs the images of listfile and their labels into prefix-00000.rec,
+ * prefix-00001.rec..., listed in prefix.shards.
+ * @param shard_bytes Size after which a new shard is started, 0 for one
+ */
+void pack_records(char *listfile, char *prefix, size_t shard_bytes)
+{
+    int i, j;
+    list *plist = get_paths(listfile);
+    char **paths = (char **)list_to_array(plist);
+    int n = plist->size;
+    char name[4096];
+    snprintf(name, sizeof(name), "%s.shards", prefix);
+    FILE *shardlist = fopen(name, "w");
+    if(!shardlist) file_error(name);
+
+    FILE *fp = 0;
+    int shards = 0, records = 0, unlabeled = 0;
+    size_t bytes = 0, total = 0;
+    double start = what_time_is_it_now();
+    for(i = 0; i < n; ++i){
+        if(!fp || (shard_bytes && bytes >= shard_bytes)){
+            if(fp) close_shard(fp, records);
+            fp = open_shard(prefix, shards++, shardlist);
+            bytes = records = 0;
+        }
+        size_t size;
+        unsigned char *image = read_bytes(paths[i], &size);
+        int count;
+        box_label *boxes = read_label_boxes(paths[i], &count);
+        if(!boxes) ++unlabeled;
+        record_header r = {strlen(paths[i]) + 1, size, count};
+        fwrite(&r, sizeof(r), 1, fp);
+        fwrite(paths[i], 1, r.path, fp);
+        fwrite(image, 1, size, fp);
+        for(j = 0; j < count; ++j){
+            record_box b = {boxes[j].id, boxes[j].x, boxes[j].y, boxes[j].w, boxes[j].h};
+            fwrite(&b, sizeof(b), 1, fp);
+        }
+        size_t record_bytes = sizeof(r) + r.path + size + count*sizeof(record_box);
+        bytes += record_bytes;
+        total += record_bytes;
+        ++records;
+        free(image);
+        free(boxes);
+        if(i % 100 == 99 || i == n - 1) fprintf(stderr, "\rPacking images: %d / %d", i + 1, n);
+    }
+    fprintf(stderr, "\n");
+    if(fp) close_shard(fp, records);
+    if(fclose(shardlist)) file_error(name);
+    fprintf(stderr, "Packed %d images, %d without labels, into %d shards, %.1f MB, in %.1f seconds\n",
+            n, unlabeled, shards, total/(1024.*1024.), what_time_is_it_now() - start);
+    free_ptrs((void **)paths, n);
+    free_list(plist);
+}
+
+/* Opens the next shard that has records, shuffling the order at the end
+   of a pass */
+static void open_next_shard(record_reader *r)
+{
+    int tries;
+    for(tries = 0; tries < 2*r->n; ++tries){
+        if(r->fp) fclose(r->fp);
+        if(r->next == r->n){
+            shuffle(r->order, r->n, sizeof(int));
+            r->next = 0;
+        }
+        char *name = r->shards[r->order[r->next++]];
+        r->fp = fopen(name, "rb");
+        if(!r->fp) file_error(name);
+        setvbuf(r->fp, r->buffer, _IOFBF, RECORD_READ_BUFFER);
+        posix_fadvise(fileno(r->fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+        shard_header h;
+        if(fread(&h, sizeof(h), 1, r->fp) != 1 || memcmp(h.magic, RECORD_MAGIC, sizeof(h.magic))) error("Not a record shard");
+        if(h.version != RECORD_VERSION) error("Unsupported record shard version");
+        r->left = h.records;
+        if(r->left) return;
+    }
+    error("The record shards are empty");
+}
+
+static void read_record(record_reader *r, data_record *record)
+{
+    uint32_t i;
+    if(!r->left) open_next_shard(r);
+    record_header h;
+    if(fread(&h, sizeof(h), 1, r->fp) != 1 || !h.path) error("Truncated record shard");
+    record->path = safe_malloc(h.path);
+    record->bytes = safe_malloc(h.image ? h.image : 1);
+    record->size = h.image;
+    record->boxes = safe_calloc(h.boxes ? h.boxes : 1, sizeof(box_label));
+    record->n = h.boxes;
+    if(fread(record->path, 1, h.path, r->fp) != h.path) error("Truncated record shard");
+    if(fread(record->bytes, 1, h.image, r->fp) != h.image) error("Truncated record shard");
+    record->path[h.path - 1] = 0;
+    for(i = 0; i < h.boxes; ++i){
+        record_box b;
+        if(fread(&b, sizeof(b), 1, r->fp) != 1) error("Truncated record shard");
+        box_label *l = record->boxes + i;
+        l->id = b.id;
+        l->x = b.x;
+        l->y = b.y;
+        l->w = b.w;
+        l->h = b.h;
+        l->left   = b.x - b.w/2;
+        l->right  = b.x + b.w/2;
+        l->top    = b.y - b.h/2;
+        l->bottom = b.y + b.h/2;
+    }
+    --r->left;
+}
+
+/**
+ * Reads the shards listed in shardlist, shuffling records across window
+ * of them.
+ */
+record_reader *open_record_reader(char *shardlist, int window)
+{
+    int i;
+    record_reader *r = safe_calloc(1, sizeof(record_reader));
+    list *l = get_paths(shardlist);
+    r->shards = (char **)list_to_array(l);
+    r->n = l->size;
+    free_list(l);
+    if(!r->n) error("No record shards listed");
+    r->order = safe_calloc(r->n, sizeof(int));
+    for(i = 0; i < r->n; ++i) r->order[i] = i;
+    r->next = r->n;
+    r->buffer = safe_malloc(RECORD_READ_BUFFER);
+    r->size = window > 0 ? window : 1;
+    r->window = safe_calloc(r->size, sizeof(data_record));
+    pthread_mutex_init(&r->lock, 0);
+    return r;
+}
+
+/**
+ * Next record of the stream. The caller owns it and frees it with
+ * free_record. Safe to call from several loader threads.
+ */
+void next_record(record_reader *r, data_record *record)
+{
+    pthread_mutex_lock(&r->lock);
+    while(r->filled < r->size) read_record(r, r->window + r->filled++);
+    int i = rand()%r->size;
+    *record = r->window[i];
+    read_record(r, r->window + i);
+    pthread_mutex_unlock(&r->lock);
+}
+
+void free_record(data_record record)
+{
+    free(record.path);
+    free(record.bytes);
+    free(record.boxes);
+}
+
+/**
+ * The records a .data file asks for, from the shards darknet pack wrote:
+ *
+ *     records = data/train.shards
+ *     records_window = 256    # records shuffled across
+ *
+ * @return 0 without a records option
+ */
+record_reader *load_record_reader(list *options)
+{
+    char *shardlist = option_find(options, "records");
+    if(!shardlist) return 0;
+    int window = option_find_int_quiet(options, "records_window", 256);
+    record_reader *r = open_record_reader(shardlist, window);
+    fprintf(stderr, "Records %s: %d shards, shuffled across %d\n", shardlist, r->n, r->size);
+    return r;
+}
+
+void free_record_reader(record_reader *r)
+{
+    int i;
+    if(!r) return;
+    for(i = 0; i < r->filled; ++i) free_record(r->window[i]);
+    if(r->fp) fclose(r->fp);
+    free_ptrs((void **)r->shards, r->n);
+    free(r->order);
+    free(r->buffer);
+    free(r->window);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
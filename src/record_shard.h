@@ -0,0 +1,16 @@
+#ifndef RECORD_SHARD_H
+#define RECORD_SHARD_H
+#include "darknet.h"
+
+typedef struct {
+    char *path;
+    unsigned char *bytes;
+    size_t size;
+    box_label *boxes;
+    int n;
+} data_record;
+
+void next_record(record_reader *reader, data_record *record);
+void free_record(data_record record);
+
+#endif
@@ -1,4 +1,5 @@
 #include "region_layer.h"
+#include "layer.h"
 #include "activations.h"
 #include "blas.h"
 #include "box.h"
@@ -61,8 +62,8 @@ void resize_region_layer(layer *l, int w, int h)
     l->outputs = h*w*l->n*(l->classes + l->coords + 1);
     l->inputs = l->outputs;
 
-    l->output = safe_realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta = safe_realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    l->output = resize_layer_buffer(l, l->output, l->batch*l->outputs*sizeof(float));
+    l->delta = resize_layer_buffer(l, l->delta, l->batch*l->outputs*sizeof(float));
 
 #ifdef GPU
     cuda_free(l->delta_gpu);
@@ -200,7 +201,7 @@ void forward_region_layer(const layer l, network net)
     apply_softmax(l, net);
 #endif
 
-    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
+    if(l.delta) memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
     if(!net.train) return;
     float avg_iou = 0;
     float recall = 0;
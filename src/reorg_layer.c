@@ -1,4 +1,5 @@
 #include "reorg_layer.h"
+#include "layer.h"
 #include "cuda.h"
 #include "blas.h"
 
@@ -78,8 +79,8 @@ void resize_reorg_layer(layer *l, int w, int h)
     l->inputs = l->outputs;
     int output_size = l->outputs * l->batch;
 
-    l->output = safe_realloc(l->output, output_size * sizeof(float));
-    l->delta = safe_realloc(l->delta, output_size * sizeof(float));
+    l->output = resize_layer_buffer(l, l->output, output_size * sizeof(float));
+    l->delta = resize_layer_buffer(l, l->delta, output_size * sizeof(float));
 
 #ifdef GPU
     cuda_free(l->output_gpu);
@@ -1,4 +1,5 @@
 #include "route_layer.h"
+#include "layer.h"
 #include "cuda.h"
 #include "blas.h"
 
@@ -60,8 +61,8 @@ void resize_route_layer(route_layer *l, network *net)
         }
     }
     l->inputs = l->outputs;
-    l->delta =  safe_realloc(l->delta, l->outputs*l->batch*sizeof(float));
-    l->output = safe_realloc(l->output, l->outputs*l->batch*sizeof(float));
+    l->delta =  resize_layer_buffer(l, l->delta, l->outputs*l->batch*sizeof(float));
+    l->output = resize_layer_buffer(l, l->output, l->outputs*l->batch*sizeof(float));
 
 #ifdef GPU
     cuda_free(l->output_gpu);
@@ -81,7 +82,10 @@ void forward_route_layer(const route_layer l, network net)
         float *input = net.layers[index].output;
         int input_size = l.input_sizes[i];
         for(j = 0; j < l.batch; ++j){
-            copy_cpu(input_size, input + j*input_size, 1, l.output + offset + j*l.outputs, 1);
+            float *src = input + j*input_size;
+            float *dst = l.output + offset + j*l.outputs;
+            /* inputs optimize_network already placed in the output */
+            if(src != dst) copy_cpu(input_size, src, 1, dst, 1);
         }
         offset += input_size;
     }
@@ -1,10 +1,10 @@
 #include "shortcut_layer.h"
+#include "layer.h"
 #include "cuda.h"
 #include "blas.h"
 #include "activations.h"
 
 #include <stdio.h>
-#include <assert.h>
 #include "utils.h"
 
 layer make_shortcut_layer(int batch, int index, int w, int h, int c, int w2, int h2, int c2)
@@ -39,16 +39,17 @@ layer make_shortcut_layer(int batch, int index, int w, int h, int c, int w2, int
     return l;
 }
 
-void resize_shortcut_layer(layer *l, int w, int h)
+/* w, h: the new size of the previous layer, w2, h2: of the layer added */
+void resize_shortcut_layer(layer *l, int w, int h, int w2, int h2)
 {
-    assert(l->w == l->out_w);
-    assert(l->h == l->out_h);
-    l->w = l->out_w = w;
-    l->h = l->out_h = h;
+    l->w = w2;
+    l->h = h2;
+    l->out_w = w;
+    l->out_h = h;
     l->outputs = w*h*l->out_c;
     l->inputs = l->outputs;
-    l->delta =  safe_realloc(l->delta, l->outputs*l->batch*sizeof(float));
-    l->output = safe_realloc(l->output, l->outputs*l->batch*sizeof(float));
+    l->delta =  resize_layer_buffer(l, l->delta, l->outputs*l->batch*sizeof(float));
+    l->output = resize_layer_buffer(l, l->output, l->outputs*l->batch*sizeof(float));
 
 #ifdef GPU
     cuda_free(l->output_gpu);
@@ -62,6 +63,8 @@ void resize_shortcut_layer(layer *l, int w, int h)
 
 void forward_shortcut_layer(const layer l, network net)
 {
+    /* folded into the convolution before it */
+    if(l.fused) return;
     copy_cpu(l.outputs*l.batch, net.input, 1, l.output, 1);
     shortcut_cpu(l.batch, l.w, l.h, l.c, net.layers[l.index].output, l.out_w, l.out_h, l.out_c, l.alpha, l.beta, l.output);
     activate_array(l.output, l.outputs*l.batch, l.activation);
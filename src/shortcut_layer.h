@@ -7,7 +7,7 @@
 layer make_shortcut_layer(int batch, int index, int w, int h, int c, int w2, int h2, int c2);
 void forward_shortcut_layer(const layer l, network net);
 void backward_shortcut_layer(const layer l, network net);
-void resize_shortcut_layer(layer *l, int w, int h);
+void resize_shortcut_layer(layer *l, int w, int h, int w2, int h2);
 
 #ifdef GPU
 void forward_shortcut_layer_gpu(const layer l, network net);
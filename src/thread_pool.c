@@ -0,0 +1,250 @@
+#include "thread_pool.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Persistent work-stealing pool behind parallel_for.
+ *
+ * A loop of n iterations is cut into ceil(n/grain) chunks. The chunk
+ * boundaries depend only on n and grain, never on the thread count, and
+ * every chunk is run by exactly one thread, so a kernel whose chunks write
+ * disjoint outputs gives bit-identical results for any pool size.
+ *
+ * Each participating thread starts with a contiguous run of chunks, packed
+ * as [next, end) in one 64-bit word. The owner takes chunks from the front
+ * and, once its run is empty, steals single chunks from the back of other
+ * runs. Workers are started on first use and sleep between loops; the
+ * calling thread always takes part as the loop's first thread.
+ *
+ * Several threads can run loops at once, each on the workers that are idle
+ * when it starts, so clones of a network predicting on their own threads
+ * share the pool. A thread's loops use set_thread_pool_limit threads if it
+ * set a limit, the pool size otherwise, and start new workers when too few
+ * are idle, up to the larger of the two in all. Loops started from inside a
+ * loop run serially.
+ */
+
+#define POOL_MAX_THREADS 256
+
+typedef struct {
+    _Atomic uint64_t range;
+    char pad[64 - sizeof(uint64_t)];
+} pool_queue;
+
+/* One parallel_for, run by its caller and the workers it took */
+typedef struct {
+    parallel_fn fn;
+    void *args;
+    int n, grain;
+    int active;
+    int pending;
+    pool_queue *queues;
+} pool_job;
+
+typedef struct {
+    pthread_cond_t wake;
+    pool_job *job;
+    int index;
+} pool_worker_slot;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int spawned;
+    pool_worker_slot workers[POOL_MAX_THREADS - 1];
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static atomic_int pool_size = 0;
+static __thread int pool_limit = 0;
+static __thread int in_pool = 0;
+
+static int online_cpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n < 1) return 1;
+    return n < POOL_MAX_THREADS ? (int)n : POOL_MAX_THREADS;
+}
+
+/* Threads used by parallel_for from now on, including the caller; 0 means
+   one per online core. Workers are never torn down, extra ones just sleep. */
+void set_thread_pool_size(int threads)
+{
+    if(threads <= 0) threads = online_cpus();
+    if(threads > POOL_MAX_THREADS) threads = POOL_MAX_THREADS;
+    atomic_store(&pool_size, threads);
+}
+
+int thread_pool_size(void)
+{
+    int n = atomic_load(&pool_size);
+    return n ? n : online_cpus();
+}
+
+/**
+ * Threads the calling thread's loops use in place of the pool size, for
+ * a network pass with its own [net] threads=. Other threads' loops and the
+ * pool size are left alone.
+ * @param threads Limit, 0 to go back to the pool size
+ * @return The previous limit, to restore after the pass
+ */
+int set_thread_pool_limit(int threads)
+{
+    int previous = pool_limit;
+    if(threads < 0) threads = 0;
+    pool_limit = threads < POOL_MAX_THREADS ? threads : POOL_MAX_THREADS;
+    return previous;
+}
+
+/* Worker threads started so far, for tests */
+int thread_pool_workers(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    int n = pool.spawned;
+    pthread_mutex_unlock(&pool.lock);
+    return n;
+}
+
+static inline uint64_t make_range(uint32_t next, uint32_t end)
+{
+    return (uint64_t)end << 32 | next;
+}
+
+static void run_chunk(pool_job *job, int c)
+{
+    int begin = c*job->grain;
+    int end = (job->n - begin < job->grain) ? job->n : begin + job->grain;
+    job->fn(job->args, begin, end);
+}
+
+static int take_own(pool_queue *q)
+{
+    uint64_t r = atomic_load(&q->range);
+    while((uint32_t)r < (uint32_t)(r >> 32)){
+        if(atomic_compare_exchange_weak(&q->range, &r, r + 1)) return (uint32_t)r;
+    }
+    return -1;
+}
+
+static int steal(pool_queue *q)
+{
+    uint64_t r = atomic_load(&q->range);
+    while((uint32_t)r < (uint32_t)(r >> 32)){
+        uint32_t end = (uint32_t)(r >> 32) - 1;
+        if(atomic_compare_exchange_weak(&q->range, &r, make_range((uint32_t)r, end))) return end;
+    }
+    return -1;
+}
+
+static void run_chunks(pool_job *job, int id)
+{
+    int c, i;
+    while((c = take_own(&job->queues[id])) >= 0) run_chunk(job, c);
+    for(i = 1; i < job->active; ++i){
+        pool_queue *victim = &job->queues[(id + i) % job->active];
+        while((c = steal(victim)) >= 0) run_chunk(job, c);
+    }
+}
+
+static void *pool_worker(void *ptr)
+{
+    pool_worker_slot *slot = ptr;
+    in_pool = 1;
+    pthread_mutex_lock(&pool.lock);
+    for(;;){
+        while(!slot->job) pthread_cond_wait(&slot->wake, &pool.lock);
+        pool_job *job = slot->job;
+        int id = slot->index;
+        pthread_mutex_unlock(&pool.lock);
+        run_chunks(job, id);
+        pthread_mutex_lock(&pool.lock);
+        slot->job = 0;
+        if(--job->pending == 0) pthread_cond_broadcast(&pool.done);
+    }
+    return 0;
+}
+
+static void run_serial(int n, int grain, parallel_fn fn, void *args)
+{
+    int begin;
+    for(begin = 0; begin < n; begin += grain){
+        fn(args, begin, (n - begin < grain) ? n : begin + grain);
+    }
+}
+
+/* Iterations per chunk for loops whose iterations each touch cost
+   elements, so a chunk covers about PARALLEL_GRAIN of them */
+int parallel_grain(size_t cost)
+{
+    if(cost >= PARALLEL_GRAIN) return 1;
+    return PARALLEL_GRAIN/(int)(cost ? cost : 1);
+}
+
+/**
+ * Runs fn over [0, n) in chunks of grain iterations on the thread pool and
+ * returns once every chunk has finished.
+ * @param grain Iterations per chunk; fixes the chunk boundaries, so pick it
+ *        from the problem size only
+ */
+void parallel_for(int n, int grain, parallel_fn fn, void *args)
+{
+    if(n <= 0) return;
+    if(grain < 1) grain = 1;
+    int chunks = (n - 1)/grain + 1;
+    int size = thread_pool_size();
+    int threads = pool_limit ? pool_limit : size;
+    int most = threads > size ? threads : size;
+    if(threads > chunks) threads = chunks;
+    if(threads <= 1 || in_pool){
+        run_serial(n, grain, fn, args);
+        return;
+    }
+    pool_queue queues[threads];
+    pool_job job = {fn, args, n, grain, 1, 0, queues};
+    int i;
+
+    pthread_mutex_lock(&pool.lock);
+    /* idle workers first, then new ones */
+    for(i = 0; i < pool.spawned && job.active < threads; ++i){
+        pool_worker_slot *slot = &pool.workers[i];
+        if(slot->job) continue;
+        slot->job = &job;
+        slot->index = job.active++;
+    }
+    while(job.active < threads && pool.spawned < most - 1){
+        pool_worker_slot *slot = &pool.workers[pool.spawned];
+        pthread_t thread;
+        pthread_cond_init(&slot->wake, 0);
+        slot->job = &job;
+        slot->index = job.active;
+        if(pthread_create(&thread, 0, pool_worker, slot)){
+            slot->job = 0;
+            pthread_cond_destroy(&slot->wake);
+            break;
+        }
+        pthread_detach(thread);
+        ++pool.spawned;
+        ++job.active;
+    }
+    for(i = 0; i < job.active; ++i){
+        int begin = (int)((int64_t)chunks*i/job.active);
+        int end = (int)((int64_t)chunks*(i + 1)/job.active);
+        atomic_store(&queues[i].range, make_range(begin, end));
+    }
+    job.pending = job.active - 1;
+    for(i = 0; i < pool.spawned; ++i){
+        if(pool.workers[i].job == &job) pthread_cond_signal(&pool.workers[i].wake);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    in_pool = 1;
+    run_chunks(&job, 0);
+    in_pool = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    while(job.pending) pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+}
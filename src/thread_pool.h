@@ -0,0 +1,17 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include "darknet.h"
+
+/* Body of a parallel loop: handles iterations [begin, end). */
+typedef void (*parallel_fn)(void *args, int begin, int end);
+
+/* Elements per chunk for cheap element-wise loops */
+#define PARALLEL_GRAIN 32768
+
+void parallel_for(int n, int grain, parallel_fn fn, void *args);
+int parallel_grain(size_t cost);
+
+int set_thread_pool_limit(int threads);
+int thread_pool_workers(void);
+
+#endif
@@ -1,4 +1,5 @@
 #include "upsample_layer.h"
+#include "layer.h"
 #include "cuda.h"
 #include "blas.h"
 
@@ -54,8 +55,8 @@ void resize_upsample_layer(layer *l, int w, int h)
     }
     l->outputs = l->out_w*l->out_h*l->out_c;
     l->inputs = l->h*l->w*l->c;
-    l->delta =  safe_realloc(l->delta, l->outputs*l->batch*sizeof(float));
-    l->output = safe_realloc(l->output, l->outputs*l->batch*sizeof(float));
+    l->delta =  resize_layer_buffer(l, l->delta, l->outputs*l->batch*sizeof(float));
+    l->output = resize_layer_buffer(l, l->output, l->outputs*l->batch*sizeof(float));
 
 #ifdef GPU
     cuda_free(l->output_gpu);
@@ -68,6 +69,8 @@ void resize_upsample_layer(layer *l, int w, int h)
 
 void forward_upsample_layer(const layer l, network net)
 {
+    /* the 1x1 convolution after it reads the small input itself */
+    if(l.fused) return;
     fill_cpu(l.outputs*l.batch, 0, l.output, 1);
     if(l.reverse){
         upsample_cpu(l.output, l.out_w, l.out_h, l.c, l.batch, l.stride, 0, l.scale, net.input);
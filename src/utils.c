@@ -8,6 +8,7 @@
 #include <limits.h>
 #include <time.h>
 #include <sys/time.h>
+#include <pthread.h>
 
 #include "utils.h"
 #include "safe_math.h"
@@ -104,6 +105,7 @@ void shuffle(void *arr, size_t n, size_t size)
         memcpy(arr+(j*size), arr+(i*size), size);
         memcpy(arr+(i*size), swp,          size);
     }
+    free(swp);
 }
 
 int *random_index_order(int min, int max)
@@ -232,7 +234,7 @@ void find_replace(char *str, const char *orig, char *rep, char *output)
 
     snprintf(buffer, sizeof(buffer), "%s", str);
     if(!(p = strstr(buffer, orig))){  // Is 'orig' even in 'str'?
-        snprintf(output, STRING_BUFFER_SIZE, "%s", str);
+        snprintf(output, STRING_BUFFER_SIZE, "%s", buffer);
         return;
     }
 
@@ -331,6 +333,49 @@ void *safe_realloc(void *old_ptr, size_t size)
     return ptr;
 }
 
+static pthread_key_t thread_buffers_key;
+static pthread_once_t thread_buffers_once = PTHREAD_ONCE_INIT;
+static __thread thread_buffer *thread_buffers = 0;
+
+static void free_thread_buffers(void *ptr)
+{
+    thread_buffer *b = ptr;
+    while(b){
+        thread_buffer *next = b->next;
+        free(b->data);
+        b->data = 0;
+        b->size = 0;
+        b->next = 0;
+        b = next;
+    }
+}
+
+static void make_thread_buffers_key()
+{
+    if(pthread_key_create(&thread_buffers_key, free_thread_buffers)) error("pthread_key_create failed");
+}
+
+/**
+ * The calling thread's buffer b with room for at least bytes, 64-byte
+ * aligned and zeroed whenever it grows.
+ * @param b A static __thread buffer, freed when the thread exits
+ */
+void *grow_thread_buffer(thread_buffer *b, size_t bytes)
+{
+    if(bytes <= b->size) return b->data;
+    if(!b->data && !b->size){
+        pthread_once(&thread_buffers_once, make_thread_buffers_key);
+        b->next = thread_buffers;
+        thread_buffers = b;
+        pthread_setspecific(thread_buffers_key, thread_buffers);
+    }
+    free(b->data);
+    if(posix_memalign(&b->data, 64, bytes)) malloc_error();
+    memset(b->data, 0, bytes);
+    b->size = bytes;
+    return b->data;
+}
+
 list *split_str(char *s, char delim)
 {
     size_t i;
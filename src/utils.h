@@ -14,6 +14,14 @@
 
 #define TWO_PI 6.2831853071795864769252866f
 
+/* Builds AVX-512/AVX2 variants of a plain C kernel next to the baseline one
+   and picks between them at load time. */
+#if defined(__GNUC__) && (__GNUC__ >= 12) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define SIMD_CLONES __attribute__((target_clones("arch=x86-64-v4","arch=x86-64-v3","default")))
+#else
+#define SIMD_CLONES
+#endif
+
 double what_time_is_it_now();
 void shuffle(void *arr, size_t n, size_t size);
 void sorta_shuffle(void *arr, size_t n, size_t size, size_t sections);
@@ -32,6 +40,15 @@ void file_error(char *s);
 void *safe_malloc(size_t size);
 void *safe_calloc(size_t nmemb, size_t size);
 void *safe_realloc(void *ptr, size_t size);
+
+/* Per-thread scratch that only grows. Declare one static __thread; the
+   thread's buffers are freed when it exits. */
+typedef struct thread_buffer {
+    void *data;
+    size_t size;
+    struct thread_buffer *next;
+} thread_buffer;
+void *grow_thread_buffer(thread_buffer *b, size_t bytes);
 void strip(char *s);
 void strip_char(char *s, char bad);
 list *split_str(char *s, char delim);
@@ -0,0 +1,321 @@
+#include "winograd.h"
+#include "gemm.h"
+#include "utils.h"
+#include "thread_pool.h"
+#include <string.h>
+
+/*
+ * Winograd F(mxm, 3x3) convolution, stride 1, pad 1 (Lavin & Gray).
+ *
+ * Every (m+2)x(m+2) input tile d is taken to V = B^T d B and every filter g
+ * to U = G g G^T. The (m+2)^2 element-wise products of U and V summed over
+ * input channels become (m+2)^2 independent GEMMs, K x C times C x tiles,
+ * and Y = A^T M A gives the mxm output tile. F(2x2,3x3) needs 16 multiplies
+ * per 4 outputs instead of 36, F(4x4,3x3) 36 per 16 instead of 144.
+ *
+ * Tiles are processed in chunks so that V and M for a chunk fit the
+ * workspace; filters are transformed once by winograd_transform_weights.
+ * Within a chunk the thread pool splits the input transform over channels,
+ * the GEMMs over the (m+2)^2 tile positions and the output transform over
+ * filters.
+ */
+
+#define WINOGRAD_MAX_ALPHA 6
+#define WINOGRAD_LANES 8
+
+typedef float winograd_vec __attribute__((vector_size(WINOGRAD_LANES*sizeof(float))));
+
+/* Column chunk of the tile GEMMs, large enough to keep them efficient */
+#define WINOGRAD_TILE_BLOCK 128
+
+static const float winograd_g2[4][3] = {
+    {1,    0,   0},
+    {.5,  .5,  .5},
+    {.5, -.5,  .5},
+    {0,    0,   1}
+};
+static const float winograd_g4[6][3] = {
+    { 1./4,      0,     0},
+    {-1./6,  -1./6, -1./6},
+    {-1./6,   1./6, -1./6},
+    { 1./24, 1./12,  1./6},
+    { 1./24,-1./12,  1./6},
+    {     0,     0,     1}
+};
+
+int winograd_supported(int size, int stride, int pad)
+{
+    return size == 3 && stride == 1 && pad == 1;
+}
+
+static int winograd_tiles(int tile, int height, int width)
+{
+    return ((height + tile - 1)/tile) * ((width + tile - 1)/tile);
+}
+
+size_t winograd_weights_size(int tile, int filters, int channels)
+{
+    int alpha = tile + 2;
+    return (size_t)alpha*alpha*filters*channels;
+}
+
+size_t winograd_workspace_size(int tile, int channels, int filters, int height, int width)
+{
+    int alpha = tile + 2;
+    int tiles = winograd_tiles(tile, height, width);
+    if(tiles > WINOGRAD_TILE_BLOCK) tiles = WINOGRAD_TILE_BLOCK;
+    tiles = (tiles + WINOGRAD_LANES - 1)/WINOGRAD_LANES*WINOGRAD_LANES;
+    return (size_t)alpha*alpha*(channels + filters)*tiles*sizeof(float);
+}
+
+typedef struct {
+    int tile;
+    float *weights;
+    int filters, channels;
+    float *out;
+} winograd_weights_args;
+
+static void winograd_transform_filters(void *ptr, int begin, int end)
+{
+    winograd_weights_args *a = ptr;
+    int alpha = a->tile + 2;
+    const float *g = (a->tile == 4) ? winograd_g4[0] : winograd_g2[0];
+    float *weights = a->weights;
+    float *out = a->out;
+    int filters = a->filters;
+    int channels = a->channels;
+    int f;
+    for(f = begin; f < end; ++f){
+        int c, i, j, k;
+        for(c = 0; c < channels; ++c){
+            float *w = weights + (f*channels + c)*9;
+            float tmp[WINOGRAD_MAX_ALPHA][3];
+            for(i = 0; i < alpha; ++i){
+                for(j = 0; j < 3; ++j){
+                    float sum = 0;
+                    for(k = 0; k < 3; ++k) sum += g[i*3 + k]*w[k*3 + j];
+                    tmp[i][j] = sum;
+                }
+            }
+            for(i = 0; i < alpha; ++i){
+                for(j = 0; j < alpha; ++j){
+                    float sum = 0;
+                    for(k = 0; k < 3; ++k) sum += tmp[i][k]*g[j*3 + k];
+                    out[((size_t)(i*alpha + j)*filters + f)*channels + c] = sum;
+                }
+            }
+        }
+    }
+}
+
+void winograd_transform_weights(int tile, float *weights, int filters, int channels, float *out)
+{
+    winograd_weights_args a = {tile, weights, filters, channels, out};
+    parallel_for(filters, 8, winograd_transform_filters, &a);
+}
+
+/* 1-D transforms, applied to vectors of WINOGRAD_LANES tiles at once */
+static inline __attribute__((always_inline))
+void winograd_bt_1d(const int tile, winograd_vec *d, winograd_vec *r)
+{
+    if(tile == 4){
+        r[0] = 4*d[0] - 5*d[2] + d[4];
+        r[1] = -4*(d[1] + d[2]) + d[3] + d[4];
+        r[2] = 4*(d[1] - d[2]) - d[3] + d[4];
+        r[3] = 2*(d[3] - d[1]) - d[2] + d[4];
+        r[4] = 2*(d[1] - d[3]) - d[2] + d[4];
+        r[5] = 4*d[1] - 5*d[3] + d[5];
+    } else {
+        r[0] = d[0] - d[2];
+        r[1] = d[1] + d[2];
+        r[2] = d[2] - d[1];
+        r[3] = d[1] - d[3];
+    }
+}
+
+static inline __attribute__((always_inline))
+void winograd_at_1d(const int tile, winograd_vec *m, winograd_vec *r)
+{
+    if(tile == 4){
+        winograd_vec s1 = m[1] + m[2], d1 = m[1] - m[2];
+        winograd_vec s2 = m[3] + m[4], d2 = m[3] - m[4];
+        r[0] = m[0] + s1 + s2;
+        r[1] = d1 + 2*d2;
+        r[2] = s1 + 4*s2;
+        r[3] = d1 + 8*d2 + m[5];
+    } else {
+        r[0] = m[0] + m[1] + m[2];
+        r[1] = m[1] - m[2] - m[3];
+    }
+}
+
+typedef struct {
+    float *im;
+    int channels, height, width;
+    float *u;
+    int filters;
+    int t0, nt, ld;
+    float *v, *m;
+    float *output;
+} winograd_args;
+
+/* V[xi][c][t] = (B^T d B)[xi] for tiles [t0, t0 + nt) and channels
+   [c0, c1), rows of V are ldv long */
+static inline __attribute__((always_inline))
+void winograd_input_transform(const int tile, float *im, int channels,
+        int height, int width, int t0, int nt, int ldv, float *v, int c0, int c1)
+{
+    const int alpha = tile + 2;
+    int tiles_w = (width + tile - 1)/tile;
+    int c;
+    for(c = c0; c < c1; ++c){
+        float *plane = im + (size_t)c*height*width;
+        int t, l, i, j;
+        for(t = 0; t < ldv; t += WINOGRAD_LANES){
+            float d[WINOGRAD_MAX_ALPHA*WINOGRAD_MAX_ALPHA][WINOGRAD_LANES];
+            winograd_vec dv[WINOGRAD_MAX_ALPHA][WINOGRAD_MAX_ALPHA];
+            winograd_vec tmp[WINOGRAD_MAX_ALPHA][WINOGRAD_MAX_ALPHA];
+            winograd_vec col[WINOGRAD_MAX_ALPHA], res[WINOGRAD_MAX_ALPHA];
+            for(l = 0; l < WINOGRAD_LANES; ++l){
+                /* padding lanes repeat the last tile, their columns are never read back */
+                int tt = t0 + ((t + l < nt) ? t + l : nt - 1);
+                int y0 = tt/tiles_w*tile - 1;
+                int x0 = tt%tiles_w*tile - 1;
+                if(y0 >= 0 && x0 >= 0 && y0 + alpha <= height && x0 + alpha <= width){
+                    for(i = 0; i < alpha; ++i){
+                        float *row = plane + (y0 + i)*width + x0;
+                        for(j = 0; j < alpha; ++j) d[i*alpha + j][l] = row[j];
+                    }
+                } else {
+                    for(i = 0; i < alpha; ++i){
+                        int y = y0 + i;
+                        for(j = 0; j < alpha; ++j){
+                            int x = x0 + j;
+                            d[i*alpha + j][l] = (y < 0 || y >= height || x < 0 || x >= width) ? 0 : plane[y*width + x];
+                        }
+                    }
+                }
+            }
+            for(i = 0; i < alpha; ++i){
+                for(j = 0; j < alpha; ++j) memcpy(&dv[i][j], d[i*alpha + j], sizeof(winograd_vec));
+            }
+            for(j = 0; j < alpha; ++j){
+                for(i = 0; i < alpha; ++i) col[i] = dv[i][j];
+                winograd_bt_1d(tile, col, res);
+                for(i = 0; i < alpha; ++i) tmp[i][j] = res[i];
+            }
+            for(i = 0; i < alpha; ++i){
+                winograd_bt_1d(tile, tmp[i], res);
+                for(j = 0; j < alpha; ++j){
+                    memcpy(v + ((size_t)(i*alpha + j)*channels + c)*ldv + t, &res[j], sizeof(winograd_vec));
+                }
+            }
+        }
+    }
+}
+
+/* output tile = A^T M A for tiles [t0, t0 + nt) and filters [f0, f1),
+   clipped to the image */
+static inline __attribute__((always_inline))
+void winograd_output_transform(const int tile, float *m, int filters,
+        int height, int width, int t0, int nt, int ldm, float *output, int f0, int f1)
+{
+    const int alpha = tile + 2;
+    int tiles_w = (width + tile - 1)/tile;
+    int f;
+    for(f = f0; f < f1; ++f){
+        float *plane = output + (size_t)f*height*width;
+        int t, l, i, j;
+        for(t = 0; t < nt; t += WINOGRAD_LANES){
+            winograd_vec mv[WINOGRAD_MAX_ALPHA][WINOGRAD_MAX_ALPHA];
+            winograd_vec tmp[WINOGRAD_MAX_ALPHA][WINOGRAD_MAX_ALPHA];
+            winograd_vec col[WINOGRAD_MAX_ALPHA], res[WINOGRAD_MAX_ALPHA];
+            winograd_vec yv[WINOGRAD_MAX_ALPHA][WINOGRAD_MAX_ALPHA];
+            float y[WINOGRAD_MAX_ALPHA*WINOGRAD_MAX_ALPHA][WINOGRAD_LANES];
+            for(i = 0; i < alpha; ++i){
+                for(j = 0; j < alpha; ++j){
+                    memcpy(&mv[i][j], m + ((size_t)(i*alpha + j)*filters + f)*ldm + t, sizeof(winograd_vec));
+                }
+            }
+            for(j = 0; j < alpha; ++j){
+                for(i = 0; i < alpha; ++i) col[i] = mv[i][j];
+                winograd_at_1d(tile, col, res);
+                for(i = 0; i < tile; ++i) tmp[i][j] = res[i];
+            }
+            for(i = 0; i < tile; ++i){
+                winograd_at_1d(tile, tmp[i], res);
+                for(j = 0; j < tile; ++j) yv[i][j] = res[j];
+            }
+            for(i = 0; i < tile; ++i){
+                for(j = 0; j < tile; ++j) memcpy(y[i*tile + j], &yv[i][j], sizeof(winograd_vec));
+            }
+            for(l = 0; l < WINOGRAD_LANES && t + l < nt; ++l){
+                int y0 = (t0 + t + l)/tiles_w*tile;
+                int x0 = (t0 + t + l)%tiles_w*tile;
+                for(i = 0; i < tile && y0 + i < height; ++i){
+                    float *row = plane + (y0 + i)*width + x0;
+                    for(j = 0; j < tile && x0 + j < width; ++j) row[j] = y[i*tile + j][l];
+                }
+            }
+        }
+    }
+}
+
+SIMD_CLONES
+static void winograd_input_f2(void *ptr, int begin, int end)
+{
+    winograd_args *a = ptr;
+    winograd_input_transform(2, a->im, a->channels, a->height, a->width, a->t0, a->nt, a->ld, a->v, begin, end);
+}
+
+SIMD_CLONES
+static void winograd_input_f4(void *ptr, int begin, int end)
+{
+    winograd_args *a = ptr;
+    winograd_input_transform(4, a->im, a->channels, a->height, a->width, a->t0, a->nt, a->ld, a->v, begin, end);
+}
+
+SIMD_CLONES
+static void winograd_output_f2(void *ptr, int begin, int end)
+{
+    winograd_args *a = ptr;
+    winograd_output_transform(2, a->m, a->filters, a->height, a->width, a->t0, a->nt, a->ld, a->output, begin, end);
+}
+
+SIMD_CLONES
+static void winograd_output_f4(void *ptr, int begin, int end)
+{
+    winograd_args *a = ptr;
+    winograd_output_transform(4, a->m, a->filters, a->height, a->width, a->t0, a->nt, a->ld, a->output, begin, end);
+}
+
+/* M[xi] = U[xi] V[xi] for tile positions [begin, end) */
+static void winograd_products(void *ptr, int begin, int end)
+{
+    winograd_args *a = ptr;
+    int xi;
+    for(xi = begin; xi < end; ++xi){
+        gemm(0,0,a->filters,a->ld,a->channels,1,
+                a->u + (size_t)xi*a->filters*a->channels, a->channels,
+                a->v + (size_t)xi*a->channels*a->ld, a->ld,
+                0, a->m + (size_t)xi*a->filters*a->ld, a->ld);
+    }
+}
+
+void winograd_conv3x3_cpu(int tile, float *im, int channels, int height, int width,
+        float *weights, int filters, float *workspace, float *output)
+{
+    int alpha = tile + 2;
+    int tiles = winograd_tiles(tile, height, width);
+    winograd_args a = {im, channels, height, width, weights, filters};
+    a.output = output;
+    for(a.t0 = 0; a.t0 < tiles; a.t0 += WINOGRAD_TILE_BLOCK){
+        a.nt = (tiles - a.t0 < WINOGRAD_TILE_BLOCK) ? tiles - a.t0 : WINOGRAD_TILE_BLOCK;
+        a.ld = (a.nt + WINOGRAD_LANES - 1)/WINOGRAD_LANES*WINOGRAD_LANES;
+        a.v = workspace;
+        a.m = workspace + (size_t)alpha*alpha*channels*a.ld;
+        parallel_for(channels, 4, tile == 4 ? winograd_input_f4 : winograd_input_f2, &a);
+        parallel_for(alpha*alpha, 1, winograd_products, &a);
+        parallel_for(filters, 4, tile == 4 ? winograd_output_f4 : winograd_output_f2, &a);
+    }
+}
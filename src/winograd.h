@@ -0,0 +1,13 @@
+#ifndef WINOGRAD_H
+#define WINOGRAD_H
+#include <stddef.h>
+
+int winograd_supported(int size, int stride, int pad);
+size_t winograd_weights_size(int tile, int filters, int channels);
+size_t winograd_workspace_size(int tile, int channels, int filters, int height, int width);
+
+void winograd_transform_weights(int tile, float *weights, int filters, int channels, float *out);
+void winograd_conv3x3_cpu(int tile, float *im, int channels, int height, int width,
+        float *weights, int filters, float *workspace, float *output);
+
+#endif
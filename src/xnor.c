@@ -0,0 +1,315 @@
+#include "xnor.h"
+#include "convolutional_layer.h"
+#include "utils.h"
+#include "thread_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+/*
+ * Bit-packed convolution for xnor layers.
+ *
+ * Weights and inputs are binarized to +-1 and packed 64 channels per word,
+ * a bit set when the value is positive. The input becomes one run of
+ * binary_words(channels) words per pixel and each filter one run per tap,
+ * so a tap's dot product over channels is c - 2*popcount(w ^ x) and the
+ * convolution reads pixels in place rather than through an im2col matrix.
+ * Taps in the padding are 0 rather than +-1 and are skipped. Bits past the
+ * last channel are zero in both operands and never differ.
+ *
+ * Filters are interleaved in blocks of XNOR_FB, [block][tap][word][XNOR_FB],
+ * so one input word meets XNOR_FB filter words in a row; with AVX-512
+ * VPOPCNTDQ that inner loop is a single vpopcntq. target_clones can only
+ * pick that variant by CPU model, so the kernel is chosen with CPUID like
+ * gemm's.
+ */
+
+#define XNOR_FB 8
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define XNOR_X86
+#include <immintrin.h>
+#endif
+
+int binary_words(int n)
+{
+    return (n + 63)/64;
+}
+
+/**
+ * Sign bits of planar float data, pixel-major.
+ * @param x channels planes of spatial values
+ * @param bits Out: binary_words(channels) words per pixel
+ */
+void pack_sign_bits(float *x, int channels, int spatial, uint64_t *bits)
+{
+    int words = binary_words(channels);
+    int c, p;
+    memset(bits, 0, (size_t)spatial*words*sizeof(uint64_t));
+    for(c = 0; c < channels; ++c){
+        int shift = c%64;
+        uint64_t *b = bits + c/64;
+        float *plane = x + (size_t)c*spatial;
+        for(p = 0; p < spatial; ++p){
+            b[(size_t)p*words] |= (uint64_t)(plane[p] > 0) << shift;
+        }
+    }
+}
+
+size_t binary_filter_words(int filters, int channels, int size)
+{
+    return (size_t)(filters + XNOR_FB - 1)/XNOR_FB*XNOR_FB*size*size*binary_words(channels);
+}
+
+static inline __attribute__((always_inline))
+void xnor_conv_block(const uint64_t *bits, int channels, int height, int width,
+        int size, int stride, int pad, const uint64_t *w, int rows,
+        const float *scales, float *output)
+{
+    int words = binary_words(channels);
+    int out_h = (height + 2*pad - size)/stride + 1;
+    int out_w = (width + 2*pad - size)/stride + 1;
+    int i, y, x, ky, kx, k;
+    for(y = 0; y < out_h; ++y){
+        for(x = 0; x < out_w; ++x){
+            uint64_t diff[XNOR_FB] = {0};
+            int count = 0;
+            for(ky = 0; ky < size; ++ky){
+                int iy = y*stride + ky - pad;
+                if(iy < 0 || iy >= height) continue;
+                for(kx = 0; kx < size; ++kx){
+                    int ix = x*stride + kx - pad;
+                    if(ix < 0 || ix >= width) continue;
+                    const uint64_t *in = bits + ((size_t)iy*width + ix)*words;
+                    const uint64_t *tap = w + (size_t)(ky*size + kx)*words*XNOR_FB;
+                    for(k = 0; k < words; ++k){
+                        uint64_t v = in[k];
+                        for(i = 0; i < XNOR_FB; ++i) diff[i] += __builtin_popcountll(tap[k*XNOR_FB + i] ^ v);
+                    }
+                    count += channels;
+                }
+            }
+            for(i = 0; i < rows; ++i){
+                output[((size_t)i*out_h + y)*out_w + x] = scales[i]*(count - 2*(int)diff[i]);
+            }
+        }
+    }
+}
+
+typedef void (*xnor_block_kernel)(const uint64_t *bits, int channels, int height, int width,
+        int size, int stride, int pad, const uint64_t *w, int rows,
+        const float *scales, float *output);
+
+static void xnor_block_generic(const uint64_t *bits, int channels, int height, int width,
+        int size, int stride, int pad, const uint64_t *w, int rows,
+        const float *scales, float *output)
+{
+    xnor_conv_block(bits, channels, height, width, size, stride, pad, w, rows, scales, output);
+}
+
+#ifdef XNOR_X86
+__attribute__((target("popcnt")))
+static void xnor_block_popcnt(const uint64_t *bits, int channels, int height, int width,
+        int size, int stride, int pad, const uint64_t *w, int rows,
+        const float *scales, float *output)
+{
+    xnor_conv_block(bits, channels, height, width, size, stride, pad, w, rows, scales, output);
+}
+
+/* The same loop with the XNOR_FB filters of a block in one zmm register */
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static void xnor_block_vpopcnt(const uint64_t *bits, int channels, int height, int width,
+        int size, int stride, int pad, const uint64_t *w, int rows,
+        const float *scales, float *output)
+{
+    int words = binary_words(channels);
+    int out_h = (height + 2*pad - size)/stride + 1;
+    int out_w = (width + 2*pad - size)/stride + 1;
+    int i, y, x, ky, kx, k;
+    for(y = 0; y < out_h; ++y){
+        for(x = 0; x < out_w; ++x){
+            __m512i diff = _mm512_setzero_si512();
+            int count = 0;
+            for(ky = 0; ky < size; ++ky){
+                int iy = y*stride + ky - pad;
+                if(iy < 0 || iy >= height) continue;
+                for(kx = 0; kx < size; ++kx){
+                    int ix = x*stride + kx - pad;
+                    if(ix < 0 || ix >= width) continue;
+                    const uint64_t *in = bits + ((size_t)iy*width + ix)*words;
+                    const uint64_t *tap = w + (size_t)(ky*size + kx)*words*XNOR_FB;
+                    for(k = 0; k < words; ++k){
+                        __m512i d = _mm512_xor_si512(_mm512_loadu_si512(tap + k*XNOR_FB), _mm512_set1_epi64(in[k]));
+                        diff = _mm512_add_epi64(diff, _mm512_popcnt_epi64(d));
+                    }
+                    count += channels;
+                }
+            }
+            uint64_t d[XNOR_FB];
+            _mm512_storeu_si512(d, diff);
+            for(i = 0; i < rows; ++i){
+                output[((size_t)i*out_h + y)*out_w + x] = scales[i]*(count - 2*(int)d[i]);
+            }
+        }
+    }
+}
+#endif
+
+typedef struct {
+    const char *name;
+    xnor_block_kernel kernel;
+} xnor_engine;
+
+static const xnor_engine xnor_engine_generic = {"generic", xnor_block_generic};
+#ifdef XNOR_X86
+static const xnor_engine xnor_engine_popcnt  = {"popcnt",  xnor_block_popcnt};
+static const xnor_engine xnor_engine_vpopcnt = {"avx512vpopcntdq", xnor_block_vpopcnt};
+#endif
+
+static const xnor_engine *xnor_active_engine = &xnor_engine_generic;
+static pthread_once_t xnor_engine_once = PTHREAD_ONCE_INIT;
+
+static void select_xnor_engine(void)
+{
+#ifdef XNOR_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512vpopcntdq")){
+        xnor_active_engine = &xnor_engine_vpopcnt;
+    } else if(__builtin_cpu_supports("popcnt")){
+        xnor_active_engine = &xnor_engine_popcnt;
+    }
+#endif
+}
+
+static const xnor_engine *get_xnor_engine(void)
+{
+    pthread_once(&xnor_engine_once, select_xnor_engine);
+    return xnor_active_engine;
+}
+
+const char *xnor_kernel_name(void)
+{
+    return get_xnor_engine()->name;
+}
+
+/* Overrides the CPUID choice. Returns 0 if the named kernel is unknown or
+   not supported by this CPU. */
+int xnor_select_kernel(const char *name)
+{
+    get_xnor_engine();
+    if(0 == strcmp(name, "generic")){
+        xnor_active_engine = &xnor_engine_generic;
+        return 1;
+    }
+#ifdef XNOR_X86
+    if(0 == strcmp(name, "popcnt") && __builtin_cpu_supports("popcnt")){
+        xnor_active_engine = &xnor_engine_popcnt;
+        return 1;
+    }
+    if(0 == strcmp(name, "avx512vpopcntdq") && __builtin_cpu_supports("avx512vpopcntdq")){
+        xnor_active_engine = &xnor_engine_vpopcnt;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+typedef struct {
+    uint64_t *bits;
+    int channels, height, width, size, stride, pad;
+    uint64_t *weights;
+    int filters;
+    float *scales, *output;
+} xnor_conv_args;
+
+static void xnor_conv_blocks(void *ptr, int begin, int end)
+{
+    xnor_conv_args *a = ptr;
+    int out_size = ((a->height + 2*a->pad - a->size)/a->stride + 1)*((a->width + 2*a->pad - a->size)/a->stride + 1);
+    size_t block_words = (size_t)a->size*a->size*binary_words(a->channels)*XNOR_FB;
+    xnor_block_kernel kernel = get_xnor_engine()->kernel;
+    int b;
+    for(b = begin; b < end; ++b){
+        int f = b*XNOR_FB;
+        int rows = (a->filters - f < XNOR_FB) ? a->filters - f : XNOR_FB;
+        kernel(a->bits, a->channels, a->height, a->width, a->size, a->stride, a->pad,
+                a->weights + b*block_words, rows, a->scales + f, a->output + (size_t)f*out_size);
+    }
+}
+
+/**
+ * output = scales[f]*(sign(w_f) . sign(x)) over the taps inside the image.
+ * @param bits Input packed by pack_sign_bits
+ * @param weights Filters packed by pack_binary_filters
+ */
+void xnor_conv_bits(uint64_t *bits, int channels, int height, int width,
+        int size, int stride, int pad, uint64_t *weights, int filters,
+        float *scales, float *output)
+{
+    xnor_conv_args a = {bits, channels, height, width, size, stride, pad, weights, filters, scales, output};
+    parallel_for((filters + XNOR_FB - 1)/XNOR_FB, 1, xnor_conv_blocks, &a);
+}
+
+/**
+ * Sign bits of filters x channels x size x size weights in the interleaved
+ * layout xnor_conv_bits reads, binary_filter_words words in all.
+ */
+void pack_binary_filters(float *weights, int filters, int channels, int size, uint64_t *packed)
+{
+    int words = binary_words(channels);
+    int taps = size*size;
+    int f, c, t;
+    memset(packed, 0, binary_filter_words(filters, channels, size)*sizeof(uint64_t));
+    for(f = 0; f < filters; ++f){
+        uint64_t *block = packed + (size_t)f/XNOR_FB*taps*words*XNOR_FB + f%XNOR_FB;
+        for(c = 0; c < channels; ++c){
+            float *w = weights + ((size_t)f*channels + c)*taps;
+            for(t = 0; t < taps; ++t){
+                if(w[t] > 0) block[(t*words + c/64)*XNOR_FB] |= 1ULL << (c%64);
+            }
+        }
+    }
+}
+
+/**
+ * Repacks the layer's binarized weights after l.weights changed.
+ * @param l Convolutional layer, does nothing unless it is binary or xnor
+ */
+void update_binary_weights(layer l)
+{
+    if(!l.packed_weights) return;
+    int m = l.n/l.groups;
+    int c = l.c/l.groups;
+    int j;
+    binarize_weights(l.weights, l.n, c*l.size*l.size, l.binary_weights);
+    for(j = 0; j < l.groups; ++j){
+        pack_binary_filters(l.weights + j*l.nweights/l.groups, m, c, l.size,
+                l.packed_weights + j*binary_filter_words(m, c, l.size));
+    }
+}
+
+/* Scratch is per calling thread */
+static __thread thread_buffer xnor_bits_buffer;
+static __thread thread_buffer xnor_scales_buffer;
+
+/**
+ * One group of an xnor layer on one image: output = mean|w| * sign(w)*sign(x)
+ * summed over the taps, the same values the float path gets from
+ * binarize_weights, binarize_cpu, im2col and gemm.
+ * @param im The group's input channels
+ * @param output The group's l.n/l.groups output planes
+ */
+void xnor_conv_cpu(layer l, float *im, int group, float *output)
+{
+    int m = l.n/l.groups;
+    int c = l.c/l.groups;
+    int f;
+    uint64_t *xnor_bits = grow_thread_buffer(&xnor_bits_buffer, (size_t)l.h*l.w*binary_words(c)*sizeof(uint64_t));
+    float *xnor_scales = grow_thread_buffer(&xnor_scales_buffer, m*sizeof(float));
+    for(f = 0; f < m; ++f) xnor_scales[f] = fabs(l.binary_weights[(size_t)(group*m + f)*c*l.size*l.size]);
+
+    pack_sign_bits(im, c, l.h*l.w, xnor_bits);
+    xnor_conv_bits(xnor_bits, c, l.h, l.w, l.size, l.stride, l.pad,
+            l.packed_weights + group*binary_filter_words(m, c, l.size), m, xnor_scales, output);
+}
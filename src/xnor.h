@@ -0,0 +1,23 @@
+#ifndef XNOR_H
+#define XNOR_H
+#include "darknet.h"
+
+/* Weights files with this minor version hold binary and xnor convolutional
+   layers at 1 bit per weight, see save_weights_binary */
+#define BINARY_WEIGHTS_MINOR 4
+
+int binary_words(int n);
+void pack_sign_bits(float *x, int channels, int spatial, uint64_t *bits);
+size_t binary_filter_words(int filters, int channels, int size);
+void pack_binary_filters(float *weights, int filters, int channels, int size, uint64_t *packed);
+void xnor_conv_bits(uint64_t *bits, int channels, int height, int width,
+        int size, int stride, int pad, uint64_t *weights, int filters,
+        float *scales, float *output);
+
+const char *xnor_kernel_name(void);
+int xnor_select_kernel(const char *name);
+
+void update_binary_weights(layer l);
+void xnor_conv_cpu(layer l, float *im, int group, float *output);
+
+#endif
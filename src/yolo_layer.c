@@ -1,9 +1,11 @@
 #include "yolo_layer.h"
+#include "layer.h"
 #include "activations.h"
 #include "blas.h"
 #include "box.h"
 #include "cuda.h"
 #include "utils.h"
+#include "thread_pool.h"
 #include "safe_math.h"
 
 #include <stdio.h>
@@ -69,8 +71,8 @@ void resize_yolo_layer(layer *l, int w, int h)
     l->outputs = h*w*l->n*(l->classes + 4 + 1);
     l->inputs = l->outputs;
 
-    l->output = safe_realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta = safe_realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    l->output = resize_layer_buffer(l, l->output, l->batch*l->outputs*sizeof(float));
+    l->delta = resize_layer_buffer(l, l->delta, l->batch*l->outputs*sizeof(float));
 
 #ifdef GPU
     cuda_free(l->delta_gpu);
@@ -132,23 +134,39 @@ static int entry_index(layer l, int batch, int location, int entry)
     return batch*l.outputs + n*l.w*l.h*(4+l.classes+1) + entry*l.w*l.h + loc;
 }
 
-void forward_yolo_layer(const layer l, network net)
-{
-    int i,j,b,t,n;
-    memcpy(l.output, net.input, l.outputs*l.batch*sizeof(float));
+/* Copies and squashes the x, y, objectness and class maps of anchors
+   [begin, end) over the whole batch */
+typedef struct {
+    const layer *l;
+    float *input;
+} yolo_args;
 
+static void decode_yolo_anchors(void *ptr, int begin, int end)
+{
+    const layer *l = ((yolo_args *)ptr)->l;
+    float *input = ((yolo_args *)ptr)->input;
+    int a;
+    for(a = begin; a < end; ++a){
+        int b = a / l->n;
+        int n = a % l->n;
+        int index = entry_index(*l, b, n*l->w*l->h, 0);
+        int size = (4 + 1 + l->classes)*l->w*l->h;
+        memcpy(l->output + index, input + index, size*sizeof(float));
 #ifndef GPU
-    for (b = 0; b < l.batch; ++b){
-        for(n = 0; n < l.n; ++n){
-            int index = entry_index(l, b, n*l.w*l.h, 0);
-            activate_array(l.output + index, 2*l.w*l.h, LOGISTIC);
-            index = entry_index(l, b, n*l.w*l.h, 4);
-            activate_array(l.output + index, (1+l.classes)*l.w*l.h, LOGISTIC);
-        }
-    }
+        activate_array(l->output + index, 2*l->w*l->h, LOGISTIC);
+        index = entry_index(*l, b, n*l->w*l->h, 4);
+        activate_array(l->output + index, (1+l->classes)*l->w*l->h, LOGISTIC);
 #endif
+    }
+}
+
+void forward_yolo_layer(const layer l, network net)
+{
+    int i,j,b,t,n;
+    yolo_args decode = {&l, net.input};
+    parallel_for(l.batch*l.n, 1, decode_yolo_anchors, &decode);
 
-    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
+    if(l.delta) memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
     if(!net.train) return;
     float avg_iou = 0;
     float recall = 0;
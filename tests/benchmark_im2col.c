@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/im2col.h"
+#include "../src/col2im.h"
+#include "../src/thread_pool.h"
+#include "../src/utils.h"
+
+/* The per-pixel versions im2col.c and col2im.c replaced, as the baseline */
+static float get_pixel_naive(float *im, int height, int width, int row, int col, int channel, int pad)
+{
+    row -= pad;
+    col -= pad;
+    if (row < 0 || col < 0 || row >= height || col >= width) return 0;
+    return im[col + width*(row + height*channel)];
+}
+
+static void im2col_naive(float *im, int channels, int height, int width, int ksize, int stride, int pad, float *col)
+{
+    int height_col = (height + 2*pad - ksize) / stride + 1;
+    int width_col = (width + 2*pad - ksize) / stride + 1;
+    for (int c = 0; c < channels*ksize*ksize; ++c) {
+        int w_offset = c % ksize;
+        int h_offset = (c / ksize) % ksize;
+        int c_im = c / ksize / ksize;
+        for (int h = 0; h < height_col; ++h) {
+            for (int w = 0; w < width_col; ++w) {
+                col[(c * height_col + h) * width_col + w] = get_pixel_naive(im, height, width,
+                        h_offset + h * stride, w_offset + w * stride, c_im, pad);
+            }
+        }
+    }
+}
+
+static void col2im_naive(float *col, int channels, int height, int width, int ksize, int stride, int pad, float *im)
+{
+    int height_col = (height + 2*pad - ksize) / stride + 1;
+    int width_col = (width + 2*pad - ksize) / stride + 1;
+    for (int c = 0; c < channels*ksize*ksize; ++c) {
+        int w_offset = c % ksize;
+        int h_offset = (c / ksize) % ksize;
+        int c_im = c / ksize / ksize;
+        for (int h = 0; h < height_col; ++h) {
+            for (int w = 0; w < width_col; ++w) {
+                int row = h_offset + h * stride - pad;
+                int x = w_offset + w * stride - pad;
+                if (row < 0 || x < 0 || row >= height || x >= width) continue;
+                double val = col[(c * height_col + h) * width_col + w];
+                im[x + width*(row + height*c_im)] += val;
+            }
+        }
+    }
+}
+
+static size_t col_size(int c, int h, int w, int size, int stride, int pad)
+{
+    size_t out_h = (h + 2*pad - size)/stride + 1;
+    size_t out_w = (w + 2*pad - size)/stride + 1;
+    return (size_t)c*size*size*out_h*out_w;
+}
+
+static void check_shape(int c, int h, int w, int size, int stride, int pad)
+{
+    size_t n = col_size(c, h, w, size, stride, pad);
+    float *im = calloc(c*h*w, sizeof(float));
+    float *col = calloc(n, sizeof(float));
+    float *ref = calloc(n, sizeof(float));
+    float *back = calloc(c*h*w, sizeof(float));
+    float *back_ref = calloc(c*h*w, sizeof(float));
+    for (int i = 0; i < c*h*w; ++i) im[i] = rand_uniform(-1, 1);
+    im2col_naive(im, c, h, w, size, stride, pad, ref);
+    im2col_cpu(im, c, h, w, size, stride, pad, col);
+    assert(memcmp(col, ref, n*sizeof(float)) == 0);
+    col2im_naive(ref, c, h, w, size, stride, pad, back_ref);
+    col2im_cpu(ref, c, h, w, size, stride, pad, back);
+    assert(memcmp(back, back_ref, c*h*w*sizeof(float)) == 0);
+    free(im);
+    free(col);
+    free(ref);
+    free(back);
+    free(back_ref);
+}
+
+/* The im2col convolutions of cfg/yolov3.cfg at 416x416; its 1x1 stride 1
+   layers multiply the input directly */
+static const int yolov3_shapes[][5] = {
+    /* c, h, w, size, stride */
+    {   3, 416, 416, 3, 1},
+    {  32, 416, 416, 3, 2},
+    {  32, 208, 208, 3, 1},
+    {  64, 208, 208, 3, 2},
+    {  64, 104, 104, 3, 1},
+    { 128, 104, 104, 3, 2},
+    { 128,  52,  52, 3, 1},
+    { 256,  52,  52, 3, 2},
+    { 256,  26,  26, 3, 1},
+    { 512,  26,  26, 3, 2},
+    { 512,  13,  13, 3, 1},
+};
+
+static double time_it(void (*fn)(float *, int, int, int, int, int, int, float *),
+        float *in, int c, int h, int w, int size, int stride, int pad, float *out, int reps)
+{
+    fn(in, c, h, w, size, stride, pad, out);
+    double start = what_time_is_it_now();
+    for (int r = 0; r < reps; ++r) fn(in, c, h, w, size, stride, pad, out);
+    return (what_time_is_it_now() - start)/reps;
+}
+
+static void benchmark_shape(const int *s)
+{
+    int c = s[0], h = s[1], w = s[2], size = s[3], stride = s[4], pad = size/2;
+    size_t n = col_size(c, h, w, size, stride, pad);
+    float *im = calloc(c*h*w, sizeof(float));
+    float *col = calloc(n, sizeof(float));
+    for (int i = 0; i < c*h*w; ++i) im[i] = rand_uniform(-1, 1);
+    int reps = 3;
+    double gb = n*sizeof(float)/1e9;
+    double t0 = time_it(im2col_naive, im, c, h, w, size, stride, pad, col, reps);
+    double t1 = time_it(im2col_cpu, im, c, h, w, size, stride, pad, col, reps);
+    double t2 = time_it(col2im_naive, col, c, h, w, size, stride, pad, im, reps);
+    double t3 = time_it(col2im_cpu, col, c, h, w, size, stride, pad, im, reps);
+    printf("%4d x %3d x %3d  %dx%d/%d | im2col %6.2f -> %6.2f GB/s (%4.1fx) | col2im %6.2f -> %6.2f GB/s (%4.1fx)\n",
+            c, h, w, size, size, stride, gb/t0, gb/t1, t0/t1, gb/t2, gb/t3, t2/t3);
+    free(im);
+    free(col);
+}
+
+int main(int argc, char **argv)
+{
+    printf("\n===== im2col/col2im =====\n\n");
+    printf("Checking against the per-pixel versions...\n");
+    int shapes[][6] = {
+        {3, 11, 9, 3, 1, 1}, {5, 10, 13, 3, 2, 1}, {4, 9, 9, 1, 1, 0}, {2, 17, 15, 5, 1, 2},
+        {3, 12, 12, 3, 3, 0}, {6, 7, 8, 2, 2, 0}, {2, 5, 5, 7, 1, 3}, {3, 1, 1, 3, 1, 1},
+    };
+    int sizes[] = {1, 3};
+    for (int t = 0; t < 2; ++t) {
+        set_thread_pool_size(sizes[t]);
+        for (int i = 0; i < (int)(sizeof(shapes)/sizeof(shapes[0])); ++i) {
+            int *s = shapes[i];
+            check_shape(s[0], s[1], s[2], s[3], s[4], s[5]);
+        }
+    }
+    printf("✓ identical output\n\n");
+
+    set_thread_pool_size(argc > 1 ? atoi(argv[1]) : 0);
+    printf("yolov3 layer shapes, %d threads (column buffer bytes per second):\n", thread_pool_size());
+    for (int i = 0; i < (int)(sizeof(yolov3_shapes)/sizeof(yolov3_shapes[0])); ++i) {
+        benchmark_shape(yolov3_shapes[i]);
+    }
+    return 0;
+}
@@ -44,7 +44,7 @@ PASSED_TESTS=0
 FAILED_TESTS=0
 
 # Array of test executables
-TESTS=(test_utils test_data test_network test_box test_image test_blas)
+TESTS=(test_utils test_data test_network test_box test_image test_blas test_gemm test_conv test_nchwc test_quantize test_xnor test_thread_pool test_inference test_memory_plan test_clone test_mmap_weights test_weights_loader test_graph_optimizer test_detect_batch test_profiler test_reserve test_data_loader test_augment test_image_cache test_records)
 
 for test in "${TESTS[@]}"; do
     echo "----------------------------------------"
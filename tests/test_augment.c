@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include "../src/data.h"
+#include "../src/image.h"
+#include "../src/utils.h"
+
+/* Random pixels, with black and gray ones for the hue and saturation
+   corner cases */
+static byte_image random_byte_image(int w, int h)
+{
+    byte_image im = {w, h, 3, calloc(w*h*3, 1)};
+    for(int i = 0; i < w*h; ++i){
+        int kind = rand()%8;
+        unsigned char gray = rand()%256;
+        for(int k = 0; k < 3; ++k){
+            unsigned char v = rand()%256;
+            if(kind == 0) v = 0;
+            if(kind == 1) v = gray;
+            im.data[3*i + k] = v;
+        }
+    }
+    return im;
+}
+
+static image to_float_image(byte_image b)
+{
+    image im = make_image(b.w, b.h, b.c);
+    for(int k = 0; k < b.c; ++k){
+        for(int i = 0; i < b.w*b.h; ++i) im.data[k*b.w*b.h + i] = (float)b.data[b.c*i + k]/255.;
+    }
+    return im;
+}
+
+/* The passes load_data_detection used to make. Saturation and exposure
+   above 1 amplify their rounding, hence the 1e-3 below. */
+static void place_distort_reference(image orig, int w, int h, int dx, int dy, int flip, float hue, float sat, float val, image canvas)
+{
+    fill_image(canvas, .5);
+    place_image(orig, w, h, dx, dy, canvas);
+    distort_image(canvas, hue, sat, val);
+    if(flip) flip_image(canvas);
+}
+
+static float max_difference(image a, image b)
+{
+    float worst = 0;
+    for(int i = 0; i < a.w*a.h*a.c; ++i){
+        float d = fabsf(a.data[i] - b.data[i]);
+        if(!(d <= worst)) worst = d;
+    }
+    return worst;
+}
+
+void test_against_separate_passes() {
+    printf("Testing the fused kernel against the separate passes...\n");
+    /* source w, h, placed w, h, dx, dy, canvas w, h */
+    int cases[][8] = {
+        {40, 30, 64, 48, 0, 8, 64, 64},
+        {97, 61, 50, 40, 7, 3, 64, 48},
+        {20, 20, 90, 90, -13, -5, 64, 64},
+        {64, 64, 64, 64, 0, 0, 64, 64},
+        {300, 200, 33, 71, 20, 1, 41, 77},
+    };
+    float jitters[][3] = {{0, 1, 1}, {.1, 1.5, .66}, {-.1, .5, 1.5}, {.45, 2, 2}, {-.45, .3, .2}};
+    for(int c = 0; c < sizeof(cases)/sizeof(cases[0]); ++c){
+        int *t = cases[c];
+        byte_image src = random_byte_image(t[0], t[1]);
+        image orig = to_float_image(src);
+        for(int j = 0; j < 5; ++j){
+            for(int flip = 0; flip < 2; ++flip){
+                float *p = jitters[j];
+                image expected = make_image(t[6], t[7], 3);
+                image fused = make_image(t[6], t[7], 3);
+                place_distort_reference(orig, t[2], t[3], t[4], t[5], flip, p[0], p[1], p[2], expected);
+                place_distort_image(src, t[2], t[3], t[4], t[5], flip, p[0], p[1], p[2], fused);
+                assert(max_difference(fused, expected) < 1e-3);
+                free_image(expected);
+                free_image(fused);
+            }
+        }
+        free_image(orig);
+        free(src.data);
+    }
+    printf("✓ same canvas as place_image, distort_image and flip_image\n");
+}
+
+void test_thread_counts() {
+    printf("Testing the kernel over different thread counts...\n");
+    byte_image src = random_byte_image(333, 250);
+    image one = make_image(416, 416, 3);
+    image many = make_image(416, 416, 3);
+    int threads = thread_pool_size();
+    set_thread_pool_size(1);
+    place_distort_image(src, 416, 312, 0, 52, 1, .1, 1.5, .8, one);
+    set_thread_pool_size(4);
+    place_distort_image(src, 416, 312, 0, 52, 1, .1, 1.5, .8, many);
+    set_thread_pool_size(threads);
+    assert(!memcmp(one.data, many.data, 416*416*3*sizeof(float)));
+    free_image(one);
+    free_image(many);
+    free(src.data);
+    printf("✓ identical on 1 and 4 threads\n");
+}
+
+void test_detection_loader() {
+    printf("Testing load_data_detection on 8-bit sources...\n");
+    char dir[] = "/tmp/test_augment_XXXXXX";
+    assert(mkdtemp(dir));
+    char path[256], label[256];
+    snprintf(path, sizeof(path), "%s/image", dir);
+    snprintf(label, sizeof(label), "%s/image.txt", dir);
+    byte_image src = random_byte_image(57, 43);
+    image orig = to_float_image(src);
+    save_image_options(orig, path, PNG, 0);
+    strcat(path, ".png");
+    FILE *fp = fopen(label, "w");
+    fprintf(fp, "1 0.4 0.5 0.2 0.3\n");
+    fclose(fp);
+
+    byte_image loaded = load_byte_image(path, 3);
+    assert(loaded.w == 57 && loaded.h == 43 && loaded.c == 3);
+    assert(!memcmp(loaded.data, src.data, 57*43*3));
+    free_byte_image(loaded);
+    printf("✓ decodes to the bytes that were saved\n");
+
+    char *paths[] = {path};
+    int w = 48, h = 32;
+    float jitter = .2, hue = .1, saturation = 1.5, exposure = 1.5;
+    for(int seed = 1; seed <= 6; ++seed){
+        srand(seed);
+        data d = load_data_detection(1, paths, 1, w, h, 4, 2, jitter, hue, saturation, exposure);
+
+        /* the same draws, in the same order */
+        srand(seed);
+        rand();
+        float dw = jitter*orig.w, dh = jitter*orig.h;
+        float new_ar = (orig.w + rand_uniform(-dw, dw)) / (orig.h + rand_uniform(-dh, dh));
+        float nw = new_ar < 1 ? h*new_ar : w;
+        float nh = new_ar < 1 ? h : w/new_ar;
+        float dx = rand_uniform(0, w - nw);
+        float dy = rand_uniform(0, h - nh);
+        float dhue = rand_uniform(-hue, hue);
+        float dsat = rand_scale(saturation);
+        float dexp = rand_scale(exposure);
+        int flip = rand()%2;
+        image expected = make_image(w, h, 3);
+        place_distort_reference(orig, nw, nh, dx, dy, flip, dhue, dsat, dexp, expected);
+        assert(max_difference(float_to_image(w, h, 3, d.X.vals[0]), expected) < 1e-3);
+        assert(d.y.vals[0][4] == 1);
+        free_image(expected);
+        free_data(d);
+    }
+    free_image(orig);
+    free(src.data);
+    unlink(path);
+    unlink(label);
+    rmdir(dir);
+    printf("✓ same batches as decoding to floats and augmenting in passes\n");
+}
+
+int main() {
+    printf("\n===== Running Augmentation Tests =====\n\n");
+
+    test_against_separate_passes();
+    test_thread_counts();
+    test_detection_loader();
+
+    printf("\n===== All Augmentation Tests Passed =====\n\n");
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "../src/network.h"
+#include "../src/parser.h"
+#include "../src/utils.h"
+
+#define CLONES 3
+#define REPEATS 4
+
+typedef struct {
+    network *net;
+    float *input;
+    float *expected;
+    int ok;
+} predict_job;
+
+static void *predict_thread(void *ptr)
+{
+    predict_job *job = ptr;
+    job->ok = 1;
+    for(int r = 0; r < REPEATS; r++){
+        float *out = network_predict(job->net, job->input);
+        if(memcmp(out, job->expected, job->net->outputs*job->net->batch*sizeof(float))) job->ok = 0;
+    }
+    return 0;
+}
+
+static float *random_input(network *net)
+{
+    float *x = calloc(net->inputs*net->batch, sizeof(float));
+    for(int i = 0; i < net->inputs*net->batch; i++) x[i] = rand_uniform(0, 1);
+    return x;
+}
+
+/* Each clone predicts its own input on its own thread, over and over, and
+   has to match what the original predicts for that input on its own */
+static void check_concurrent_clones(network *net)
+{
+    network *clones[CLONES];
+    predict_job jobs[CLONES];
+    pthread_t threads[CLONES];
+    size_t outputs = net->outputs*net->batch;
+    for(int c = 0; c < CLONES; c++){
+        clones[c] = clone_network_for_inference(net);
+        assert(clones[c]->parent == net && clones[c]->inference);
+        jobs[c].net = clones[c];
+        jobs[c].input = random_input(net);
+        jobs[c].expected = calloc(outputs, sizeof(float));
+        memcpy(jobs[c].expected, network_predict(net, jobs[c].input), outputs*sizeof(float));
+    }
+    for(int i = 0; i < net->n; i++){
+        layer l = net->layers[i], k = clones[0]->layers[i];
+        assert(l.weights == k.weights && l.biases == k.biases);
+        assert(l.scales == k.scales && l.rolling_mean == k.rolling_mean && l.rolling_variance == k.rolling_variance);
+        assert(l.output != k.output && !k.delta && !k.x);
+    }
+    assert(clones[0]->workspace != net->workspace && clones[0]->input != net->input);
+
+    for(int c = 0; c < CLONES; c++) pthread_create(threads + c, 0, predict_thread, jobs + c);
+    for(int c = 0; c < CLONES; c++){
+        pthread_join(threads[c], 0);
+        assert(jobs[c].ok);
+    }
+
+    network *grandchild = clone_network_for_inference(clones[0]);
+    assert(grandchild->parent == net);
+    assert(memcmp(network_predict(grandchild, jobs[1].input), jobs[1].expected, outputs*sizeof(float)) == 0);
+    free_network(grandchild);
+
+    for(int c = 0; c < CLONES; c++){
+        free_network(clones[c]);
+        free(jobs[c].input);
+        free(jobs[c].expected);
+    }
+}
+
+void test_inference_network_clones() {
+    printf("Testing clones of an inference-only yolov3-tiny on %d threads...\n", CLONES);
+    srand(11);
+    network *net = load_network_inference("../cfg/yolov3-tiny.cfg", 0);
+    check_concurrent_clones(net);
+    free_network(net);
+    printf("✓ concurrent predictions match the original\n");
+}
+
+void test_training_network_clones() {
+    printf("Testing clones of a training yolov3-tiny...\n");
+    srand(13);
+    network *net = parse_network_cfg("../cfg/yolov3-tiny.cfg");
+    check_concurrent_clones(net);
+    for(int i = 0; i < net->n; i++) assert(net->layers[i].delta);
+    free_network(net);
+    printf("✓ training buffers stay with the original\n");
+}
+
+int main() {
+    printf("\n===== Running Network Clone Tests =====\n\n");
+
+    test_inference_network_clones();
+    test_training_network_clones();
+
+    printf("\n===== All Network Clone Tests Passed =====\n\n");
+    return 0;
+}
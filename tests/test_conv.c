@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "../src/convolutional_layer.h"
+#include "../src/direct_conv.h"
+#include "../src/utils.h"
+
+static void fill_random(float *x, int n)
+{
+    for(int i = 0; i < n; i++) x[i] = rand_uniform(-1, 1);
+}
+
+static float max_rel_error(float *a, float *b, int n)
+{
+    float err = 0;
+    for(int i = 0; i < n; i++) {
+        float d = fabs(a[i] - b[i]) / (1 + fabs(b[i]));
+        if(d > err) err = d;
+    }
+    return err;
+}
+
+static void check_algorithm_size(CONV_ALGORITHM a, int batch, int h, int w, int c, int n, int groups, int size, int stride)
+{
+    convolutional_layer ref = make_convolutional_layer(batch, h, w, c, n, groups, size, stride, size/2, LEAKY, 0, 0, 0, 0);
+    convolutional_layer dir = make_convolutional_layer(batch, h, w, c, n, groups, size, stride, size/2, LEAKY, 0, 0, 0, 0);
+    set_convolutional_algorithm(&ref, CONV_IM2COL);
+    set_convolutional_algorithm(&dir, a);
+    assert(dir.algorithm == a);
+    memcpy(dir.weights, ref.weights, ref.nweights*sizeof(float));
+    update_winograd_weights(dir);
+    update_direct_weights(dir);
+    fill_random(ref.biases, n);
+    memcpy(dir.biases, ref.biases, n*sizeof(float));
+
+    network net = {0};
+    net.input = calloc(batch*ref.inputs, sizeof(float));
+    net.delta = calloc(batch*ref.inputs, sizeof(float));
+    net.workspace = calloc(1, ref.workspace_size > dir.workspace_size ? ref.workspace_size : dir.workspace_size);
+    float *delta_ref = calloc(batch*ref.inputs, sizeof(float));
+    fill_random(net.input, batch*ref.inputs);
+
+    forward_convolutional_layer(ref, net);
+    forward_convolutional_layer(dir, net);
+    float err = max_rel_error(dir.output, ref.output, batch*ref.outputs);
+    printf("  %d: %dx%dx%d -> %d, groups %d, %dx%d/%d: forward err %g", a, w, h, c, n, groups, size, size, stride, err);
+    assert(err <= 1e-4);
+
+    fill_random(ref.delta, batch*ref.outputs);
+    memcpy(dir.delta, ref.delta, batch*ref.outputs*sizeof(float));
+    backward_convolutional_layer(ref, net);
+    memcpy(delta_ref, net.delta, batch*ref.inputs*sizeof(float));
+    memset(net.delta, 0, batch*ref.inputs*sizeof(float));
+    backward_convolutional_layer(dir, net);
+    float werr = max_rel_error(dir.weight_updates, ref.weight_updates, ref.nweights);
+    float derr = max_rel_error(net.delta, delta_ref, batch*ref.inputs);
+    printf(", backward err %g / %g\n", werr, derr);
+    assert(werr <= 1e-4);
+    assert(derr <= 1e-4);
+
+    free(net.input);
+    free(net.delta);
+    free(net.workspace);
+    free(delta_ref);
+    free_layer(ref);
+    free_layer(dir);
+}
+
+static void check_algorithm(CONV_ALGORITHM a, int batch, int h, int w, int c, int n, int groups, int stride)
+{
+    check_algorithm_size(a, batch, h, w, c, n, groups, 3, stride);
+}
+
+void test_direct_conv() {
+    printf("Testing direct 3x3 convolution against im2col...\n");
+    check_algorithm(CONV_DIRECT, 1, 13, 11, 3, 10, 1, 1);
+    check_algorithm(CONV_DIRECT, 2, 17, 23, 5, 16, 1, 1);
+    check_algorithm(CONV_DIRECT, 1, 17, 23, 5, 19, 1, 2);
+    check_algorithm(CONV_DIRECT, 1, 16, 16, 8, 8, 1, 2);
+    check_algorithm(CONV_DIRECT, 2, 9, 30, 8, 12, 2, 1);
+    check_algorithm(CONV_DIRECT, 1, 1, 1, 4, 8, 1, 1);
+    check_algorithm(CONV_DIRECT, 1, 2, 3, 4, 8, 1, 2);
+    check_algorithm(CONV_DIRECT, 1, 40, 416, 32, 8, 1, 1);
+    printf("✓ direct convolution matches im2col\n");
+}
+
+void test_winograd_conv() {
+    printf("Testing winograd 3x3 convolution against im2col...\n");
+    CONV_ALGORITHM tiles[] = {CONV_WINOGRAD2, CONV_WINOGRAD4};
+    for(int t = 0; t < 2; t++) {
+        check_algorithm(tiles[t], 1, 13, 11, 3, 10, 1, 1);
+        check_algorithm(tiles[t], 2, 17, 23, 16, 16, 1, 1);
+        check_algorithm(tiles[t], 1, 9, 30, 8, 12, 2, 1);
+        check_algorithm(tiles[t], 1, 1, 1, 4, 8, 1, 1);
+        check_algorithm(tiles[t], 1, 52, 52, 64, 32, 1, 1);
+    }
+    printf("✓ winograd convolution matches im2col\n");
+}
+
+void test_winograd_weights_follow_updates() {
+    printf("Testing winograd weights after an update...\n");
+    convolutional_layer l = make_convolutional_layer(1, 8, 8, 8, 8, 1, 3, 1, 1, LINEAR, 0, 0, 0, 0);
+    set_convolutional_algorithm(&l, CONV_WINOGRAD4);
+    l.learning_rate_scale = 1;
+    float *u = calloc(l.nweights*4, sizeof(float));
+    memcpy(u, l.winograd_weights, l.nweights*4*sizeof(float));
+    fill_random(l.weight_updates, l.nweights);
+    update_args a = {0};
+    a.batch = 1;
+    a.learning_rate = 1;
+    update_convolutional_layer(l, a);
+    assert(memcmp(u, l.winograd_weights, l.nweights*4*sizeof(float)));
+    srand(3);
+    int next = rand();
+    srand(3);
+    check_convolutional_algorithm(&l);
+    assert(l.algorithm == CONV_WINOGRAD4);
+    assert(rand() == next);
+    free(u);
+    free_layer(l);
+    printf("✓ winograd weights are refreshed\n");
+}
+
+void test_direct_weights_follow_updates() {
+    printf("Testing packed direct weights after an update...\n");
+    convolutional_layer l = make_convolutional_layer(1, 8, 8, 4, 16, 1, 3, 1, 1, LINEAR, 0, 0, 0, 0);
+    set_convolutional_algorithm(&l, CONV_DIRECT);
+    l.learning_rate_scale = 1;
+    float *packed = calloc(l.nweights, sizeof(float));
+    direct_pack_filters(l.weights, l.c, l.n, packed);
+    assert(!memcmp(packed, l.direct_weights, l.nweights*sizeof(float)));
+    fill_random(l.weight_updates, l.nweights);
+    update_args a = {0};
+    a.batch = 1;
+    a.learning_rate = 1;
+    update_convolutional_layer(l, a);
+    direct_pack_filters(l.weights, l.c, l.n, packed);
+    assert(!memcmp(packed, l.direct_weights, l.nweights*sizeof(float)));
+    free(packed);
+    free_layer(l);
+    printf("✓ direct weights are packed once and repacked on update\n");
+}
+
+void test_depthwise_conv() {
+    printf("Testing depthwise convolution against im2col...\n");
+    check_algorithm(CONV_DEPTHWISE, 1, 13, 11, 3, 3, 3, 1);
+    check_algorithm(CONV_DEPTHWISE, 2, 17, 23, 8, 8, 8, 1);
+    check_algorithm(CONV_DEPTHWISE, 1, 17, 23, 8, 8, 8, 2);
+    check_algorithm(CONV_DEPTHWISE, 2, 16, 16, 4, 12, 4, 2);
+    check_algorithm(CONV_DEPTHWISE, 1, 1, 1, 4, 8, 4, 1);
+    check_algorithm(CONV_DEPTHWISE, 1, 2, 3, 4, 4, 4, 2);
+    check_algorithm_size(CONV_DEPTHWISE, 1, 19, 14, 6, 6, 6, 5, 1);
+    check_algorithm_size(CONV_DEPTHWISE, 2, 19, 14, 6, 12, 6, 5, 2);
+    check_algorithm_size(CONV_DEPTHWISE, 1, 9, 9, 5, 5, 5, 1, 1);
+    check_algorithm_size(CONV_DEPTHWISE, 1, 9, 10, 5, 5, 5, 7, 3);
+    check_algorithm(CONV_DEPTHWISE, 1, 112, 112, 32, 32, 32, 1);
+    printf("✓ depthwise convolution matches im2col\n");
+}
+
+void test_grouped_conv() {
+    printf("Testing grouped convolution against im2col...\n");
+    check_algorithm(CONV_GROUPED, 1, 13, 11, 4, 10, 2, 1);
+    check_algorithm(CONV_GROUPED, 2, 17, 23, 16, 16, 4, 1);
+    check_algorithm(CONV_GROUPED, 3, 17, 23, 16, 32, 8, 2);
+    check_algorithm_size(CONV_GROUPED, 2, 12, 9, 12, 6, 3, 1, 1);
+    check_algorithm_size(CONV_GROUPED, 2, 12, 9, 12, 6, 3, 5, 2);
+    check_algorithm(CONV_GROUPED, 1, 28, 28, 128, 128, 32, 1);
+    printf("✓ grouped convolution matches im2col\n");
+}
+
+static void check_fused(CONV_ALGORITHM a, int size, int batch_normalize, ACTIVATION act)
+{
+    int batch = 2, h = 14, w = 10, c = 8, n = 12;
+    int groups = 1;
+    if(a == CONV_DEPTHWISE) groups = c, n = 2*c;
+    if(a == CONV_GROUPED) groups = 4;
+    convolutional_layer l = make_convolutional_layer(batch, h, w, c, n, groups, size, 1, size/2, act, batch_normalize, 0, 0, 0);
+    set_convolutional_algorithm(&l, a);
+    fill_random(l.biases, n);
+    if(batch_normalize) {
+        for(int i = 0; i < n; i++) {
+            l.scales[i] = rand_uniform(.5, 1.5);
+            l.rolling_mean[i] = rand_uniform(-.5, .5);
+            l.rolling_variance[i] = rand_uniform(.5, 2);
+        }
+    }
+    float *ref = calloc(batch*l.outputs, sizeof(float));
+
+    network net = {0};
+    net.input = calloc(batch*l.inputs, sizeof(float));
+    net.workspace = calloc(1, l.workspace_size);
+    fill_random(net.input, batch*l.inputs);
+    /* asking for the input gradient keeps the separate batchnorm pass */
+    net.delta = calloc(batch*l.inputs, sizeof(float));
+    forward_convolutional_layer(l, net);
+    memcpy(ref, l.output, batch*l.outputs*sizeof(float));
+    free(net.delta);
+    net.delta = 0;
+    forward_convolutional_layer(l, net);
+    float err = max_rel_error(l.output, ref, batch*l.outputs);
+    printf("  %d: %dx%d, bn %d, %s: err %g\n", a, size, size, batch_normalize, get_activation_string(act), err);
+    assert(err <= 1e-5);
+
+    free(ref);
+    free(net.input);
+    free(net.workspace);
+    free_layer(l);
+}
+
+void test_fused_inference() {
+    printf("Testing fused batchnorm/bias/activation at inference...\n");
+    check_fused(CONV_IM2COL, 1, 1, LEAKY);
+    check_fused(CONV_IM2COL, 3, 1, LOGISTIC);
+    check_fused(CONV_IM2COL, 3, 0, RELU);
+    check_fused(CONV_IM2COL, 5, 1, LINEAR);
+    check_fused(CONV_IM2COL, 3, 1, TANH);
+    check_fused(CONV_DIRECT, 3, 1, LEAKY);
+    check_fused(CONV_WINOGRAD4, 3, 1, LEAKY);
+    check_fused(CONV_DEPTHWISE, 3, 1, LEAKY);
+    check_fused(CONV_DEPTHWISE, 5, 0, RELU);
+    check_fused(CONV_GROUPED, 3, 1, LEAKY);
+    printf("✓ fused epilogue matches separate passes\n");
+}
+
+void test_unsupported_falls_back() {
+    printf("Testing fallback for unsupported shapes...\n");
+    convolutional_layer l = make_convolutional_layer(1, 8, 8, 4, 4, 1, 5, 1, 2, LEAKY, 0, 0, 0, 0);
+    assert(l.algorithm == CONV_IM2COL);
+    set_convolutional_algorithm(&l, CONV_DIRECT);
+    assert(l.algorithm == CONV_IM2COL);
+    free_layer(l);
+
+    l = make_convolutional_layer(1, 8, 8, 4, 4, 1, 3, 1, 1, LEAKY, 0, 0, 0, 0);
+    assert(l.algorithm == CONV_DIRECT);
+    set_convolutional_algorithm(&l, CONV_WINOGRAD2);
+    assert(l.algorithm == CONV_WINOGRAD2);
+    free_layer(l);
+
+    l = make_convolutional_layer(1, 8, 8, 4, 4, 1, 3, 2, 1, LEAKY, 0, 0, 0, 0);
+    set_convolutional_algorithm(&l, CONV_WINOGRAD4);
+    assert(l.algorithm == CONV_IM2COL);
+    free_layer(l);
+
+    /* winograd only by default for inference */
+    l = make_convolutional_layer(1, 52, 52, 64, 64, 1, 3, 1, 1, LEAKY, 0, 0, 0, 0);
+    assert(l.algorithm == CONV_IM2COL);
+    assert(default_conv_algorithm(l, 1) == CONV_WINOGRAD4);
+    free_layer(l);
+
+    l = make_convolutional_layer(1, 16, 16, 32, 32, 32, 3, 2, 1, LEAKY, 0, 0, 0, 0);
+    assert(l.algorithm == CONV_DEPTHWISE);
+    free_layer(l);
+
+    l = make_convolutional_layer(1, 16, 16, 32, 32, 8, 3, 1, 1, LEAKY, 0, 0, 0, 0);
+    assert(l.algorithm == CONV_GROUPED);
+    set_convolutional_algorithm(&l, CONV_DEPTHWISE);
+    assert(l.algorithm == CONV_IM2COL);
+    free_layer(l);
+
+    l = make_convolutional_layer(1, 16, 16, 32, 32, 1, 3, 1, 1, LEAKY, 0, 0, 0, 0);
+    set_convolutional_algorithm(&l, CONV_GROUPED);
+    assert(l.algorithm == CONV_IM2COL);
+    free_layer(l);
+    printf("✓ unsupported shapes use im2col\n");
+}
+
+int main() {
+    printf("\n===== Running Convolution Tests =====\n\n");
+
+    test_direct_conv();
+    test_winograd_conv();
+    test_winograd_weights_follow_updates();
+    test_direct_weights_follow_updates();
+    test_depthwise_conv();
+    test_grouped_conv();
+    test_fused_inference();
+    test_unsupported_falls_back();
+
+    printf("\n===== All Convolution Tests Passed =====\n\n");
+    return 0;
+}
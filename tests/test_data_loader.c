@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "../src/data.h"
+#include "../src/image.h"
+#include "../src/utils.h"
+#include "../src/network.h"
+#include "../src/parser.h"
+
+#define IMAGES 12
+
+static char *labels[] = {"cat", "dog", "bird"};
+static char dir[] = "/tmp/test_data_loader_XXXXXX";
+static char *paths[IMAGES];
+
+/* Image i is a flat gray of (i + 1)/16, labelled i%3 through its name */
+static void make_images()
+{
+    assert(mkdtemp(dir));
+    for(int i = 0; i < IMAGES; ++i){
+        image im = make_image(8, 8, 3);
+        fill_image(im, (i + 1)/16.);
+        char name[256];
+        snprintf(name, sizeof(name), "%s/%d_%s", dir, i, labels[i%3]);
+        save_image_options(im, name, PNG, 0);
+        free_image(im);
+        paths[i] = calloc(strlen(name) + 5, 1);
+        sprintf(paths[i], "%s.png", name);
+        /* one box for the detection loaders */
+        char label[256];
+        snprintf(label, sizeof(label), "%s.txt", name);
+        FILE *fp = fopen(label, "w");
+        fprintf(fp, "%d 0.5 0.5 0.4 0.3\n", i%3);
+        fclose(fp);
+    }
+}
+
+static void remove_images()
+{
+    for(int i = 0; i < IMAGES; ++i){
+        unlink(paths[i]);
+        strcpy(paths[i] + strlen(paths[i]) - 4, ".txt");
+        unlink(paths[i]);
+        free(paths[i]);
+    }
+    rmdir(dir);
+}
+
+static load_args classification_args(int n, int m, int size)
+{
+    load_args args = {0};
+    args.paths = paths;
+    args.n = n;
+    args.m = m;
+    args.labels = labels;
+    args.classes = 3;
+    args.w = size;
+    args.h = size;
+    args.threads = 3;
+    args.type = OLD_CLASSIFICATION_DATA;
+    return args;
+}
+
+/* Which image a row came from, checked against its one-hot label */
+static int image_of_row(data d, int r)
+{
+    float v = d.X.vals[r][0];
+    int i = (int)(v*16 + .5) - 1;
+    assert(i >= 0 && i < IMAGES && fabsf(v - (i + 1)/16.) < 1e-2);
+    for(int j = 0; j < d.X.cols; ++j) assert(fabsf(d.X.vals[r][j] - v) < 1e-2);
+    for(int k = 0; k < 3; ++k) assert(d.y.vals[r][k] == (k == i%3));
+    return i;
+}
+
+void test_sequential_batches() {
+    printf("Testing batches against the blocking loader...\n");
+    load_args args = classification_args(5, 0, 8);
+    data expected;
+    args.d = &expected;
+    load_data_blocking(args);
+
+    data_loader *loader = make_data_loader(args, 2);
+    for(int b = 0; b < 4; ++b){
+        data d = get_batch(loader);
+        assert(d.X.rows == 5 && d.X.cols == 8*8*3 && d.y.cols == 3);
+        /* one block, row after row */
+        for(int r = 1; r < d.X.rows; ++r) assert(d.X.vals[r] == d.X.vals[0] + r*d.X.cols);
+        for(int r = 0; r < d.X.rows; ++r){
+            assert(image_of_row(d, r) == r);
+            assert(!memcmp(d.X.vals[r], expected.X.vals[r], d.X.cols*sizeof(float)));
+            assert(!memcmp(d.y.vals[r], expected.y.vals[r], d.y.cols*sizeof(float)));
+        }
+    }
+    free_data_loader(loader);
+    free_data(expected);
+    printf("✓ contiguous batches of the right samples\n");
+}
+
+void test_random_batches() {
+    printf("Testing prefetched random batches...\n");
+    data_loader *loader = make_data_loader(classification_args(4, IMAGES, 8), 3);
+    float *blocks[8] = {0};
+    int nblocks = 0, counts[IMAGES] = {0};
+    for(int b = 0; b < 60; ++b){
+        data d = get_batch(loader);
+        assert(d.X.rows == 4);
+        for(int r = 0; r < d.X.rows; ++r) ++counts[image_of_row(d, r)];
+        int k;
+        for(k = 0; k < nblocks && blocks[k] != d.X.vals[0]; ++k);
+        if(k == nblocks) blocks[nblocks++] = d.X.vals[0];
+        assert(nblocks <= 4);
+    }
+    for(int i = 0; i < IMAGES; ++i) assert(counts[i]);
+    free_data_loader(loader);
+    printf("✓ 60 batches from 4 reused buffers, every image drawn\n");
+}
+
+void test_try_get_and_reset() {
+    printf("Testing try_get_batch and reset_data_loader...\n");
+    load_args args = classification_args(3, IMAGES, 8);
+    data_loader *loader = make_data_loader(args, 2);
+    data d;
+    int tries = 0;
+    while(!try_get_batch(loader, &d)){
+        ++tries;
+        usleep(1000);
+    }
+    assert(d.X.rows == 3 && d.X.cols == 8*8*3);
+    /* the next ones fill while this one is held */
+    data held = d;
+    while(!try_get_batch(loader, &d)) usleep(1000);
+    assert(d.X.vals[0] != held.X.vals[0]);
+    printf("✓ non-blocking pops after %d empty tries\n", tries);
+
+    args.w = args.h = 12;
+    reset_data_loader(loader, args);
+    for(int b = 0; b < 5; ++b){
+        d = get_batch(loader);
+        assert(d.X.cols == 12*12*3);
+        for(int r = 0; r < d.X.rows; ++r) image_of_row(d, r);
+    }
+    args.n = 6;
+    reset_data_loader(loader, args);
+    d = get_batch(loader);
+    assert(d.X.rows == 6 && d.X.cols == 12*12*3);
+    printf("✓ new size and batch after a reset, nothing stale\n");
+
+    /* stopped with batches in flight */
+    free_data_loader(loader);
+    loader = make_data_loader(args, 4);
+    free_data_loader(loader);
+    printf("✓ freed mid-load\n");
+}
+
+/* The same random load, once into rows of its own and once into a batch */
+static void compare_buffered_load(load_args args)
+{
+    data rows, batched;
+    args.d = &rows;
+    srand(7);
+    load_data_blocking(args);
+    assert(!rows.shallow);
+    float *X = calloc((size_t)args.n*rows.X.cols, sizeof(float));
+    float *y = calloc((size_t)args.n*rows.y.cols, sizeof(float));
+    for(size_t j = 0; j < (size_t)args.n*rows.y.cols; ++j) y[j] = -1;
+    args.d = &batched;
+    args.X = X;
+    args.y = y;
+    srand(7);
+    load_data_blocking(args);
+    assert(batched.shallow && batched.X.rows == args.n && batched.X.cols == rows.X.cols && batched.y.cols == rows.y.cols);
+    for(int r = 0; r < args.n; ++r){
+        assert(batched.X.vals[r] == X + r*rows.X.cols && batched.y.vals[r] == y + r*rows.y.cols);
+        assert(!memcmp(batched.X.vals[r], rows.X.vals[r], rows.X.cols*sizeof(float)));
+        assert(!memcmp(batched.y.vals[r], rows.y.vals[r], rows.y.cols*sizeof(float)));
+    }
+    free_data(batched);
+    free_data(rows);
+    free(X);
+    free(y);
+}
+
+void test_batch_buffers() {
+    printf("Testing loads into a caller's batch...\n");
+    load_args args = classification_args(5, 0, 8);
+    compare_buffered_load(args);
+    args = classification_args(4, IMAGES, 8);
+    args.type = CLASSIFICATION_DATA;
+    args.min = args.max = args.size = 8;
+    args.hue = .1;
+    compare_buffered_load(args);
+    args.type = DETECTION_DATA;
+    args.w = args.h = 16;
+    args.num_boxes = 4;
+    args.jitter = .2;
+    args.exposure = args.saturation = 1.5;
+    compare_buffered_load(args);
+    args.type = REGION_DATA;
+    args.coords = 4;
+    compare_buffered_load(args);
+    printf("✓ same rows as separately allocated ones, labels zeroed first\n");
+
+    data_loader *loader = make_data_loader(args, 2);
+    for(int b = 0; b < 3; ++b){
+        data d = get_batch(loader);
+        assert((uintptr_t)d.X.vals[0] % 64 == 0 && (uintptr_t)d.y.vals[0] % 64 == 0);
+        for(int r = 1; r < d.X.rows; ++r) assert(d.X.vals[r] == d.X.vals[0] + r*d.X.cols);
+    }
+    free_data_loader(loader);
+    printf("✓ loader batches aligned for SIMD\n");
+}
+
+void test_train_in_place() {
+    printf("Testing training on a contiguous batch in place...\n");
+    char cfg[] = "/tmp/test_data_loader_cfg_XXXXXX";
+    int fd = mkstemp(cfg);
+    assert(fd >= 0);
+    FILE *fp = fdopen(fd, "w");
+    fputs("[net]\nbatch=2\nwidth=8\nheight=8\nchannels=3\nlearning_rate=0.1\n"
+          "[convolutional]\nfilters=4\nsize=3\nstride=2\npad=1\nactivation=leaky\n"
+          "[connected]\noutput=3\nactivation=linear\n[softmax]\n", fp);
+    fclose(fp);
+    srand(3);
+    network *net = parse_network_cfg(cfg);
+    srand(3);
+    network *ref = parse_network_cfg(cfg);
+
+    load_args args = classification_args(4, 0, 8);
+    float *X = calloc(4*8*8*3, sizeof(float));
+    float *y = calloc(4*3, sizeof(float));
+    data batched, rows;
+    args.X = X;
+    args.y = y;
+    args.d = &batched;
+    load_data_blocking(args);
+    rows = copy_data(batched);
+    float *input = net->input, *truth = net->truth;
+    for(int step = 0; step < 3; ++step){
+        float loss = train_network(net, batched);
+        float expected = train_network(ref, rows);
+        assert(loss == expected);
+        assert(net->input == input && net->truth == truth);
+    }
+    for(int j = 0; j < net->layers[1].inputs*net->layers[1].outputs; ++j){
+        assert(net->layers[1].weights[j] == ref->layers[1].weights[j]);
+    }
+    free_data(batched);
+    free_data(rows);
+    free(X);
+    free(y);
+    free_network(net);
+    free_network(ref);
+    unlink(cfg);
+    printf("✓ same losses and weights as copying the rows in\n");
+}
+
+void test_concat_datas() {
+    printf("Testing concat_datas...\n");
+    data parts[3];
+    for(int i = 0; i < 3; ++i){
+        parts[i] = (data){0};
+        parts[i].X = make_matrix(i + 1, 2);
+        parts[i].y = make_matrix(i + 1, 1);
+        for(int r = 0; r < i + 1; ++r) parts[i].X.vals[r][0] = 10*i + r;
+    }
+    data d = concat_datas(parts, 3);
+    assert(d.X.rows == 6 && d.y.rows == 6 && d.X.cols == 2 && d.y.cols == 1 && d.shallow);
+    /* the order concat_data folding gave: the last part first */
+    float order[] = {20, 21, 22, 10, 11, 0};
+    for(int r = 0; r < 6; ++r) assert(d.X.vals[r][0] == order[r]);
+    free_data(d);
+    for(int i = 0; i < 3; ++i) free_data(parts[i]);
+    printf("✓ same rows and order in one pass\n");
+}
+
+int main() {
+    printf("\n===== Running Data Loader Tests =====\n\n");
+
+    make_images();
+    test_sequential_batches();
+    test_random_batches();
+    test_try_get_and_reset();
+    test_batch_buffers();
+    test_train_in_place();
+    test_concat_datas();
+    remove_images();
+
+    printf("\n===== All Data Loader Tests Passed =====\n\n");
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "../src/network.h"
+#include "../src/parser.h"
+#include "../src/image.h"
+#include "../src/utils.h"
+
+#define IMAGES 3
+
+static image random_image(int w, int h)
+{
+    image im = make_image(w, h, 3);
+    for(int i = 0; i < w*h*3; ++i) im.data[i] = rand_uniform(0, 1);
+    return im;
+}
+
+/* random weights overflow exp() in the box sizes, so inf and nan must match too */
+static int close(float a, float b)
+{
+    if(isnan(a) || isnan(b)) return isnan(a) && isnan(b);
+    return a == b || fabsf(a - b) <= 1e-4*(1 + fabsf(b));
+}
+
+static void assert_same_detections(detection *a, int na, detection *b, int nb, int classes)
+{
+    assert(na == nb);
+    for(int i = 0; i < na; ++i){
+        assert(close(a[i].bbox.x, b[i].bbox.x) && close(a[i].bbox.y, b[i].bbox.y));
+        assert(close(a[i].bbox.w, b[i].bbox.w) && close(a[i].bbox.h, b[i].bbox.h));
+        assert(close(a[i].objectness, b[i].objectness));
+        for(int j = 0; j < classes; ++j) assert(close(a[i].prob[j], b[i].prob[j]));
+    }
+}
+
+/* Every image of a batch gets the boxes it gets on its own at batch 1 */
+static void check_batch(network *single, network *batched, image *ims, int n, float thresh)
+{
+    int classes = single->layers[single->n - 1].classes;
+    int *num = calloc(n, sizeof(int));
+    detection **dets = network_detect_batch(batched, ims, n, thresh, .5, 0, 0, num);
+    assert(batched->batch == n);
+    for(int b = 0; b < n; ++b){
+        int nboxes = 0;
+        network_predict_image(single, ims[b]);
+        detection *expected = get_network_boxes(single, ims[b].w, ims[b].h, thresh, .5, 0, 0, &nboxes);
+        assert(nboxes > 0);
+        assert_same_detections(dets[b], num[b], expected, nboxes, classes);
+        free_detections(expected, nboxes);
+    }
+    free_batch_detections(dets, num, n);
+    free(num);
+}
+
+void test_yolov3_tiny_batches() {
+    printf("Testing batched yolov3-tiny detection against single images...\n");
+    srand(3);
+    network *single = load_network_inference("../cfg/yolov3-tiny.cfg", 0);
+    srand(3);
+    network *batched = load_network_inference("../cfg/yolov3-tiny.cfg", 0);
+    set_batch_network(single, 1);
+    set_batch_network(batched, 1);
+
+    image ims[IMAGES] = {random_image(640, 480), random_image(300, 500), random_image(416, 416)};
+    check_batch(single, batched, ims, IMAGES, .6);
+    printf("✓ %d images of different sizes, buffers grown from batch 1\n", IMAGES);
+
+    /* batch 2 is where the decoders used to average a flipped pair */
+    check_batch(single, batched, ims + 1, 2, .6);
+    printf("✓ 2 images, no flipped-pair averaging\n");
+
+    for(int i = 0; i < IMAGES; ++i) free_image(ims[i]);
+    free_network(single);
+    free_network(batched);
+}
+
+int main() {
+    printf("\n===== Running Batched Detection Tests =====\n\n");
+
+    test_yolov3_tiny_batches();
+
+    printf("\n===== All Batched Detection Tests Passed =====\n\n");
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "../src/gemm.h"
+
+static float max_rel_error(float *a, float *b, int n)
+{
+    float err = 0;
+    for(int i = 0; i < n; i++) {
+        float d = fabs(a[i] - b[i]) / (1 + fabs(b[i]));
+        if(d > err) err = d;
+    }
+    return err;
+}
+
+static void check_gemm(int TA, int TB, int m, int n, int k, float alpha, float beta)
+{
+    float *a = TA ? random_matrix(k, m) : random_matrix(m, k);
+    float *b = TB ? random_matrix(n, k) : random_matrix(k, n);
+    int lda = TA ? m : k;
+    int ldb = TB ? k : n;
+    float *c = random_matrix(m, n);
+    float *c_ref = malloc(m*n*sizeof(float));
+    memcpy(c_ref, c, m*n*sizeof(float));
+
+    gemm_cpu(TA, TB, m, n, k, alpha, a, lda, b, ldb, beta, c, n);
+    gemm_cpu_reference(TA, TB, m, n, k, alpha, a, lda, b, ldb, beta, c_ref, n);
+
+    float err = max_rel_error(c, c_ref, m*n);
+    if(err > 1e-4) {
+        printf("  FAILED TA=%d TB=%d m=%d n=%d k=%d: rel err %g\n", TA, TB, m, n, k, err);
+    }
+    assert(err <= 1e-4);
+
+    free(a);
+    free(b);
+    free(c);
+    free(c_ref);
+}
+
+void test_gemm_kernel(const char *name) {
+    if(!gemm_cpu_select_kernel(name)) {
+        printf("  - %s kernel not supported on this CPU, skipped\n", name);
+        return;
+    }
+    printf("Testing gemm_cpu with %s kernel...\n", name);
+
+    int shapes[][3] = {
+        {1, 1, 1}, {3, 5, 7}, {6, 16, 9}, {8, 32, 33}, {13, 47, 300},
+        {64, 100, 27}, {150, 4100, 20}, {200, 70, 520}
+    };
+    int nshapes = sizeof(shapes)/sizeof(shapes[0]);
+    for(int s = 0; s < nshapes; s++) {
+        for(int t = 0; t < 4; t++) {
+            check_gemm(t&1, t>>1, shapes[s][0], shapes[s][1], shapes[s][2], 1, 1);
+        }
+    }
+    check_gemm(0, 0, 37, 61, 45, .5, 0);
+    check_gemm(1, 1, 37, 61, 45, 2, .25);
+
+    printf("  ✓ %s kernel tests passed\n", name);
+}
+
+int main() {
+    printf("\n=== Running GEMM Tests ===\n\n");
+
+    test_gemm_kernel("generic");
+    test_gemm_kernel("avx2");
+    test_gemm_kernel("avx512");
+
+    printf("\n=== All GEMM Tests Passed! ===\n\n");
+
+    return 0;
+}
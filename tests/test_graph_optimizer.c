@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include "test_helpers.h"
+
+/* One of each rewrite: a shortcut after a convolution (2, 3), an upsample
+   before a 1x1 convolution (4, 5), a concatenation of a maxpool and that
+   shortcut (7), a route with one input (10) */
+static const char *test_cfg =
+    "[net]\nbatch=1\nwidth=16\nheight=12\nchannels=3\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=8\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[convolutional]\nfilters=4\nsize=1\nstride=1\npad=1\nactivation=leaky\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=8\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[shortcut]\nfrom=-3\nactivation=linear\n"
+    "[upsample]\nstride=2\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=6\nsize=1\nstride=1\npad=1\nactivation=leaky\n"
+    "[maxpool]\nsize=2\nstride=2\n"
+    "[route]\nlayers=-1,3\n"
+    "[convolutional]\nfilters=4\nsize=3\nstride=1\npad=1\nactivation=linear\n"
+    "[upsample]\nstride=2\n"
+    "[route]\nlayers=-1\n"
+    "[convolutional]\nfilters=2\nsize=1\nstride=1\npad=1\nactivation=linear\n";
+
+/* Same seed, same weights: one network as built, one with the rewrites undone */
+static void make_pair(char *cfg, network **optimized, network **plain)
+{
+    srand(7);
+    *optimized = parse_network_cfg_inference(cfg);
+    srand(7);
+    *plain = parse_network_cfg_inference(cfg);
+    (*plain)->optimize = 0;
+    unoptimize_network(*plain);
+    plan_network_memory(*plain);
+}
+
+void test_every_rewrite() {
+    printf("Testing every rewrite on a small network...\n");
+    char cfg[] = "/tmp/test_graph_cfg_XXXXXX";
+    write_temp_file(cfg, test_cfg);
+    network *net, *plain;
+    make_pair(cfg, &net, &plain);
+
+    layer *l = net->layers;
+    assert(l[2].residual && l[2].residual_layer == 0 && l[3].fused && l[3].output == l[2].output);
+    assert(l[5].upsampled == 2 && l[5].upsampled_layer == 3 && l[4].fused);
+    assert(l[6].output == l[7].output && l[2].output == l[7].output + l[6].outputs);
+    assert(l[10].alias && l[10].output == l[9].output);
+    assert(!plain->layers[3].fused && plain->layers[10].output != plain->layers[9].output);
+
+    float *x = calloc(net->inputs, sizeof(float));
+    for(int i = 0; i < net->inputs; ++i) x[i] = rand_uniform(-1, 1);
+    assert_close_outputs(net, plain, x);
+
+    /* undone and redone with a resize, and the same again in a clone */
+    assert(resize_network(net, 24, 20) == 0 && resize_network(plain, 24, 20) == 0);
+    assert(net->layers[3].fused && net->layers[10].alias);
+    x = realloc(x, net->inputs*sizeof(float));
+    for(int i = 0; i < net->inputs; ++i) x[i] = rand_uniform(-1, 1);
+    assert_close_outputs(net, plain, x);
+    network *clone = clone_network_for_inference(net);
+    assert(clone->layers[6].output == clone->layers[7].output && clone->layers[3].output == clone->layers[2].output);
+    assert_close_outputs(clone, plain, x);
+    printf("✓ same results, also after a resize and in a clone\n");
+
+    free_network(clone);
+    free_network(net);
+    free_network(plain);
+    free(x);
+    unlink(cfg);
+}
+
+void test_yolov3_tiny() {
+    printf("Testing yolov3-tiny with and without the rewrites...\n");
+    network *net, *plain;
+    make_pair("../cfg/yolov3-tiny.cfg", &net, &plain);
+    set_batch_network(net, 1);
+    set_batch_network(plain, 1);
+
+    /* the route after the first head reuses layer 13, the one before the
+       second head is written by the upsample and layer 8 */
+    assert(net->layers[17].output == net->layers[13].output);
+    assert(net->layers[19].output == net->layers[20].output);
+    assert(net->layers[8].output == net->layers[20].output + net->layers[19].outputs);
+    assert(net->output_arena_size <= plain->output_arena_size);
+
+    float *x = calloc(net->inputs, sizeof(float));
+    for(int i = 0; i < net->inputs; ++i) x[i] = rand_uniform(0, 1);
+    network_predict(net, x);
+    network_predict(plain, x);
+    for(int i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type != YOLO) continue;
+        assert(memcmp(l.output, plain->layers[i].output, l.outputs*l.batch*sizeof(float)) == 0);
+    }
+    printf("✓ identical detections\n");
+
+    free_network(net);
+    free_network(plain);
+    free(x);
+}
+
+void test_training_network() {
+    printf("Testing that training networks are left alone...\n");
+    network *net = parse_network_cfg("../cfg/yolov3-tiny.cfg");
+    assert(!net->optimize && optimize_network(net) == 0);
+    for(int i = 0; i < net->n; ++i) assert(!net->layers[i].alias && !net->layers[i].fused);
+    free_network(net);
+    printf("✓ no rewrites\n");
+}
+
+int main() {
+    printf("\n===== Running Graph Optimizer Tests =====\n\n");
+
+    test_every_rewrite();
+    test_yolov3_tiny();
+    test_training_network();
+
+    printf("\n===== All Graph Optimizer Tests Passed =====\n\n");
+    return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef TEST_HELPERS_H
+#define TEST_HELPERS_H
+/* Fixtures shared by the tests that parse small networks from text */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include "../src/network.h"
+#include "../src/parser.h"
+#include "../src/utils.h"
+
+/* Writes text to a new temporary file; path is a mkstemp template and is
+   left holding the file's name */
+static inline void write_temp_file(char *path, const char *text)
+{
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    FILE *fp = fdopen(fd, "w");
+    fputs(text, fp);
+    fclose(fp);
+}
+
+/* Parses a batch 2, 40x32 network made of the given [net] options and
+   layers */
+static inline network *parse_test_cfg(const char *net_options, const char *layers)
+{
+    const char *head = "[net]\nbatch=2\nwidth=40\nheight=32\nchannels=3\n";
+    char cfg[] = "/tmp/test_cfg_XXXXXX";
+    char *text = malloc(strlen(head) + strlen(net_options) + strlen(layers) + 1);
+    sprintf(text, "%s%s%s", head, net_options, layers);
+    write_temp_file(cfg, text);
+    free(text);
+    network *net = parse_network_cfg(cfg);
+    unlink(cfg);
+    return net;
+}
+
+/* Predicts on the same random input with both networks and compares the
+   outputs read after the pass: the network output and every yolo layer */
+static inline void assert_same_prediction(network *a, network *b)
+{
+    assert(a->n == b->n && a->inputs == b->inputs && a->outputs == b->outputs);
+    int n = a->inputs*a->batch;
+    float *x = calloc(n, sizeof(float));
+    for(int i = 0; i < n; i++) x[i] = rand_uniform(0, 1);
+    network_predict(a, x);
+    network_predict(b, x);
+    assert(memcmp(a->output, b->output, a->outputs*a->batch*sizeof(float)) == 0);
+    for(int i = 0; i < a->n; i++){
+        layer la = a->layers[i], lb = b->layers[i];
+        if(la.type != YOLO) continue;
+        assert(memcmp(la.output, lb.output, la.outputs*la.batch*sizeof(float)) == 0);
+    }
+    free(x);
+}
+
+/* Predicts on x with both networks and compares the outputs to a relative
+   1e-5, for rewrites that may round differently */
+static inline void assert_close_outputs(network *a, network *b, float *x)
+{
+    assert(a->outputs == b->outputs && a->batch == b->batch);
+    size_t outputs = a->outputs*a->batch;
+    float *expected = calloc(outputs, sizeof(float));
+    memcpy(expected, network_predict(b, x), outputs*sizeof(float));
+    float *out = network_predict(a, x);
+    for(size_t i = 0; i < outputs; ++i) assert(fabsf(out[i] - expected[i]) <= 1e-5*(1 + fabsf(expected[i])));
+    free(expected);
+}
+
+#endif
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../src/data.h"
+#include "../src/image.h"
+#include "../src/image_cache.h"
+#include "../src/list.h"
+#include "../src/option_list.h"
+#include "../src/utils.h"
+
+#define IMAGES 6
+
+static char dir[] = "/tmp/test_image_cache_XXXXXX";
+static char *paths[IMAGES];
+static int sizes[IMAGES][2] = {{40, 30}, {24, 24}, {13, 50}, {64, 16}, {31, 29}, {20, 20}};
+
+/* Random images of assorted shapes, each with one box */
+static void make_images()
+{
+    assert(mkdtemp(dir));
+    for(int i = 0; i < IMAGES; ++i){
+        image im = make_image(sizes[i][0], sizes[i][1], 3);
+        for(int j = 0; j < im.w*im.h*im.c; ++j) im.data[j] = rand_uniform(0, 1);
+        char name[256];
+        snprintf(name, sizeof(name), "%s/%d", dir, i);
+        save_image_options(im, name, PNG, 0);
+        free_image(im);
+        paths[i] = calloc(strlen(name) + 5, 1);
+        sprintf(paths[i], "%s.png", name);
+        char label[256];
+        snprintf(label, sizeof(label), "%s.txt", name);
+        FILE *fp = fopen(label, "w");
+        fprintf(fp, "%d 0.5 0.5 0.4 0.3\n", i%2);
+        fclose(fp);
+    }
+}
+
+static void remove_images()
+{
+    for(int i = 0; i < IMAGES; ++i){
+        unlink(paths[i]);
+        strcpy(paths[i] + strlen(paths[i]) - 4, ".txt");
+        unlink(paths[i]);
+        free(paths[i]);
+    }
+    rmdir(dir);
+}
+
+static void cache_path(char *buf, const char *name)
+{
+    sprintf(buf, "%s/%s", dir, name);
+}
+
+void test_build_and_find() {
+    printf("Testing a cache of the whole list...\n");
+    char file[256];
+    cache_path(file, "all.cache");
+    build_image_cache(file, paths, IMAGES, 0, 0);
+    image_cache *cache = open_image_cache(file);
+    assert(image_cache_size(cache) == IMAGES);
+    for(int i = IMAGES - 1; i >= 0; --i){
+        byte_image cached, decoded = load_byte_image(paths[i], 3);
+        assert(image_cache_find(cache, paths[i], &cached));
+        assert(cached.w == decoded.w && cached.h == decoded.h && cached.c == 3);
+        assert((size_t)cached.data % 64 == 0);
+        assert(!memcmp(cached.data, decoded.data, cached.w*cached.h*3));
+        free_byte_image(decoded);
+    }
+    byte_image missing;
+    assert(!image_cache_find(cache, "/nowhere/0.png", &missing));
+    assert(!image_cache_find(0, paths[0], &missing));
+    free_image_cache(cache);
+    unlink(file);
+    printf("✓ every image found, the same bytes as decoding it\n");
+}
+
+void test_downscale_and_cap() {
+    printf("Testing the side and size limits...\n");
+    char file[256];
+    cache_path(file, "small.cache");
+    build_image_cache(file, paths, IMAGES, 32, 0);
+    image_cache *cache = open_image_cache(file);
+    for(int i = 0; i < IMAGES; ++i){
+        byte_image im;
+        assert(image_cache_find(cache, paths[i], &im));
+        int w = sizes[i][0], h = sizes[i][1];
+        int side = w > h ? w : h;
+        if(side <= 32){
+            assert(im.w == w && im.h == h);
+            continue;
+        }
+        assert((im.w == 32 || im.h == 32) && (im.w > im.h) == (w > h));
+        assert(fabsf((float)im.w/im.h - (float)w/h) < .1*w/h);
+        image full = load_image_color(paths[i], 0, 0);
+        image expected = resize_image(full, im.w, im.h);
+        image got = byte_image_to_image(im);
+        for(int j = 0; j < got.w*got.h*3; ++j) assert(fabsf(got.data[j] - expected.data[j]) <= .5/255 + 1e-6);
+        free_image(full);
+        free_image(expected);
+        free_image(got);
+    }
+    free_image_cache(cache);
+
+    /* room for the first three images only */
+    size_t bytes = 0;
+    for(int i = 0; i < 3; ++i) bytes += sizes[i][0]*sizes[i][1]*3;
+    build_image_cache(file, paths, IMAGES, 0, bytes + 10);
+    cache = open_image_cache(file);
+    assert(image_cache_size(cache) == 3);
+    for(int i = 0; i < IMAGES; ++i){
+        byte_image im;
+        assert(image_cache_find(cache, paths[i], &im) == (i < 3));
+    }
+    free_image_cache(cache);
+    unlink(file);
+    printf("✓ large images downscaled, images past the size limit left out\n");
+}
+
+static void assert_same_data(data a, data b)
+{
+    assert(a.X.rows == b.X.rows && a.X.cols == b.X.cols && a.y.cols == b.y.cols);
+    for(int r = 0; r < a.X.rows; ++r){
+        assert(!memcmp(a.X.vals[r], b.X.vals[r], a.X.cols*sizeof(float)));
+        assert(!memcmp(a.y.vals[r], b.y.vals[r], a.y.cols*sizeof(float)));
+    }
+}
+
+/* The same load with and without the cache */
+static void compare_cached_load(load_args args, image_cache *cache)
+{
+    data plain, cached;
+    args.d = &plain;
+    srand(11);
+    load_data_blocking(args);
+    args.d = &cached;
+    args.cache = cache;
+    srand(11);
+    load_data_blocking(args);
+    assert_same_data(plain, cached);
+    free_data(plain);
+    free_data(cached);
+}
+
+void test_loaders() {
+    printf("Testing the loaders on a cache...\n");
+    char file[256];
+    cache_path(file, "loaders.cache");
+    /* the last image isn't cached and is decoded */
+    build_image_cache(file, paths, IMAGES - 1, 0, 0);
+    image_cache *cache = open_image_cache(file);
+
+    load_args args = {0};
+    args.paths = paths;
+    args.n = 4;
+    args.m = IMAGES;
+    args.w = args.h = 24;
+    args.threads = 1;
+    args.classes = 2;
+    args.num_boxes = 4;
+    args.jitter = .2;
+    args.hue = .1;
+    args.saturation = args.exposure = 1.5;
+    args.type = DETECTION_DATA;
+    for(int i = 0; i < 3; ++i) compare_cached_load(args, cache);
+
+    args.type = CLASSIFICATION_DATA;
+    /* one class per image */
+    char *labels[] = {"/0.png", "/1.png", "/2.png", "/3.png", "/4.png", "/5.png"};
+    args.labels = labels;
+    args.classes = IMAGES;
+    args.min = args.max = args.size = 24;
+    args.n = IMAGES;
+    compare_cached_load(args, cache);
+
+    args.type = OLD_CLASSIFICATION_DATA;
+    args.m = 0;
+    compare_cached_load(args, cache);
+
+    free_image_cache(cache);
+    unlink(file);
+    printf("✓ same batches as decoding every image\n");
+}
+
+static ino_t inode_of(char *file)
+{
+    struct stat st;
+    assert(!stat(file, &st));
+    return st.st_ino;
+}
+
+void test_data_options() {
+    printf("Testing the .data cache options...\n");
+    char file[256], datacfg[256];
+    cache_path(file, "train.cache");
+    cache_path(datacfg, "train.data");
+    FILE *fp = fopen(datacfg, "w");
+    fprintf(fp, "classes = 2\ncache = %s\ncache_max_side = 32\ncache_max_mb = 1\n", file);
+    fclose(fp);
+    list *options = read_data_cfg(datacfg);
+
+    image_cache *cache = load_image_cache(options, paths, IMAGES);
+    assert(image_cache_size(cache) == IMAGES);
+    byte_image im;
+    assert(image_cache_find(cache, paths[3], &im) && im.w == 32 && im.h == 8);
+    free_image_cache(cache);
+    ino_t built = inode_of(file);
+
+    /* built once */
+    cache = load_image_cache(options, paths, IMAGES);
+    assert(inode_of(file) == built);
+    free_image_cache(cache);
+
+    /* a new list builds it again */
+    cache = load_image_cache(options, paths, IMAGES - 2);
+    assert(image_cache_size(cache) == IMAGES - 2 && inode_of(file) != built);
+    free_image_cache(cache);
+    free_list_contents(options);
+    free_list(options);
+
+    fp = fopen(datacfg, "w");
+    fprintf(fp, "classes = 2\n");
+    fclose(fp);
+    options = read_data_cfg(datacfg);
+    assert(!load_image_cache(options, paths, IMAGES));
+    free_list_contents(options);
+    free_list(options);
+    unlink(file);
+    unlink(datacfg);
+    printf("✓ built from the list once, again when it changes, not without cache=\n");
+}
+
+int main() {
+    printf("\n===== Running Image Cache Tests =====\n\n");
+
+    make_images();
+    test_build_and_find();
+    test_downscale_and_cap();
+    test_loaders();
+    test_data_options();
+    remove_images();
+
+    printf("\n===== All Image Cache Tests Passed =====\n\n");
+    return 0;
+}
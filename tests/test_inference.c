@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include "test_helpers.h"
+
+static const char *test_layers =
+    "[convolutional]\nbatch_normalize=1\nfilters=16\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[maxpool]\nsize=2\nstride=2\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=32\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=16\nsize=1\nstride=1\npad=1\nactivation=leaky\n"
+    "[shortcut]\nfrom=-3\nactivation=linear\n"
+    "[upsample]\nstride=2\n"
+    "[route]\nlayers=-1,-6\n"
+    "[convolutional]\nfilters=18\nsize=1\nstride=1\npad=1\nactivation=linear\n"
+    "[yolo]\nmask=0,1,2\nanchors=10,14,23,27,37,58\nclasses=1\nnum=3\n";
+
+static void assert_no_training_buffers(network *net)
+{
+    for(int i = 0; i < net->n; i++) {
+        layer l = net->layers[i];
+        assert(!l.delta && !l.weight_updates && !l.bias_updates && !l.scale_updates);
+        assert(!l.x && !l.x_norm && !l.mean && !l.variance && !l.mean_delta && !l.variance_delta);
+        assert(!l.indexes && !l.rand);
+        assert(!l.m && !l.v && !l.bias_m && !l.bias_v && !l.scale_m && !l.scale_v);
+        assert(l.output);
+    }
+}
+
+void test_yolov3_tiny() {
+    printf("Testing an inference-only yolov3-tiny...\n");
+    srand(3);
+    network *train = parse_network_cfg("../cfg/yolov3-tiny.cfg");
+    srand(3);
+    network *infer = load_network_inference("../cfg/yolov3-tiny.cfg", 0);
+    assert(!train->inference && infer->inference);
+    assert_no_training_buffers(infer);
+    assert_same_prediction(train, infer);
+
+    size_t saved = 0;
+    for(int i = 0; i < train->n; i++) {
+        layer l = train->layers[i];
+        size_t out = (size_t)l.outputs*l.batch;
+        if(l.delta) saved += out*sizeof(float);
+        if(l.x) saved += 2*out*sizeof(float);
+        if(l.indexes) saved += out*sizeof(int);
+        if(l.weight_updates) saved += l.nweights*sizeof(float);
+    }
+    printf("✓ same detections without %.1f MB of training buffers\n", saved/1e6);
+    free_network(train);
+    free_network(infer);
+}
+
+void test_resize_and_batch() {
+    printf("Testing resize_network and set_batch_network without training buffers...\n");
+    srand(5);
+    network *infer = parse_test_cfg("inference=1\nadam=1\n", test_layers);
+    assert(infer->inference);
+    assert_no_training_buffers(infer);
+    srand(5);
+    network *train = parse_test_cfg("adam=1\n", test_layers);
+    assert(!train->inference);
+    for(int i = 0; i < train->n; i++) assert(train->layers[i].delta);
+
+    assert_same_prediction(train, infer);
+    resize_network(train, 56, 48);
+    resize_network(infer, 56, 48);
+    assert(infer->w == 56 && infer->h == 48);
+    assert_no_training_buffers(infer);
+    assert_same_prediction(train, infer);
+    set_batch_network(train, 1);
+    set_batch_network(infer, 1);
+    assert_same_prediction(train, infer);
+
+    free_network(train);
+    free_network(infer);
+    printf("✓ both keep working\n");
+}
+
+int main() {
+    printf("\n===== Running Inference-Only Network Tests =====\n\n");
+
+    test_yolov3_tiny();
+    test_resize_and_batch();
+
+    printf("\n===== All Inference-Only Network Tests Passed =====\n\n");
+    return 0;
+}
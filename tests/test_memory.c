@@ -4,6 +4,8 @@
 #include <assert.h>
 #include <signal.h>
 #include <setjmp.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "../src/utils.h"
 #include "../src/list.h"
 #include "../src/matrix.h"
@@ -220,6 +222,30 @@ void test_realloc_growth() {
     printf("PASSED\n");
 }
 
+static thread_buffer exiting_buffer;
+
+static void *grow_and_exit(void *ptr) {
+    float *data = grow_thread_buffer(&exiting_buffer, 1000*sizeof(float));
+    assert(data != NULL);
+    assert(((uintptr_t)data & 63) == 0);
+    assert(data[999] == 0);
+    assert(grow_thread_buffer(&exiting_buffer, 10*sizeof(float)) == data);
+    data = grow_thread_buffer(&exiting_buffer, 4000*sizeof(float));
+    assert(data[3999] == 0);
+    return 0;
+}
+
+// Test that a thread's scratch buffers are freed when it exits
+void test_thread_buffer_freed_on_exit() {
+    printf("Testing thread buffers are freed on thread exit... ");
+    pthread_t thread;
+    assert(pthread_create(&thread, 0, grow_and_exit, 0) == 0);
+    pthread_join(thread, 0);
+    assert(exiting_buffer.data == NULL);
+    assert(exiting_buffer.size == 0);
+    printf("PASSED\n");
+}
+
 int main() {
     printf("=== Memory Allocation Safety Tests ===\n\n");
     
@@ -234,6 +260,7 @@ int main() {
     test_copy_string_safe();
     test_multiple_allocations();
     test_realloc_growth();
+    test_thread_buffer_freed_on_exit();
     
     printf("\n=== All tests PASSED ===\n");
     return 0;
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include "test_helpers.h"
+
+/* A chain with a shortcut, a dropout alias and two routes reaching back */
+static const char *test_layers =
+    "[convolutional]\nbatch_normalize=1\nfilters=16\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[maxpool]\nsize=2\nstride=2\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=32\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[dropout]\nprobability=.5\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=16\nsize=1\nstride=1\npad=1\nactivation=leaky\n"
+    "[shortcut]\nfrom=-4\nactivation=linear\n"
+    "[upsample]\nstride=2\n"
+    "[route]\nlayers=-1,-7\n"
+    "[convolutional]\nfilters=18\nsize=1\nstride=1\npad=1\nactivation=linear\n"
+    "[yolo]\nmask=0,1,2\nanchors=10,14,23,27,37,58\nclasses=1\nnum=3\n"
+    "[route]\nlayers=-5\n"
+    "[convolutional]\nfilters=18\nsize=1\nstride=1\npad=1\nactivation=linear\n"
+    "[yolo]\nmask=0,1,2\nanchors=10,14,23,27,37,58\nclasses=1\nnum=3\n";
+
+static size_t naive_bytes(network *net)
+{
+    size_t bytes = 0;
+    for(int i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type != DROPOUT) bytes += (size_t)l.outputs*l.batch*sizeof(float);
+    }
+    return bytes;
+}
+
+void test_yolov3_tiny() {
+    printf("Testing a planned yolov3-tiny...\n");
+    srand(7);
+    network *naive = parse_network_cfg("../cfg/yolov3-tiny.cfg");
+    srand(7);
+    network *planned = load_network_inference("../cfg/yolov3-tiny.cfg", 0);
+    assert(!naive->output_arena && planned->output_arena);
+    assert_same_prediction(naive, planned);
+    size_t before = naive_bytes(naive);
+    size_t after = planned->output_arena_size*sizeof(float);
+    assert(after*2 < before);
+    printf("✓ same detections from %.1f MB instead of %.1f MB\n", after/1e6, before/1e6);
+
+    resize_network(naive, 320, 256);
+    resize_network(planned, 320, 256);
+    assert(planned->output_arena && planned->output_arena_size*sizeof(float) < after);
+    assert_same_prediction(naive, planned);
+    printf("✓ planned again after resize_network\n");
+    free_network(naive);
+    free_network(planned);
+}
+
+void test_routes() {
+    printf("Testing route, shortcut and dropout edges...\n");
+    srand(9);
+    network *naive = parse_test_cfg("", test_layers);
+    srand(9);
+    network *planned = parse_test_cfg("inference=1\n", test_layers);
+    assert(planned->plan_memory && planned->output_arena);
+    assert(planned->layers[3].output == planned->layers[2].output);
+    assert_same_prediction(naive, planned);
+    printf("✓ %.1f KB instead of %.1f KB\n",
+            planned->output_arena_size*sizeof(float)/1e3, naive_bytes(planned)/1e3);
+
+    free_network(naive);
+    free_network(planned);
+}
+
+void test_opt_out() {
+    printf("Testing plan_memory=0...\n");
+    network *net = parse_test_cfg("inference=1\nplan_memory=0\n", test_layers);
+    assert(net->inference && !net->plan_memory && !net->output_arena);
+    free_network(net);
+    printf("✓ every layer keeps its own output\n");
+}
+
+int main() {
+    printf("\n===== Running Memory Plan Tests =====\n\n");
+
+    test_yolov3_tiny();
+    test_routes();
+    test_opt_out();
+
+    printf("\n===== All Memory Plan Tests Passed =====\n\n");
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include "test_helpers.h"
+#include "../src/quantize.h"
+
+static const char *test_cfg =
+    "[net]\nbatch=1\nwidth=24\nheight=20\nchannels=3\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=8\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[maxpool]\nsize=2\nstride=2\n"
+    "[convolutional]\nfilters=16\nsize=3\ngroups=2\nstride=1\npad=1\nactivation=relu\n"
+    "[batchnorm]\n"
+    "[connected]\nbatch_normalize=1\noutput=10\nactivation=linear\n"
+    "[softmax]\n";
+
+static char *slurp(char *path, size_t *size)
+{
+    FILE *fp = fopen(path, "rb");
+    assert(fp);
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *data = malloc(*size);
+    assert(fread(data, 1, *size, fp) == *size);
+    fclose(fp);
+    return data;
+}
+
+static int in_map(network *net, void *p)
+{
+    char *begin = net->weights_map;
+    return (char *)p >= begin && (char *)p < begin + net->weights_map_size;
+}
+
+void test_yolov3_tiny() {
+    printf("Testing yolov3-tiny through memory-mapped weights...\n");
+    char classic[] = "/tmp/test_mmap_classic_XXXXXX";
+    char mapped[] = "/tmp/test_mmap_mapped_XXXXXX";
+    char resaved[] = "/tmp/test_mmap_resaved_XXXXXX";
+    write_temp_file(classic, "");
+    write_temp_file(mapped, "");
+    write_temp_file(resaved, "");
+
+    srand(17);
+    network *net = load_network_inference("../cfg/yolov3-tiny.cfg", 0);
+    *net->seen = 12345;
+    save_weights(net, classic);
+    save_weights_mmap(net, mapped);
+
+    srand(19);
+    network *loaded = load_network_inference("../cfg/yolov3-tiny.cfg", mapped);
+    assert(loaded->weights_map && *loaded->seen == 12345);
+    for(int i = 0; i < loaded->n; i++){
+        layer l = loaded->layers[i];
+        if(l.type != CONVOLUTIONAL) continue;
+        assert(in_map(loaded, l.weights) && in_map(loaded, l.biases));
+        assert(((uintptr_t)l.weights & 63) == 0);
+        assert(!l.batch_normalize || (in_map(loaded, l.scales) && in_map(loaded, l.rolling_mean)));
+    }
+    assert_same_prediction(net, loaded);
+
+    /* saving the mapped network gives the classic file back */
+    save_weights(loaded, resaved);
+    size_t n1, n2;
+    char *a = slurp(classic, &n1);
+    char *b = slurp(resaved, &n2);
+    assert(n1 == n2 && memcmp(a, b, n1) == 0);
+    printf("✓ same predictions and the same classic weights file\n");
+
+    free(a);
+    free(b);
+    free_network(net);
+    free_network(loaded);
+    unlink(classic);
+    unlink(mapped);
+    unlink(resaved);
+}
+
+void test_int8_and_partial_loads() {
+    printf("Testing int8, batchnorm and connected tensors...\n");
+    char cfg[] = "/tmp/test_mmap_cfg_XXXXXX";
+    char mapped[] = "/tmp/test_mmap_int8_XXXXXX";
+    write_temp_file(cfg, test_cfg);
+    write_temp_file(mapped, "");
+
+    srand(23);
+    network *net = parse_network_cfg(cfg);
+    for(int i = 0; i < net->n; i++){
+        layer *l = net->layers + i;
+        if(l->type == BATCHNORM){
+            for(int j = 0; j < l->c; j++) l->scales[j] = rand_uniform(.5, 1.5);
+        }
+        if(!int8_supported(*l)) continue;
+        make_int8_weights(l);
+        l->input_scale = 1./64;
+        update_int8_weights(*l);
+    }
+    save_weights_mmap(net, mapped);
+
+    srand(29);
+    network *loaded = parse_network_cfg(cfg);
+    load_weights(loaded, mapped);
+    for(int i = 0; i < net->n; i++){
+        layer l = loaded->layers[i];
+        if(!int8_supported(l)) continue;
+        assert(in_map(loaded, l.weights_int8) && in_map(loaded, l.weight_scales));
+        assert(l.input_scale == net->layers[i].input_scale);
+    }
+    assert(in_map(loaded, loaded->layers[3].scales));
+    assert_same_prediction(net, loaded);
+    free_network(loaded);
+
+    /* layers past the cutoff keep the weights they were parsed with */
+    srand(29);
+    network *partial = parse_network_cfg(cfg);
+    load_weights_upto(partial, mapped, 0, 2);
+    assert(in_map(partial, partial->layers[0].weights));
+    assert(!in_map(partial, partial->layers[2].weights) && !partial->layers[2].weights_int8);
+    free_network(partial);
+    printf("✓ int8 layers load from the mapping\n");
+
+    free_network(net);
+    unlink(cfg);
+    unlink(mapped);
+}
+
+int main() {
+    printf("\n===== Running Memory-Mapped Weights Tests =====\n\n");
+
+    test_yolov3_tiny();
+    test_int8_and_partial_loads();
+
+    printf("\n===== All Memory-Mapped Weights Tests Passed =====\n\n");
+    return 0;
+}
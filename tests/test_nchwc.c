@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include "../src/network.h"
+#include "../src/parser.h"
+#include "../src/convolutional_layer.h"
+#include "../src/nchwc.h"
+#include "../src/utils.h"
+
+static const char *test_cfg =
+    "[net]\nbatch=2\nwidth=40\nheight=32\nchannels=3\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=16\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[maxpool]\nsize=2\nstride=2\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=32\nsize=3\nstride=2\npad=1\nactivation=leaky\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=16\nsize=1\nstride=1\npad=1\nactivation=leaky\n"
+    "[convolutional]\nfilters=32\nsize=5\nstride=1\npad=1\nactivation=linear\n"
+    "[shortcut]\nfrom=-3\nactivation=linear\n"
+    "[batchnorm]\n"
+    "[maxpool]\nsize=3\nstride=1\n"
+    "[upsample]\nstride=2\n"
+    "[route]\nlayers=-1,-8\n"
+    "[convolutional]\nfilters=24\nsize=3\nstride=1\npad=1\nactivation=logistic\n"
+    "[convolutional]\nfilters=18\nsize=1\nstride=1\npad=1\nactivation=linear\n"
+    "[dropout]\nprobability=.5\n"
+    "[convolutional]\nfilters=16\nsize=3\nstride=1\npad=1\nactivation=relu\n";
+
+static void fill_random(float *x, int n, float lo, float hi)
+{
+    for(int i = 0; i < n; i++) x[i] = rand_uniform(lo, hi);
+}
+
+static void randomize_network(network *net)
+{
+    for(int i = 0; i < net->n; i++) {
+        layer l = net->layers[i];
+        int n = l.type == BATCHNORM ? l.out_c : l.n;
+        if(l.biases) fill_random(l.biases, n, -.5, .5);
+        if(l.scales) fill_random(l.scales, n, .5, 1.5);
+        if(l.rolling_mean) fill_random(l.rolling_mean, n, -.5, .5);
+        if(l.rolling_variance) fill_random(l.rolling_variance, n, .5, 2);
+    }
+}
+
+static float max_rel_error(float *a, float *b, int n)
+{
+    float err = 0;
+    for(int i = 0; i < n; i++) {
+        float d = fabs(a[i] - b[i]) / (1 + fabs(b[i]));
+        if(d > err) err = d;
+    }
+    return err;
+}
+
+static void compare_layouts(network *net, const char *name)
+{
+    float *input = calloc(net->inputs*net->batch, sizeof(float));
+    fill_random(input, net->inputs*net->batch, 0, 1);
+
+    set_network_layout(net, 0);
+    float *ref = calloc(net->outputs*net->batch, sizeof(float));
+    memcpy(ref, network_predict(net, input), net->outputs*net->batch*sizeof(float));
+
+    int blocks[] = {8, 16};
+    for(int b = 0; b < 2; b++) {
+        set_network_layout(net, blocks[b]);
+        int packed = 0;
+        for(int i = 0; i < net->n; i++) packed += net->layers[i].nchwc != 0;
+        assert(packed > 0);
+        assert(net->layers[net->n-1].nchwc == 0);
+        float err = max_rel_error(network_predict(net, input), ref, net->outputs*net->batch);
+        printf("  %s, nchw%dc: %d layers packed, err %g\n", name, blocks[b], packed, err);
+        assert(err <= 1e-4);
+    }
+    set_network_layout(net, 0);
+    free(ref);
+    free(input);
+}
+
+void test_reorder_roundtrip() {
+    printf("Testing NCHW <-> NCHWc reorders...\n");
+    int batch = 2, c = 32, spatial = 7*5;
+    int n = batch*c*spatial;
+    float *a = calloc(n, sizeof(float));
+    float *p = calloc(n, sizeof(float));
+    float *b = calloc(n, sizeof(float));
+    for(int i = 0; i < n; i++) a[i] = i;
+    nchw_to_nchwc(a, batch, c, spatial, 8, p);
+    /* channel 11 of image 1, pixel 3 */
+    assert(p[((1*4 + 1)*spatial + 3)*8 + 3] == a[(1*c + 11)*spatial + 3]);
+    nchwc_to_nchw(p, batch, c, spatial, 8, b);
+    assert(memcmp(a, b, n*sizeof(float)) == 0);
+    nchw_to_nchwc(a, batch, c, spatial, 16, p);
+    nchwc_to_nchw(p, batch, c, spatial, 16, b);
+    assert(memcmp(a, b, n*sizeof(float)) == 0);
+    free(a);
+    free(p);
+    free(b);
+    printf("✓ reorders round-trip\n");
+}
+
+void test_layout_matches_plain() {
+    printf("Testing packed inference against plain NCHW...\n");
+    char path[] = "/tmp/test_nchwc_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    FILE *fp = fdopen(fd, "w");
+    fputs(test_cfg, fp);
+    fclose(fp);
+
+    network *net = parse_network_cfg(path);
+    randomize_network(net);
+    compare_layouts(net, "mixed layers");
+
+    /* the shortcut source is packed, so the shortcut and route must be too */
+    set_network_layout(net, 8);
+    assert(net->layers[2].nchwc == 8);
+    assert(net->layers[5].nchwc == 8);
+    assert(net->layers[9].nchwc == 8);
+    /* 18 filters can't be blocked, and dropout aliases its input */
+    assert(net->layers[11].nchwc == 0);
+    assert(net->layers[12].nchwc == 0);
+    free_network(net);
+    unlink(path);
+
+    net = parse_network_cfg("../cfg/yolov3-tiny.cfg");
+    resize_network(net, 160, 128);
+    randomize_network(net);
+    compare_layouts(net, "yolov3-tiny");
+    free_network(net);
+    printf("✓ packed layouts match plain NCHW\n");
+}
+
+void test_weights_loaded_after_layout() {
+    printf("Testing weights loaded into a packed network...\n");
+    char cfg[] = "/tmp/test_nchwc_XXXXXX";
+    char packed_cfg[] = "/tmp/test_nchwc_XXXXXX";
+    char weights[] = "/tmp/test_nchwc_XXXXXX";
+    int fd = mkstemp(cfg);
+    assert(fd >= 0);
+    FILE *fp = fdopen(fd, "w");
+    fputs(test_cfg, fp);
+    fclose(fp);
+    fd = mkstemp(packed_cfg);
+    assert(fd >= 0);
+    fp = fdopen(fd, "w");
+    fprintf(fp, "[net]\nlayout=nchw16c\n%s", test_cfg + strlen("[net]\n"));
+    fclose(fp);
+    fd = mkstemp(weights);
+    assert(fd >= 0);
+    close(fd);
+
+    network *net = parse_network_cfg(cfg);
+    randomize_network(net);
+    save_weights(net, weights);
+    free_network(net);
+    /* the weights file has no batchnorm layer biases, compare loaded to loaded */
+    net = parse_network_cfg(cfg);
+    load_weights(net, weights);
+    /* packed when parsed, before the weights are there */
+    network *packed = parse_network_cfg(packed_cfg);
+    assert(packed->nchwc == 16 && packed->layers[0].nchwc_weights);
+    load_weights(packed, weights);
+
+    float *input = calloc(net->inputs*net->batch, sizeof(float));
+    fill_random(input, net->inputs*net->batch, 0, 1);
+    float *ref = calloc(net->outputs*net->batch, sizeof(float));
+    memcpy(ref, network_predict(net, input), net->outputs*net->batch*sizeof(float));
+    assert(max_rel_error(network_predict(packed, input), ref, net->outputs*net->batch) <= 1e-4);
+
+    /* and repacked when they change */
+    rescale_weights(net->layers[0], 2, -.5);
+    rescale_weights(packed->layers[0], 2, -.5);
+    memcpy(ref, network_predict(net, input), net->outputs*net->batch*sizeof(float));
+    assert(max_rel_error(network_predict(packed, input), ref, net->outputs*net->batch) <= 1e-4);
+
+    free(ref);
+    free(input);
+    free_network(net);
+    free_network(packed);
+    unlink(cfg);
+    unlink(packed_cfg);
+    unlink(weights);
+    printf("✓ packed filters and folded batchnorm follow the weights\n");
+}
+
+int main() {
+    printf("\n===== Running NCHWc Layout Tests =====\n\n");
+
+    test_reorder_roundtrip();
+    test_layout_matches_plain();
+    test_weights_loaded_after_layout();
+
+    printf("\n===== All NCHWc Layout Tests Passed =====\n\n");
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include "test_helpers.h"
+#include "../src/profiler.h"
+
+static const char *test_cfg =
+    "[net]\nbatch=2\nwidth=8\nheight=8\nchannels=3\nlearning_rate=0.01\nmomentum=0.9\ndecay=0.0005\n"
+    "[convolutional]\nfilters=4\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[maxpool]\nsize=2\nstride=2\n"
+    "[connected]\noutput=5\nactivation=linear\n"
+    "[softmax]\n";
+
+static char *slurp(char *path)
+{
+    FILE *fp = fopen(path, "r");
+    assert(fp);
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    char *text = calloc(size + 1, 1);
+    assert(fread(text, 1, size, fp) == (size_t)size);
+    fclose(fp);
+    return text;
+}
+
+static int count(char *text, char *word)
+{
+    int n = 0;
+    for(char *p = strstr(text, word); p; p = strstr(p + 1, word)) ++n;
+    return n;
+}
+
+static void random_example(network *net)
+{
+    for(int i = 0; i < net->inputs*net->batch; ++i) net->input[i] = rand_uniform(0, 1);
+    memset(net->truth, 0, net->truths*net->batch*sizeof(float));
+    for(int b = 0; b < net->batch; ++b) net->truth[b*net->truths + rand()%net->truths] = 1;
+}
+
+void test_training_passes() {
+    printf("Testing forward, backward and update accounting...\n");
+    char cfg[] = "/tmp/test_profiler_cfg_XXXXXX";
+    write_temp_file(cfg, test_cfg);
+    network *net = parse_network_cfg(cfg);
+    assert(!net->profile && get_layer_profile(net, 0, PROFILE_FORWARD, 0, 0, 0) == 0);
+
+    set_network_profiling(net, 1);
+    for(int i = 0; i < 3; ++i){
+        random_example(net);
+        train_network_datum(net);
+    }
+    double seconds, flops, bytes;
+    layer conv = net->layers[0];
+    assert(get_layer_profile(net, 0, PROFILE_FORWARD, &seconds, &flops, &bytes) == 3);
+    assert(seconds > 0);
+    double conv_flops = 2.*conv.n*conv.c*conv.size*conv.size*conv.out_h*conv.out_w*conv.batch + 2.*conv.outputs*conv.batch;
+    assert(fabs(flops - 3*conv_flops) < 1);
+    assert(bytes >= 3.*(conv.inputs + conv.outputs)*conv.batch*sizeof(float));
+    for(int i = 0; i < net->n; ++i){
+        assert(get_layer_profile(net, i, PROFILE_FORWARD, 0, 0, 0) == 3);
+        assert(get_layer_profile(net, i, PROFILE_BACKWARD, 0, 0, 0) == 3);
+    }
+    /* only the layers with parameters update, once per step */
+    assert(get_layer_profile(net, 0, PROFILE_UPDATE, 0, &flops, 0) == 3 && flops > 0);
+    assert(get_layer_profile(net, 1, PROFILE_UPDATE, 0, 0, 0) == 0);
+    assert(get_layer_profile(net, 2, PROFILE_UPDATE, 0, 0, 0) == 3);
+    assert(get_layer_profile(net, 0, PROFILE_BACKWARD, 0, &flops, 0) == 3);
+    assert(fabs(flops - 6*conv_flops) < 1);
+    printf("✓ every layer and phase counted with the expected FLOPs\n");
+
+    reset_network_profile(net);
+    assert(get_layer_profile(net, 0, PROFILE_FORWARD, 0, 0, 0) == 0);
+    set_network_profiling(net, 0);
+    assert(!net->profile);
+    forward_network(net);
+    printf("✓ reset and turned off\n");
+
+    free_network(net);
+    unlink(cfg);
+}
+
+void test_exports() {
+    printf("Testing the table, JSON and trace exports...\n");
+    network *net = load_network_inference("../cfg/yolov3-tiny.cfg", 0);
+    set_batch_network(net, 1);
+    float *x = calloc(net->inputs, sizeof(float));
+    set_network_profiling(net, 1);
+    network_predict(net, x);
+    network_predict(net, x);
+
+    char table[] = "/tmp/test_profiler_table_XXXXXX";
+    char json[] = "/tmp/test_profiler_json_XXXXXX";
+    char trace[] = "/tmp/test_profiler_trace_XXXXXX";
+    write_temp_file(table, "");
+    write_temp_file(json, "");
+    write_temp_file(trace, "");
+    FILE *fp = fopen(table, "w");
+    print_network_profile(net, fp);
+    fclose(fp);
+    save_network_profile(net, json);
+    save_network_trace(net, trace);
+
+    char *text = slurp(table);
+    assert(strstr(text, "forward, 2 passes") && strstr(text, "GFLOP/s") && strstr(text, "total"));
+    assert(count(text, "convolutional") == 13 && !strstr(text, "backward"));
+    free(text);
+    text = slurp(json);
+    assert(count(text, "\"phase\": \"forward\"") == net->n && count(text, "\"calls\": 2") == net->n);
+    free(text);
+    text = slurp(trace);
+    assert(strstr(text, "\"traceEvents\"") && count(text, "\"ph\": \"X\"") == 2*net->n);
+    free(text);
+    printf("✓ one line per layer, one event per call\n");
+
+    /* clones record their own calls */
+    network *clone = clone_network_for_inference(net);
+    assert(clone->profile && clone->profile != net->profile);
+    network_predict(clone, x);
+    assert(get_layer_profile(clone, 0, PROFILE_FORWARD, 0, 0, 0) == 1);
+    assert(get_layer_profile(net, 0, PROFILE_FORWARD, 0, 0, 0) == 2);
+    free_network(clone);
+    printf("✓ clones profiled separately\n");
+
+    unlink(table);
+    unlink(json);
+    unlink(trace);
+    free(x);
+    free_network(net);
+}
+
+void test_environment() {
+    printf("Testing DARKNET_PROFILE...\n");
+    char cfg[] = "/tmp/test_profiler_cfg_XXXXXX";
+    char json[] = "/tmp/test_profiler_json_XXXXXX";
+    write_temp_file(cfg, test_cfg);
+    write_temp_file(json, "");
+    setenv("DARKNET_PROFILE", "1", 1);
+    setenv("DARKNET_PROFILE_JSON", json, 1);
+    network *net = parse_network_cfg_inference(cfg);
+    unsetenv("DARKNET_PROFILE");
+    assert(net->profile);
+    float *x = calloc(net->inputs*net->batch, sizeof(float));
+    network_predict(net, x);
+    free(x);
+    free_network(net);
+    unsetenv("DARKNET_PROFILE_JSON");
+
+    /* the report is written when the network is freed */
+    char *text = slurp(json);
+    assert(count(text, "\"calls\": 1") == 4);
+    free(text);
+    net = parse_network_cfg_inference(cfg);
+    assert(!net->profile);
+    free_network(net);
+    printf("✓ profiled and reported on free\n");
+    unlink(json);
+    unlink(cfg);
+}
+
+int main() {
+    printf("\n===== Running Profiler Tests =====\n\n");
+
+    test_training_passes();
+    test_exports();
+    test_environment();
+
+    printf("\n===== All Profiler Tests Passed =====\n\n");
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include "../src/network.h"
+#include "../src/parser.h"
+#include "../src/quantize.h"
+#include "../src/convolutional_layer.h"
+#include "../src/utils.h"
+
+static void fill_random(float *x, int n, float lo, float hi)
+{
+    for(int i = 0; i < n; i++) x[i] = rand_uniform(lo, hi);
+}
+
+/* largest deviation relative to the largest reference value */
+static float max_scaled_error(float *a, float *b, int n)
+{
+    float err = 0;
+    float most = 0;
+    for(int i = 0; i < n; i++) {
+        if(fabs(b[i]) > most) most = fabs(b[i]);
+        if(fabs(a[i] - b[i]) > err) err = fabs(a[i] - b[i]);
+    }
+    return most > 0 ? err/most : err;
+}
+
+static void check_gemm_int8(int m, int n, int k)
+{
+    signed char *a = calloc(m*k, 1);
+    signed char *b = calloc(k*n, 1);
+    int *c = calloc(m*n, sizeof(int));
+    for(int i = 0; i < m*k; i++) a[i] = rand()%255 - 127;
+    for(int i = 0; i < k*n; i++) b[i] = rand()%255 - 127;
+    gemm_int8_cpu(m, n, k, a, k, b, n, c, n);
+    for(int i = 0; i < m; i++) {
+        for(int j = 0; j < n; j++) {
+            int sum = 0;
+            for(int p = 0; p < k; p++) sum += a[i*k + p]*b[p*n + j];
+            assert(c[i*n + j] == sum);
+        }
+    }
+    free(a);
+    free(b);
+    free(c);
+}
+
+void test_gemm_int8_kernel(const char *name) {
+    if(!gemm_int8_select_kernel(name)) {
+        printf("  - %s kernel not supported on this CPU, skipped\n", name);
+        return;
+    }
+    int shapes[][3] = {
+        {1, 1, 1}, {3, 5, 7}, {6, 8, 4}, {8, 32, 33}, {13, 47, 300}, {64, 100, 27}, {17, 70, 1153}
+    };
+    for(int s = 0; s < (int)(sizeof(shapes)/sizeof(shapes[0])); s++) {
+        check_gemm_int8(shapes[s][0], shapes[s][1], shapes[s][2]);
+    }
+    printf("  ✓ %s int8 kernel is exact\n", name);
+}
+
+static void check_conv_int8(int size, int stride, int groups, int batch_normalize, ACTIVATION act)
+{
+    int batch = 2, h = 13, w = 11, c = 8, n = 16;
+    convolutional_layer l = make_convolutional_layer(batch, h, w, c, n, groups, size, stride, size/2, act, batch_normalize, 0, 0, 0);
+    fill_random(l.biases, n, -.5, .5);
+    if(batch_normalize) {
+        fill_random(l.scales, n, .5, 1.5);
+        fill_random(l.rolling_mean, n, -.5, .5);
+        fill_random(l.rolling_variance, n, .5, 2);
+    }
+    network net = {0};
+    net.input = calloc(batch*l.inputs, sizeof(float));
+    net.workspace = calloc(1, l.workspace_size);
+    fill_random(net.input, batch*l.inputs, -1, 1);
+    float *ref = calloc(batch*l.outputs, sizeof(float));
+    forward_convolutional_layer(l, net);
+    memcpy(ref, l.output, batch*l.outputs*sizeof(float));
+
+    make_int8_weights(&l);
+    l.input_scale = 1./127;
+    update_int8_weights(l);
+    forward_convolutional_layer(l, net);
+    float err = max_scaled_error(l.output, ref, batch*l.outputs);
+    printf("  %dx%d/%d, groups %d, bn %d: err %g\n", size, size, stride, groups, batch_normalize, err);
+    assert(err < .02);
+
+    free(ref);
+    free(net.input);
+    free(net.workspace);
+    free_layer(l);
+}
+
+void test_conv_int8() {
+    printf("Testing int8 convolution against float...\n");
+    check_conv_int8(3, 1, 1, 1, LEAKY);
+    check_conv_int8(1, 1, 1, 0, LINEAR);
+    check_conv_int8(3, 2, 2, 1, LOGISTIC);
+    check_conv_int8(5, 1, 1, 0, RELU);
+    printf("✓ int8 convolution tracks float\n");
+}
+
+static const char *test_cfg =
+    "[net]\nbatch=1\nwidth=32\nheight=32\nchannels=3\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=16\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[maxpool]\nsize=2\nstride=2\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=32\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[convolutional]\nfilters=16\nsize=1\nstride=1\npad=1\nactivation=leaky\n"
+    "[connected]\noutput=10\nactivation=linear\n";
+
+void test_quantized_weights_file() {
+    printf("Testing quantize_network and int8 weights files...\n");
+    char cfg[] = "/tmp/test_quantize_cfg_XXXXXX";
+    char weights[] = "/tmp/test_quantize_weights_XXXXXX";
+    int fd = mkstemp(cfg);
+    assert(fd >= 0);
+    FILE *fp = fdopen(fd, "w");
+    fputs(test_cfg, fp);
+    fclose(fp);
+    fd = mkstemp(weights);
+    assert(fd >= 0);
+    close(fd);
+
+    network *net = parse_network_cfg(cfg);
+    for(int i = 0; i < net->n; i++) {
+        layer l = net->layers[i];
+        if(l.rolling_variance) fill_random(l.rolling_variance, l.n, .5, 2);
+    }
+    image im = load_image_color("../data/dog.jpg", 0, 0);
+    image sized = letterbox_image(im, net->w, net->h);
+    float *ref = calloc(net->outputs, sizeof(float));
+    memcpy(ref, network_predict(net, sized.data), net->outputs*sizeof(float));
+
+    char *paths[] = {"../data/dog.jpg", "../data/eagle.jpg", "../data/horses.jpg"};
+    quantize_network(net, paths, 3);
+    for(int i = 0; i < net->n; i++) {
+        layer l = net->layers[i];
+        assert(!int8_supported(l) || (l.weights_int8 && l.input_scale > 0));
+    }
+    float *q = calloc(net->outputs, sizeof(float));
+    memcpy(q, network_predict(net, sized.data), net->outputs*sizeof(float));
+    float err = max_scaled_error(q, ref, net->outputs);
+    printf("  int8 vs float: err %g\n", err);
+    assert(err < .05);
+    save_weights_int8(net, weights);
+
+    network *loaded = parse_network_cfg(cfg);
+    load_weights(loaded, weights);
+    for(int i = 0; i < loaded->n; i++) {
+        assert(!int8_supported(loaded->layers[i]) || loaded->layers[i].weights_int8);
+    }
+    assert(memcmp(network_predict(loaded, sized.data), q, net->outputs*sizeof(float)) == 0);
+
+    free(ref);
+    free(q);
+    free_image(im);
+    free_image(sized);
+    free_network(net);
+    free_network(loaded);
+    unlink(cfg);
+    unlink(weights);
+    printf("✓ int8 weights round-trip\n");
+}
+
+int main() {
+    printf("\n===== Running INT8 Quantization Tests =====\n\n");
+
+    printf("Testing gemm_int8_cpu kernels...\n");
+    test_gemm_int8_kernel("generic");
+    test_gemm_int8_kernel("avx2");
+    test_gemm_int8_kernel("avx512vnni");
+    test_conv_int8();
+    test_quantized_weights_file();
+
+    printf("\n===== All INT8 Quantization Tests Passed =====\n\n");
+    return 0;
+}
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include "../src/data.h"
+#include "../src/image.h"
+#include "../src/list.h"
+#include "../src/option_list.h"
+#include "../src/record_shard.h"
+#include "../src/utils.h"
+
+#define IMAGES 5
+
+static char dir[] = "/tmp/test_records_XXXXXX";
+static char *paths[IMAGES];
+
+/* Random images with a box or two each, but the last, which has no label
+   file */
+static void make_images()
+{
+    assert(mkdtemp(dir));
+    for(int i = 0; i < IMAGES; ++i){
+        image im = make_image(20 + 7*i, 30 - 3*i, 3);
+        for(int j = 0; j < im.w*im.h*im.c; ++j) im.data[j] = rand_uniform(0, 1);
+        char name[256];
+        snprintf(name, sizeof(name), "%s/%d", dir, i);
+        save_image_options(im, name, PNG, 0);
+        free_image(im);
+        paths[i] = calloc(strlen(name) + 5, 1);
+        sprintf(paths[i], "%s.png", name);
+        if(i == IMAGES - 1) continue;
+        char label[256];
+        snprintf(label, sizeof(label), "%s.txt", name);
+        FILE *fp = fopen(label, "w");
+        fprintf(fp, "%d 0.5 0.5 0.4 0.3\n", i);
+        if(i%2) fprintf(fp, "%d 0.25 0.3 0.2 0.1\n", i + 10);
+        fclose(fp);
+    }
+}
+
+static void write_list(char *file, int n)
+{
+    FILE *fp = fopen(file, "w");
+    for(int i = 0; i < n; ++i) fprintf(fp, "%s\n", paths[i]);
+    fclose(fp);
+}
+
+/* Removes prefix.shards and the shards it lists */
+static void remove_shards(char *prefix)
+{
+    char file[300];
+    snprintf(file, sizeof(file), "%s.shards", prefix);
+    list *shards = get_paths(file);
+    char **names = (char **)list_to_array(shards);
+    for(int i = 0; i < shards->size; ++i) unlink(names[i]);
+    free_ptrs((void **)names, shards->size);
+    free_list(shards);
+    unlink(file);
+}
+
+static int path_index(char *path)
+{
+    for(int i = 0; i < IMAGES; ++i) if(!strcmp(paths[i], path)) return i;
+    return -1;
+}
+
+static void assert_record_matches(data_record r)
+{
+    int i = path_index(r.path);
+    assert(i >= 0);
+    FILE *fp = fopen(r.path, "rb");
+    fseek(fp, 0, SEEK_END);
+    size_t size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char *bytes = malloc(size);
+    assert(fread(bytes, 1, size, fp) == size);
+    fclose(fp);
+    assert(r.size == size && !memcmp(r.bytes, bytes, size));
+    free(bytes);
+
+    if(i == IMAGES - 1){
+        assert(r.n == 0);
+        return;
+    }
+    char label[256];
+    detection_label_path(r.path, label);
+    int n;
+    box_label *boxes = read_boxes(label, &n);
+    assert(r.n == n);
+    assert(!memcmp(r.boxes, boxes, n*sizeof(box_label)));
+    free(boxes);
+}
+
+void test_pack_and_read() {
+    printf("Testing packing into a shard per image...\n");
+    char list_file[256], prefix[200];
+    snprintf(list_file, sizeof(list_file), "%s/train.list", dir);
+    snprintf(prefix, sizeof(prefix), "%s/train", dir);
+    write_list(list_file, IMAGES);
+    pack_records(list_file, prefix, 1);
+
+    char shardlist[256];
+    snprintf(shardlist, sizeof(shardlist), "%s.shards", prefix);
+    list *shards = get_paths(shardlist);
+    assert(shards->size == IMAGES);
+    free_list_contents(shards);
+    free_list(shards);
+
+    /* without a window, every record once a pass */
+    record_reader *reader = open_record_reader(shardlist, 1);
+    for(int pass = 0; pass < 3; ++pass){
+        int seen[IMAGES] = {0};
+        for(int i = 0; i < IMAGES; ++i){
+            data_record r;
+            next_record(reader, &r);
+            assert_record_matches(r);
+            ++seen[path_index(r.path)];
+            free_record(r);
+        }
+        for(int i = 0; i < IMAGES; ++i) assert(seen[i] == 1);
+    }
+    free_record_reader(reader);
+    remove_shards(prefix);
+    unlink(list_file);
+    printf("✓ image bytes and parsed boxes, each record once a pass\n");
+}
+
+void test_window() {
+    printf("Testing shuffling across a window...\n");
+    char list_file[256], prefix[200], shardlist[256];
+    snprintf(list_file, sizeof(list_file), "%s/train.list", dir);
+    snprintf(prefix, sizeof(prefix), "%s/one", dir);
+    snprintf(shardlist, sizeof(shardlist), "%s.shards", prefix);
+    write_list(list_file, IMAGES);
+    pack_records(list_file, prefix, 0);
+
+    int window = 3;
+    int first[IMAGES] = {0};
+    srand(5);
+    record_reader *reader = open_record_reader(shardlist, window);
+    /* the first IMAGES - window draws come from the first pass */
+    for(int i = 0; i < IMAGES - window; ++i){
+        data_record r;
+        next_record(reader, &r);
+        assert(!first[path_index(r.path)]++);
+        free_record(r);
+    }
+    int shuffled = 0;
+    for(int i = 0; i < 20*IMAGES; ++i){
+        data_record r;
+        next_record(reader, &r);
+        assert_record_matches(r);
+        shuffled |= path_index(r.path) != (i + IMAGES - window)%IMAGES;
+        free_record(r);
+    }
+    assert(shuffled);
+    free_record_reader(reader);
+    remove_shards(prefix);
+    unlink(list_file);
+    printf("✓ records drawn out of order, none twice within a pass\n");
+}
+
+void test_detection_loader() {
+    printf("Testing load_data_detection on records...\n");
+    char list_file[256], prefix[200], shardlist[256];
+    snprintf(list_file, sizeof(list_file), "%s/single.list", dir);
+    snprintf(prefix, sizeof(prefix), "%s/single", dir);
+    snprintf(shardlist, sizeof(shardlist), "%s.shards", prefix);
+    /* one image, so the path and record draws both pick it */
+    write_list(list_file, 1);
+    pack_records(list_file, prefix, 0);
+    record_reader *reader = open_record_reader(shardlist, 1);
+
+    load_args args = {0};
+    args.paths = paths;
+    args.n = 1;
+    args.m = 1;
+    args.w = 32;
+    args.h = 24;
+    args.threads = 1;
+    args.classes = 20;
+    args.num_boxes = 4;
+    args.jitter = .2;
+    args.hue = .1;
+    args.saturation = args.exposure = 1.5;
+    args.type = DETECTION_DATA;
+    for(int seed = 1; seed <= 4; ++seed){
+        data plain, packed;
+        args.d = &plain;
+        args.records = 0;
+        srand(seed);
+        load_data_blocking(args);
+        args.d = &packed;
+        args.records = reader;
+        srand(seed);
+        load_data_blocking(args);
+        assert(!memcmp(plain.X.vals[0], packed.X.vals[0], plain.X.cols*sizeof(float)));
+        assert(!memcmp(plain.y.vals[0], packed.y.vals[0], plain.y.cols*sizeof(float)));
+        free_data(plain);
+        free_data(packed);
+    }
+    free_record_reader(reader);
+
+    char datacfg[256];
+    snprintf(datacfg, sizeof(datacfg), "%s/train.data", dir);
+    FILE *fp = fopen(datacfg, "w");
+    fprintf(fp, "classes = 20\nrecords = %s\nrecords_window = 8\n", shardlist);
+    fclose(fp);
+    list *options = read_data_cfg(datacfg);
+    reader = load_record_reader(options);
+    assert(reader);
+    data_record r;
+    next_record(reader, &r);
+    assert(!strcmp(r.path, paths[0]));
+    free_record(r);
+    free_record_reader(reader);
+    free_list_contents(options);
+    free_list(options);
+
+    fp = fopen(datacfg, "w");
+    fprintf(fp, "classes = 20\n");
+    fclose(fp);
+    options = read_data_cfg(datacfg);
+    assert(!load_record_reader(options));
+    free_list_contents(options);
+    free_list(options);
+    unlink(datacfg);
+    remove_shards(prefix);
+    unlink(list_file);
+    printf("✓ same batches as reading the image and label files\n");
+}
+
+int main() {
+    printf("\n===== Running Record Shard Tests =====\n\n");
+
+    make_images();
+    test_pack_and_read();
+    test_window();
+    test_detection_loader();
+    for(int i = 0; i < IMAGES; ++i){
+        unlink(paths[i]);
+        strcpy(paths[i] + strlen(paths[i]) - 4, ".txt");
+        unlink(paths[i]);
+        free(paths[i]);
+    }
+    rmdir(dir);
+
+    printf("\n===== All Record Shard Tests Passed =====\n\n");
+    return 0;
+}
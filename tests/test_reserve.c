@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include "test_helpers.h"
+#include "../src/graph_optimizer.h"
+
+#define MAX_LAYERS 32
+
+/* The graph optimizer's test network: a folded shortcut, a moved upsample,
+   a route concatenated in place and an aliased route */
+static const char *test_cfg =
+    "[net]\nbatch=1\nwidth=16\nheight=12\nchannels=3\nmax_w=32\nmax_h=28\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=8\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[convolutional]\nfilters=4\nsize=1\nstride=1\npad=1\nactivation=leaky\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=8\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[shortcut]\nfrom=-3\nactivation=linear\n"
+    "[upsample]\nstride=2\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=6\nsize=1\nstride=1\npad=1\nactivation=leaky\n"
+    "[maxpool]\nsize=2\nstride=2\n"
+    "[route]\nlayers=-1,3\n"
+    "[convolutional]\nfilters=4\nsize=3\nstride=1\npad=1\nactivation=linear\n"
+    "[upsample]\nstride=2\n"
+    "[route]\nlayers=-1\n"
+    "[convolutional]\nfilters=2\nsize=1\nstride=1\npad=1\nactivation=linear\n";
+
+typedef struct {
+    float *input, *truth, *workspace, *arena;
+    float *outputs[MAX_LAYERS], *deltas[MAX_LAYERS];
+} buffers;
+
+static buffers get_buffers(network *net)
+{
+    buffers b = {net->input, net->truth, net->workspace, net->output_arena};
+    assert(net->n <= MAX_LAYERS);
+    for(int i = 0; i < net->n; ++i){
+        /* an alias moves with its offset into the buffer it aliases */
+        b.outputs[i] = net->layers[output_owner(net, i)].output;
+        b.deltas[i] = net->layers[i].delta;
+    }
+    return b;
+}
+
+/* The network resized the usual way, with the same weights */
+static network *reference_network(char *cfg, int inference, int w, int h)
+{
+    srand(5);
+    network *net = inference ? parse_network_cfg_inference(cfg) : parse_network_cfg(cfg);
+    net->reserved_batch = 0;
+    for(int i = 0; i < net->n; ++i) net->layers[i].reserved = 0;
+    resize_network(net, w, h);
+    return net;
+}
+
+static void assert_same_predictions(network *net, network *ref)
+{
+    assert(net->inputs == ref->inputs);
+    float *x = calloc(net->inputs*net->batch, sizeof(float));
+    for(int i = 0; i < net->inputs*net->batch; ++i) x[i] = rand_uniform(-1, 1);
+    assert_close_outputs(net, ref, x);
+    free(x);
+}
+
+void test_resize_within_reservation() {
+    printf("Testing resizes within the reserved size...\n");
+    char cfg[] = "/tmp/test_reserve_cfg_XXXXXX";
+    write_temp_file(cfg, test_cfg);
+    srand(5);
+    network *net = parse_network_cfg_inference(cfg);
+    assert(net->max_w == 32 && net->max_h == 28 && net->reserved_batch == 1);
+    assert(net->w == 16 && net->h == 12 && net->layers[0].reserved);
+    buffers before = get_buffers(net);
+
+    int sizes[][2] = {{32, 28}, {8, 8}, {24, 12}, {16, 12}, {30, 20}};
+    for(int s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s){
+        int w = sizes[s][0], h = sizes[s][1];
+        assert(resize_network(net, w, h) == 0);
+        assert(net->w == w && net->h == h && net->inputs == w*h*3);
+        buffers after = get_buffers(net);
+        assert(memcmp(&before, &after, sizeof(buffers)) == 0);
+        /* still concatenated in place, at the new offsets */
+        layer *l = net->layers;
+        assert(l[6].output == l[7].output && l[2].output == l[7].output + l[6].outputs);
+        network *ref = reference_network(cfg, 1, w, h);
+        assert_same_predictions(net, ref);
+        free_network(ref);
+    }
+    printf("✓ no buffer moved, same results as a network resized the usual way\n");
+
+    /* past the reservation it grows once, then holds again */
+    assert(resize_network(net, 40, 28) == 0);
+    assert(net->max_w == 40 && net->max_h == 28);
+    before = get_buffers(net);
+    assert(resize_network(net, 36, 16) == 0);
+    buffers after = get_buffers(net);
+    assert(memcmp(&before, &after, sizeof(buffers)) == 0);
+    network *ref = reference_network(cfg, 1, 36, 16);
+    assert_same_predictions(net, ref);
+    free_network(ref);
+    printf("✓ grows past the reserved size\n");
+
+    /* a larger batch reserves again for that batch */
+    set_batch_network(net, 2);
+    assert(net->reserved_batch == 2 && net->w == 36);
+    assert(resize_network(net, 20, 20) == 0);
+    ref = reference_network(cfg, 1, 20, 20);
+    set_batch_network(ref, 2);
+    resize_network(ref, 20, 20);
+    assert_same_predictions(net, ref);
+    free_network(ref);
+    printf("✓ batch changes keep the reservation\n");
+
+    network *clone = clone_network_for_inference(net);
+    assert(!clone->reserved_batch && !clone->layers[0].reserved);
+    free_network(clone);
+    free_network(net);
+    unlink(cfg);
+}
+
+void test_training_network() {
+    printf("Testing multi-scale training on a reserved network...\n");
+    char cfg[] = "/tmp/test_reserve_cfg_XXXXXX";
+    char text[4096];
+    snprintf(text, sizeof(text), "%s[cost]\ntype=sse\n", test_cfg);
+    write_temp_file(cfg, text);
+    srand(5);
+    network *net = parse_network_cfg(cfg);
+    assert(net->reserved_batch == 1);
+    network *ref = reference_network(cfg, 0, net->w, net->h);
+    net->learning_rate = ref->learning_rate = 1e-5;
+    buffers before = get_buffers(net);
+    int dims[] = {8, 28, 16, 24};
+    for(int s = 0; s < 4; ++s){
+        int dim = dims[s];
+        resize_network(net, dim, dim);
+        resize_network(ref, dim, dim);
+        buffers after = get_buffers(net);
+        assert(memcmp(&before, &after, sizeof(buffers)) == 0);
+        for(int i = 0; i < net->inputs*net->batch; ++i) net->input[i] = ref->input[i] = rand_uniform(-1, 1);
+        memset(net->truth, 0, net->truths*net->batch*sizeof(float));
+        memset(ref->truth, 0, ref->truths*ref->batch*sizeof(float));
+        float loss = train_network_datum(net);
+        float expected = train_network_datum(ref);
+        assert(fabsf(loss - expected) <= 1e-4*fabsf(expected));
+    }
+    free_network(ref);
+    free_network(net);
+    printf("✓ trains at every size without moving a buffer, as a network resized the usual way\n");
+    unlink(cfg);
+}
+
+void test_yolov3_tiny() {
+    printf("Testing yolov3-tiny reserved for 608 x 608...\n");
+    srand(5);
+    network *net = parse_network_cfg_inference("../cfg/yolov3-tiny.cfg");
+    set_batch_network(net, 1);
+    reserve_network(net, 608, 608);
+    assert(net->w == 416 && net->reserved_batch == 1);
+    buffers before = get_buffers(net);
+    int sizes[] = {320, 608, 416};
+    for(int s = 0; s < 3; ++s){
+        resize_network(net, sizes[s], sizes[s]);
+        buffers after = get_buffers(net);
+        assert(memcmp(&before, &after, sizeof(buffers)) == 0);
+        srand(5);
+        network *ref = parse_network_cfg_inference("../cfg/yolov3-tiny.cfg");
+        set_batch_network(ref, 1);
+        resize_network(ref, sizes[s], sizes[s]);
+        /* random weights overflow, so compare the bits */
+        float *x = calloc(net->inputs, sizeof(float));
+        for(int i = 0; i < net->inputs; ++i) x[i] = rand_uniform(-1, 1);
+        network_predict(ref, x);
+        network_predict(net, x);
+        free(x);
+        for(int i = 0; i < net->n; ++i){
+            layer l = net->layers[i];
+            if(l.type != YOLO) continue;
+            assert(memcmp(l.output, ref->layers[i].output, l.outputs*sizeof(float)) == 0);
+        }
+        free_network(ref);
+    }
+    free_network(net);
+    printf("✓ identical detections at 320, 608 and 416\n");
+}
+
+int main() {
+    printf("\n===== Running Reserved Resize Tests =====\n\n");
+
+    test_resize_within_reservation();
+    test_training_network();
+    test_yolov3_tiny();
+
+    printf("\n===== All Reserved Resize Tests Passed =====\n\n");
+    return 0;
+}
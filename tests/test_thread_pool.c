@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../src/network.h"
+#include "../src/parser.h"
+#include "../src/thread_pool.h"
+#include "../src/utils.h"
+
+typedef struct {
+    int *hits;
+    int *chunk_begin;
+    int grain;
+} coverage_args;
+
+static void mark_range(void *ptr, int begin, int end)
+{
+    coverage_args *a = ptr;
+    assert(begin % a->grain == 0);
+    a->chunk_begin[begin/a->grain] = begin;
+    for(int i = begin; i < end; i++) a->hits[i]++;
+}
+
+static void check_coverage(int n, int grain)
+{
+    int chunks = (n + grain - 1)/grain;
+    coverage_args a = {calloc(n, sizeof(int)), malloc(chunks*sizeof(int)), grain};
+    for(int c = 0; c < chunks; c++) a.chunk_begin[c] = -1;
+    parallel_for(n, grain, mark_range, &a);
+    for(int i = 0; i < n; i++) assert(a.hits[i] == 1);
+    for(int c = 0; c < chunks; c++) assert(a.chunk_begin[c] == c*grain);
+    free(a.hits);
+    free(a.chunk_begin);
+}
+
+void test_parallel_for_coverage() {
+    printf("Testing parallel_for coverage and chunking...\n");
+    int sizes[] = {1, 4};
+    for(int s = 0; s < 2; s++) {
+        set_thread_pool_size(sizes[s]);
+        check_coverage(1, 1);
+        check_coverage(7, 3);
+        check_coverage(1000, 1);
+        check_coverage(100000, 333);
+        check_coverage(12345, 12345);
+    }
+    printf("✓ every iteration runs once, in fixed chunks\n");
+}
+
+static void nested_range(void *ptr, int begin, int end)
+{
+    int *hits = ptr;
+    for(int i = begin; i < end; i++) {
+        coverage_args inner = {calloc(50, sizeof(int)), malloc(10*sizeof(int)), 5};
+        parallel_for(50, 5, mark_range, &inner);
+        int sum = 0;
+        for(int j = 0; j < 50; j++) sum += inner.hits[j];
+        hits[i] = sum;
+        free(inner.hits);
+        free(inner.chunk_begin);
+    }
+}
+
+void test_nested_and_persistent() {
+    printf("Testing nested loops and worker reuse...\n");
+    set_thread_pool_size(4);
+    int hits[64] = {0};
+    parallel_for(64, 1, nested_range, hits);
+    for(int i = 0; i < 64; i++) assert(hits[i] == 50);
+    int workers = thread_pool_workers();
+    assert(workers == 3);
+    for(int i = 0; i < 1000; i++) check_coverage(256, 1);
+    assert(thread_pool_workers() == workers);
+    set_thread_pool_size(2);
+    check_coverage(256, 1);
+    assert(thread_pool_workers() == workers);
+    printf("✓ %d workers, started once\n", workers);
+}
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_t seen[8];
+    int threads;
+} thread_set;
+
+static void note_thread(void *ptr, int begin, int end)
+{
+    thread_set *t = ptr;
+    usleep(2000);
+    pthread_mutex_lock(&t->lock);
+    int i;
+    for(i = 0; i < t->threads && !pthread_equal(t->seen[i], pthread_self()); i++);
+    if(i == t->threads) t->seen[t->threads++] = pthread_self();
+    pthread_mutex_unlock(&t->lock);
+}
+
+static void *limited_loops(void *ptr)
+{
+    int limit = *(int *)ptr;
+    set_thread_pool_limit(limit);
+    for(int i = 0; i < 200; i++) check_coverage(256, 1);
+    thread_set t = {PTHREAD_MUTEX_INITIALIZER};
+    parallel_for(16, 1, note_thread, &t);
+    assert(t.threads <= limit);
+    return 0;
+}
+
+void test_concurrent_limits() {
+    printf("Testing loops from several threads with their own limits...\n");
+    set_thread_pool_size(4);
+    int limits[] = {2, 3, 1};
+    pthread_t threads[3];
+    for(int i = 0; i < 3; i++) assert(!pthread_create(&threads[i], 0, limited_loops, &limits[i]));
+    for(int i = 0; i < 3; i++) pthread_join(threads[i], 0);
+    assert(thread_pool_size() == 4);
+    /* the limits were the callers' own */
+    thread_set t = {PTHREAD_MUTEX_INITIALIZER};
+    parallel_for(16, 1, note_thread, &t);
+    assert(t.threads <= 4);
+    assert(thread_pool_workers() <= 3);
+    printf("✓ limits stay with their threads, %d workers shared\n", thread_pool_workers());
+}
+
+static const char *test_cfg =
+    "[net]\nbatch=2\nwidth=32\nheight=32\nchannels=3\nlearning_rate=0.01\nmomentum=0.9\ndecay=0.0005\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=16\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[maxpool]\nsize=2\nstride=2\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=32\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[convolutional]\nfilters=16\nsize=1\nstride=1\npad=1\nactivation=logistic\n"
+    "[shortcut]\nfrom=-3\nactivation=linear\n"
+    "[local]\nfilters=8\nsize=3\nstride=2\npad=1\nactivation=leaky\n"
+    "[avgpool]\n"
+    "[connected]\noutput=10\nactivation=linear\n"
+    "[softmax]\n";
+
+/* forward, backward and update once, returns the output and the first
+   layer's weights afterwards */
+static void train_step(char *cfg, int threads, float *input, float *truth, float *out, float *weights)
+{
+    srand(7);
+    network *net = parse_network_cfg(cfg);
+    net->threads = threads;
+    layer first = net->layers[0];
+    memcpy(net->input, input, net->inputs*net->batch*sizeof(float));
+    memcpy(net->truth, truth, net->truths*net->batch*sizeof(float));
+    train_network_datum(net);
+    memcpy(out, net->output, net->outputs*net->batch*sizeof(float));
+    memcpy(weights, first.weights, first.nweights*sizeof(float));
+    free_network(net);
+}
+
+void test_reproducible_training() {
+    printf("Testing results do not depend on the thread count...\n");
+    char cfg[] = "/tmp/test_thread_pool_cfg_XXXXXX";
+    int fd = mkstemp(cfg);
+    assert(fd >= 0);
+    FILE *fp = fdopen(fd, "w");
+    fputs(test_cfg, fp);
+    fclose(fp);
+
+    network *net = parse_network_cfg(cfg);
+    int inputs = net->inputs*net->batch;
+    int outputs = net->outputs*net->batch;
+    int truths = net->truths*net->batch;
+    int nweights = net->layers[0].nweights;
+    free_network(net);
+
+    float *input = calloc(inputs, sizeof(float));
+    float *truth = calloc(truths, sizeof(float));
+    for(int i = 0; i < inputs; i++) input[i] = rand_uniform(0, 1);
+    truth[3] = truth[10 + 7] = 1;
+
+    float *out1 = calloc(outputs, sizeof(float));
+    float *outn = calloc(outputs, sizeof(float));
+    float *w1 = calloc(nweights, sizeof(float));
+    float *wn = calloc(nweights, sizeof(float));
+    set_thread_pool_size(2);
+    train_step(cfg, 1, input, truth, out1, w1);
+    train_step(cfg, 4, input, truth, outn, wn);
+    /* threads= limits the pass, it doesn't resize the pool */
+    assert(thread_pool_size() == 2);
+    assert(memcmp(out1, outn, outputs*sizeof(float)) == 0);
+    assert(memcmp(w1, wn, nweights*sizeof(float)) == 0);
+
+    free(input);
+    free(truth);
+    free(out1);
+    free(outn);
+    free(w1);
+    free(wn);
+    unlink(cfg);
+    printf("✓ 1 and 4 threads give bit-identical outputs and updates\n");
+}
+
+int main() {
+    printf("\n===== Running Thread Pool Tests =====\n\n");
+
+    test_parallel_for_coverage();
+    test_nested_and_persistent();
+    test_concurrent_limits();
+    test_reproducible_training();
+
+    printf("\n===== All Thread Pool Tests Passed =====\n\n");
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include "test_helpers.h"
+#include "../src/thread_pool.h"
+
+/* Every layer type with its own weights loader */
+static const char *test_cfg =
+    "[net]\nbatch=1\nwidth=16\nheight=12\nchannels=3\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=8\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[convolutional]\nfilters=8\nsize=3\ngroups=4\nstride=2\npad=1\nactivation=relu\n"
+    "[deconvolutional]\nfilters=4\nsize=2\nstride=2\nactivation=linear\n"
+    "[batchnorm]\n"
+    "[local]\nfilters=2\nsize=3\nstride=2\npad=1\nactivation=linear\n"
+    "[connected]\nbatch_normalize=1\noutput=12\nactivation=linear\n"
+    "[rnn]\nbatch_normalize=1\noutput=6\nhidden=5\nactivation=leaky\n"
+    "[gru]\noutput=7\n"
+    "[lstm]\noutput=5\n"
+    "[connected]\noutput=4\nactivation=linear\n";
+
+static void assert_same_arrays(float *a, float *b, size_t n)
+{
+    if(!a || !b){
+        assert(a == b);
+        return;
+    }
+    assert(memcmp(a, b, n*sizeof(float)) == 0);
+}
+
+static void assert_same_layer(layer a, layer b)
+{
+    int outputs = a.type == CONNECTED ? a.outputs : a.n;
+    if(a.type == BATCHNORM) outputs = a.c;
+    if(a.type == LOCAL) outputs = a.outputs;
+    size_t weights = a.type == CONNECTED ? (size_t)a.outputs*a.inputs : (size_t)a.nweights;
+    if(a.type == LOCAL) weights = (size_t)a.size*a.size*a.c*a.n*a.out_w*a.out_h;
+    if(a.type != BATCHNORM){
+        assert_same_arrays(a.biases, b.biases, outputs);
+        assert_same_arrays(a.weights, b.weights, weights);
+    }
+    if(a.batch_normalize || a.type == BATCHNORM){
+        assert_same_arrays(a.scales, b.scales, outputs);
+        assert_same_arrays(a.rolling_mean, b.rolling_mean, outputs);
+        assert_same_arrays(a.rolling_variance, b.rolling_variance, outputs);
+    }
+}
+
+static void assert_same_weights(network *a, network *b, int from)
+{
+    for(int i = from; i < a->n; i++){
+        layer l = a->layers[i], k = b->layers[i];
+        if(l.type == RNN || l.type == CRNN){
+            assert_same_layer(*l.input_layer, *k.input_layer);
+            assert_same_layer(*l.self_layer, *k.self_layer);
+            assert_same_layer(*l.output_layer, *k.output_layer);
+        } else if(l.type == GRU){
+            assert_same_layer(*l.wz, *k.wz);
+            assert_same_layer(*l.uh, *k.uh);
+        } else if(l.type == LSTM){
+            assert_same_layer(*l.wi, *k.wi);
+            assert_same_layer(*l.ug, *k.ug);
+        } else {
+            assert_same_layer(l, k);
+        }
+    }
+}
+
+static void randomize_statistics(network *net)
+{
+    for(int i = 0; i < net->n; i++){
+        layer l = net->layers[i];
+        int n = l.type == BATCHNORM ? l.c : (l.type == CONNECTED ? l.outputs : l.n);
+        if(!l.batch_normalize && l.type != BATCHNORM) continue;
+        for(int j = 0; j < n; j++){
+            l.scales[j] = rand_uniform(.5, 1.5);
+            l.rolling_mean[j] = rand_uniform(-1, 1);
+            l.rolling_variance[j] = rand_uniform(.5, 2);
+        }
+    }
+}
+
+void test_layer_offsets() {
+    printf("Testing layer offsets for every weights loader...\n");
+    char cfg[] = "/tmp/test_loader_cfg_XXXXXX";
+    char weights[] = "/tmp/test_loader_weights_XXXXXX";
+    write_temp_file(cfg, test_cfg);
+    write_temp_file(weights, "");
+    srand(31);
+    network *net = parse_network_cfg(cfg);
+    randomize_statistics(net);
+    save_weights(net, weights);
+
+    int sizes[] = {1, 4};
+    for(int s = 0; s < 2; s++){
+        set_thread_pool_size(sizes[s]);
+        srand(37);
+        network *loaded = parse_network_cfg(cfg);
+        load_weights(loaded, weights);
+        assert_same_weights(net, loaded, 0);
+        free_network(loaded);
+    }
+    set_thread_pool_size(0);
+    printf("✓ every layer reads its own bytes with 1 and 4 threads\n");
+    free_network(net);
+    unlink(cfg);
+    unlink(weights);
+}
+
+void test_yolov3_tiny_truncated() {
+    printf("Testing yolov3-tiny from a full and a truncated weights file...\n");
+    char weights[] = "/tmp/test_loader_tiny_XXXXXX";
+    write_temp_file(weights, "");
+    srand(41);
+    network *net = parse_network_cfg("../cfg/yolov3-tiny.cfg");
+    randomize_statistics(net);
+    save_weights(net, weights);
+
+    srand(43);
+    network *loaded = parse_network_cfg("../cfg/yolov3-tiny.cfg");
+    load_weights_timed(loaded, weights);
+    assert_same_weights(net, loaded, 0);
+    free_network(loaded);
+
+    /* cut the file right after layer 4, the way a backbone-only file ends */
+    FILE *fp = fopen(weights, "rb");
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    long keep = 3*sizeof(int) + sizeof(size_t);
+    for(int i = 0; i <= 4; i++){
+        layer l = net->layers[i];
+        if(l.type == CONVOLUTIONAL) keep += (l.n*(l.batch_normalize ? 4 : 1) + l.nweights)*sizeof(float);
+    }
+    assert(keep < size);
+    assert(truncate(weights, keep) == 0);
+
+    srand(43);
+    network *fresh = parse_network_cfg("../cfg/yolov3-tiny.cfg");
+    srand(43);
+    network *partial = parse_network_cfg("../cfg/yolov3-tiny.cfg");
+    load_weights(partial, weights);
+    for(int i = 0; i <= 4; i++) assert_same_layer(net->layers[i], partial->layers[i]);
+    assert_same_weights(fresh, partial, 5);
+    printf("✓ layers past the end of the file keep their initial weights\n");
+
+    free_network(net);
+    free_network(fresh);
+    free_network(partial);
+    unlink(weights);
+}
+
+int main() {
+    printf("\n===== Running Weights Loader Tests =====\n\n");
+
+    test_layer_offsets();
+    test_yolov3_tiny_truncated();
+
+    printf("\n===== All Weights Loader Tests Passed =====\n\n");
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include "../src/network.h"
+#include "../src/parser.h"
+#include "../src/xnor.h"
+#include "../src/convolutional_layer.h"
+#include "../src/im2col.h"
+#include "../src/gemm.h"
+#include "../src/utils.h"
+
+static void fill_random(float *x, int n, float lo, float hi)
+{
+    for(int i = 0; i < n; i++) x[i] = rand_uniform(lo, hi);
+}
+
+static float max_rel_error(float *a, float *b, int n)
+{
+    float err = 0;
+    for(int i = 0; i < n; i++) {
+        float d = fabs(a[i] - b[i]) / (1 + fabs(b[i]));
+        if(d > err) err = d;
+    }
+    return err;
+}
+
+/* The float xnor path: binarize, im2col, gemm */
+static void reference_conv(convolutional_layer l, float *input, float *weights, int binarize, float *out)
+{
+    int m = l.n/l.groups;
+    int k = l.size*l.size*l.c/l.groups;
+    int n = l.out_w*l.out_h;
+    int spatial = l.c/l.groups*l.h*l.w;
+    float *in = calloc(l.batch*l.inputs, sizeof(float));
+    float *col = calloc(k*n, sizeof(float));
+    if(binarize) binarize_cpu(input, l.batch*l.inputs, in);
+    else memcpy(in, input, l.batch*l.inputs*sizeof(float));
+    memset(out, 0, l.batch*l.outputs*sizeof(float));
+    for(int i = 0; i < l.batch; i++) {
+        for(int j = 0; j < l.groups; j++) {
+            im2col_cpu(in + (i*l.groups + j)*spatial, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, col);
+            gemm_cpu_reference(0, 0, m, n, k, 1, weights + j*l.nweights/l.groups, k, col, n, 1,
+                    out + (i*l.groups + j)*n*m, n);
+        }
+    }
+    free(in);
+    free(col);
+}
+
+static void check_xnor_conv(int c, int size, int stride, int pad, int groups)
+{
+    int batch = 2, h = 11, w = 9, n = 12;
+    convolutional_layer l = make_convolutional_layer(batch, h, w, c, n, groups, size, stride, pad, LINEAR, 0, 0, 1, 0);
+    network net = {0};
+    net.input = calloc(batch*l.inputs, sizeof(float));
+    net.workspace = calloc(1, l.workspace_size);
+    fill_random(net.input, batch*l.inputs, -1, 1);
+    float *ref = calloc(batch*l.outputs, sizeof(float));
+    reference_conv(l, net.input, l.binary_weights, 1, ref);
+    forward_convolutional_layer(l, net);
+    float err = max_rel_error(l.output, ref, batch*l.outputs);
+    printf("  %d channels, %dx%d/%d pad %d, groups %d: err %g\n", c, size, size, stride, pad, groups, err);
+    assert(err < 1e-5);
+    free(ref);
+    free(net.input);
+    free(net.workspace);
+    free_layer(l);
+}
+
+void test_xnor_conv(const char *kernel) {
+    if(!xnor_select_kernel(kernel)) {
+        printf("  - %s kernel not supported on this CPU, skipped\n", kernel);
+        return;
+    }
+    printf("Testing bit-packed xnor convolution against float, %s kernel...\n", kernel);
+    check_xnor_conv(3, 3, 1, 1, 1);
+    check_xnor_conv(16, 3, 2, 1, 1);
+    check_xnor_conv(70, 1, 1, 0, 1);
+    check_xnor_conv(32, 3, 1, 1, 2);
+    check_xnor_conv(9, 5, 1, 2, 1);
+    printf("✓ xnor convolution matches float\n");
+}
+
+void test_binary_conv() {
+    printf("Testing binary-weight convolution...\n");
+    int batch = 1, h = 10, w = 10, c = 8, n = 16;
+    convolutional_layer l = make_convolutional_layer(batch, h, w, c, n, 1, 3, 1, 1, LINEAR, 0, 1, 0, 0);
+    network net = {0};
+    net.input = calloc(batch*l.inputs, sizeof(float));
+    net.workspace = calloc(1, l.workspace_size);
+    fill_random(net.input, batch*l.inputs, -1, 1);
+    float *ref = calloc(batch*l.outputs, sizeof(float));
+    reference_conv(l, net.input, l.binary_weights, 0, ref);
+    forward_convolutional_layer(l, net);
+    float err = max_rel_error(l.output, ref, batch*l.outputs);
+    printf("  err %g\n", err);
+    assert(err < 1e-5);
+    free(ref);
+    free(net.input);
+    free(net.workspace);
+    free_layer(l);
+    printf("✓ binary layers run on their binarized weights\n");
+}
+
+static const char *test_cfg =
+    "[net]\nbatch=1\nwidth=24\nheight=24\nchannels=3\n"
+    "[convolutional]\nbatch_normalize=1\nfilters=16\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[convolutional]\nbatch_normalize=1\nxnor=1\nfilters=32\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[maxpool]\nsize=2\nstride=2\n"
+    "[convolutional]\nbinary=1\nfilters=13\nsize=3\nstride=1\npad=1\nactivation=leaky\n"
+    "[convolutional]\nxnor=1\nfilters=8\nsize=1\nstride=1\npad=0\nactivation=linear\n";
+
+void test_binary_weights_file() {
+    printf("Testing packed binary weights files...\n");
+    char cfg[] = "/tmp/test_xnor_cfg_XXXXXX";
+    char packed[] = "/tmp/test_xnor_packed_XXXXXX";
+    char plain[] = "/tmp/test_xnor_plain_XXXXXX";
+    int fd = mkstemp(cfg);
+    assert(fd >= 0);
+    FILE *fp = fdopen(fd, "w");
+    fputs(test_cfg, fp);
+    fclose(fp);
+    close(mkstemp(packed));
+    close(mkstemp(plain));
+
+    network *net = parse_network_cfg(cfg);
+    float *input = calloc(net->inputs, sizeof(float));
+    fill_random(input, net->inputs, -1, 1);
+    float *ref = calloc(net->outputs, sizeof(float));
+    memcpy(ref, network_predict(net, input), net->outputs*sizeof(float));
+    save_weights(net, plain);
+    save_weights_binary(net, packed);
+
+    network *loaded = parse_network_cfg(cfg);
+    load_weights(loaded, packed);
+    float err = max_rel_error(network_predict(loaded, input), ref, net->outputs);
+    printf("  packed reload: err %g\n", err);
+    assert(err < 1e-5);
+
+    fp = fopen(packed, "rb");
+    fseek(fp, 0, SEEK_END);
+    long packed_size = ftell(fp);
+    fclose(fp);
+    fp = fopen(plain, "rb");
+    fseek(fp, 0, SEEK_END);
+    long plain_size = ftell(fp);
+    fclose(fp);
+    printf("  %ld bytes packed, %ld float\n", packed_size, plain_size);
+    assert(packed_size < plain_size/4);
+
+    free(input);
+    free(ref);
+    free_network(net);
+    free_network(loaded);
+    unlink(cfg);
+    unlink(packed);
+    unlink(plain);
+    printf("✓ binary weights round-trip\n");
+}
+
+int main() {
+    printf("\n===== Running XNOR Convolution Tests =====\n\n");
+
+    test_xnor_conv("generic");
+    test_xnor_conv("popcnt");
+    test_xnor_conv("avx512vpopcntdq");
+    test_binary_conv();
+    test_binary_weights_file();
+
+    printf("\n===== All XNOR Convolution Tests Passed =====\n\n");
+    return 0;
+}